@@ -0,0 +1,833 @@
+/**
+ * Compares database layouts and write paths on the same synthetic data.
+ *
+ * Each mode fills fresh database files in the temporary directory and times the statements the server runs on them:
+ *
+ * - `layout`: `movie_genre` as created by schema version 1, a rowid table with separate indexes, against version 2,
+ *   clustered on (genre_id, movie_id). Times `search_by_genre` and the genre join used to read the genres of a movie.
+ * - `packed`: `add_movie`, `get_movie` and windows of `list_movies` through the server database code, for movies with
+ *   1, 4 and 16 genres. Genres are read as set by `DB_PACKED_GENRES`, so run it once with each value to compare.
+ * - `ids`: adding movies one transaction at a time with `AUTOINCREMENT` ids, as in schema version 3, against ids
+ *   reserved from `id_block` as in version 4, with blocks of 1 and of 1000 ids.
+ * - `links`: the `add_movie` part of `packed`, with the latency of each call. Genre links are inserted as set by
+ *   `DB_MULTI_ROW_LINKS`, and every run checks that `movie_genre` holds all of them.
+ *
+ * Results are printed as YAML, like `replay`, so runs against different builds can be compared directly.
+ */
+#include "../database/sqlite_source.h"  // must be included first for defines
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../config.h"
+#include "../database/database.h"
+#include "../database/schema.h"
+#include "../defines.h"
+#include "../movie/movie.h"
+#include "../stats/clock.h"
+
+/** Maximum genres for a single generated movie. */
+#define MAX_GENRES_PER_MOVIE 4
+/** Output buffer size for generated names. */
+#define NAME_LEN 64
+/** Template for the temporary database files. */
+#define TEMP_TEMPLATE "/tmp/db-bench-XXXXXX"
+/** Movies read by each `list_movies` window. */
+#define LIST_WINDOW 100
+/** Most genres given to a movie by `packed`. */
+#define MAX_PACKED_GENRES 16
+
+/** Genre counts compared by `packed`. */
+static const size_t PACKED_GENRE_COUNTS[] = {1, 4, MAX_PACKED_GENRES};
+
+/** Id block sizes compared by `ids`, from one id per transaction to the `DB_ID_BLOCK` default. */
+static const int64_t ID_BLOCK_SIZES[] = {1, 1'000};
+
+/** Benchmark options. */
+struct bench_options {
+    /** Movies in each database. */
+    uint64_t movies;
+    /** Distinct genres. */
+    uint64_t genres;
+    /** Timed operations of each kind. */
+    uint64_t operations;
+    /** PRNG seed, the same for every layout. */
+    uint64_t seed;
+};
+
+/** Measurements for one layout. */
+struct layout_result {
+    /** Size of the database file. */
+    uint64_t bytes;
+    /** Time to run all searches. */
+    uint64_t search_ns;
+    /** Movies returned by all searches. */
+    uint64_t search_rows;
+    /** Time to read the genres of all sampled movies. */
+    uint64_t genre_read_ns;
+    /** Genres returned for all sampled movies. */
+    uint64_t genre_read_rows;
+};
+
+/** Measurements for one genre count through the database code. */
+struct packed_result {
+    /** Time to add all movies, each in its own transaction. */
+    uint64_t add_ns;
+    /** Median time to add a single movie. */
+    uint64_t add_p50_ns;
+    /** 99th percentile of the time to add a single movie. */
+    uint64_t add_p99_ns;
+    /** Links found in `movie_genre` after adding all movies. */
+    uint64_t links;
+    /** Time to read all sampled movies. */
+    uint64_t get_ns;
+    /** Time to read all `list_movies` windows. */
+    uint64_t list_ns;
+};
+
+[[nodiscard("useless call if discarded"), gnu::const]]
+/** Operations per second, or zero if nothing was timed. */
+static inline double per_sec(uint64_t operations, uint64_t elapsed_ns) {
+    static constexpr const double NS_PER_SEC = 1e9;
+    return elapsed_ns > 0 ? (double) operations * NS_PER_SEC / (double) elapsed_ns : 0;
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Orders durations for `qsort`. */
+static int compare_ns(const void *NONNULL a, const void *NONNULL b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+[[gnu::hot, gnu::nonnull(1)]]
+/** SplitMix64 generator, as in `gen-catalog`. */
+static inline uint64_t rng_next(uint64_t *NONNULL state) {
+    uint64_t z = (*state += 0x9E37'79B9'7F4A'7C15);
+    z = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+    z = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EB;
+    return z ^ (z >> 31);
+}
+
+[[gnu::hot, gnu::nonnull(1)]]
+/** Uniform integer in `[0, bound)`. */
+static inline uint64_t rng_below(uint64_t *NONNULL state, uint64_t bound) {
+    return (uint64_t) (((unsigned __int128) rng_next(state) * bound) >> 64);
+}
+
+[[gnu::hot, gnu::nonnull(1)]]
+/** Integer in `[0, bound)` skewed towards zero, so a few genres are much more popular than the rest. */
+static inline uint64_t rng_skewed(uint64_t *NONNULL state, uint64_t bound) {
+    // product of two uniforms concentrates near zero
+    return (rng_below(state, bound) * rng_below(state, bound)) / bound;
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Reports the last SQLite error and returns false. */
+static bool report_error(sqlite3 *NONNULL db, const char context[NONNULL]) {
+    (void) fprintf(stderr, "db-bench: %s: %s\n", context, sqlite3_errmsg(db));
+    return false;
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Runs SQL without results. */
+static bool exec(sqlite3 *NONNULL db, const char sql[NONNULL]) {
+    const int rv = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    return likely(rv == SQLITE_OK) || report_error(db, sql);
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Steps a write statement to completion and resets it. */
+static bool step(sqlite3 *NONNULL db, sqlite3_stmt *NONNULL stmt) {
+    const int rv = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return likely(rv == SQLITE_DONE) || report_error(db, "write failed");
+}
+
+[[gnu::nonnull(1, 2, 3)]]
+/** Prepares `sql` into `stmt`. */
+static bool prepare(sqlite3 *NONNULL db, const char sql[NONNULL], sqlite3_stmt *NULLABLE *NONNULL stmt) {
+    const int rv = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, stmt, NULL);
+    return likely(rv == SQLITE_OK) || report_error(db, sql);
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Reads a single integer from a query. */
+static bool query_int(sqlite3 *NONNULL db, const char sql[NONNULL], int64_t *NONNULL value) {
+    sqlite3_stmt *stmt = NULL;
+    bool ok = prepare(db, sql, &stmt) && sqlite3_step(stmt) == SQLITE_ROW;
+    if likely (ok) {
+        *value = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+[[gnu::nonnull(1)]]
+/** Name for the genre with index `index`. */
+static void genre_name(char name[NONNULL NAME_LEN], uint64_t index) {
+    (void) snprintf(name, NAME_LEN, "genre %" PRIu64, index);
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/** Creates an empty file named from `TEMP_TEMPLATE`, storing its path. */
+static bool make_temp(char path[NONNULL sizeof(TEMP_TEMPLATE)]) {
+    memcpy(path, TEMP_TEMPLATE, sizeof(TEMP_TEMPLATE));
+    const int fd = mkstemp(path);
+    if unlikely (fd < 0) {
+        perror("db-bench: mkstemp");
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+[[gnu::nonnull(1)]]
+/** Removes a database created from `make_temp`, with its journal. */
+static void remove_temp(const char path[NONNULL]) {
+    static constexpr const size_t SUFFIX_LEN = sizeof("-journal");
+
+    (void) unlink(path);
+    char journal[sizeof(TEMP_TEMPLATE) + SUFFIX_LEN];
+    (void) snprintf(journal, sizeof(journal), "%s-journal", path);
+    (void) unlink(journal);
+    (void) snprintf(journal, sizeof(journal), "%s-wal", path);
+    (void) unlink(journal);
+    (void) snprintf(journal, sizeof(journal), "%s-shm", path);
+    (void) unlink(journal);
+}
+
+[[nodiscard("must be closed"), gnu::nonnull(1)]]
+/** Creates an empty database file named from `TEMP_TEMPLATE` and opens it, storing its path. */
+static sqlite3 *NULLABLE open_temp(char path[NONNULL sizeof(TEMP_TEMPLATE)]) {
+    if unlikely (!make_temp(path)) {
+        return NULL;
+    }
+
+    sqlite3 *db = NULL;
+    const int rv = sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    if unlikely (rv != SQLITE_OK) {
+        (void) fprintf(stderr, "db-bench: could not open %s: %s\n", path, sqlite3_errstr(rv));
+        sqlite3_close_v2(db);
+        (void) unlink(path);
+        return NULL;
+    }
+    return db;
+}
+
+[[gnu::nonnull(2)]]
+/** Closes and removes a database created by `open_temp`. */
+static void close_temp(sqlite3 *NULLABLE db, const char path[NONNULL]) {
+    sqlite3_close_v2(db);
+    remove_temp(path);
+}
+
+[[gnu::nonnull(1)]]
+/** Applies the schema migrations from version `from` to `to`, as `db_setup` would, without going further. */
+static bool migrate(sqlite3 *NONNULL db, size_t from, size_t to) {
+    bool ok = exec(db, "BEGIN IMMEDIATE;");
+    for (size_t i = from; ok && i < to; i++) {
+        ok = exec(db, MIGRATIONS[i]);
+    }
+    return ok && exec(db, "COMMIT;");
+}
+
+[[gnu::nonnull(1, 2)]]
+/**
+ * Inserts the synthetic catalog through the version 1 columns, which every later version keeps. Genre links are
+ * inserted in movie order, like the server does.
+ */
+static bool fill_catalog(sqlite3 *NONNULL db, const struct bench_options *NONNULL options) {
+    sqlite3_stmt *insert_genre = NULL;
+    sqlite3_stmt *insert_movie = NULL;
+    sqlite3_stmt *insert_link = NULL;
+    bool ok = prepare(db, "INSERT INTO genre(id, name) VALUES (?, ?);", &insert_genre)
+        && prepare(
+               db,
+               "INSERT INTO movie(id, title, director, release_year) VALUES (?, ?, 'director', 2000);",
+               &insert_movie
+        )
+        && prepare(db, "INSERT INTO movie_genre(movie_id, genre_id) VALUES (?, ?);", &insert_link)
+        && exec(db, "BEGIN IMMEDIATE;");
+
+    char name[NAME_LEN];
+    for (uint64_t i = 0; ok && i < options->genres; i++) {
+        genre_name(name, i);
+        sqlite3_bind_int64(insert_genre, 1, (int64_t) i + 1);
+        sqlite3_bind_text(insert_genre, 2, name, -1, SQLITE_TRANSIENT);
+        ok = step(db, insert_genre);
+    }
+
+    uint64_t state = options->seed;
+    for (uint64_t i = 0; ok && i < options->movies; i++) {
+        (void) snprintf(name, NAME_LEN, "movie %" PRIu64, i);
+        sqlite3_bind_int64(insert_movie, 1, (int64_t) i + 1);
+        sqlite3_bind_text(insert_movie, 2, name, -1, SQLITE_TRANSIENT);
+        ok = step(db, insert_movie);
+
+        uint64_t chosen[MAX_GENRES_PER_MOVIE];
+        const uint64_t count = 1 + rng_below(&state, MAX_GENRES_PER_MOVIE);
+        for (uint64_t j = 0; ok && j < count && j < options->genres; j++) {
+            bool repeated;
+            do {
+                chosen[j] = rng_skewed(&state, options->genres);
+                repeated = false;
+                for (uint64_t k = 0; k < j; k++) {
+                    repeated = repeated || chosen[k] == chosen[j];
+                }
+            } while (repeated);
+
+            sqlite3_bind_int64(insert_link, 1, (int64_t) i + 1);
+            sqlite3_bind_int64(insert_link, 2, (int64_t) chosen[j] + 1);
+            ok = step(db, insert_link);
+        }
+    }
+
+    ok = ok && exec(db, "COMMIT;") && exec(db, "PRAGMA optimize;");
+    sqlite3_finalize(insert_link);
+    sqlite3_finalize(insert_movie);
+    sqlite3_finalize(insert_genre);
+    return ok;
+}
+
+[[gnu::hot, gnu::nonnull(1, 2)]]
+/** Steps `stmt` through all of its rows and resets it, adding the number of rows to `rows`. */
+static bool read_all(sqlite3 *NONNULL db, sqlite3_stmt *NONNULL stmt, uint64_t *NONNULL rows) {
+    int rv;
+    while ((rv = sqlite3_step(stmt)) == SQLITE_ROW) {
+        *rows += 1;
+    }
+    sqlite3_reset(stmt);
+    return likely(rv == SQLITE_DONE) || report_error(db, "read failed");
+}
+
+[[gnu::nonnull(1, 2, 3)]]
+/** Times `search_by_genre` over every genre in turn, and the genre join for random movies, on an open database. */
+static bool time_layout_reads(
+    sqlite3 *NONNULL db,
+    const struct bench_options *NONNULL options,
+    struct layout_result *NONNULL result
+) {
+    // the statements are the same for both layouts, as in the server before and after the change
+    sqlite3_stmt *search = NULL;
+    sqlite3_stmt *movie_genres = NULL;
+    bool ok = prepare(
+                  db,
+                  "SELECT movie.id, movie.title, movie.director, movie.release_year"
+                  "    FROM movie_genre"
+                  "        INNER JOIN movie ON movie.id = movie_genre.movie_id"
+                  "        INNER JOIN genre ON genre.id = movie_genre.genre_id"
+                  "    WHERE genre.name = :genre;",
+                  &search
+              )
+        && prepare(
+                  db,
+                  "SELECT genre.name"
+                  "    FROM genre"
+                  "        INNER JOIN movie_genre ON genre.id = genre_id"
+                  "    WHERE movie_id = :movie;",
+                  &movie_genres
+        );
+
+    char name[NAME_LEN];
+    uint64_t start_ns = clock_now_ns();
+    for (uint64_t i = 0; ok && i < options->operations; i++) {
+        genre_name(name, i % options->genres);
+        sqlite3_bind_text(search, 1, name, -1, SQLITE_TRANSIENT);
+        ok = read_all(db, search, &(result->search_rows));
+    }
+    result->search_ns = clock_now_ns() - start_ns;
+
+    uint64_t state = options->seed;
+    start_ns = clock_now_ns();
+    for (uint64_t i = 0; ok && i < options->operations; i++) {
+        sqlite3_bind_int64(movie_genres, 1, 1 + (int64_t) rng_below(&state, options->movies));
+        ok = read_all(db, movie_genres, &(result->genre_read_rows));
+    }
+    result->genre_read_ns = clock_now_ns() - start_ns;
+
+    sqlite3_finalize(movie_genres);
+    sqlite3_finalize(search);
+    return ok;
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1, 2)]]
+/** Builds a database at schema `version` and times its reads. */
+static bool run_layout(
+    const struct bench_options *NONNULL options,
+    struct layout_result *NONNULL result,
+    size_t version
+) {
+    char path[sizeof(TEMP_TEMPLATE)];
+    sqlite3 *db = open_temp(path);
+    if unlikely (db == NULL) {
+        return false;
+    }
+
+    // a database migrated later holds the same rows, rewritten in the new layout
+    int64_t pages = 0;
+    int64_t page_size = 0;
+    bool ok = migrate(db, 0, 1) && fill_catalog(db, options) && migrate(db, 1, version)
+        && exec(db, "VACUUM;") && query_int(db, "PRAGMA page_count;", &pages)
+        && query_int(db, "PRAGMA page_size;", &page_size);
+    result->bytes = (uint64_t) (pages * page_size);
+
+    ok = ok && time_layout_reads(db, options, result);
+    close_temp(db, path);
+    return ok;
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Prints the measurements of a layout as a YAML mapping. */
+static void report_layout(const char name[NONNULL], const struct layout_result *NONNULL result, uint64_t operations) {
+    static constexpr const uint64_t NS_PER_US = 1'000;
+
+    printf("  %s:\n", name);
+    printf("    bytes: %" PRIu64 "\n", result->bytes);
+    printf("    search_us: %" PRIu64 "\n", result->search_ns / NS_PER_US);
+    printf("    searches_per_sec: %.1f\n", per_sec(operations, result->search_ns));
+    printf("    search_rows: %" PRIu64 "\n", result->search_rows);
+    printf("    genre_read_us: %" PRIu64 "\n", result->genre_read_ns / NS_PER_US);
+    printf("    genre_reads_per_sec: %.1f\n", per_sec(operations, result->genre_read_ns));
+    printf("    genre_read_rows: %" PRIu64 "\n", result->genre_read_rows);
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/** Compares `movie_genre` before and after schema version 2. */
+static bool bench_layout(const struct bench_options *NONNULL options) {
+    struct layout_result before = {};
+    struct layout_result after = {};
+    if unlikely (!run_layout(options, &before, 1) || !run_layout(options, &after, 2)) {
+        return false;
+    }
+    if unlikely (before.search_rows != after.search_rows || before.genre_read_rows != after.genre_read_rows) {
+        (void) fprintf(stderr, "db-bench: layouts returned different rows\n");
+        return false;
+    }
+
+    report_layout("rowid_v1", &before, options->operations);
+    report_layout("clustered_v2", &after, options->operations);
+    return true;
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1, 2, 3)]]
+/**
+ * Adds `options->movies` movies to a database at schema `version`, each in its own write transaction. Ids come from
+ * `AUTOINCREMENT` if `block` is zero, and otherwise from `id_block`, reserving `block` ids whenever the last reserved
+ * ones ran out, like the server does.
+ */
+static bool run_ids(
+    const struct bench_options *NONNULL options,
+    size_t version,
+    int64_t block,
+    uint64_t *NONNULL elapsed_ns
+) {
+    char path[sizeof(TEMP_TEMPLATE)];
+    sqlite3 *db = open_temp(path);
+    if unlikely (db == NULL) {
+        return false;
+    }
+
+    // the server opens its connections in WAL mode, and is built with `SQLITE_DEFAULT_WAL_SYNCHRONOUS=1`
+    sqlite3_stmt *begin = NULL;
+    sqlite3_stmt *commit = NULL;
+    sqlite3_stmt *reserve = NULL;
+    sqlite3_stmt *insert = NULL;
+    bool ok = exec(db, "PRAGMA journal_mode = WAL;") && exec(db, "PRAGMA synchronous = NORMAL;")
+        && migrate(db, 0, version) && prepare(db, "BEGIN IMMEDIATE;", &begin) && prepare(db, "COMMIT;", &commit);
+    if (block == 0) {
+        ok = ok
+            && prepare(
+                   db,
+                   "INSERT INTO movie(title, director, release_year, genres)"
+                   "    VALUES (:title, 'director', 2000, '')"
+                   "    RETURNING movie.id;",
+                   &insert
+            );
+    } else {
+        ok = ok
+            && prepare(
+                   db,
+                   "UPDATE id_block"
+                   "    SET next = next + :count"
+                   "    WHERE name = 'movie'"
+                   "    RETURNING next - :count;",
+                   &reserve
+            )
+            && prepare(
+                   db,
+                   "INSERT INTO movie(id, title, director, release_year, genres)"
+                   "    VALUES (:id, :title, 'director', 2000, '');",
+                   &insert
+            );
+    }
+
+    char title[NAME_LEN];
+    int64_t next = 0;
+    int64_t end = 0;
+    const uint64_t start_ns = clock_now_ns();
+    for (uint64_t i = 0; ok && i < options->movies; i++) {
+        ok = step(db, begin);
+        if (ok && block != 0 && next == end) {
+            // reserved in the same transaction as the first insert, and given back with it on rollback
+            sqlite3_bind_int64(reserve, 1, block);
+            ok = sqlite3_step(reserve) == SQLITE_ROW || report_error(db, "reserve failed");
+            next = sqlite3_column_int64(reserve, 0);
+            end = next + block;
+            sqlite3_reset(reserve);
+        }
+
+        (void) snprintf(title, sizeof(title), "movie %" PRIu64, i);
+        if (block == 0) {
+            sqlite3_bind_text(insert, 1, title, -1, SQLITE_TRANSIENT);
+            ok = ok && (sqlite3_step(insert) == SQLITE_ROW || report_error(db, "insert failed"));
+            sqlite3_reset(insert);
+        } else {
+            sqlite3_bind_int64(insert, 1, next++);
+            sqlite3_bind_text(insert, 2, title, -1, SQLITE_TRANSIENT);
+            ok = ok && step(db, insert);
+        }
+        ok = ok && step(db, commit);
+    }
+    *elapsed_ns = clock_now_ns() - start_ns;
+
+    int64_t rows = 0;
+    int64_t max_id = 0;
+    ok = ok && query_int(db, "SELECT count(*) FROM movie;", &rows)
+        && query_int(db, "SELECT max(id) FROM movie;", &max_id);
+    if unlikely (ok && (rows != (int64_t) options->movies || max_id != rows)) {
+        (void) fprintf(stderr, "db-bench: added %" PRIi64 " movies up to id %" PRIi64 "\n", rows, max_id);
+        ok = false;
+    }
+
+    sqlite3_finalize(insert);
+    sqlite3_finalize(reserve);
+    sqlite3_finalize(commit);
+    sqlite3_finalize(begin);
+    close_temp(db, path);
+    return ok;
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/** Compares movie inserts with `AUTOINCREMENT` before schema version 4 against ids reserved from `id_block`. */
+static bool bench_ids(const struct bench_options *NONNULL options) {
+    static constexpr const size_t BLOCKS = sizeof(ID_BLOCK_SIZES) / sizeof(ID_BLOCK_SIZES[0]);
+
+    uint64_t autoincrement_ns = 0;
+    uint64_t block_ns[BLOCKS] = {};
+    bool ok = run_ids(options, 3, 0, &autoincrement_ns);
+    for (size_t i = 0; ok && i < BLOCKS; i++) {
+        ok = run_ids(options, 4, ID_BLOCK_SIZES[i], &(block_ns[i]));
+    }
+    if unlikely (!ok) {
+        return false;
+    }
+
+    printf("  autoincrement_v3:\n");
+    printf("    inserts_per_sec: %.1f\n", per_sec(options->movies, autoincrement_ns));
+    for (size_t i = 0; i < BLOCKS; i++) {
+        printf("  id_block_%" PRIi64 "_v4:\n", ID_BLOCK_SIZES[i]);
+        printf("    inserts_per_sec: %.1f\n", per_sec(options->movies, block_ns[i]));
+    }
+    return true;
+}
+
+[[gnu::cold, gnu::nonnull(1)]]
+/** Reports a database error and returns false. */
+static bool report_db_error(const char context[NONNULL], db_error_t error) {
+    char message[DB_ERROR_LEN];
+    (void) db_error_format(error, sizeof(message), message);
+    (void) fprintf(stderr, "db-bench: %s: %s\n", context, message);
+    return false;
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1, 2, 4, 5)]]
+/**
+ * Adds `options->movies` movies with `genre_count` genres each to an empty catalog, timing each of them. With `reads`,
+ * then times random `get_movie` calls and `list_movies` windows over them.
+ */
+static bool run_packed(
+    db_conn_t *NONNULL conn,
+    const struct bench_options *NONNULL options,
+    size_t genre_count,
+    const char *NONNULL const genre_names[NONNULL MAX_PACKED_GENRES],
+    struct packed_result *NONNULL result,
+    bool reads
+) {
+    int64_t *ids = calloc(options->movies, sizeof(int64_t));
+    uint64_t *add_ns = calloc(options->movies, sizeof(uint64_t));
+    if unlikely (ids == NULL || add_ns == NULL) {
+        (void) fprintf(stderr, "db-bench: out of memory\n");
+        free(add_ns);
+        free(ids);
+        return false;
+    }
+
+    db_error_t error = {.code = DB_ERROR_NONE};
+    char title[NAME_LEN];
+    const char *genres[MAX_PACKED_GENRES];
+    bool ok = true;
+    uint64_t start_ns = clock_now_ns();
+    for (uint64_t i = 0; ok && i < options->movies; i++) {
+        (void) snprintf(title, sizeof(title), "movie %" PRIu64, i);
+        for (size_t j = 0; j < genre_count; j++) {
+            genres[j] = genre_names[(i + j) % MAX_PACKED_GENRES];
+        }
+        struct movie movie = {
+            .title = title,
+            .director = "director",
+            .release_year = 2000,
+            .genres = genres,
+            .genre_count = genre_count,
+        };
+        const uint64_t movie_start_ns = clock_now_ns();
+        ok = db_register_movie(conn, &movie, &error) == DB_SUCCESS || report_db_error("add_movie", error);
+        add_ns[i] = clock_now_ns() - movie_start_ns;
+        ids[i] = movie.id;
+    }
+    result->add_ns = clock_now_ns() - start_ns;
+
+    qsort(add_ns, options->movies, sizeof(uint64_t), compare_ns);
+    result->add_p50_ns = options->movies > 0 ? add_ns[options->movies / 2] : 0;
+    result->add_p99_ns = options->movies > 0 ? add_ns[options->movies * 99 / 100] : 0;
+    free(add_ns);
+    if (!reads) {
+        free(ids);
+        return ok;
+    }
+
+    uint64_t state = options->seed;
+    start_ns = clock_now_ns();
+    for (uint64_t i = 0; ok && i < options->operations; i++) {
+        struct movie movie;
+        const int64_t id = ids[rng_below(&state, options->movies)];
+        ok = db_get_movie(conn, id, true, &movie, &error) == DB_SUCCESS || report_db_error("get_movie", error);
+        if likely (ok) {
+            ok = movie.genre_count == genre_count;
+            if unlikely (!ok) {
+                (void) fprintf(stderr, "db-bench: movie %" PRIi64 " has %zu genres\n", id, movie.genre_count);
+            }
+            free_movie(movie);
+        }
+    }
+    result->get_ns = clock_now_ns() - start_ns;
+
+    const uint64_t windows = options->movies > LIST_WINDOW ? options->movies - LIST_WINDOW : 1;
+    start_ns = clock_now_ns();
+    for (uint64_t i = 0; ok && i < options->operations; i++) {
+        const struct db_page page = {
+            .limit = LIST_WINDOW,
+            .offset = rng_below(&state, windows),
+            .order_by = DB_ORDER_ID,
+        };
+        struct movie *list;
+        size_t length;
+        ok = db_list_movies(conn, true, &page, &list, &length, &error) == DB_SUCCESS
+            || report_db_error("list_movies", error);
+        for (size_t j = 0; ok && j < length; j++) {
+            free_movie(list[j]);
+        }
+        if likely (ok) {
+            free(list);
+        }
+    }
+    result->list_ns = clock_now_ns() - start_ns;
+
+    free(ids);
+    return ok;
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1, 2, 4)]]
+/**
+ * Runs `run_packed` on a new database at `path`, printing its results. Fails unless `movie_genre` holds every link
+ * afterwards, so statements that silently drop rows cannot look fast.
+ */
+static bool report_packed(
+    const char path[NONNULL],
+    const struct bench_options *NONNULL options,
+    size_t genre_count,
+    const char *NONNULL const genre_names[NONNULL MAX_PACKED_GENRES],
+    bool reads
+) {
+    static constexpr const uint64_t NS_PER_US = 1'000;
+
+    db_error_t error = {.code = DB_ERROR_NONE};
+    db_conn_t *conn = NULL;
+    bool ok = db_setup(path, &error) || report_db_error("db_setup", error);
+    if likely (ok) {
+        conn = db_connect(path, &error);
+        ok = conn != NULL || report_db_error("db_connect", error);
+    }
+
+    struct packed_result result = {};
+    ok = ok && run_packed(conn, options, genre_count, genre_names, &result, reads);
+    if (conn != NULL) {
+        ok = (db_disconnect(conn, &error) || report_db_error("db_disconnect", error)) && ok;
+    }
+
+    sqlite3 *db = NULL;
+    int64_t links = 0;
+    ok = ok && (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK || report_error(db, path))
+        && query_int(db, "SELECT count(*) FROM movie_genre;", &links);
+    sqlite3_close_v2(db);
+    result.links = (uint64_t) links;
+    if unlikely (ok && result.links != options->movies * genre_count) {
+        (void) fprintf(
+            stderr,
+            "db-bench: expected %" PRIu64 " genre links, found %" PRIu64 "\n",
+            options->movies * genre_count,
+            result.links
+        );
+        ok = false;
+    }
+    if unlikely (!ok) {
+        return false;
+    }
+
+    printf("  genres_%zu:\n", genre_count);
+    printf("    links: %" PRIu64 "\n", result.links);
+    printf("    add_movie_per_sec: %.1f\n", per_sec(options->movies, result.add_ns));
+    printf("    add_movie_p50_us: %" PRIu64 "\n", result.add_p50_ns / NS_PER_US);
+    printf("    add_movie_p99_us: %" PRIu64 "\n", result.add_p99_ns / NS_PER_US);
+    if (reads) {
+        printf("    get_movie_per_sec: %.1f\n", per_sec(options->operations, result.get_ns));
+        printf("    list_movies_per_sec: %.1f\n", per_sec(options->operations, result.list_ns));
+    }
+    return true;
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/**
+ * Times writes through the database code for each of `PACKED_GENRE_COUNTS`, and reads too with `reads`.
+ *
+ * `db_setup` runs once per process, so every genre count gets a child process with its own database. Sharing one would
+ * make later `list_movies` windows skip over the movies of earlier counts.
+ */
+static bool bench_packed(const struct bench_options *NONNULL options, bool reads) {
+    static constexpr const size_t COUNTS = sizeof(PACKED_GENRE_COUNTS) / sizeof(PACKED_GENRE_COUNTS[0]);
+
+    char names[MAX_PACKED_GENRES][NAME_LEN];
+    const char *genre_names[MAX_PACKED_GENRES];
+    for (size_t i = 0; i < MAX_PACKED_GENRES; i++) {
+        genre_name(names[i], i);
+        genre_names[i] = names[i];
+    }
+
+    // read by `db_setup` with the same defaults
+    printf("  packed_genres: %s\n", config_u64("DB_PACKED_GENRES", 1) != 0 ? "true" : "false");
+    printf("  multi_row_links: %s\n", config_u64("DB_MULTI_ROW_LINKS", 1) != 0 ? "true" : "false");
+    if (reads) {
+        printf("  list_window: %d\n", LIST_WINDOW);
+    }
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < COUNTS; i++) {
+        char path[sizeof(TEMP_TEMPLATE)];
+        if unlikely (!make_temp(path)) {
+            return false;
+        }
+        (void) fflush(stdout);
+        const pid_t child = fork();
+        if (child == 0) {
+            const bool child_ok = report_packed(path, options, PACKED_GENRE_COUNTS[i], genre_names, reads);
+            (void) fflush(stdout);
+            exit(child_ok ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+
+        int status = 0;
+        ok = child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if unlikely (child < 0) {
+            (void) fprintf(stderr, "db-bench: could not fork: %s\n", strerror(errno));
+        }
+        remove_temp(path);
+    }
+    return ok;
+}
+
+[[gnu::cold]]
+/** Prints usage information. */
+static void usage(const char program[NONNULL]) {
+    (void) fprintf(
+        stderr,
+        "usage: %s [-n MOVIES] [-g GENRES] [-o OPERATIONS] [-s SEED] MODE\n"
+        "  MODE           layout, packed, ids or links\n"
+        "  -n MOVIES      movies in each database (default 100000)\n"
+        "  -g GENRES      distinct genres (default 64)\n"
+        "  -o OPERATIONS  timed operations of each kind (default 2000)\n"
+        "  -s SEED        PRNG seed (default 1)\n",
+        program
+    );
+}
+
+int main(int argc, char *NONNULL argv[]) {
+    static constexpr const uint64_t DEFAULT_MOVIES = 100'000;
+    static constexpr const uint64_t DEFAULT_GENRES = 64;
+    static constexpr const uint64_t DEFAULT_OPERATIONS = 2'000;
+    static constexpr const int AS_DECIMAL = 10;
+
+    struct bench_options options = {
+        .movies = DEFAULT_MOVIES,
+        .genres = DEFAULT_GENRES,
+        .operations = DEFAULT_OPERATIONS,
+        .seed = 1,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:g:o:s:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                options.movies = strtoull(optarg, NULL, AS_DECIMAL);
+                break;
+            case 'g':
+                options.genres = strtoull(optarg, NULL, AS_DECIMAL);
+                break;
+            case 'o':
+                options.operations = strtoull(optarg, NULL, AS_DECIMAL);
+                break;
+            case 's':
+                options.seed = strtoull(optarg, NULL, AS_DECIMAL);
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind + 1 != argc || options.movies == 0 || options.genres == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *mode = argv[optind];
+    printf("---\ndb_bench:\n");
+    printf("  mode: %s\n", mode);
+    printf("  movies: %" PRIu64 "\n", options.movies);
+    printf("  genres: %" PRIu64 "\n", options.genres);
+    printf("  operations: %" PRIu64 "\n", options.operations);
+
+    bool ok;
+    if (strcmp(mode, "layout") == 0) {
+        ok = bench_layout(&options);
+    } else if (strcmp(mode, "packed") == 0) {
+        ok = bench_packed(&options, true);
+    } else if (strcmp(mode, "links") == 0) {
+        ok = bench_packed(&options, false);
+    } else if (strcmp(mode, "ids") == 0) {
+        ok = bench_ids(&options);
+    } else {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("...\n");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,401 @@
+/**
+ * Compares the cost of YAML and JSON requests and responses.
+ *
+ * The same `add_movie` operations are written in both formats to a socket pair and read back by the parser, then
+ * movies with the same contents are rendered as they would be in a `list_movies` response. Both phases go through the
+ * same code as the server, and the socket copy costs the same for both formats. Throughput is printed as YAML, like
+ * `replay`.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../defines.h"
+#include "../movie/movie.h"
+#include "../movie/parser.h"
+#include "../movie/render.h"
+#include "../stats/clock.h"
+
+/** Request formats understood by the parser. */
+enum [[gnu::packed]] bench_format {
+    FORMAT_YAML,
+    FORMAT_JSON,
+};
+
+/** Input written to the parser by a separate thread, so the socket buffer never blocks the benchmark. */
+struct bench_writer {  // NOLINT(altera-struct-pack-align)
+    /** Write end of the socket pair, closed when done. */
+    int sock_fd;
+    /** Whole input. */
+    const char *NONNULL data;
+    /** Length of `data`. */
+    size_t length;
+};
+
+/** Measurements for a single format. */
+struct bench_result {  // NOLINT(altera-struct-pack-align)
+    /** Bytes of requests parsed. */
+    size_t input_bytes;
+    /** Time to parse all operations. */
+    uint64_t parse_ns;
+    /** Bytes of responses rendered. */
+    size_t output_bytes;
+    /** Time to render all movies. */
+    uint64_t render_ns;
+};
+
+/** Distinct genre names used by the generated movies. */
+static constexpr const size_t GENRE_NAMES = 32;
+
+[[nodiscard("useless call if discarded"), gnu::const]]
+/** Release year of the `i`-th generated movie. */
+static inline int movie_year(size_t i) {
+    static constexpr const size_t YEARS = 125;
+    static constexpr const int FIRST_YEAR = 1900;
+    return FIRST_YEAR + (int) (i % YEARS);
+}
+
+[[nodiscard("must be freed"), gnu::nonnull(2)]]
+/** Writes `operations` `add_movie` requests with `genres` genres each, as YAML or JSON. */
+static char *NULLABLE build_input(enum bench_format format, size_t *NONNULL length, size_t operations, size_t genres) {
+    char *buffer = NULL;
+    FILE *output = open_memstream(&buffer, length);
+    if unlikely (output == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < operations; i++) {
+        const int year = movie_year(i);
+        if (format == FORMAT_JSON) {
+            (void) fprintf(output, "{\"add_movie\": {\"title\": \"Movie %zu\", \"director\": \"Director %zu\", ", i, i);
+            (void) fprintf(output, "\"release_year\": %d, \"genres\": [", year);
+            for (size_t j = 0; j < genres; j++) {
+                (void) fprintf(output, "%s\"genre %zu\"", j == 0 ? "" : ", ", (i + j) % GENRE_NAMES);
+            }
+            (void) fputs("]}}\n", output);
+        } else {
+            (void) fprintf(output, "--- {add_movie: {title: Movie %zu, director: Director %zu, ", i, i);
+            (void) fprintf(output, "release_year: %d, genres: [", year);
+            for (size_t j = 0; j < genres; j++) {
+                (void) fprintf(output, "%sgenre %zu", j == 0 ? "" : ", ", (i + j) % GENRE_NAMES);
+            }
+            (void) fputs("]}}\n", output);
+        }
+    }
+
+    if unlikely (fclose(output) != 0) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+/** Writes the whole input and closes the socket, so the parser sees the end of the stream. */
+static void *NULLABLE writer_thread(void *NONNULL arg) {
+    const struct bench_writer *writer = arg;
+    size_t written = 0;
+    while (written < writer->length) {
+        const ssize_t rv = write(writer->sock_fd, writer->data + written, writer->length - written);
+        if unlikely (rv < 0 && errno != EINTR) {
+            perror("format-bench: write");
+            break;
+        }
+        written += rv > 0 ? (size_t) rv : 0;
+    }
+    close(writer->sock_fd);
+    return NULL;
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1, 4)]]
+/**
+ * Parses `length` bytes of `input`, dropping each movie like the server does after running the operation. Returns
+ * `false` on parse errors or if the number of movies does not match `count`.
+ */
+static bool parse_input(const char input[NONNULL], size_t length, size_t count, uint64_t *NONNULL elapsed_ns) {
+    int sockets[2];
+    if unlikely (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+        perror("format-bench: socketpair");
+        return false;
+    }
+
+    struct bench_writer writer = {.sock_fd = sockets[1], .data = input, .length = length};
+    pthread_t thread;
+    if unlikely (pthread_create(&thread, NULL, writer_thread, &writer) != 0) {
+        (void) fprintf(stderr, "format-bench: could not start writer thread\n");
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+
+    atomic_bool shutdown_requested = false;
+    parser_t *parser = parser_create(&shutdown_requested, sockets[0]);
+    bool ok = parser != NULL;
+    if unlikely (!ok) {
+        (void) fprintf(stderr, "format-bench: could not create parser\n");
+    }
+
+    size_t parsed = 0;
+    const uint64_t start_ns = clock_now_ns();
+    while (ok && !parser_finished(parser)) {
+        struct operation op = parser_next_op(parser);
+        switch (op.ty) {
+            case ADD_MOVIE:
+                free_movie(op.movie);
+                parsed += 1;
+                break;
+            case PARSE_DONE:
+                break;
+            case PARSE_ERROR:
+                (void) fprintf(stderr, "format-bench: parse error: %s\n", op.error_message);
+                ok = false;
+                break;
+            case UPSERT_MOVIE:
+                free_movie(op.movie);
+                ok = false;
+                break;
+            case ADD_GENRE:
+            case REMOVE_MOVIE:
+            case GET_MOVIE:
+            case LIST_SUMMARIES:
+            case LIST_MOVIES:
+            case SEARCH_BY_GENRE:
+            case STATS:
+            case CHANGES_SINCE:
+            default:
+                ok = false;
+                break;
+        }
+    }
+    *elapsed_ns = clock_now_ns() - start_ns;
+
+    if (parser != NULL) {
+        parser_destroy(parser);
+    }
+    // unblocks the writer if parsing stopped early
+    close(sockets[0]);
+    (void) pthread_join(thread, NULL);
+
+    if unlikely (ok && parsed != count) {
+        (void) fprintf(stderr, "format-bench: parsed %zu movies, expected %zu\n", parsed, count);
+        return false;
+    }
+    return ok;
+}
+
+[[nodiscard("must be freed"), gnu::nonnull(3)]]
+/**
+ * Creates `count` movies with `genres` genres each, with the same contents as the generated requests. Their strings
+ * are stored in `names`, which must be freed after the movies.
+ */
+static struct movie *NULLABLE build_movies(size_t count, size_t genres, char *NULLABLE *NONNULL names) {
+    static constexpr const size_t NAME_LEN = 32;
+
+    struct movie *movies = calloc(count > 0 ? count : 1, sizeof(struct movie));
+    *names = calloc((2 * count) + GENRE_NAMES, NAME_LEN);
+    if unlikely (movies == NULL || *names == NULL) {
+        free(movies);
+        free(*names);
+        *names = NULL;
+        return NULL;
+    }
+
+    char *genre_names = *names + (2 * count * NAME_LEN);
+    for (size_t i = 0; i < GENRE_NAMES; i++) {
+        (void) snprintf(genre_names + (i * NAME_LEN), NAME_LEN, "genre %zu", i);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        char *title = *names + (2 * i * NAME_LEN);
+        char *director = title + NAME_LEN;
+        (void) snprintf(title, NAME_LEN, "Movie %zu", i);
+        (void) snprintf(director, NAME_LEN, "Director %zu", i);
+
+        // released by `free_movie` as part of rendering
+        const char **list = malloc((genres > 0 ? genres : 1) * sizeof(const char *));
+        if unlikely (list == NULL) {
+            for (size_t j = 0; j < i; j++) {
+                free_movie(movies[j]);
+            }
+            free(movies);
+            free(*names);
+            *names = NULL;
+            return NULL;
+        }
+        for (size_t j = 0; j < genres; j++) {
+            list[j] = genre_names + (((i + j) % GENRE_NAMES) * NAME_LEN);
+        }
+
+        movies[i] = (struct movie) {
+            .id = (int64_t) i + 1,
+            .title = title,
+            .director = director,
+            .release_year = movie_year(i),
+            .genres = list,
+            .genre_count = genres,
+        };
+    }
+    return movies;
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(2, 4)]]
+/** Renders and frees all `movies` as a list response in `format`, storing the response size. */
+static bool render_movies(
+    enum bench_format format,
+    struct movie movies[NONNULL],
+    size_t count,
+    struct bench_result *NONNULL result
+) {
+    char *doc = NULL;
+    FILE *output = open_memstream(&doc, &(result->output_bytes));
+    if unlikely (output == NULL) {
+        for (size_t i = 0; i < count; i++) {
+            free_movie(movies[i]);
+        }
+        return false;
+    }
+
+    const uint64_t start_ns = clock_now_ns();
+    if (format == FORMAT_JSON) {
+        (void) fputs("{\"status\":\"ok\",\"movies\":[", output);
+        for (size_t i = 0; i < count; i++) {
+            if (i > 0) {
+                (void) fputc(',', output);
+            }
+            render_movie_json(output, movies[i], FIELD_ALL);
+        }
+        (void) fputs("]}\n", output);
+    } else {
+        (void) fputs("movies:\n", output);
+        for (size_t i = 0; i < count; i++) {
+            render_movie(output, movies[i], true, FIELD_ALL);
+        }
+    }
+    const bool ok = fclose(output) == 0;
+    result->render_ns = clock_now_ns() - start_ns;
+
+    free(doc);
+    return ok;
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(2)]]
+/** Runs both phases for `format`. */
+static bool run_format(
+    enum bench_format format,
+    struct bench_result *NONNULL result,
+    size_t operations,
+    size_t genres
+) {
+    char *input = build_input(format, &(result->input_bytes), operations, genres);
+    if unlikely (input == NULL) {
+        (void) fprintf(stderr, "format-bench: out of memory\n");
+        return false;
+    }
+    const bool parsed = parse_input(input, result->input_bytes, operations, &(result->parse_ns));
+    free(input);
+    if unlikely (!parsed) {
+        return false;
+    }
+
+    char *names = NULL;
+    struct movie *movies = build_movies(operations, genres, &names);
+    if unlikely (movies == NULL) {
+        (void) fprintf(stderr, "format-bench: out of memory\n");
+        return false;
+    }
+    const bool rendered = render_movies(format, movies, operations, result);
+    free(movies);
+    free(names);
+    return rendered;
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Prints the measurements of a format as a YAML mapping. */
+static void report_format(const char name[NONNULL], const struct bench_result *NONNULL result, size_t operations) {
+    static constexpr const uint64_t NS_PER_US = 1'000;
+    static constexpr const double NS_PER_SEC = 1e9;
+
+    printf("  %s:\n", name);
+    printf("    input_bytes: %zu\n", result->input_bytes);
+    printf("    parse_us: %" PRIu64 "\n", result->parse_ns / NS_PER_US);
+    printf(
+        "    parse_ops_per_sec: %.1f\n",
+        result->parse_ns > 0 ? (double) operations * NS_PER_SEC / (double) result->parse_ns : 0
+    );
+    printf("    output_bytes: %zu\n", result->output_bytes);
+    printf("    render_us: %" PRIu64 "\n", result->render_ns / NS_PER_US);
+    printf(
+        "    render_ops_per_sec: %.1f\n",
+        result->render_ns > 0 ? (double) operations * NS_PER_SEC / (double) result->render_ns : 0
+    );
+}
+
+[[gnu::cold]]
+/** Prints usage information. */
+static void usage(const char program[NONNULL]) {
+    (void) fprintf(
+        stderr,
+        "usage: %s [-n OPERATIONS] [-g GENRES]\n"
+        "  -n OPERATIONS  movies parsed and rendered in each format (default 100000)\n"
+        "  -g GENRES      genres per movie (default 3)\n",
+        program
+    );
+}
+
+int main(int argc, char *NONNULL argv[]) {
+    static constexpr const size_t DEFAULT_OPERATIONS = 100'000;
+    static constexpr const size_t DEFAULT_GENRES = 3;
+    static constexpr const int AS_DECIMAL = 10;
+
+    size_t operations = DEFAULT_OPERATIONS;
+    size_t genres = DEFAULT_GENRES;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:g:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                operations = strtoul(optarg, NULL, AS_DECIMAL);
+                break;
+            case 'g':
+                genres = strtoul(optarg, NULL, AS_DECIMAL);
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // read once by parser_setup, the genre list is the only limit that `-g` could exceed
+    setenv("REQUEST_MAX_GENRES", "0", false);
+    parser_setup();
+
+    struct bench_result yaml = {};
+    struct bench_result json = {};
+    if unlikely (!run_format(FORMAT_YAML, &yaml, operations, genres)) {
+        return EXIT_FAILURE;
+    }
+    if unlikely (!run_format(FORMAT_JSON, &json, operations, genres)) {
+        return EXIT_FAILURE;
+    }
+
+    printf("---\nformat_bench:\n");
+    printf("  operations: %zu\n", operations);
+    printf("  genres: %zu\n", genres);
+    report_format("yaml", &yaml, operations);
+    report_format("json", &json, operations);
+    printf("...\n");
+    return EXIT_SUCCESS;
+}
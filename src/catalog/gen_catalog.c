@@ -0,0 +1,532 @@
+/**
+ * Generates a synthetic movie catalog directly into a database file, for benchmarks.
+ *
+ * The schema is created by `db_setup`, exactly as the server would, and then filled in large transactions through a
+ * private SQLite connection. Genre and director popularity follow a Zipf distribution, while title lengths, genre counts
+ * and release years follow fixed skewed tables. The same seed always generates the same catalog.
+ */
+#include "../database/sqlite_source.h"  // must be included first for defines
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "../database/database.h"
+#include "../defines.h"
+#include "../movie/movie.h"
+
+/** Number of movies inserted in each transaction. */
+#define MOVIES_PER_TRANSACTION 100'000
+/** Maximum genres for a single movie. */
+#define MAX_GENRES_PER_MOVIE 8
+/** Maximum words in a title. */
+#define MAX_TITLE_WORDS 8
+/** Output buffer size for generated names. */
+#define NAME_LEN 256
+
+/** Well known genres, used before numbered ones. */
+static const char *const GENRES[] = {
+    "Drama",   "Comedy",  "Action",      "Thriller", "Romance", "Horror",    "Crime",   "Adventure",
+    "Fantasy", "Mystery", "Animation",   "Sci-Fi",   "Family",  "Biography", "History", "Documentary",
+    "War",     "Music",   "Musical",     "Western",  "Sport",   "Film-Noir", "Short",   "Superhero",
+    "Satire",  "Noir",    "Coming-of-Age", "Heist",  "Disaster", "Psychological", "Slasher", "Mockumentary",
+};
+
+/** Words used in titles. */
+static const char *const TITLE_WORDS[] = {
+    "The",      "Last",    "Night",  "of",      "Return", "Dark",    "City",    "Love",    "Man",     "Woman",
+    "Story",    "House",   "War",    "Blood",   "Star",   "Time",    "Dead",    "King",    "Queen",   "Girl",
+    "Boy",      "Secret",  "Lost",   "River",   "Shadow", "Fire",    "Ice",     "Heart",   "Game",    "Dream",
+    "Journey",  "Silent",  "Golden", "Wild",    "Broken", "Red",     "Black",   "White",   "Blue",    "Green",
+    "Midnight", "Summer",  "Winter", "Island",  "Road",   "Ghost",   "Empire",  "Legend",  "Storm",   "Sky",
+    "Edge",     "World",   "Angel",  "Devil",   "Moon",   "Sun",     "Ocean",   "Forest",  "Machine", "Song",
+    "Last",     "First",   "Little", "Great",
+};
+
+/** First names for directors. */
+static const char *const FIRST_NAMES[] = {
+    "Akira",  "Agnès",  "Alfred",  "Ana",    "Bong",    "Chantal", "Claire", "Céline", "David",   "Denis",
+    "Federico", "Fernando", "Greta", "Hayao", "Ingmar", "Jane",    "Jean",   "Jordan", "Kathryn", "Kelly",
+    "Lucrecia", "Lynne", "Martin",  "Mira",   "Nadine",  "Park",    "Pedro",  "Ridley", "Sofia",   "Stanley",
+    "Steven", "Wong",
+};
+
+/** Last names for directors. */
+static const char *const LAST_NAMES[] = {
+    "Almodóvar", "Anderson", "Bergman", "Bigelow", "Campion", "Coppola", "Denis",    "Fellini", "Gerwig",
+    "Hitchcock", "Kar-wai",  "Kubrick", "Kurosawa", "Labaki", "Martel",  "Meirelles", "Miyazaki", "Nair",
+    "Ozu",       "Peele",    "Ramsay",  "Reichardt", "Sciamma", "Scorsese", "Scott",  "Spielberg", "Tarkovsky",
+    "Varda",     "Villeneuve", "Wachowski", "Wilder", "Zhao",
+};
+
+/** Number of items in a static array. */
+#define countof(array) (sizeof(array) / sizeof((array)[0]))
+
+/** Relative frequency of title word counts, starting at one word. */
+static const unsigned TITLE_LENGTH_WEIGHTS[MAX_TITLE_WORDS] = {15, 30, 25, 15, 8, 4, 2, 1};
+/** Relative frequency of genre counts per movie, starting at one genre. */
+static const unsigned GENRE_COUNT_WEIGHTS[MAX_GENRES_PER_MOVIE] = {25, 35, 22, 10, 5, 2, 1, 0};
+
+/** Catalog parameters. */
+struct catalog_options {
+    /** Output database file. */
+    const char *NONNULL filepath;
+    /** Number of movies. */
+    uint64_t movies;
+    /** Number of distinct genres. */
+    uint64_t genres;
+    /** Number of distinct directors. Zero derives it from `movies`. */
+    uint64_t directors;
+    /** PRNG seed. */
+    uint64_t seed;
+    /** Overwrite an existing file. */
+    bool force;
+};
+
+[[gnu::hot, gnu::nonnull(1)]]
+/** SplitMix64 generator: fast, tiny state and good enough statistical quality for synthetic data. */
+static inline uint64_t rng_next(uint64_t *NONNULL state) {
+    uint64_t z = (*state += 0x9E37'79B9'7F4A'7C15);
+    z = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+    z = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EB;
+    return z ^ (z >> 31);
+}
+
+[[gnu::hot, gnu::nonnull(1)]]
+/** Uniform integer in `[0, bound)`, using Lemire's multiply-shift reduction. */
+static inline uint64_t rng_below(uint64_t *NONNULL state, uint64_t bound) {
+    return (uint64_t) (((unsigned __int128) rng_next(state) * bound) >> 64);
+}
+
+[[gnu::hot, gnu::nonnull(1, 3)]]
+/** Picks an index in `[0, count)` with the relative frequencies in `weights`. */
+static size_t rng_weighted(uint64_t *NONNULL state, size_t count, const unsigned weights[NONNULL count]) {
+    unsigned total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += weights[i];
+    }
+
+    uint64_t pick = rng_below(state, total);
+    for (size_t i = 0; i < count; i++) {
+        if (pick < weights[i]) {
+            return i;
+        }
+        pick -= weights[i];
+    }
+    return count - 1;
+}
+
+/** Zipf distribution with exponent 1 over `[0, count)`, sampled through its cumulative table. */
+struct zipf {
+    /** Cumulative weights, scaled to `UINT64_MAX`. */
+    uint64_t *NONNULL cdf;
+    /** Number of ranks. */
+    size_t count;
+};
+
+[[gnu::nonnull(1)]]
+/** Builds the cumulative table for `count` ranks. */
+static bool zipf_init(struct zipf *NONNULL zipf, size_t count) {
+    zipf->cdf = calloc(count, sizeof(uint64_t));
+    if unlikely (zipf->cdf == NULL) {
+        return false;
+    }
+    zipf->count = count;
+
+    double total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += 1.0 / (double) (i + 1);
+    }
+    double acc = 0;
+    for (size_t i = 0; i < count; i++) {
+        acc += 1.0 / (double) (i + 1);
+        // avoid rounding up to 2^64, which is undefined when converted
+        const double scaled = (acc / total) * 18446744073709549568.0;
+        zipf->cdf[i] = (uint64_t) scaled;
+    }
+    zipf->cdf[count - 1] = UINT64_MAX;
+    return true;
+}
+
+[[gnu::hot, gnu::nonnull(1, 2)]]
+/** Samples a rank, with rank zero being the most popular. */
+static size_t zipf_sample(const struct zipf *NONNULL zipf, uint64_t *NONNULL state) {
+    const uint64_t pick = rng_next(state);
+    size_t lo = 0;
+    size_t hi = zipf->count - 1;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (zipf->cdf[mid] < pick) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+[[gnu::nonnull(1)]]
+/** Name for genre with rank `rank`. */
+static void genre_name(char name[NONNULL NAME_LEN], uint64_t rank) {
+    if (rank < countof(GENRES)) {
+        (void) snprintf(name, NAME_LEN, "%s", GENRES[rank]);
+    } else {
+        (void) snprintf(name, NAME_LEN, "Genre %" PRIu64, rank - countof(GENRES) + 1);
+    }
+}
+
+[[gnu::nonnull(1)]]
+/** Name for director with rank `rank`, unique for every rank. */
+static void director_name(char name[NONNULL NAME_LEN], uint64_t rank) {
+    const uint64_t first = rank % countof(FIRST_NAMES);
+    const uint64_t last = (rank / countof(FIRST_NAMES)) % countof(LAST_NAMES);
+    const uint64_t suffix = rank / (countof(FIRST_NAMES) * countof(LAST_NAMES));
+    if (suffix == 0) {
+        (void) snprintf(name, NAME_LEN, "%s %s", FIRST_NAMES[first], LAST_NAMES[last]);
+    } else {
+        (void) snprintf(name, NAME_LEN, "%s %s %" PRIu64, FIRST_NAMES[first], LAST_NAMES[last], suffix + 1);
+    }
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Random title with a skewed number of words. */
+static void title_name(char name[NONNULL NAME_LEN], uint64_t *NONNULL state) {
+    const size_t words = 1 + rng_weighted(state, MAX_TITLE_WORDS, TITLE_LENGTH_WEIGHTS);
+    size_t len = 0;
+    for (size_t i = 0; i < words; i++) {
+        const char *word = TITLE_WORDS[rng_below(state, countof(TITLE_WORDS))];
+        const int rv = snprintf(name + len, NAME_LEN - len, "%s%s", i > 0 ? " " : "", word);
+        if unlikely (rv < 0 || (size_t) rv >= NAME_LEN - len) {
+            break;
+        }
+        len += (size_t) rv;
+    }
+}
+
+[[gnu::nonnull(1)]]
+/** Release year between 1920 and 2025, skewed towards recent years. */
+static int64_t release_year(uint64_t *NONNULL state) {
+    static constexpr const uint64_t SPAN = 106;
+    static constexpr const int64_t LATEST = 2025;
+
+    // product of two uniforms concentrates near zero
+    const uint64_t a = rng_below(state, SPAN);
+    const uint64_t b = rng_below(state, SPAN);
+    return LATEST - (int64_t) ((a * b) / SPAN);
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Reports the last SQLite error and returns false. */
+static bool report_error(sqlite3 *NONNULL db, const char context[NONNULL]) {
+    (void) fprintf(stderr, "gen-catalog: %s: %s\n", context, sqlite3_errmsg(db));
+    return false;
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Runs SQL without results. */
+static bool exec(sqlite3 *NONNULL db, const char sql[NONNULL]) {
+    const int rv = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    return likely(rv == SQLITE_OK) || report_error(db, sql);
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Steps a write statement to completion and resets it. */
+static bool step(sqlite3 *NONNULL db, sqlite3_stmt *NONNULL stmt) {
+    const int rv = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return likely(rv == SQLITE_DONE) || report_error(db, "insert failed");
+}
+
+/** Prepared inserts for the catalog. */
+struct catalog_stmts {
+    sqlite3_stmt *NULLABLE insert_genre;
+    sqlite3_stmt *NULLABLE insert_movie;
+    sqlite3_stmt *NULLABLE insert_link;
+};
+
+[[gnu::nonnull(1, 2)]]
+/** Prepares all inserts. */
+static bool prepare_stmts(sqlite3 *NONNULL db, struct catalog_stmts *NONNULL stmts) {
+    static constexpr const int FLAGS = SQLITE_PREPARE_PERSISTENT;
+
+    int rv = sqlite3_prepare_v3(db, "INSERT INTO genre(id, name) VALUES (?, ?);", -1, FLAGS, &(stmts->insert_genre), NULL);
+    if likely (rv == SQLITE_OK) {
+        rv = sqlite3_prepare_v3(
+            db,
+            "INSERT INTO movie(id, title, director, release_year, genres) VALUES (?, ?, ?, ?, ?);",
+            -1,
+            FLAGS,
+            &(stmts->insert_movie),
+            NULL
+        );
+    }
+    if likely (rv == SQLITE_OK) {
+        rv = sqlite3_prepare_v3(
+            db,
+            "INSERT INTO movie_genre(movie_id, genre_id) VALUES (?, ?);",
+            -1,
+            FLAGS,
+            &(stmts->insert_link),
+            NULL
+        );
+    }
+    return likely(rv == SQLITE_OK) || report_error(db, "prepare failed");
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Inserts all genres, with ids matching their popularity rank plus one. */
+static bool insert_genres(sqlite3 *NONNULL db, const struct catalog_stmts *NONNULL stmts, uint64_t genres) {
+    char name[NAME_LEN];
+    for (uint64_t rank = 0; rank < genres; rank++) {
+        genre_name(name, rank);
+        sqlite3_bind_int64(stmts->insert_genre, 1, (int64_t) rank + 1);
+        sqlite3_bind_text(stmts->insert_genre, 2, name, -1, SQLITE_STATIC);
+        if unlikely (!step(db, stmts->insert_genre)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+[[gnu::nonnull(1, 2, 3, 4, 5)]]
+/** Inserts a single movie and its genre links. */
+static bool insert_movie(
+    sqlite3 *NONNULL db,
+    const struct catalog_stmts *NONNULL stmts,
+    const struct zipf *NONNULL genre_dist,
+    const struct zipf *NONNULL director_dist,
+    uint64_t *NONNULL state,
+    int64_t id
+) {
+    char title[NAME_LEN];
+    char director[NAME_LEN];
+    title_name(title, state);
+    director_name(director, zipf_sample(director_dist, state));
+
+    size_t count = 1 + rng_weighted(state, MAX_GENRES_PER_MOVIE, GENRE_COUNT_WEIGHTS);
+    if (count > genre_dist->count) {
+        count = genre_dist->count;
+    }
+    size_t chosen[MAX_GENRES_PER_MOVIE];
+    // denormalized names for `movie.genres`
+    char packed[MAX_GENRES_PER_MOVIE * NAME_LEN] = "";
+    size_t packed_len = 0;
+    for (size_t i = 0; i < count; i++) {
+        bool repeated;
+        do {
+            chosen[i] = zipf_sample(genre_dist, state);
+            repeated = false;
+            for (size_t j = 0; j < i; j++) {
+                repeated = repeated || chosen[j] == chosen[i];
+            }
+        } while (repeated);
+
+        if (i > 0) {
+            packed[packed_len++] = GENRE_SEPARATOR;
+        }
+        genre_name(packed + packed_len, chosen[i]);
+        packed_len += strlen(packed + packed_len);
+    }
+
+    sqlite3_bind_int64(stmts->insert_movie, 1, id);
+    sqlite3_bind_text(stmts->insert_movie, 2, title, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmts->insert_movie, 3, director, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmts->insert_movie, 4, release_year(state));
+    sqlite3_bind_text(stmts->insert_movie, 5, packed, (int) packed_len, SQLITE_STATIC);
+    if unlikely (!step(db, stmts->insert_movie)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        sqlite3_bind_int64(stmts->insert_link, 1, id);
+        sqlite3_bind_int64(stmts->insert_link, 2, (int64_t) chosen[i] + 1);
+        if unlikely (!step(db, stmts->insert_link)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Fills the catalog, committing every `MOVIES_PER_TRANSACTION` movies. */
+static bool fill_catalog(sqlite3 *NONNULL db, const struct catalog_options *NONNULL options) {
+    struct catalog_stmts stmts = {};
+    struct zipf genre_dist = {};
+    struct zipf director_dist = {};
+    uint64_t state = options->seed;
+
+    const uint64_t directors = options->directors > 0 ? options->directors : options->movies / 20 + 50;
+    bool ok = prepare_stmts(db, &stmts) && zipf_init(&genre_dist, options->genres)
+        && zipf_init(&director_dist, directors);
+
+    ok = ok && exec(db, "BEGIN IMMEDIATE;") && insert_genres(db, &stmts, options->genres);
+    for (uint64_t i = 0; ok && i < options->movies; i++) {
+        ok = insert_movie(db, &stmts, &genre_dist, &director_dist, &state, (int64_t) i + 1);
+        if (ok && (i + 1) % MOVIES_PER_TRANSACTION == 0) {
+            ok = exec(db, "COMMIT; BEGIN IMMEDIATE;");
+            (void) fprintf(stderr, "gen-catalog: %" PRIu64 " movies\n", i + 1);
+        }
+    }
+    // ids were assigned explicitly, so the server must reserve new blocks after them
+    ok = ok
+        && exec(
+             db,
+             "UPDATE id_block SET next = max(next, (SELECT coalesce(max(id), 0) + 1 FROM movie)) WHERE name = 'movie';"
+             "UPDATE id_block SET next = max(next, (SELECT coalesce(max(id), 0) + 1 FROM genre)) WHERE name = 'genre';"
+        );
+    // a single new generation for the whole catalog, so clients syncing changes see every movie
+    ok = ok
+        && exec(
+             db,
+             "UPDATE id_block SET next = next + 1 WHERE name = 'generation';"
+             "INSERT INTO movie_change(movie_id, created, modified, deleted)"
+             "    SELECT id, generation.next - 1, generation.next - 1, 0"
+             "        FROM movie, (SELECT next FROM id_block WHERE name = 'generation') AS generation"
+             "    WHERE true"
+             "    ON CONFLICT (movie_id) DO UPDATE SET modified = excluded.modified, deleted = 0;"
+        );
+    ok = ok && exec(db, "COMMIT;") && exec(db, "PRAGMA optimize;");
+
+    free(director_dist.cdf);
+    free(genre_dist.cdf);
+    sqlite3_finalize(stmts.insert_link);
+    sqlite3_finalize(stmts.insert_movie);
+    sqlite3_finalize(stmts.insert_genre);
+    return ok;
+}
+
+[[gnu::nonnull(1)]]
+/** Creates the schema through `db_setup`, then fills it. */
+static bool generate(const struct catalog_options *NONNULL options) {
+    db_error_t error = {.code = DB_ERROR_NONE};
+    if unlikely (!db_setup(options->filepath, &error)) {
+        char message[DB_ERROR_LEN];
+        (void) db_error_format(error, sizeof(message), message);
+        (void) fprintf(stderr, "gen-catalog: db_setup: %s\n", message);
+        return false;
+    }
+
+    int rv = sqlite3_initialize();
+    if unlikely (rv != SQLITE_OK) {
+        (void) fprintf(stderr, "gen-catalog: sqlite3_initialize: %s\n", sqlite3_errstr(rv));
+        return false;
+    }
+
+    sqlite3 *db = NULL;
+    rv = sqlite3_open_v2(options->filepath, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_EXRESCODE, NULL);
+    bool ok = likely(rv == SQLITE_OK) || report_error(db, "open failed");
+    // bulk loading into a fresh file: durability is only needed at the end
+    ok = ok && exec(db, "PRAGMA synchronous = OFF; PRAGMA cache_size = -262144;");
+    ok = ok && fill_catalog(db, options);
+
+    (void) sqlite3_close(db);
+    (void) sqlite3_shutdown();
+    return ok;
+}
+
+[[gnu::cold]]
+/** Prints usage information. */
+static void usage(const char program[NONNULL]) {
+    (void) fprintf(
+        stderr,
+        "usage: %s [-n MOVIES] [-g GENRES] [-d DIRECTORS] [-s SEED] [-f] [OUTPUT]\n"
+        "  -n MOVIES     number of movies (default 1000)\n"
+        "  -g GENRES     number of distinct genres (default 64)\n"
+        "  -d DIRECTORS  number of distinct directors (default MOVIES / 20 + 50)\n"
+        "  -s SEED       random seed (default 1)\n"
+        "  -f            overwrite OUTPUT if it exists\n"
+        "  OUTPUT        database file (default %s)\n",
+        program,
+        DATABASE
+    );
+}
+
+[[gnu::nonnull(1)]]
+/** Removes a database file and its journals. */
+static bool remove_database(const char filepath[NONNULL]) {
+    static const char *const SUFFIXES[] = {"", "-wal", "-shm", "-journal"};
+
+    for (size_t i = 0; i < countof(SUFFIXES); i++) {
+        char path[NAME_LEN * 4];
+        (void) snprintf(path, sizeof(path), "%s%s", filepath, SUFFIXES[i]);
+        if (unlink(path) != 0 && errno != ENOENT) {
+            (void) fprintf(stderr, "gen-catalog: could not remove %s: %s\n", path, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *NONNULL argv[]) {
+    static constexpr const uint64_t DEFAULT_MOVIES = 1'000;
+    static constexpr const uint64_t DEFAULT_GENRES = 64;
+    static constexpr const int AS_DECIMAL = 10;
+
+    struct catalog_options options = {
+        .filepath = DATABASE,
+        .movies = DEFAULT_MOVIES,
+        .genres = DEFAULT_GENRES,
+        .directors = 0,
+        .seed = 1,
+        .force = false,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:g:d:s:fh")) != -1) {
+        switch (opt) {
+            case 'n':
+                options.movies = strtoull(optarg, NULL, AS_DECIMAL);
+                break;
+            case 'g':
+                options.genres = strtoull(optarg, NULL, AS_DECIMAL);
+                break;
+            case 'd':
+                options.directors = strtoull(optarg, NULL, AS_DECIMAL);
+                break;
+            case 's':
+                options.seed = strtoull(optarg, NULL, AS_DECIMAL);
+                break;
+            case 'f':
+                options.force = true;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc - 1 || options.genres == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (optind == argc - 1) {
+        options.filepath = argv[optind];
+    }
+
+    if (access(options.filepath, F_OK) == 0) {
+        if (!options.force) {
+            (void) fprintf(stderr, "gen-catalog: %s already exists, use -f to overwrite\n", options.filepath);
+            return EXIT_FAILURE;
+        }
+        if (!remove_database(options.filepath)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    (void) fprintf(
+        stderr,
+        "gen-catalog: %" PRIu64 " movies, %" PRIu64 " genres, seed %" PRIu64 " into %s\n",
+        options.movies,
+        options.genres,
+        options.seed,
+        options.filepath
+    );
+    return generate(&options) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,294 @@
+/**
+ * Pipelines requests through a `client_pool_t` against a running server.
+ *
+ * A movie is added first, unless `-i` names an existing one. Then every thread takes a connection from the pool and
+ * keeps up to the pipeline depth of `get_movie` requests for it in flight until the request count is reached.
+ * Throughput and latency percentiles are printed as YAML, like `replay`, so runs against different builds can be
+ * compared directly. The latency of a request runs from queueing it to receiving its response, so it includes the time
+ * spent waiting behind the pipeline.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+
+#include "../defines.h"
+#include "../movie/movie.h"
+#include "../stats/clock.h"
+#include "./client.h"
+
+/** Benchmark options. */
+struct bench_options {
+    /** Server address. */
+    struct sockaddr_in server;
+    /** Total number of requests. */
+    size_t requests;
+    /** Requests in flight per connection. */
+    size_t depth;
+    /** Number of threads, each with its own connection. */
+    size_t threads;
+    /** Existing movie to request, or 0 to add one. */
+    int64_t movie_id;
+};
+
+/** Shared benchmark state. */
+static struct bench_state {
+    /** Parsed options. */
+    struct bench_options options;
+    /** Pool shared by all threads. */
+    client_pool_t *NULLABLE pool;
+    /** Movie requested by every `get_movie`. */
+    int64_t movie_id;
+    /** Next request to queue, claimed by the threads. */
+    atomic_size_t next;
+    /** Responses received with `ok`. */
+    atomic_size_t succeeded;
+    /** Responses received with an error, and requests lost to connection failures. */
+    atomic_size_t failed;
+    /** Latency of every response received, in the order they were recorded. */
+    uint64_t *NULLABLE latencies_ns;
+    /** Number of entries written to `latencies_ns`. */
+    atomic_size_t recorded;
+} state;
+
+[[gnu::nonnull(1)]]
+/** Receives a single response, counting it and recording its latency from `sent_ns`. */
+static bool receive_one(client_conn_t *NONNULL conn, uint64_t sent_ns) {
+    struct client_response response;
+    if unlikely (client_receive(conn, &response) != CLIENT_OK) {
+        return false;
+    }
+    const uint64_t latency_ns = clock_now_ns() - sent_ns;
+    state.latencies_ns[atomic_fetch_add_explicit(&(state.recorded), 1, memory_order_relaxed)] = latency_ns;
+    atomic_fetch_add_explicit(response.ok ? &(state.succeeded) : &(state.failed), 1, memory_order_relaxed);
+    client_response_free(&response);
+    return true;
+}
+
+/** Sends requests on a pooled connection until all of them were claimed, keeping the pipeline full. */
+static void *NULLABLE bench_thread(void *NULLABLE arg) {
+    (void) arg;
+    // queue times of the requests in flight, oldest at `oldest`, since responses arrive in request order
+    uint64_t *sent_ns = calloc(state.options.depth, sizeof(uint64_t));
+    if unlikely (sent_ns == NULL) {
+        (void) fprintf(stderr, "client-bench: out of memory\n");
+        return NULL;
+    }
+    client_conn_t *conn = client_pool_acquire(state.pool);
+    if unlikely (conn == NULL) {
+        (void) fprintf(stderr, "client-bench: could not connect: %s\n", strerror(errno));
+        free(sent_ns);
+        return NULL;
+    }
+
+    size_t oldest = 0;
+    bool usable = true;
+    while (usable) {
+        while (client_pending(conn) < state.options.depth) {
+            const size_t i = atomic_fetch_add_explicit(&(state.next), 1, memory_order_relaxed);
+            if (i >= state.options.requests) {
+                break;
+            }
+            sent_ns[(oldest + client_pending(conn)) % state.options.depth] = clock_now_ns();
+            if unlikely (!client_get_movie(conn, state.movie_id)) {
+                atomic_fetch_add_explicit(&(state.failed), 1, memory_order_relaxed);
+                usable = false;
+                break;
+            }
+        }
+        if (client_pending(conn) == 0) {
+            break;
+        }
+        usable = receive_one(conn, sent_ns[oldest]) && usable;
+        oldest = (oldest + 1) % state.options.depth;
+    }
+
+    if unlikely (!usable) {
+        (void) fprintf(stderr, "client-bench: connection failed: %s\n", strerror(errno));
+        atomic_fetch_add_explicit(&(state.failed), client_pending(conn), memory_order_relaxed);
+    }
+    client_pool_release(state.pool, conn);
+    free(sent_ns);
+    return NULL;
+}
+
+[[nodiscard("errors cannot be ignored")]]
+/** Adds the movie read by the benchmark, storing its id. */
+static bool add_bench_movie(void) {
+    const char *genres[] = {"bench"};
+    const struct movie movie = {
+        .title = "client-bench",
+        .director = "client-bench",
+        .release_year = 2000,
+        .genres = genres,
+        .genre_count = 1,
+    };
+
+    client_conn_t *conn = client_pool_acquire(state.pool);
+    if unlikely (conn == NULL) {
+        (void) fprintf(stderr, "client-bench: could not connect: %s\n", strerror(errno));
+        return false;
+    }
+
+    bool added = false;
+    struct client_response response;
+    if likely (client_add_movie(conn, &movie) && client_receive(conn, &response) == CLIENT_OK) {
+        added = response.ok && client_response_id(&response, &(state.movie_id));
+        if unlikely (!added) {
+            (void) fprintf(stderr, "client-bench: could not add movie:\n%s", response.text);
+        }
+        client_response_free(&response);
+    } else {
+        (void) fprintf(stderr, "client-bench: could not add movie: %s\n", strerror(errno));
+    }
+    client_pool_release(state.pool, conn);
+    return added;
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Orders latencies for `qsort`. */
+static int compare_ns(const void *NONNULL a, const void *NONNULL b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/** Prints throughput and latency percentiles as YAML. */
+static void report(uint64_t elapsed_ns) {
+    static constexpr const uint64_t NS_PER_US = 1'000;
+    static constexpr const double NS_PER_SEC = 1e9;
+    static constexpr const unsigned PERCENTILES[] = {50, 90, 99};
+
+    const size_t succeeded = atomic_load(&(state.succeeded));
+    const size_t failed = atomic_load(&(state.failed));
+    printf("---\nclient_bench:\n");
+    printf("  requests: %zu\n", state.options.requests);
+    printf("  depth: %zu\n", state.options.depth);
+    printf("  threads: %zu\n", state.options.threads);
+    printf("  succeeded: %zu\n", succeeded);
+    printf("  failed: %zu\n", failed);
+    printf("  elapsed_us: %" PRIu64 "\n", elapsed_ns / NS_PER_US);
+    const size_t completed = succeeded + failed;
+    printf("  ops_per_sec: %.1f\n", elapsed_ns > 0 ? (double) completed * NS_PER_SEC / (double) elapsed_ns : 0);
+
+    const size_t recorded = atomic_load(&(state.recorded));
+    if (recorded > 0) {
+        qsort(state.latencies_ns, recorded, sizeof(uint64_t), compare_ns);
+        for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); i++) {
+            const uint64_t latency_ns = state.latencies_ns[recorded * PERCENTILES[i] / 100];
+            printf("  latency_p%u_us: %.1f\n", PERCENTILES[i], (double) latency_ns / NS_PER_US);
+        }
+        printf("  latency_max_us: %.1f\n", (double) state.latencies_ns[recorded - 1] / NS_PER_US);
+    }
+    printf("...\n");
+}
+
+[[gnu::cold]]
+/** Prints usage information. */
+static void usage(const char program[NONNULL]) {
+    (void) fprintf(
+        stderr,
+        "usage: %s [-a ADDRESS] [-p PORT] [-n REQUESTS] [-d DEPTH] [-j THREADS] [-i MOVIE_ID]\n"
+        "  -a ADDRESS   server IPv4 address (default 127.0.0.1)\n"
+        "  -p PORT      server port (default 12345)\n"
+        "  -n REQUESTS  total requests (default 100000)\n"
+        "  -d DEPTH     requests in flight per connection (default 64)\n"
+        "  -j THREADS   concurrent connections (default 4)\n"
+        "  -i MOVIE_ID  request an existing movie instead of adding one\n",
+        program
+    );
+}
+
+int main(int argc, char *NONNULL argv[]) {
+    static constexpr const uint16_t DEFAULT_PORT = 12'345;
+    static constexpr const size_t DEFAULT_REQUESTS = 100'000;
+    static constexpr const size_t DEFAULT_DEPTH = 64;
+    static constexpr const size_t DEFAULT_THREADS = 4;
+    static constexpr const int AS_DECIMAL = 10;
+
+    state.options = (struct bench_options) {
+        .server = {.sin_family = AF_INET, .sin_port = htons(DEFAULT_PORT), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)},
+        .requests = DEFAULT_REQUESTS,
+        .depth = DEFAULT_DEPTH,
+        .threads = DEFAULT_THREADS,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:n:d:j:i:h")) != -1) {
+        switch (opt) {
+            case 'a':
+                if (inet_pton(AF_INET, optarg, &(state.options.server.sin_addr)) != 1) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                state.options.server.sin_port = htons((uint16_t) strtoul(optarg, NULL, AS_DECIMAL));
+                break;
+            case 'n':
+                state.options.requests = strtoul(optarg, NULL, AS_DECIMAL);
+                break;
+            case 'd':
+                state.options.depth = strtoul(optarg, NULL, AS_DECIMAL);
+                break;
+            case 'j':
+                state.options.threads = strtoul(optarg, NULL, AS_DECIMAL);
+                break;
+            case 'i':
+                state.options.movie_id = strtoll(optarg, NULL, AS_DECIMAL);
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || state.options.depth == 0 || state.options.threads == 0 || state.options.movie_id < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    state.pool = client_pool_create(&(state.options.server), state.options.threads);
+    pthread_t *threads = calloc(state.options.threads, sizeof(pthread_t));
+    state.latencies_ns = calloc(state.options.requests > 0 ? state.options.requests : 1, sizeof(uint64_t));
+    if unlikely (state.pool == NULL || threads == NULL || state.latencies_ns == NULL) {
+        (void) fprintf(stderr, "client-bench: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    state.movie_id = state.options.movie_id;
+    if (state.movie_id == 0 && !add_bench_movie()) {
+        return EXIT_FAILURE;
+    }
+
+    const uint64_t start_ns = clock_now_ns();
+    size_t started = 0;
+    for (; started < state.options.threads; started++) {
+        if unlikely (pthread_create(&(threads[started]), NULL, bench_thread, NULL) != 0) {
+            (void) fprintf(stderr, "client-bench: could only start %zu threads\n", started);
+            break;
+        }
+    }
+    if unlikely (started == 0) {
+        bench_thread(NULL);
+    }
+    for (size_t i = 0; i < started; i++) {
+        (void) pthread_join(threads[i], NULL);
+    }
+    const uint64_t elapsed_ns = clock_now_ns() - start_ns;
+
+    report(elapsed_ns);
+
+    free(state.latencies_ns);
+    free(threads);
+    client_pool_destroy(state.pool);
+    const size_t lost = state.options.requests - atomic_load(&(state.succeeded)) - atomic_load(&(state.failed));
+    return lost == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
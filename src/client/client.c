@@ -0,0 +1,769 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdckdint.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../defines.h"
+#include "../movie/movie.h"
+#include "./client.h"
+
+/** Growable byte buffer, consumed from `start`. */
+struct client_buffer {
+    /** Buffer contents. */
+    char *NULLABLE data;
+    /** First byte not consumed yet. */
+    size_t start;
+    /** Bytes in use, including the consumed ones. */
+    size_t length;
+    /** Allocated size of `data`. */
+    size_t capacity;
+};
+
+/** A connection to the server. */
+struct client_conn {
+    /** The socket, always used with `MSG_DONTWAIT`. */
+    int fd;
+    /** If `client_flush` and `client_receive` return instead of waiting on `poll`. */
+    bool nonblocking;
+    /** Set after socket errors, so the pool never reuses the connection. */
+    bool broken;
+    /** Requests queued or sent without a response yet. */
+    size_t pending;
+    /** Queued requests, not yet sent. */
+    struct client_buffer output;
+    /** Received bytes, not yet returned as a response. */
+    struct client_buffer input;
+};
+
+/** Idle connections to the same server. */
+struct client_pool {
+    /** Protects `idle` and `idle_count`. */
+    pthread_mutex_t lock;
+    /** Server address for new connections. */
+    struct sockaddr_in server;
+    /** Most idle connections kept open. */
+    size_t max_idle;
+    /** Number of connections in `idle`. */
+    size_t idle_count;
+    /** Stack of idle connections, so the most recently used ones are reused first. */
+    client_conn_t *NONNULL idle[];
+};
+
+/** Smallest allocation for a buffer, and the most bytes read at once. */
+#define CLIENT_CHUNK ((size_t) 64 * 1024)
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1)]]
+/** Makes room for `extra` bytes after `length`, dropping the consumed prefix first. */
+static bool buffer_reserve(struct client_buffer *NONNULL buffer, size_t extra) {
+    if (buffer->start > 0) {
+        assume(buffer->data != NULL);
+        memmove(buffer->data, &(buffer->data[buffer->start]), buffer->length - buffer->start);
+        buffer->length -= buffer->start;
+        buffer->start = 0;
+    }
+
+    size_t needed;
+    if unlikely (ckd_add(&needed, buffer->length, extra)) {
+        return false;
+    } else if likely (needed <= buffer->capacity) {
+        return true;
+    }
+
+    size_t capacity = buffer->capacity > CLIENT_CHUNK ? buffer->capacity : CLIENT_CHUNK;
+    while (capacity < needed) {
+        if unlikely (ckd_mul(&capacity, capacity, 2)) {
+            return false;
+        }
+    }
+
+    char *data = realloc(buffer->data, capacity);
+    if unlikely (data == NULL) {
+        return false;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1, 3)]]
+/** Appends `length` bytes of `str`. */
+static bool buffer_append(struct client_buffer *NONNULL buffer, size_t length, const char str[NONNULL length]) {
+    if unlikely (!buffer_reserve(buffer, length)) {
+        return false;
+    }
+    memcpy(&(buffer->data[buffer->length]), str, length);
+    buffer->length += length;
+    return true;
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1, 2)]]
+/** Appends a NUL-terminated string. */
+static bool buffer_append_str(struct client_buffer *NONNULL buffer, const char str[NONNULL]) {
+    return buffer_append(buffer, strlen(str), str);
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1, 2)]]
+/** Appends `str` as a double-quoted YAML scalar, escaping quotes, backslashes and control characters. */
+static bool buffer_append_quoted(struct client_buffer *NONNULL buffer, const char str[NONNULL]) {
+    bool ok = buffer_append(buffer, 1, "\"");
+    while (ok && *str != '\0') {
+        // copy runs of plain characters at once
+        size_t plain = 0;
+        while (str[plain] != '\0' && str[plain] != '"' && str[plain] != '\\' && (unsigned char) str[plain] >= ' '
+               && str[plain] != '\x7F') {
+            plain++;
+        }
+        ok = buffer_append(buffer, plain, str);
+        str += plain;
+
+        if (ok && *str != '\0') {
+            char escaped[sizeof("\\xFF")];
+            const int len = (*str == '"' || *str == '\\')
+                ? snprintf(escaped, sizeof(escaped), "\\%c", *str)
+                : snprintf(escaped, sizeof(escaped), "\\x%02X", (unsigned) (unsigned char) *str);
+            ok = buffer_append(buffer, (size_t) len, escaped);
+            str++;
+        }
+    }
+    return ok && buffer_append(buffer, 1, "\"");
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1)]]
+/** Appends a decimal integer. */
+static bool buffer_append_i64(struct client_buffer *NONNULL buffer, int64_t value) {
+    char number[sizeof("-9223372036854775808")];
+    const int len = snprintf(number, sizeof(number), "%" PRIi64, value);
+    return buffer_append(buffer, (size_t) len, number);
+}
+
+/** Opens a blocking connection to `server`. */
+client_conn_t *NULLABLE client_connect(const struct sockaddr_in *NONNULL server) {
+    client_conn_t *conn = calloc(1, sizeof(client_conn_t));
+    if unlikely (conn == NULL) {
+        return NULL;
+    }
+
+    conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if unlikely (conn->fd < 0) {
+        free(conn);
+        return NULL;
+    }
+
+    // pipelined requests are small, don't hold them back waiting for ACKs
+    const int enabled = 1;
+    (void) setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+
+    int rv;
+    do {
+        rv = connect(conn->fd, (const struct sockaddr *) server, sizeof(*server));
+    } while (rv != 0 && errno == EINTR);
+    if unlikely (rv != 0) {
+        const int error = errno;
+        (void) close(conn->fd);
+        free(conn);
+        errno = error;
+        return NULL;
+    }
+    return conn;
+}
+
+/** Closes the connection and frees its buffers. */
+void client_close(client_conn_t *NONNULL conn) {
+    (void) close(conn->fd);
+    free(conn->output.data);
+    free(conn->input.data);
+    free(conn);
+}
+
+/** Socket of the connection. */
+int client_fd(const client_conn_t *NONNULL conn) {
+    return conn->fd;
+}
+
+/** Number of requests without a response. */
+size_t client_pending(const client_conn_t *NONNULL conn) {
+    return conn->pending;
+}
+
+/** Switches between blocking and non-blocking mode. */
+void client_set_nonblocking(client_conn_t *NONNULL conn, bool nonblocking) {
+    conn->nonblocking = nonblocking;
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1)]]
+/**
+ * Finishes the request started at `mark` in the output buffer, as a YAML document of its own, so the server answers it
+ * without waiting for the next one. On failure, the partial request is dropped.
+ */
+static bool finish_request(client_conn_t *NONNULL conn, size_t mark, bool ok) {
+    ok = ok && buffer_append_str(&(conn->output), "\n...\n");
+    if unlikely (!ok) {
+        conn->output.length = mark;
+        return false;
+    }
+
+    conn->pending += 1;
+    return true;
+}
+
+/** Queues a raw operation. */
+bool client_request(client_conn_t *NONNULL conn, const char operation[NONNULL]) {
+    const size_t mark = conn->output.length;
+    const bool ok = buffer_append_str(&(conn->output), "---\n") && buffer_append_str(&(conn->output), operation);
+    return finish_request(conn, mark, ok);
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1, 2, 3)]]
+/** Queues an operation on a full movie. */
+static bool request_movie(
+    client_conn_t *NONNULL conn,
+    const char operation[NONNULL],
+    const struct movie *NONNULL movie
+) {
+    struct client_buffer *output = &(conn->output);
+    const size_t mark = output->length;
+
+    bool ok = buffer_append_str(output, "---\n") && buffer_append_str(output, operation)
+        && buffer_append_str(output, ": {title: ") && buffer_append_quoted(output, movie->title)
+        && buffer_append_str(output, ", director: ") && buffer_append_quoted(output, movie->director)
+        && buffer_append_str(output, ", release_year: ") && buffer_append_i64(output, movie->release_year)
+        && buffer_append_str(output, ", genres: [");
+    for (size_t i = 0; ok && i < movie->genre_count; i++) {
+        ok = (i == 0 || buffer_append_str(output, ", ")) && buffer_append_quoted(output, movie->genres[i]);
+    }
+    ok = ok && buffer_append_str(output, "]}");
+    return finish_request(conn, mark, ok);
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1, 2)]]
+/** Queues an operation with optional `id` and `genre` keys. */
+static bool request_key(
+    client_conn_t *NONNULL conn,
+    const char operation[NONNULL],
+    bool with_id,
+    int64_t movie_id,
+    const char *NULLABLE genre
+) {
+    struct client_buffer *output = &(conn->output);
+    const size_t mark = output->length;
+
+    bool ok = buffer_append_str(output, "---\n") && buffer_append_str(output, operation)
+        && buffer_append_str(output, ": {");
+    if (ok && with_id) {
+        ok = buffer_append_str(output, "id: ") && buffer_append_i64(output, movie_id);
+    }
+    if (ok && genre != NULL) {
+        ok = buffer_append_str(output, with_id ? ", genre: " : "genre: ") && buffer_append_quoted(output, genre);
+    }
+    ok = ok && buffer_append_str(output, "}");
+    return finish_request(conn, mark, ok);
+}
+
+/** Queues an `add_movie` request. */
+bool client_add_movie(client_conn_t *NONNULL conn, const struct movie *NONNULL movie) {
+    return request_movie(conn, "add_movie", movie);
+}
+
+/** Queues an `upsert_movie` request. */
+bool client_upsert_movie(client_conn_t *NONNULL conn, const struct movie *NONNULL movie) {
+    return request_movie(conn, "upsert_movie", movie);
+}
+
+/** Queues an `add_genre` request. */
+bool client_add_genre(client_conn_t *NONNULL conn, int64_t movie_id, const char genre[NONNULL]) {
+    return request_key(conn, "add_genre", true, movie_id, genre);
+}
+
+/** Queues a `remove_movie` request. */
+bool client_remove_movie(client_conn_t *NONNULL conn, int64_t movie_id) {
+    return request_key(conn, "remove_movie", true, movie_id, NULL);
+}
+
+/** Queues a `get_movie` request. */
+bool client_get_movie(client_conn_t *NONNULL conn, int64_t movie_id) {
+    return request_key(conn, "get_movie", true, movie_id, NULL);
+}
+
+/** Queues a `list_summaries` request. */
+bool client_list_summaries(client_conn_t *NONNULL conn) {
+    return request_key(conn, "list_summaries", false, 0, NULL);
+}
+
+/** Queues a `list_movies` request. */
+bool client_list_movies(client_conn_t *NONNULL conn) {
+    return request_key(conn, "list_movies", false, 0, NULL);
+}
+
+/** Queues a `search_by_genre` request. */
+bool client_search_by_genre(client_conn_t *NONNULL conn, const char genre[NONNULL]) {
+    return request_key(conn, "search_by_genre", false, 0, genre);
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/** Waits until the socket is ready for `events`, for blocking connections. */
+static client_status_t wait_socket(client_conn_t *NONNULL conn, short events) {
+    struct pollfd poller = {.fd = conn->fd, .events = events, .revents = 0};
+    while (poll(&poller, 1, -1) < 0) {
+        if unlikely (errno != EINTR) {
+            conn->broken = true;
+            return CLIENT_ERROR;
+        }
+    }
+    return CLIENT_OK;
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/** Sends as much of the queued requests as the socket accepts without blocking. */
+static client_status_t send_some(client_conn_t *NONNULL conn) {
+    struct client_buffer *output = &(conn->output);
+    while (output->start < output->length) {
+        assume(output->data != NULL);
+        const ssize_t sent = send(
+            conn->fd,
+            &(output->data[output->start]),
+            output->length - output->start,
+            MSG_DONTWAIT | MSG_NOSIGNAL
+        );
+        if unlikely (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return CLIENT_AGAIN;
+            }
+            conn->broken = true;
+            return CLIENT_ERROR;
+        }
+        output->start += (size_t) sent;
+    }
+
+    output->start = 0;
+    output->length = 0;
+    return CLIENT_OK;
+}
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/** Reads whatever the socket has available without blocking. */
+static client_status_t receive_some(client_conn_t *NONNULL conn) {
+    struct client_buffer *input = &(conn->input);
+    if unlikely (!buffer_reserve(input, CLIENT_CHUNK)) {
+        errno = ENOMEM;
+        conn->broken = true;
+        return CLIENT_ERROR;
+    }
+    assume(input->data != NULL);
+
+    while (true) {
+        const ssize_t received =
+            recv(conn->fd, &(input->data[input->length]), input->capacity - input->length, MSG_DONTWAIT);
+        if likely (received > 0) {
+            input->length += (size_t) received;
+            return CLIENT_OK;
+        } else if (received == 0) {
+            conn->broken = true;
+            return CLIENT_CLOSED;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return CLIENT_AGAIN;
+        }
+        conn->broken = true;
+        return CLIENT_ERROR;
+    }
+}
+
+/** Sends all queued requests. */
+client_status_t client_flush(client_conn_t *NONNULL conn) {
+    while (true) {
+        const client_status_t status = send_some(conn);
+        if (status != CLIENT_AGAIN || conn->nonblocking) {
+            return status;
+        }
+
+        const client_status_t waited = wait_socket(conn, POLLOUT);
+        if unlikely (waited != CLIENT_OK) {
+            return waited;
+        }
+    }
+}
+
+/** Line echoing the `request_id` of a multiplexed operation, always the first one. */
+static constexpr const char REQUEST_ID[] = "request_id: ";
+/** Line acknowledging an operation, before its body. */
+static constexpr const char RECEIVED[] = "server: received ";
+
+[[nodiscard("incomplete input on false"), gnu::nonnull(2, 3, 4)]]
+/** Moves `offset` past the line there, if it starts with `prefix`. Returns `false` if that line is incomplete. */
+static bool skip_line(
+    size_t length,
+    const char data[NONNULL length],
+    const char prefix[NONNULL],
+    size_t *NONNULL offset
+) {
+    const size_t prefix_len = strlen(prefix);
+    if (length - *offset < prefix_len || memcmp(&(data[*offset]), prefix, prefix_len) != 0) {
+        return true;
+    }
+
+    const char *eol = memchr(&(data[*offset]), '\n', length - *offset);
+    if (eol == NULL) {
+        return false;
+    }
+    *offset = (size_t) (eol - data) + 1;
+    return true;
+}
+
+[[gnu::pure, gnu::nonnull(2)]]
+/**
+ * Finds the length of the first complete response in `data`, or zero if more input is needed.
+ *
+ * Each response is an optional `request_id` line and an optional `server: received` line, followed by either a YAML
+ * document from `---` to `...`, or by lines up to the first empty one.
+ */
+static size_t response_length(size_t length, const char data[NONNULL length]) {
+    size_t body = 0;
+    if (!skip_line(length, data, REQUEST_ID, &body) || !skip_line(length, data, RECEIVED, &body)) {
+        return 0;
+    }
+
+    // every body is longer than the document start
+    static constexpr const char DOC_START[] = "---\n";
+    static constexpr const size_t DOC_START_LEN = sizeof(DOC_START) - 1;
+    if (length - body < DOC_START_LEN) {
+        return 0;
+    }
+
+    const char *end = NULL;
+    size_t end_len = 0;
+    if (memcmp(&(data[body]), DOC_START, DOC_START_LEN) == 0) {
+        static constexpr const char DOC_END[] = "\n...\n";
+        end_len = sizeof(DOC_END) - 1;
+        end = memmem(&(data[body + DOC_START_LEN - 1]), length - body - DOC_START_LEN + 1, DOC_END, end_len);
+    } else {
+        end_len = 2;
+        end = memmem(&(data[body]), length - body, "\n\n", end_len);
+    }
+    return end != NULL ? (size_t) (end - data) + end_len : 0;
+}
+
+[[gnu::pure, gnu::nonnull(1, 2)]]
+/** Checks if `str` starts with `prefix`. */
+static inline bool starts_with(const char str[NONNULL], const char prefix[NONNULL]) {
+    return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+[[gnu::pure, gnu::nonnull(2)]]
+/** Checks if the response body reports success. Failures are single `server:` lines, besides the known replies. */
+static bool response_ok(size_t length, const char text[NONNULL length]) {
+    size_t body = 0;
+    (void) skip_line(length, text, REQUEST_ID, &body);
+    (void) skip_line(length, text, RECEIVED, &body);
+
+    text = &(text[body]);
+    return !starts_with(text, "server: ") || starts_with(text, "server: ok\n")
+        || starts_with(text, "server: not modified\n");
+}
+
+[[gnu::pure, gnu::nonnull(1)]]
+/** Reads the echoed `request_id`, or zero if there is none. */
+static uint64_t response_request_id(const char text[NONNULL]) {
+    if likely (!starts_with(text, REQUEST_ID)) {
+        return 0;
+    }
+
+    static constexpr const int AS_DECIMAL = 10;
+    return (uint64_t) strtoull(&(text[strlen(REQUEST_ID)]), NULL, AS_DECIMAL);
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1, 2, 3)]]
+/** Moves the first complete response out of the input buffer, if there is one. */
+static bool take_response(
+    client_conn_t *NONNULL conn,
+    struct client_response *NONNULL response,
+    bool *NONNULL taken
+) {
+    struct client_buffer *input = &(conn->input);
+    *taken = false;
+    if (input->start >= input->length) {
+        return true;
+    }
+    assume(input->data != NULL);
+
+    const size_t length = response_length(input->length - input->start, &(input->data[input->start]));
+    if (length == 0) {
+        return true;
+    }
+
+    char *text = malloc(length + 1);
+    if unlikely (text == NULL) {
+        return false;
+    }
+    memcpy(text, &(input->data[input->start]), length);
+    text[length] = '\0';
+    input->start += length;
+    conn->pending -= 1;
+
+    *response = (struct client_response) {
+        .text = text,
+        .length = length,
+        .ok = response_ok(length, text),
+        .request_id = response_request_id(text),
+        .lines = NULL,
+    };
+    *taken = true;
+    return true;
+}
+
+/** Receives the response for the oldest pending request. */
+client_status_t client_receive(client_conn_t *NONNULL conn, struct client_response *NONNULL response) {
+    if unlikely (conn->pending == 0) {
+        errno = EINVAL;
+        return CLIENT_ERROR;
+    }
+
+    while (true) {
+        bool taken = false;
+        if unlikely (!take_response(conn, response, &taken)) {
+            errno = ENOMEM;
+            return CLIENT_ERROR;
+        } else if (taken) {
+            return CLIENT_OK;
+        }
+
+        // keep sending while waiting, the server may only read more requests after its responses are read
+        const client_status_t sent = send_some(conn);
+        if unlikely (sent == CLIENT_ERROR) {
+            return sent;
+        }
+
+        const client_status_t received = receive_some(conn);
+        if (received == CLIENT_OK) {
+            continue;
+        } else if (received != CLIENT_AGAIN || conn->nonblocking) {
+            return received;
+        }
+
+        const short events = POLLIN | (sent == CLIENT_AGAIN ? POLLOUT : 0);
+        const client_status_t waited = wait_socket(conn, events);
+        if unlikely (waited != CLIENT_OK) {
+            return waited;
+        }
+    }
+}
+
+/** Reads the `id` of an `add_movie` or `upsert_movie` response. */
+bool client_response_id(const struct client_response *NONNULL response, int64_t *NONNULL id) {
+    if unlikely (response->text == NULL) {
+        return false;
+    }
+
+    const char *line = strstr(response->text, "\nid: ");
+    if (line == NULL) {
+        return false;
+    }
+
+    char *end;
+    errno = 0;
+    static constexpr const int AS_DECIMAL = 10;
+    const long long value = strtoll(&(line[strlen("\nid: ")]), &end, AS_DECIMAL);
+    if unlikely (errno != 0 || *end != '\n') {
+        return false;
+    }
+    *id = (int64_t) value;
+    return true;
+}
+
+/** Frees a partial movie list. */
+static void free_movie_list(size_t count, struct movie *NULLABLE movies) {
+    for (size_t i = 0; movies != NULL && i < count; i++) {
+        free_movie(movies[i]);
+    }
+    free(movies);
+}
+
+/** Reads the movies of a response. */
+struct movie *NULLABLE client_response_movies(struct client_response *NONNULL response, size_t *NONNULL count) {
+    if unlikely (response->text == NULL) {
+        return NULL;
+    }
+
+    free(response->lines);
+    response->lines = strdup(response->text);
+    if unlikely (response->lines == NULL) {
+        return NULL;
+    }
+
+    static constexpr const int AS_DECIMAL = 10;
+    struct movie *movies = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    size_t genre_capacity = 0;
+    // indentation of the `genres:` key of the current movie, or zero outside of a genre list
+    size_t genres_indent = 0;
+
+    char *next = NULL;
+    for (char *line = response->lines; line != NULL; line = next) {
+        char *eol = strchr(line, '\n');
+        next = eol != NULL ? &(eol[1]) : NULL;
+        if (eol != NULL) {
+            *eol = '\0';
+        }
+
+        // rendered as `- id:` in lists and as `id:` inside `movie:`, always the first field
+        const size_t indent = strspn(line, " ");
+        const char *field = &(line[indent]);
+        const bool list_item = starts_with(field, "- id: ");
+        if (list_item || (indent == 2 && starts_with(field, "id: "))) {
+            if (length >= capacity) {
+                const size_t larger = capacity > 0 ? 2 * capacity : 16;
+                struct movie *grown = realloc(movies, larger * sizeof(struct movie));
+                if unlikely (grown == NULL) {
+                    free_movie_list(length, movies);
+                    return NULL;
+                }
+                movies = grown;
+                capacity = larger;
+            }
+
+            static constexpr const size_t INITIAL_GENRES = 4;
+            const char **genres = malloc(INITIAL_GENRES * sizeof(const char *));
+            if unlikely (genres == NULL) {
+                free_movie_list(length, movies);
+                return NULL;
+            }
+
+            const char *id = &(field[list_item ? strlen("- id: ") : strlen("id: ")]);
+            movies[length++] = (struct movie) {
+                .id = (int64_t) strtoll(id, NULL, AS_DECIMAL),
+                .title = "",
+                .director = "",
+                .release_year = 0,
+                .genres = genres,
+                .genre_count = 0,
+            };
+            genre_capacity = INITIAL_GENRES;
+            genres_indent = 0;
+            continue;
+        } else if (length == 0 || indent < 2) {
+            genres_indent = 0;
+            continue;
+        }
+
+        struct movie *movie = &(movies[length - 1]);
+        if (genres_indent > 0 && indent > genres_indent && starts_with(field, "- ")) {
+            if (movie->genre_count >= genre_capacity) {
+                const char **grown = realloc((void *) movie->genres, 2 * genre_capacity * sizeof(const char *));
+                if unlikely (grown == NULL) {
+                    free_movie_list(length, movies);
+                    return NULL;
+                }
+                movie->genres = grown;
+                genre_capacity *= 2;
+            }
+            movie->genres[movie->genre_count++] = &(field[strlen("- ")]);
+            continue;
+        }
+
+        genres_indent = 0;
+        if (starts_with(field, "title: ")) {
+            movie->title = &(field[strlen("title: ")]);
+        } else if (starts_with(field, "director: ")) {
+            movie->director = &(field[strlen("director: ")]);
+        } else if (starts_with(field, "release_year: ")) {
+            movie->release_year = (int) strtol(&(field[strlen("release_year: ")]), NULL, AS_DECIMAL);
+        } else if (starts_with(field, "genres:")) {
+            genres_indent = indent;
+        }
+    }
+
+    *count = length;
+    // an empty list is still a valid result
+    return movies != NULL ? movies : calloc(1, sizeof(struct movie));
+}
+
+/** Frees the response text. */
+void client_response_free(struct client_response *NONNULL response) {
+    free(response->text);
+    free(response->lines);
+    *response = (struct client_response) {.text = NULL, .length = 0, .ok = false, .request_id = 0, .lines = NULL};
+}
+
+/** Creates a pool of connections to `server`. */
+client_pool_t *NULLABLE client_pool_create(const struct sockaddr_in *NONNULL server, size_t max_idle) {
+    size_t size;
+    if unlikely (ckd_mul(&size, max_idle, sizeof(client_conn_t *)) || ckd_add(&size, size, sizeof(client_pool_t))) {
+        return NULL;
+    }
+
+    client_pool_t *pool = malloc(size);
+    if unlikely (pool == NULL) {
+        return NULL;
+    }
+
+    int rv = pthread_mutex_init(&(pool->lock), NULL);
+    if unlikely (rv != 0) {
+        free(pool);
+        return NULL;
+    }
+    pool->server = *server;
+    pool->max_idle = max_idle;
+    pool->idle_count = 0;
+    return pool;
+}
+
+/** Closes all idle connections and frees the pool. */
+void client_pool_destroy(client_pool_t *NONNULL pool) {
+    for (size_t i = 0; i < pool->idle_count; i++) {
+        client_close(pool->idle[i]);
+    }
+    pthread_mutex_destroy(&(pool->lock));
+    free(pool);
+}
+
+/** Takes an idle connection from the pool, or opens a new one. */
+client_conn_t *NULLABLE client_pool_acquire(client_pool_t *NONNULL pool) {
+    client_conn_t *conn = NULL;
+    pthread_mutex_lock(&(pool->lock));
+    if likely (pool->idle_count > 0) {
+        conn = pool->idle[--pool->idle_count];
+    }
+    pthread_mutex_unlock(&(pool->lock));
+
+    if unlikely (conn == NULL) {
+        // connect outside the lock, it may take a whole round trip
+        conn = client_connect(&(pool->server));
+    }
+    return conn;
+}
+
+/** Returns a connection to the pool. */
+void client_pool_release(client_pool_t *NONNULL pool, client_conn_t *NONNULL conn) {
+    // leftover requests or responses would be matched to the next user
+    const bool reusable = !conn->broken && conn->pending == 0 && conn->output.length == conn->output.start
+        && conn->input.length == conn->input.start;
+    conn->nonblocking = false;
+
+    bool pooled = false;
+    if likely (reusable) {
+        pthread_mutex_lock(&(pool->lock));
+        if likely (pool->idle_count < pool->max_idle) {
+            pool->idle[pool->idle_count++] = conn;
+            pooled = true;
+        }
+        pthread_mutex_unlock(&(pool->lock));
+    }
+
+    if unlikely (!pooled) {
+        client_close(conn);
+    }
+}
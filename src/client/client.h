@@ -0,0 +1,183 @@
+#ifndef SRC_CLIENT_CLIENT_H
+/** Client library for the YAML protocol, with connection pooling and pipelined requests. */
+#define SRC_CLIENT_CLIENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+#include "../defines.h"
+#include "../movie/movie.h"
+
+/** Results for operations that wait on the socket. */
+typedef enum [[gnu::packed]] client_status {
+    /** Operation completed. */
+    CLIENT_OK,
+    /** The socket is non-blocking and not ready. Retry once `client_fd` is readable or writable. */
+    CLIENT_AGAIN,
+    /** The server closed the connection. */
+    CLIENT_CLOSED,
+    /** Socket or allocation error, see `errno`. The connection cannot be used anymore. */
+    CLIENT_ERROR,
+} client_status_t;
+
+static_assert(sizeof(client_status_t) == 1);
+
+/** Opaque handle to a server connection, with buffered requests and responses. */
+typedef struct client_conn client_conn_t;
+
+/** Opaque pool of idle connections to the same server. Thread safe. */
+typedef struct client_pool client_pool_t;
+
+/** A single response, matched in order to the request that caused it. */
+struct client_response {
+    /** The whole response text, including the `server: received` line, NUL-terminated. */
+    char *NULLABLE text;
+    /** Length of `text`, without the NUL. */
+    size_t length;
+    /** If the server reported success, including `not modified` replies. */
+    bool ok;
+    /** The `request_id` of the operation, or zero if it was not multiplexed. */
+    uint64_t request_id;
+    /** Copy of `text` split into lines, referenced by the movies from `client_response_movies`. */
+    char *NULLABLE lines;
+};
+
+[[nodiscard("allocated memory must be freed"), gnu::malloc, gnu::nonnull(1), gnu::cold]]
+/**
+ * Opens a blocking connection to `server`.
+ *
+ * Returns `NULL` and sets `errno` on failure. The caller is responsible for calling `client_close`.
+ */
+client_conn_t *NULLABLE client_connect(const struct sockaddr_in *NONNULL server);
+
+[[gnu::nonnull(1), gnu::cold]]
+/** Closes the connection and frees its buffers. Responses not yet received are lost. */
+void client_close(client_conn_t *NONNULL conn);
+
+[[nodiscard("useless call if discarded"), gnu::pure, gnu::nonnull(1)]]
+/** Socket of the connection, for `poll` or `epoll` with non-blocking connections. */
+int client_fd(const client_conn_t *NONNULL conn);
+
+[[nodiscard("useless call if discarded"), gnu::pure, gnu::nonnull(1)]]
+/** Number of requests queued or sent whose responses were not received yet. */
+size_t client_pending(const client_conn_t *NONNULL conn);
+
+[[gnu::nonnull(1)]]
+/**
+ * Switches the connection between blocking and non-blocking mode. In non-blocking mode, `client_flush` and
+ * `client_receive` return `CLIENT_AGAIN` instead of waiting. Blocking mode waits with `poll`, sending queued requests
+ * while responses arrive, so long pipelines never deadlock on full socket buffers.
+ */
+void client_set_nonblocking(client_conn_t *NONNULL conn, bool nonblocking);
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1, 2)]]
+/**
+ * Queues a raw operation, written as a single YAML mapping entry, like `list_movies: {limit: 20}`. Nothing is sent
+ * until `client_flush` or `client_receive`, so many requests can be pipelined in a single write.
+ *
+ * Returns `false` on allocation failures.
+ */
+bool client_request(client_conn_t *NONNULL conn, const char operation[NONNULL]);
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1, 2)]]
+/** Queues an `add_movie` request. The `id` of `movie` is ignored, the assigned id is in the response. */
+bool client_add_movie(client_conn_t *NONNULL conn, const struct movie *NONNULL movie);
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1, 2)]]
+/** Queues an `upsert_movie` request. The `id` of `movie` is ignored, the stored id is in the response. */
+bool client_upsert_movie(client_conn_t *NONNULL conn, const struct movie *NONNULL movie);
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1, 3)]]
+/** Queues an `add_genre` request. */
+bool client_add_genre(client_conn_t *NONNULL conn, int64_t movie_id, const char genre[NONNULL]);
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/** Queues a `remove_movie` request. */
+bool client_remove_movie(client_conn_t *NONNULL conn, int64_t movie_id);
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/** Queues a `get_movie` request. */
+bool client_get_movie(client_conn_t *NONNULL conn, int64_t movie_id);
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/** Queues a `list_summaries` request. */
+bool client_list_summaries(client_conn_t *NONNULL conn);
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/** Queues a `list_movies` request. */
+bool client_list_movies(client_conn_t *NONNULL conn);
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1, 2)]]
+/** Queues a `search_by_genre` request. */
+bool client_search_by_genre(client_conn_t *NONNULL conn, const char genre[NONNULL]);
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1)]]
+/**
+ * Sends all queued requests.
+ *
+ * Returns `CLIENT_OK` once everything was written, or `CLIENT_AGAIN` if a non-blocking socket is full.
+ */
+client_status_t client_flush(client_conn_t *NONNULL conn);
+
+[[nodiscard("errors cannot be ignored"), gnu::nonnull(1, 2)]]
+/**
+ * Receives the next response into `response`, flushing queued requests first. Responses come in the same order as the
+ * requests, except for operations sent with a `request_id` through `client_request`, which may be answered out of
+ * order and are matched by `response->request_id`.
+ *
+ * Returns `CLIENT_OK` when `response` is filled, or `CLIENT_AGAIN` if a non-blocking socket has no complete response
+ * yet. Calling it without pending requests is an error, with `errno` set to `EINVAL`.
+ *
+ * @note The caller is responsible for calling `client_response_free` on success.
+ */
+client_status_t client_receive(client_conn_t *NONNULL conn, struct client_response *NONNULL response);
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1, 2)]]
+/** Reads the `id` of an `add_movie` or `upsert_movie` response. Returns `false` if there is none. */
+bool client_response_id(const struct client_response *NONNULL response, int64_t *NONNULL id);
+
+[[nodiscard("allocated memory must be freed"), gnu::nonnull(1, 2)]]
+/**
+ * Reads the movies of a `get_movie`, `list_movies`, `search_by_genre` or `changes_since` response. Fields left out by
+ * a projection are empty.
+ *
+ * Returns the list of `count` movies, or `NULL` on allocation failures. Strings point into `response`, so the movies
+ * must be released with `free_movie` and `free` before `client_response_free`.
+ */
+struct movie *NULLABLE client_response_movies(struct client_response *NONNULL response, size_t *NONNULL count);
+
+[[gnu::nonnull(1)]]
+/** Frees the response text. */
+void client_response_free(struct client_response *NONNULL response);
+
+[[nodiscard("allocated memory must be freed"), gnu::malloc, gnu::nonnull(1), gnu::cold]]
+/**
+ * Creates a pool of connections to `server`, keeping up to `max_idle` idle connections open for reuse.
+ *
+ * Returns `NULL` on allocation failures. The caller is responsible for calling `client_pool_destroy`.
+ */
+client_pool_t *NULLABLE client_pool_create(const struct sockaddr_in *NONNULL server, size_t max_idle);
+
+[[gnu::nonnull(1), gnu::cold]]
+/** Closes all idle connections and frees the pool. Connections still acquired must be closed by their users. */
+void client_pool_destroy(client_pool_t *NONNULL pool);
+
+[[nodiscard("must be released"), gnu::nonnull(1)]]
+/**
+ * Takes an idle connection from the pool, or opens a new one when none is left.
+ *
+ * Returns `NULL` and sets `errno` if a new connection could not be opened.
+ */
+client_conn_t *NULLABLE client_pool_acquire(client_pool_t *NONNULL pool);
+
+[[gnu::nonnull(1, 2)]]
+/**
+ * Returns a connection to the pool, in blocking mode. Connections with requests still pending, after errors, or beyond
+ * `max_idle` are closed instead.
+ */
+void client_pool_release(client_pool_t *NONNULL pool, client_conn_t *NONNULL conn);
+
+#endif  // SRC_CLIENT_CLIENT_H
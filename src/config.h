@@ -0,0 +1,42 @@
+#ifndef SRC_CONFIG_H
+/** Startup configuration, read from environment variables. */
+#define SRC_CONFIG_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./defines.h"
+
+[[nodiscard("useless call if discarded"), gnu::cold, gnu::nonnull(1)]]
+/**
+ * Reads an unsigned integer from the environment variable `name`.
+ *
+ * Returns `fallback` when the variable is not set. Invalid values are reported to stderr and also fall back to the
+ * default, so a typo in the environment never prevents the server from starting.
+ */
+static inline uint64_t config_u64(const char name[NONNULL], uint64_t fallback) {
+    const char *value = getenv(name);
+    if likely (value == NULL || value[0] == '\0') {
+        return fallback;
+    }
+
+    char *end;
+    errno = 0;
+    static constexpr const int AS_DECIMAL = 10;
+    const unsigned long long parsed = strtoull(value, &end, AS_DECIMAL);
+    if unlikely (errno != 0 || end == value || *end != '\0' || value[0] == '-' || parsed > UINT64_MAX) {
+        (void) fprintf(
+            stderr,
+            "config: invalid value for %s: '%s', using %llu\n",
+            name,
+            value,
+            (unsigned long long) fallback
+        );
+        return fallback;
+    }
+    return (uint64_t) parsed;
+}
+
+#endif  // SRC_CONFIG_H
@@ -4,7 +4,8 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <limits.h>
-#include <stdarg.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdckdint.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -13,116 +14,115 @@
 #include <string.h>
 
 #include "../alloc.h"
+#include "../config.h"
 #include "../defines.h"
 #include "../movie/builder.h"
 #include "../movie/movie.h"
+#include "../stats/clock.h"
 #include "./database.h"
+#include "./genre_cache.h"
+#include "./id_set.h"
 #include "./schema.h"
+#include "./search_cache.h"
 
-static const char UNKNOWN_ERROR[] = "unknown error";
-static const char OUT_OF_MEMORY_ERROR[] = "out of memory";
-static const char ATEXIT_NOT_REGISTERED_ERROR[] = "could not call at_exit";
-
-[[gnu::cold, gnu::const, nodiscard("useless call when discarded")]]
-/** Predefined error messages, which are NOT dynamically allocated and should not be free. */
-static inline bool is_predefined_errmsg(const char *NULLABLE const error_message) {
-    return error_message == UNKNOWN_ERROR || error_message == OUT_OF_MEMORY_ERROR
-        || error_message == ATEXIT_NOT_REGISTERED_ERROR;
-}
-
-[[gnu::cold, gnu::returns_nonnull, nodiscard("might allocate memory")]]
-/**
- * Duplicates an error message string if not NULL, returning a default message when the original is NULL or
- * allocation fails.
- */
-static const char *NONNULL errmsg_dup(const char *NULLABLE error_message) {
-    if unlikely (is_predefined_errmsg(error_message)) {
-        return error_message;
-    } else if unlikely (error_message == NULL) {
-        return UNKNOWN_ERROR;
-    }
-
-    const size_t size = strlen(error_message) + 1;
-    char *copy = malloc(size * sizeof(char));
-    if unlikely (copy == NULL) {
-        return OUT_OF_MEMORY_ERROR;
+[[gnu::hot]]
+/** Stores `value` into `error`, if non-NULL. */
+static inline void error_set(db_error_t *NULLABLE error, db_error_t value) {
+    if likely (error != NULL) {
+        *error = value;
     }
-
-    memcpy(copy, error_message, size * sizeof(char));
-    return copy;
 }
 
-/** Copies the current SQLite error message from `str` into `errmsg`, if non-NULL. */
-static inline void errmsg_dup_str(message_t *NULLABLE restrict errmsg, const char str[NULLABLE restrict]) {
-    if likely (errmsg != NULL) {
-        *errmsg = errmsg_dup(str);
-    }
+/** Stores an error with no context into `error`, if non-NULL. */
+static inline void error_set_code(db_error_t *NULLABLE error, enum db_error_code code) {
+    error_set(error, (db_error_t) {.code = code});
 }
 
-/** Copies the current SQLite error message from `db` into `errmsg`, if non-NULL. */
-static inline void errmsg_dup_db(message_t *NULLABLE errmsg, sqlite3 *NULLABLE db) {
-    if likely (errmsg != NULL) {
-        *errmsg = errmsg_dup(sqlite3_errmsg(db));
-    }
+/** Stores the SQLite result code `rc` into `error`, if non-NULL. */
+static inline void error_set_rc(db_error_t *NULLABLE error, const int rc) {
+    error_set(error, (db_error_t) {.code = DB_ERROR_SQLITE, .sqlite_code = rc});
 }
 
-/** Copies the SQLite error string for the error code `rc` into `errmsg`, if non-NULL. */
-static inline void errmsg_dup_rc(message_t *NULLABLE errmsg, const int rc) {
-    if likely (errmsg != NULL) {
-        *errmsg = errmsg_dup(sqlite3_errstr(rc));
+/** Stores the last SQLite result code from `db` into `error`, if non-NULL. */
+static inline void error_set_db(db_error_t *NULLABLE error, sqlite3 *NULLABLE db) {
+    if likely (error != NULL) {
+        error_set_rc(error, sqlite3_extended_errcode(db));
     }
 }
 
-[[gnu::cold, gnu::nonnull(1, 2)]]
-/** Builds a formatted error message for expected user errors. */
-static const char *NONNULL errmsg_vprintf(const char *NONNULL restrict format, va_list args) {
-    static constexpr const size_t BUFSIZE = 128;
-
-    char *error_message = malloc(BUFSIZE * sizeof(char));
-    if unlikely (error_message == NULL) {
-        return OUT_OF_MEMORY_ERROR;
-    }
-
-    const int rv = vsnprintf(error_message, BUFSIZE, format, args);
-    if likely (rv > 0) {
-        return error_message;
-    } else {
-        free(error_message);
-        return UNKNOWN_ERROR;
-    }
-}
+/** Renders the message for `error`. */
+size_t db_error_format(db_error_t error, size_t size, char buffer[NONNULL restrict size]) {
+    assume(size > 0);
 
-[[gnu::format(printf, 2, 3), gnu::nonnull(2)]]
-/** Builds a formatted error message for expected user errors. */
-static inline void errmsg_printf(message_t *NULLABLE errmsg, const char *NONNULL restrict format, ...) {
-    if likely (errmsg != NULL) {
-        va_list args;
-        va_start(args);
-        *errmsg = errmsg_vprintf(format, args);
-        va_end(args);
-        return;
+    int rv;
+    switch (error.code) {
+        case DB_ERROR_NONE:
+            rv = snprintf(buffer, size, "no error");
+            break;
+        case DB_ERROR_OUT_OF_MEMORY:
+            rv = snprintf(buffer, size, "out of memory");
+            break;
+        case DB_ERROR_ATEXIT:
+            rv = snprintf(buffer, size, "could not call at_exit");
+            break;
+        case DB_ERROR_SQLITE:
+            rv = snprintf(buffer, size, "%s", sqlite3_errstr(error.sqlite_code));
+            break;
+        case DB_ERROR_SCHEMA_VERSION:
+            rv = snprintf(buffer, size, "database schema version %" PRIi64 " is not supported", error.version);
+            break;
+        case DB_ERROR_SCHEMA_FOREIGN_KEYS:
+            rv = snprintf(buffer, size, "schema migration broke foreign key constraints");
+            break;
+        case DB_ERROR_NO_MOVIE:
+            rv = snprintf(buffer, size, "no movie with id = %" PRIi64 " found in the database", error.movie_id);
+            break;
+        case DB_ERROR_NO_MOVIE_TO_DELETE:
+            rv = snprintf(
+                buffer,
+                size,
+                "no movie with id = %" PRIi64 " to be deleted from the database",
+                error.movie_id
+            );
+            break;
+        case DB_ERROR_GENRE_EXISTS:
+            rv = snprintf(buffer, size, "movie with id = %" PRIi64 " already has the provided genre", error.movie_id);
+            break;
+        case DB_ERROR_FUTURE_GENERATION:
+            rv = snprintf(
+                buffer,
+                size,
+                "generation %" PRIu64 " is newer than the catalog, list it again",
+                error.generation
+            );
+            break;
+        case DB_ERROR_INVALID_GENRE:
+            rv = snprintf(buffer, size, "genre names cannot contain the unit separator character");
+            break;
+        case DB_ERROR_UNKNOWN:
+        default:
+            rv = snprintf(buffer, size, "unknown error");
+            break;
     }
-}
 
-/** Frees a dynamically allocated error message string. */
-void db_free_errmsg(const char *NONNULL errmsg) {
-    // this string should have been "allocated" with `errmsg_dup`, which might return these static strings
-    if likely (!is_predefined_errmsg(errmsg)) {
-        free((char *) errmsg);
+    if unlikely (rv < 0) {
+        buffer[0] = '\0';
+        return 0;
     }
+    return ((size_t) rv < size) ? (size_t) rv : size - 1;
 }
 
 [[gnu::nonnull(1), gnu::cold]]
 /**
- * Closes an open SQLite3 database connection, free resources and set `errmsg`, if necessary.
+ * Closes an open SQLite3 database connection, free resources and set `error`, if necessary.
  */
-static bool db_close(sqlite3 *NULLABLE db, message_t *NULLABLE errmsg) {
+static bool db_close(sqlite3 *NULLABLE db, db_error_t *NULLABLE error) {
     const int rv = sqlite3_close(db);  // safe to call with NULL
     if likely (rv == SQLITE_OK) {
         return true;
     }
 
-    errmsg_dup_db(errmsg, db);
+    error_set_db(error, db);
     if unlikely (rv != SQLITE_BUSY) {
         return false;
     }
@@ -138,13 +138,13 @@ static bool db_close(sqlite3 *NULLABLE db, message_t *NULLABLE errmsg) {
  * Open a database at `filepath`, either connecting to an existing database or creating a new one whe `create` is true.
  */
 static sqlite3 *NULLABLE
-    db_open(const char filepath[NONNULL restrict], message_t *NULLABLE restrict errmsg, bool create) {
+    db_open(const char filepath[NONNULL restrict], db_error_t *NULLABLE restrict error, bool create) {
     const int FLAGS = SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_PRIVATECACHE | SQLITE_OPEN_EXRESCODE;
 
     sqlite3 *db;
     int rv = sqlite3_open_v2(filepath, &db, create ? FLAGS | SQLITE_OPEN_CREATE : FLAGS, NULL);
     if unlikely (rv != SQLITE_OK) {
-        errmsg_dup_db(errmsg, db);
+        error_set_db(error, db);
         db_close(db, NULL);
         return NULL;
     }
@@ -161,14 +161,20 @@ static void db_shutdown(void) {
     }
 }
 
-[[gnu::cold]]
-/** Apply schema from SQL file. */
-static bool db_create_schema(sqlite3 *NONNULL db, message_t *NULLABLE errmsg) {
-    char *errorbuf = NULL;  // will be allocated via sqlite3_malloc, need to copied to std malloc
+[[gnu::cold, gnu::nonnull(1, 2)]]
+/**
+ * Runs SQL without results, storing the error into `error`. The detailed SQLite message is only logged, since errors
+ * carry just the result code.
+ */
+static bool db_exec(sqlite3 *NONNULL db, const char sql[NONNULL], db_error_t *NULLABLE error) {
+    char *errorbuf = NULL;  // will be allocated via sqlite3_malloc
 
-    int rv = sqlite3_exec(db, SCHEMA, NULL, NULL, likely(errmsg != NULL) ? &errorbuf : NULL);
+    int rv = sqlite3_exec(db, sql, NULL, NULL, likely(error != NULL) ? &errorbuf : NULL);
     if unlikely (rv != SQLITE_OK) {
-        errmsg_dup_str(errmsg, errorbuf);
+        if (errorbuf != NULL) {
+            (void) fprintf(stderr, "db: %s\n", errorbuf);
+        }
+        error_set_rc(error, sqlite3_extended_errcode(db));
         sqlite3_free(errorbuf);  // safe to call with NULL
         return false;
     }
@@ -176,11 +182,217 @@ static bool db_create_schema(sqlite3 *NONNULL db, message_t *NULLABLE errmsg) {
     return true;
 }
 
+[[gnu::cold, gnu::nonnull(1, 2, 3)]]
+/** Reads a single integer from a query, like `PRAGMA user_version`. Returns false on errors or if the query is empty. */
+static bool db_query_int(
+    sqlite3 *NONNULL db,
+    const char sql[NONNULL],
+    int64_t *NONNULL output,
+    db_error_t *NULLABLE error
+) {
+    sqlite3_stmt *stmt = NULL;
+    int rv = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if unlikely (rv != SQLITE_OK) {
+        error_set_db(error, db);
+        return false;
+    }
+
+    rv = sqlite3_step(stmt);
+    if likely (rv == SQLITE_ROW) {
+        *output = sqlite3_column_int64(stmt, 0);
+    } else if (rv == SQLITE_DONE) {
+        *output = 0;
+    } else {
+        error_set_db(error, db);
+    }
+    sqlite3_finalize(stmt);
+    return rv == SQLITE_ROW || rv == SQLITE_DONE;
+}
+
+[[gnu::cold, gnu::nonnull(1, 2, 3)]]
+/** Checks if a query returns any row, like `PRAGMA foreign_key_check`. Returns false on errors. */
+static bool db_query_has_rows(
+    sqlite3 *NONNULL db,
+    const char sql[NONNULL],
+    bool *NONNULL has_rows,
+    db_error_t *NULLABLE error
+) {
+    sqlite3_stmt *stmt = NULL;
+    int rv = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if unlikely (rv != SQLITE_OK) {
+        error_set_db(error, db);
+        return false;
+    }
+
+    rv = sqlite3_step(stmt);
+    *has_rows = rv == SQLITE_ROW;
+    if unlikely (rv != SQLITE_ROW && rv != SQLITE_DONE) {
+        error_set_db(error, db);
+    }
+    sqlite3_finalize(stmt);
+    return rv == SQLITE_ROW || rv == SQLITE_DONE;
+}
+
+[[gnu::cold, gnu::nonnull(1)]]
+/** Applies pending migrations inside the current transaction. */
+static bool db_apply_migrations(sqlite3 *NONNULL db, db_error_t *NULLABLE error) {
+    int64_t version;
+    bool ok = db_query_int(db, "PRAGMA user_version;", &version, error);
+    if unlikely (!ok) {
+        return false;
+    }
+
+    if unlikely (version < 0 || (uint64_t) version > SCHEMA_VERSION) {
+        error_set(error, (db_error_t) {.code = DB_ERROR_SCHEMA_VERSION, .version = version});
+        return false;
+    }
+
+    for (size_t i = (size_t) version; i < SCHEMA_VERSION; i++) {
+        ok = db_exec(db, MIGRATIONS[i], error);
+        if unlikely (!ok) {
+            return false;
+        }
+        (void) fprintf(stderr, "db: applied schema migration %zu\n", i + 1);
+    }
+    if likely ((size_t) version == SCHEMA_VERSION) {
+        return true;
+    }
+
+    // the rebuilt tables must keep every reference valid, since foreign keys are off during migrations
+    // each row is a violation, whose first column is just the table name
+    bool violations;
+    ok = db_query_has_rows(db, "PRAGMA foreign_key_check;", &violations, error);
+    if unlikely (!ok) {
+        return false;
+    } else if unlikely (violations) {
+        error_set_code(error, DB_ERROR_SCHEMA_FOREIGN_KEYS);
+        return false;
+    }
+
+    char update[64];
+    (void) snprintf(update, sizeof(update), "PRAGMA user_version = %zu;", SCHEMA_VERSION);
+    return db_exec(db, update, error);
+}
+
+[[gnu::cold, gnu::nonnull(1)]]
+/**
+ * Brings the schema to `SCHEMA_VERSION`, tracked by `PRAGMA user_version`.
+ *
+ * All pending migrations run in a single transaction, so a failure leaves the database untouched. Foreign keys are
+ * disabled meanwhile, as required for table rebuilds.
+ */
+static bool db_migrate(sqlite3 *NONNULL db, db_error_t *NULLABLE error) {
+    // must be changed outside transactions
+    bool ok = db_exec(db, "PRAGMA foreign_keys = OFF;", error);
+    if unlikely (!ok) {
+        return false;
+    }
+
+    ok = db_exec(db, "BEGIN IMMEDIATE TRANSACTION;", error) && db_apply_migrations(db, error)
+        && db_exec(db, "COMMIT TRANSACTION;", error);
+    if unlikely (!ok) {
+        // may fail if the transaction never started, which is fine
+        (void) db_exec(db, "ROLLBACK TRANSACTION;", NULL);
+    }
+
+    return db_exec(db, "PRAGMA foreign_keys = ON;", ok ? error : NULL) && ok;
+}
+
+[[gnu::cold, gnu::nonnull(1)]]
+/** Fills the movie id set with every existing movie. */
+static bool db_load_ids(sqlite3 *NONNULL db, db_error_t *NULLABLE error) {
+    sqlite3_stmt *stmt = NULL;
+    int rv = sqlite3_prepare_v2(db, "SELECT id FROM movie;", -1, &stmt, NULL);
+    if unlikely (rv != SQLITE_OK) {
+        error_set_db(error, db);
+        return false;
+    }
+
+    while ((rv = sqlite3_step(stmt)) == SQLITE_ROW) {
+        id_set_add(sqlite3_column_int64(stmt, 0));
+    }
+    if unlikely (rv != SQLITE_DONE) {
+        error_set_db(error, db);
+    }
+    sqlite3_finalize(stmt);
+    return rv == SQLITE_DONE;
+}
+
+[[gnu::cold, gnu::nonnull(1)]]
+/**
+ * Creates or drops the unique index on the natural key of a movie, as set by `DB_UNIQUE_MOVIES`. Creating it fails if
+ * the catalog already has duplicates, which must be removed first.
+ */
+static bool db_unique_movies(sqlite3 *NONNULL db, bool unique, db_error_t *NULLABLE error) {
+    if (unique) {
+        return db_exec(
+            db,
+            "CREATE UNIQUE INDEX IF NOT EXISTS movie_natural_key ON movie(title, director, release_year);",
+            error
+        );
+    }
+    return db_exec(db, "DROP INDEX IF EXISTS movie_natural_key;", error);
+}
+
+/** If full movies are read from the denormalized `movie.genres` column. Set by `DB_PACKED_GENRES`. */
+static bool packed_genres_enabled = true;
+
+/**
+ * If genre links are inserted with the multi-row variants of `op_insert_genre_links`. Set by `DB_MULTI_ROW_LINKS`, and
+ * cleared for good when SQLite cannot prepare them or they insert fewer rows than given, which is how multi-row
+ * `VALUES` can behave with `SQLITE_OMIT_COMPOUND_SELECT`.
+ */
+static atomic_bool multi_row_links_enabled = true;
+
+/** Number of ids reserved from `id_block` at a time. Set by `DB_ID_BLOCK`. */
+static int64_t id_block_size = 1'000;
+
+/**
+ * How long a connection waits for the write lock held by another one, in milliseconds. Set by `DB_BUSY_TIMEOUT_MS`.
+ * Workers running operations with a `request_id` write from several connections at once.
+ */
+static int busy_timeout_ms = 5'000;
+
+/**
+ * Latest committed catalog generation. Each write reserves a new one from the `generation` row in `id_block`, and
+ * publishes it here after commit.
+ */
+static atomic_uint_fast64_t catalog_generation = 1;
+
+/** If statement counters and operation timings should be collected. Set by `DB_PROFILE`. */
+static bool profiling_enabled = false;
+/** Operations slower than this are logged when profiling. Set by `DB_SLOW_OP_MS`. */
+static uint64_t slow_op_threshold_ns = 0;
+
+[[gnu::cold]]
+/** Reads profiling options from the environment. */
+static void db_profile_setup(void) {
+    static constexpr const uint64_t DEFAULT_SLOW_OP_MS = 100;
+    static constexpr const uint64_t NS_PER_MS = 1'000'000;
+
+    profiling_enabled = config_u64("DB_PROFILE", 0) != 0;
+    slow_op_threshold_ns = config_u64("DB_SLOW_OP_MS", DEFAULT_SLOW_OP_MS) * NS_PER_MS;
+    if unlikely (profiling_enabled) {
+        (void) fprintf(stderr, "db: profiling enabled, slow operation threshold %" PRIu64 " ns\n", slow_op_threshold_ns);
+    }
+}
+
 /** Create or migrate database at `filepath`. */
-bool db_setup(const char filepath[NONNULL restrict], message_t *NULLABLE restrict errmsg) {
+bool db_setup(const char filepath[NONNULL restrict], db_error_t *NULLABLE restrict error) {
+    db_profile_setup();
+    packed_genres_enabled = config_u64("DB_PACKED_GENRES", 1) != 0;
+    atomic_store(&multi_row_links_enabled, config_u64("DB_MULTI_ROW_LINKS", 1) != 0);
+    id_set_setup();
+    search_cache_setup();
+    static constexpr const uint64_t MAX_ID_BLOCK = 1'000'000'000;
+    const uint64_t block_size = config_u64("DB_ID_BLOCK", (uint64_t) id_block_size);
+    id_block_size = (int64_t) (block_size < 1 ? 1 : block_size > MAX_ID_BLOCK ? MAX_ID_BLOCK : block_size);
+    const uint64_t busy_timeout = config_u64("DB_BUSY_TIMEOUT_MS", (uint64_t) busy_timeout_ms);
+    busy_timeout_ms = busy_timeout > INT_MAX ? INT_MAX : (int) busy_timeout;
+
     int rv = sqlite3_initialize();
     if unlikely (rv != SQLITE_OK) {
-        errmsg_dup_rc(errmsg, rv);
+        error_set_rc(error, rv);
         return false;
     }
 
@@ -188,26 +400,46 @@ bool db_setup(const char filepath[NONNULL restrict], message_t *NULLABLE restric
     if unlikely (rv != 0) {
         // ATEXIT_NOT_REGISTERED_ERROR is statically predefined because `atexit` only fails on out-of-memory
         // situations, so it doesn't make sense to try another allocation here
-        errmsg_dup_str(errmsg, ATEXIT_NOT_REGISTERED_ERROR);
+        error_set_code(error, DB_ERROR_ATEXIT);
         db_shutdown();
         return false;
     }
 
-    sqlite3 *db = db_open(filepath, errmsg, true);
+    sqlite3 *db = db_open(filepath, error, true);
     if unlikely (db == NULL) {
-        // `db_open` already sets `errmsg`
+        // `db_open` already sets `error`
         return false;
     }
 
-    bool ok = db_create_schema(db, errmsg);
+    int64_t next_generation = 0;
+    // persistent, so readers never block the writer on any connection opened later
+    bool ok = db_exec(db, "PRAGMA journal_mode = WAL;", error) && db_migrate(db, error)
+        && db_unique_movies(db, config_u64("DB_UNIQUE_MOVIES", 0) != 0, error)
+        && db_load_ids(db, error)
+        && db_query_int(db, "SELECT next FROM id_block WHERE name = 'generation';", &next_generation, error);
     if unlikely (!ok) {
         db_close(db, NULL);
         return false;
     }
+    id_set_ready();
+    atomic_store(&catalog_generation, next_generation > 1 ? (uint64_t) (next_generation - 1) : 1);
 
-    return db_close(db, errmsg);
+    return db_close(db, error);
 }
 
+/**
+ * Number of prepared multi-row variants of `op_insert_genre_links`, where variant `i` inserts `2^i` rows. A 16-row
+ * variant measured slower in `db-bench links` than two statements of 8.
+ */
+#define GENRE_LINK_VARIANTS 4
+/** Most links inserted by a single statement, from the largest variant. */
+#define GENRE_LINK_MAX_ROWS (1 << (GENRE_LINK_VARIANTS - 1))
+/** Number of columns in `enum db_order`. */
+#define DB_ORDER_COLUMNS 3
+/** Prepared variants of `op_select_movies_page`, ascending and descending for each column. */
+#define DB_PAGE_VARIANTS (2 * DB_ORDER_COLUMNS)
+static_assert(DB_ORDER_RELEASE_YEAR + 1 == DB_ORDER_COLUMNS);
+
 /**
  * A connection to the database file, which is a SQLite3 connection with cached statements.
  */
@@ -216,38 +448,324 @@ struct [[gnu::aligned(ALIGNMENT_DB_CONN)]] database_connection {
     sqlite3 *NONNULL db;
     /** Internal buffer for string output. */
     movie_builder_t *NONNULL restrict builder;
+    /** Genre ids seen by the current write transaction, published to the cache after it commits. */
+    genre_cache_txn_t *NONNULL genres;
+    /** Catalog generation loaded just before the current read snapshot started. */
+    uint64_t snapshot_generation;
     /** BEGIN TRANSACTION. */
     sqlite3_stmt *NONNULL op_begin;
+    /** BEGIN TRANSACTION, taking the write lock upfront. */
+    sqlite3_stmt *NONNULL op_begin_write;
     /** COMMIT (or END) TRANSACTION. */
     sqlite3_stmt *NONNULL op_commit;
     /** ROLLBACK TRANSACTION. */
     sqlite3_stmt *NONNULL op_rollback;
     /** REINDEX. */
     sqlite3_stmt *NONNULL op_reindex;
-    /** Register new movie into database and returns the id. */
+    /** Reserve a block of ids for a table, returning the first one. */
+    sqlite3_stmt *NONNULL op_reserve_ids;
+    /** Register new movie into database with a reserved id. */
     sqlite3_stmt *NONNULL op_insert_movie;
-    /** Register new genre, if not existent. */
+    /** Register new genre with a reserved id. */
     sqlite3_stmt *NONNULL op_insert_genre;
-    /** Add genre to movie. */
-    sqlite3_stmt *NONNULL op_insert_genre_link;
-    /** Remove movie from database. */
+    /** Find the id of an existing genre. */
+    sqlite3_stmt *NONNULL op_select_genre_id;
+    /** Add 1, 2, 4 or 8 genres to movie at once. All insert a single row if multi-row `VALUES` is unsupported. */
+    sqlite3_stmt *NONNULL op_insert_genre_links[GENRE_LINK_VARIANTS];
+    /** Append a genre to the denormalized list in `movie.genres`. */
+    sqlite3_stmt *NONNULL op_append_movie_genre;
+    /** Link a movie to a genre unless already linked, returning the genre id if it was new. */
+    sqlite3_stmt *NONNULL op_merge_movie_genre;
+    /** Find the oldest movie with the same title, director and release year. */
+    sqlite3_stmt *NONNULL op_select_movie_by_key;
+    /** Remove movie from database, returning its genres. */
     sqlite3_stmt *NONNULL op_delete_movie;
     /** Remove all genres without movies. */
     sqlite3_stmt *NONNULL op_delete_unused_genres;
+    /** Record the generation of the last change to a movie. */
+    sqlite3_stmt *NONNULL op_record_change;
+    /** List movies changed after a generation, oldest change first. */
+    sqlite3_stmt *NONNULL op_select_changes;
+    /** List existing movies changed after a generation, with all information. */
+    sqlite3_stmt *NONNULL op_select_changed_movies;
     /** List all movie ids and titles. */
     sqlite3_stmt *NONNULL op_select_all_titles;
     /** List all movies and all information. */
     sqlite3_stmt *NONNULL op_select_all_movies;
+    /** List all movies, without genres. */
+    sqlite3_stmt *NONNULL op_select_all_movies_brief;
+    /** List a sorted window of all movies, with variant `2 * order + descending`. */
+    sqlite3_stmt *NONNULL op_select_movies_page[DB_PAGE_VARIANTS];
     /** List information for a single movie. */
     sqlite3_stmt *NONNULL op_select_movie;
+    /** List information for a single movie, without genres. */
+    sqlite3_stmt *NONNULL op_select_movie_brief;
     /** List all genres for a single movie. */
     sqlite3_stmt *NONNULL op_select_movie_genres;
     /** List all movies for a single genre. */
     sqlite3_stmt *NONNULL op_select_movies_genre;
+    /** List all movies for a single genre, without genres. */
+    sqlite3_stmt *NONNULL op_select_movies_genre_brief;
+};
+/** Bytes used by the fields of `struct database_connection`, without the padding for alignment. */
+#define DB_CONN_USED (offsetof(db_conn_t, op_select_movies_genre_brief) + sizeof(void *))
+// ensure no padding between fields, only at the end
+static_assert(sizeof(db_conn_t) % alignof(db_conn_t) == 0);
+static_assert(DB_CONN_USED <= sizeof(db_conn_t));
+
+/** Name and position of each prepared statement in `struct database_connection`, for profiling. */
+static const struct db_stmt_info {
+    /** Statement name, without the `op_` prefix. */
+    const char *NONNULL name;
+    /** Offset of the `sqlite3_stmt *` field. */
+    size_t offset;
+} DB_STMTS[] = {
+#define stmt_info(name) {#name, offsetof(struct database_connection, op_##name)}
+#define stmt_variant(name, index, suffix) {#name "_" #suffix, offsetof(struct database_connection, op_##name[index])}
+    stmt_info(begin),
+    stmt_info(begin_write),
+    stmt_info(commit),
+    stmt_info(rollback),
+    stmt_info(reindex),
+    stmt_info(reserve_ids),
+    stmt_info(insert_movie),
+    stmt_info(insert_genre),
+    stmt_info(select_genre_id),
+    stmt_variant(insert_genre_links, 0, 1),
+    stmt_variant(insert_genre_links, 1, 2),
+    stmt_variant(insert_genre_links, 2, 4),
+    stmt_variant(insert_genre_links, 3, 8),
+    stmt_info(append_movie_genre),
+    stmt_info(merge_movie_genre),
+    stmt_info(select_movie_by_key),
+    stmt_info(delete_movie),
+    stmt_info(delete_unused_genres),
+    stmt_info(record_change),
+    stmt_info(select_changes),
+    stmt_info(select_changed_movies),
+    stmt_info(select_all_titles),
+    stmt_info(select_all_movies),
+    stmt_info(select_all_movies_brief),
+    stmt_variant(select_movies_page, 0, id),
+    stmt_variant(select_movies_page, 1, id_desc),
+    stmt_variant(select_movies_page, 2, title),
+    stmt_variant(select_movies_page, 3, title_desc),
+    stmt_variant(select_movies_page, 4, release_year),
+    stmt_variant(select_movies_page, 5, release_year_desc),
+    stmt_info(select_movie),
+    stmt_info(select_movie_brief),
+    stmt_info(select_movie_genres),
+    stmt_info(select_movies_genre),
+    stmt_info(select_movies_genre_brief),
+#undef stmt_variant
+#undef stmt_info
 };
-// ensure no padding here, even after correct alignment
-static_assert(sizeof(db_conn_t) == alignof(db_conn_t));
-static_assert(sizeof(db_conn_t) == offsetof(db_conn_t, op_select_movies_genre) + sizeof(void *));
+
+/** Number of prepared statements in each connection. */
+#define DB_STMT_COUNT (sizeof(DB_STMTS) / sizeof(struct db_stmt_info))
+// every statement pointer after `builder` must be listed
+static_assert(DB_STMT_COUNT == (DB_CONN_USED - offsetof(db_conn_t, op_begin)) / sizeof(sqlite3_stmt *));
+
+/** Counters read from `sqlite3_stmt_status` for a single statement. */
+enum [[gnu::packed]] db_stmt_counter {
+    /** `SQLITE_STMTSTATUS_RUN`: completed executions. */
+    STMT_RUNS,
+    /** `SQLITE_STMTSTATUS_FULLSCAN_STEP`: steps in a full table scan. */
+    STMT_FULLSCAN_STEPS,
+    /** `SQLITE_STMTSTATUS_SORT`: sort operations. */
+    STMT_SORTS,
+    /** `SQLITE_STMTSTATUS_VM_STEP`: virtual machine operations. */
+    STMT_VM_STEPS,
+    /** Number of counters. */
+    STMT_COUNTERS,
+};
+
+/** The `sqlite3_stmt_status` operation for each `db_stmt_counter`. */
+static const int DB_STMT_STATUS[STMT_COUNTERS] = {
+    [STMT_RUNS] = SQLITE_STMTSTATUS_RUN,
+    [STMT_FULLSCAN_STEPS] = SQLITE_STMTSTATUS_FULLSCAN_STEP,
+    [STMT_SORTS] = SQLITE_STMTSTATUS_SORT,
+    [STMT_VM_STEPS] = SQLITE_STMTSTATUS_VM_STEP,
+};
+
+/** Name for each `db_stmt_counter`, used in reports. */
+static const char *const DB_STMT_COUNTER_NAME[STMT_COUNTERS] = {
+    [STMT_RUNS] = "runs",
+    [STMT_FULLSCAN_STEPS] = "fullscan_steps",
+    [STMT_SORTS] = "sorts",
+    [STMT_VM_STEPS] = "vm_steps",
+};
+
+/** Statement counters aggregated across all workers. */
+static atomic_uint_fast64_t stmt_totals[DB_STMT_COUNT][STMT_COUNTERS];
+
+/** Public database operations that are timed when profiling. */
+enum [[gnu::packed]] db_op {
+    DB_OP_REGISTER_MOVIE,
+    DB_OP_ADD_GENRE,
+    DB_OP_DELETE_MOVIE,
+    DB_OP_GET_MOVIE,
+    DB_OP_LIST_MOVIES,
+    DB_OP_SEARCH_MOVIES_BY_GENRE,
+    DB_OP_LIST_SUMMARIES,
+    DB_OP_CHANGES_SINCE,
+    DB_OP_UPSERT_MOVIE,
+    /** Number of operations. */
+    DB_OP_COUNT,
+};
+
+/** Name for each `db_op`, used in reports. */
+static const char *const DB_OP_NAME[DB_OP_COUNT] = {
+    [DB_OP_REGISTER_MOVIE] = "db_register_movie",
+    [DB_OP_ADD_GENRE] = "db_add_genre",
+    [DB_OP_DELETE_MOVIE] = "db_delete_movie",
+    [DB_OP_GET_MOVIE] = "db_get_movie",
+    [DB_OP_LIST_MOVIES] = "db_list_movies",
+    [DB_OP_SEARCH_MOVIES_BY_GENRE] = "db_search_movies_by_genre",
+    [DB_OP_LIST_SUMMARIES] = "db_list_summaries",
+    [DB_OP_CHANGES_SINCE] = "db_changes_since",
+    [DB_OP_UPSERT_MOVIE] = "db_upsert_movie",
+};
+
+/** Timing for a single `db_op`, aggregated across all workers. */
+static struct db_op_totals {
+    /** Number of calls. */
+    atomic_uint_fast64_t calls;
+    /** Sum of elapsed times, in nanoseconds. */
+    atomic_uint_fast64_t total_ns;
+    /** Slowest call, in nanoseconds. */
+    atomic_uint_fast64_t max_ns;
+    /** Calls slower than `slow_op_threshold_ns`. */
+    atomic_uint_fast64_t slow;
+} op_totals[DB_OP_COUNT];
+
+/** An operation being profiled. Finished automatically at scope exit, see `db_profile`. */
+struct db_profile {
+    /** Connection used in the operation. */
+    const db_conn_t *NONNULL conn;
+    /** Start timestamp, or zero when not profiling. */
+    uint64_t start_ns;
+    /** The public operation. */
+    enum db_op op;
+};
+
+[[gnu::hot, gnu::nonnull(1)]]
+/** Starts profiling `op`, if enabled. */
+static inline struct db_profile db_profile_start(const db_conn_t *NONNULL conn, enum db_op op) {
+    if likely (!profiling_enabled) {
+        return (struct db_profile) {.conn = conn, .start_ns = 0, .op = op};
+    }
+    return (struct db_profile) {.conn = conn, .start_ns = clock_now_ns(), .op = op};
+}
+
+[[gnu::nonnull(1)]]
+/** Atomically raises `target` to at least `value`. */
+static void atomic_max(atomic_uint_fast64_t *NONNULL target, uint_fast64_t value) {
+    uint_fast64_t current = atomic_load_explicit(target, memory_order_relaxed);
+    while (current < value) {
+        if (atomic_compare_exchange_weak_explicit(target, &current, value, memory_order_relaxed, memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+[[gnu::cold, gnu::nonnull(1, 2)]]
+/** Logs a slow operation and the statement counters it caused. */
+static void db_profile_log_slow(
+    const struct db_profile *NONNULL profile,
+    const uint64_t counters[NONNULL DB_STMT_COUNT][STMT_COUNTERS],
+    uint64_t elapsed_ns
+) {
+    flockfile(stderr);
+    (void) fprintf(stderr, "db: slow operation %s took %" PRIu64 " ns\n", DB_OP_NAME[profile->op], elapsed_ns);
+    for (size_t i = 0; i < DB_STMT_COUNT; i++) {
+        if (counters[i][STMT_VM_STEPS] == 0) {
+            continue;
+        }
+        (void) fprintf(stderr, "db:   %s:", DB_STMTS[i].name);
+        for (size_t j = 0; j < STMT_COUNTERS; j++) {
+            (void) fprintf(stderr, " %s=%" PRIu64, DB_STMT_COUNTER_NAME[j], counters[i][j]);
+        }
+        (void) fputc('\n', stderr);
+    }
+    funlockfile(stderr);
+}
+
+[[gnu::hot, gnu::nonnull(1)]]
+/**
+ * Finishes profiling: reads and resets the statement counters, updates the aggregates and logs slow operations.
+ *
+ * Used as a `gnu::cleanup` handler, so it runs on every return path of the profiled function.
+ */
+static void db_profile_finish(const struct db_profile *NONNULL profile) {
+    if likely (profile->start_ns == 0) {
+        return;
+    }
+
+    const uint64_t elapsed_ns = clock_now_ns() - profile->start_ns;
+    struct db_op_totals *totals = &(op_totals[profile->op]);
+    atomic_fetch_add_explicit(&(totals->calls), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(totals->total_ns), elapsed_ns, memory_order_relaxed);
+    atomic_max(&(totals->max_ns), elapsed_ns);
+
+    uint64_t counters[DB_STMT_COUNT][STMT_COUNTERS];
+    const char *base = (const char *) profile->conn;
+    for (size_t i = 0; i < DB_STMT_COUNT; i++) {
+        sqlite3_stmt *stmt = *(sqlite3_stmt *const *) (base + DB_STMTS[i].offset);
+        for (size_t j = 0; j < STMT_COUNTERS; j++) {
+            const int value = sqlite3_stmt_status(stmt, DB_STMT_STATUS[j], true);
+            counters[i][j] = likely(value > 0) ? (uint64_t) value : 0;
+            if (counters[i][j] > 0) {
+                atomic_fetch_add_explicit(&(stmt_totals[i][j]), counters[i][j], memory_order_relaxed);
+            }
+        }
+    }
+
+    if unlikely (elapsed_ns >= slow_op_threshold_ns) {
+        atomic_fetch_add_explicit(&(totals->slow), 1, memory_order_relaxed);
+        db_profile_log_slow(profile, counters, elapsed_ns);
+    }
+}
+
+/** Profiles the current function as `op`, finishing automatically when the scope ends. */
+#define db_profile(conn, op) [[gnu::cleanup(db_profile_finish)]] const struct db_profile profile_ = db_profile_start(conn, op)
+
+/** Writes profiling aggregates as YAML. */
+void db_stats_report(FILE *NONNULL output) {
+    static constexpr const uint64_t NS_PER_US = 1'000;
+
+    (void) fprintf(output, "  database:\n    profiling: %s\n", profiling_enabled ? "true" : "false");
+    if likely (!profiling_enabled) {
+        return;
+    }
+
+    (void) fprintf(output, "    operations:\n");
+    for (size_t i = 0; i < DB_OP_COUNT; i++) {
+        const uint64_t calls = atomic_load_explicit(&(op_totals[i].calls), memory_order_relaxed);
+        const uint64_t total_ns = atomic_load_explicit(&(op_totals[i].total_ns), memory_order_relaxed);
+        (void) fprintf(
+            output,
+            "      - { name: %s, calls: %" PRIu64 ", total_us: %" PRIu64 ", mean_us: %" PRIu64 ", max_us: %" PRIu64
+            ", slow: %" PRIu64 " }\n",
+            DB_OP_NAME[i],
+            calls,
+            total_ns / NS_PER_US,
+            calls > 0 ? total_ns / calls / NS_PER_US : 0,
+            atomic_load_explicit(&(op_totals[i].max_ns), memory_order_relaxed) / NS_PER_US,
+            atomic_load_explicit(&(op_totals[i].slow), memory_order_relaxed)
+        );
+    }
+
+    (void) fprintf(output, "    statements:\n");
+    for (size_t i = 0; i < DB_STMT_COUNT; i++) {
+        (void) fprintf(output, "      - { name: %s", DB_STMTS[i].name);
+        for (size_t j = 0; j < STMT_COUNTERS; j++) {
+            const uint64_t value = atomic_load_explicit(&(stmt_totals[i][j]), memory_order_relaxed);
+            (void) fprintf(output, ", %s: %" PRIu64, DB_STMT_COUNTER_NAME[j], value);
+        }
+        (void) fprintf(output, " }\n");
+    }
+}
 
 [[gnu::malloc, gnu::nonnull(1, 3, 4)]]
 /** Build a SQLite statement for persistent use. Returns NULL on failure. */
@@ -256,7 +774,7 @@ static sqlite3_stmt *NULLABLE db_prepare(
     size_t len,
     const char sql[NONNULL restrict len],
     bool *NONNULL has_error,  // shared error flag, for creating multiple statements in series
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 ) {
     assume(len < INT_MAX);
     assume(len == strlen(sql));
@@ -272,7 +790,7 @@ static sqlite3_stmt *NULLABLE db_prepare(
     const int rv = sqlite3_prepare_v3(db, sql, ((int) len) + 1, FLAGS, &stmt, &tail);
     if unlikely (rv != SQLITE_OK) {
         *has_error = true;
-        errmsg_dup_db(errmsg, db);
+        error_set_db(error, db);
         assume(stmt == NULL);
         return NULL;
     }
@@ -281,18 +799,101 @@ static sqlite3_stmt *NULLABLE db_prepare(
     return stmt;
 }
 
+[[gnu::cold, gnu::nonnull(1)]]
+/** Switches every connection to single-row genre links, logging it once. */
+static void disable_multi_row_links(const char reason[NONNULL]) {
+    if (atomic_exchange(&multi_row_links_enabled, false)) {
+        (void) fprintf(stderr, "db: inserting genre links one row at a time, %s\n", reason);
+    }
+}
+
+[[gnu::malloc, gnu::nonnull(1, 3)]]
+/**
+ * Prepares the `op_insert_genre_links` variant with `rows` links for the same movie: `(?1, ?2), (?1, ?3), ...`. If a
+ * multi-row variant cannot be prepared, the single-row statement takes its place and the variants are disabled.
+ */
+static sqlite3_stmt *NULLABLE
+    db_prepare_links(sqlite3 *NONNULL db, size_t rows, bool *NONNULL has_error, db_error_t *NULLABLE restrict error) {
+    assume(rows > 0 && rows <= GENRE_LINK_MAX_ROWS);
+    static constexpr const char HEAD[] = "INSERT INTO movie_genre(movie_id, genre_id) VALUES ";
+    if unlikely (*has_error) {
+        return NULL;
+    }
+
+    char sql[sizeof(HEAD) + GENRE_LINK_MAX_ROWS * sizeof(", (?1, ?99)")];
+    size_t len = strlen(HEAD);
+    memcpy(sql, HEAD, len);
+    for (size_t i = 0; i < rows; i++) {
+        len += (size_t) snprintf(&(sql[len]), sizeof(sql) - len, "%s(?1, ?%zu)", i > 0 ? ", " : "", i + 2);
+    }
+    sql[len++] = ';';
+    sql[len] = '\0';
+
+    if (rows == 1) {
+        return db_prepare(db, len, sql, has_error, error);
+    }
+    bool failed = false;
+    sqlite3_stmt *stmt = db_prepare(db, len, sql, &failed, NULL);
+    if unlikely (failed) {
+        disable_multi_row_links("multi-row VALUES is not supported");
+        return db_prepare_links(db, 1, has_error, error);
+    }
+    return stmt;
+}
+
+[[gnu::malloc, gnu::nonnull(1, 3)]]
+/**
+ * Prepares the `op_select_movies_page` variant sorted by `order`, with the id as tiebreaker, so the window can be read
+ * straight from the index for that column.
+ */
+static sqlite3_stmt *NULLABLE db_prepare_page(
+    sqlite3 *NONNULL db,
+    size_t variant,
+    bool *NONNULL has_error,
+    db_error_t *NULLABLE restrict error
+) {
+    assume(variant < DB_PAGE_VARIANTS);
+    static const char *const COLUMNS[DB_ORDER_COLUMNS] = {
+        [DB_ORDER_ID] = NULL,
+        [DB_ORDER_TITLE] = "title",
+        [DB_ORDER_RELEASE_YEAR] = "release_year",
+    };
+    const char *column = COLUMNS[variant / 2];
+    const char *direction = (variant % 2 != 0) ? "DESC" : "ASC";
+
+    char key[sizeof("release_year DESC, ")] = "";
+    if (column != NULL) {
+        (void) snprintf(key, sizeof(key), "%s %s, ", column, direction);
+    }
+
+    char sql[256];
+    const int len = snprintf(
+        sql,
+        sizeof(sql),
+        "SELECT id, title, director, release_year, genres FROM movie ORDER BY %sid %s LIMIT :limit OFFSET :offset;",
+        key,
+        direction
+    );
+    assume(len > 0 && (size_t) len < sizeof(sql));
+
+    return db_prepare(db, (size_t) len, sql, has_error, error);
+}
+
 [[gnu::nonnull(1)]]
 /** Create all used statements beforehand, for faster reuse later. */
-static bool db_prepare_stmts(db_conn_t *NONNULL conn, message_t *NULLABLE errmsg) {
+static bool db_prepare_stmts(db_conn_t *NONNULL conn, db_error_t *NULLABLE error) {
     sqlite3 *NONNULL db = conn->db;
     bool has_error = false;
 
 /** Basic SQL macro: converts arguments into text and passes that to `db_prepare`. */
 #define SQL(...)   SQL_(STR(__VA_ARGS__))
-#define SQL_(stmt) db_prepare(db, strlen(stmt), stmt, &has_error, errmsg)
+#define SQL_(stmt) db_prepare(db, strlen(stmt), stmt, &has_error, error)
     sqlite3_stmt *begin = SQL(
         BEGIN DEFERRED TRANSACTION;
     );
+    sqlite3_stmt *begin_write = SQL(
+        BEGIN IMMEDIATE TRANSACTION;
+    );
     sqlite3_stmt *commit = SQL(
         COMMIT TRANSACTION;
     );
@@ -302,53 +903,129 @@ static bool db_prepare_stmts(db_conn_t *NONNULL conn, message_t *NULLABLE errmsg
     sqlite3_stmt *reindex = SQL(
         REINDEX;
     );
+    sqlite3_stmt *reserve_ids = SQL(
+        UPDATE id_block
+            SET next = next + :count
+            WHERE name = :table
+            RETURNING next - :count;
+    );
     sqlite3_stmt *insert_movie = SQL(
-        INSERT INTO movie(title, director, release_year)
-            VALUES (:title, :director, :release_year)
-            RETURNING movie.id;
+        INSERT INTO movie(id, title, director, release_year, genres)
+            VALUES (:id, :title, :director, :release_year, :genres);
     );
     sqlite3_stmt *insert_genre = SQL(
-        INSERT OR IGNORE INTO genre(name)
-            VALUES (:genre);
+        INSERT INTO genre(id, name)
+            VALUES (:id, :genre);
+    );
+    sqlite3_stmt *select_genre_id = SQL(
+        SELECT id
+            FROM genre
+            WHERE name = :genre;
     );
-    sqlite3_stmt *insert_genre_link =
+    sqlite3_stmt *insert_genre_links[GENRE_LINK_VARIANTS];
+    for (size_t i = 0; i < GENRE_LINK_VARIANTS; i++) {
+        insert_genre_links[i] = db_prepare_links(db, (size_t) 1 << i, &has_error, error);
+    }
+    sqlite3_stmt *append_movie_genre =
         SQL(
+        UPDATE movie
+            SET genres = CASE genres WHEN '' THEN :genre ELSE genres || char(31) || :genre END
+            WHERE id = :movie
+            RETURNING genres;
+    );
+    sqlite3_stmt *merge_movie_genre = SQL(
         INSERT INTO movie_genre(movie_id, genre_id)
-            SELECT :movie, genre.id
-                FROM genre
-                WHERE genre.name = :genre;
+            VALUES (:movie, :genre)
+            ON CONFLICT DO NOTHING
+            RETURNING genre_id;
+    );
+    sqlite3_stmt *select_movie_by_key = SQL(
+        SELECT id
+            FROM movie
+            WHERE title = :title AND director = :director AND release_year = :release_year
+            ORDER BY id
+            LIMIT 1;
     );
     sqlite3_stmt *delete_movie = SQL(
         DELETE FROM movie
-            WHERE id = :movie;
+            WHERE id = :movie
+            RETURNING genres;
     );
     sqlite3_stmt *delete_unused_genres = SQL(
         DELETE FROM genre
             WHERE id NOT IN (
                 SELECT DISTINCT genre_id
                     FROM movie_genre
-            );
+            )
+            RETURNING genre.name;
+    );
+    sqlite3_stmt *record_change = SQL(
+        INSERT INTO movie_change(movie_id, created, modified, deleted)
+            VALUES (:movie, :generation, :generation, :deleted)
+            ON CONFLICT (movie_id) DO UPDATE
+                SET modified = excluded.modified, deleted = excluded.deleted;
+    );
+    sqlite3_stmt *select_changes = SQL(
+        SELECT movie_id, created > :since, deleted, modified
+            FROM movie_change
+            WHERE (modified, movie_id) > (:after_generation, :after_id)
+            ORDER BY modified, movie_id;
+    );
+    sqlite3_stmt *select_changed_movies =
+        SQL(
+        SELECT movie.id, movie.title, movie.director, movie.release_year, movie.genres
+            FROM movie_change
+                INNER JOIN movie ON movie.id = movie_change.movie_id
+            WHERE (movie_change.modified, movie_change.movie_id) > (:after_generation, :after_id)
+            ORDER BY movie_change.modified, movie_change.movie_id;
     );
     sqlite3_stmt *select_all_titles = SQL(
         SELECT id, title
-            FROM movie;
+            FROM movie
+            ORDER BY id
+            LIMIT :limit OFFSET :offset;
     );
     sqlite3_stmt *select_all_movies = SQL(
+        SELECT id, title, director, release_year, genres
+            FROM movie;
+    );
+    sqlite3_stmt *select_all_movies_brief = SQL(
         SELECT id, title, director, release_year
             FROM movie;
     );
+    sqlite3_stmt *select_movies_page[DB_PAGE_VARIANTS];
+    for (size_t i = 0; i < DB_PAGE_VARIANTS; i++) {
+        select_movies_page[i] = db_prepare_page(db, i, &has_error, error);
+    }
     sqlite3_stmt *select_movie = SQL(
+        SELECT id, title, director, release_year, genres
+            FROM movie
+            WHERE id = :movie;
+    );
+    sqlite3_stmt *select_movie_brief = SQL(
         SELECT id, title, director, release_year
             FROM movie
             WHERE id = :movie;
     );
     sqlite3_stmt *select_movies_genre =
+        SQL(
+        SELECT movie.id, movie.title, movie.director, movie.release_year, movie.genres
+            FROM movie_genre
+                INNER JOIN movie ON movie.id = movie_genre.movie_id
+                INNER JOIN genre ON genre.id = movie_genre.genre_id
+            WHERE genre.name = :genre
+            ORDER BY movie_genre.movie_id
+            LIMIT :limit OFFSET :offset;
+    );
+    sqlite3_stmt *select_movies_genre_brief =
         SQL(
         SELECT movie.id, movie.title, movie.director, movie.release_year
             FROM movie_genre
                 INNER JOIN movie ON movie.id = movie_genre.movie_id
                 INNER JOIN genre ON genre.id = movie_genre.genre_id
-            WHERE genre.name = :genre;
+            WHERE genre.name = :genre
+            ORDER BY movie_genre.movie_id
+            LIMIT :limit OFFSET :offset;
     );
     sqlite3_stmt *select_movie_genres =
         SQL(
@@ -363,19 +1040,36 @@ static bool db_prepare_stmts(db_conn_t *NONNULL conn, message_t *NULLABLE errmsg
     if unlikely (has_error) {
         // safe to call with NULL
         sqlite3_finalize(begin);
+        sqlite3_finalize(begin_write);
         sqlite3_finalize(commit);
         sqlite3_finalize(rollback);
         sqlite3_finalize(reindex);
+        sqlite3_finalize(reserve_ids);
         sqlite3_finalize(insert_movie);
         sqlite3_finalize(insert_genre);
-        sqlite3_finalize(insert_genre_link);
+        sqlite3_finalize(select_genre_id);
+        for (size_t i = 0; i < GENRE_LINK_VARIANTS; i++) {
+            sqlite3_finalize(insert_genre_links[i]);
+        }
+        sqlite3_finalize(append_movie_genre);
+        sqlite3_finalize(merge_movie_genre);
+        sqlite3_finalize(select_movie_by_key);
         sqlite3_finalize(delete_movie);
         sqlite3_finalize(delete_unused_genres);
+        sqlite3_finalize(record_change);
+        sqlite3_finalize(select_changes);
+        sqlite3_finalize(select_changed_movies);
         sqlite3_finalize(select_all_titles);
         sqlite3_finalize(select_all_movies);
+        sqlite3_finalize(select_all_movies_brief);
+        for (size_t i = 0; i < DB_PAGE_VARIANTS; i++) {
+            sqlite3_finalize(select_movies_page[i]);
+        }
         sqlite3_finalize(select_movie);
+        sqlite3_finalize(select_movie_brief);
         sqlite3_finalize(select_movie_genres);
         sqlite3_finalize(select_movies_genre);
+        sqlite3_finalize(select_movies_genre_brief);
         return false;
     }
 
@@ -384,59 +1078,92 @@ static bool db_prepare_stmts(db_conn_t *NONNULL conn, message_t *NULLABLE errmsg
     conn->op_##name = (name)
 
     set_stmt(begin);
+    set_stmt(begin_write);
     set_stmt(commit);
     set_stmt(rollback);
     set_stmt(reindex);
+    set_stmt(reserve_ids);
     set_stmt(insert_movie);
     set_stmt(insert_genre);
-    set_stmt(insert_genre_link);
+    set_stmt(select_genre_id);
+    for (size_t i = 0; i < GENRE_LINK_VARIANTS; i++) {
+        set_stmt(insert_genre_links[i]);
+    }
+    set_stmt(append_movie_genre);
+    set_stmt(merge_movie_genre);
+    set_stmt(select_movie_by_key);
     set_stmt(delete_movie);
     set_stmt(delete_unused_genres);
+    set_stmt(record_change);
+    set_stmt(select_changes);
+    set_stmt(select_changed_movies);
     set_stmt(select_all_titles);
     set_stmt(select_all_movies);
+    set_stmt(select_all_movies_brief);
+    for (size_t i = 0; i < DB_PAGE_VARIANTS; i++) {
+        set_stmt(select_movies_page[i]);
+    }
     set_stmt(select_movie);
+    set_stmt(select_movie_brief);
     set_stmt(select_movie_genres);
     set_stmt(select_movies_genre);
+    set_stmt(select_movies_genre_brief);
 #undef set_stmt
 
     return true;
 }
 
 /** Connects to the existing database at `filepath`. */
-db_conn_t *NULLABLE db_connect(const char filepath[NONNULL restrict], message_t *NULLABLE restrict errmsg) {
+db_conn_t *NULLABLE db_connect(const char filepath[NONNULL restrict], db_error_t *NULLABLE restrict error) {
     db_conn_t *conn = alloc_like(struct database_connection);
     if unlikely (conn == NULL) {
-        errmsg_dup_str(errmsg, OUT_OF_MEMORY_ERROR);
+        error_set_code(error, DB_ERROR_OUT_OF_MEMORY);
         return NULL;
     }
 
     movie_builder_t *builder = movie_builder_create();
     if unlikely (builder == NULL) {
-        errmsg_dup_str(errmsg, OUT_OF_MEMORY_ERROR);
+        error_set_code(error, DB_ERROR_OUT_OF_MEMORY);
+        free(conn);
+        return NULL;
+    }
+
+    genre_cache_txn_t *genres = genre_cache_txn_create();
+    if unlikely (genres == NULL) {
+        error_set_code(error, DB_ERROR_OUT_OF_MEMORY);
+        movie_builder_destroy(builder);
         free(conn);
         return NULL;
     }
 
-    sqlite3 *db = db_open(filepath, errmsg, false);
+    sqlite3 *db = db_open(filepath, error, false);
     if unlikely (db == NULL) {
-        // `db_open` already sets `errmsg`
+        // `db_open` already sets `error`
+        genre_cache_txn_destroy(genres);
         movie_builder_destroy(builder);
         free(conn);
         return NULL;
     }
 
+    // connections only contend for the write lock, which is released on commit
+    sqlite3_busy_timeout(db, busy_timeout_ms);
+
     conn->db = db;
     conn->builder = builder;
-    const bool ok = db_prepare_stmts(conn, errmsg);
+    conn->genres = genres;
+    conn->snapshot_generation = 0;
+    const bool ok = db_prepare_stmts(conn, error);
     if unlikely (!ok) {
         db_close(db, NULL);
+        genre_cache_txn_destroy(genres);
         movie_builder_destroy(builder);
         free(conn);
         return NULL;
     }
 
     // last verification that all pointers are non null
-    for (size_t i = 0; i < sizeof(db_conn_t) / sizeof(void *); i++) {
+    assume(conn->db != NULL && conn->builder != NULL && conn->genres != NULL);
+    for (size_t i = offsetof(db_conn_t, op_begin) / sizeof(void *); i < DB_CONN_USED / sizeof(void *); i++) {
         const void *const *start = (const void *const *) conn;
         assume(start[i] != NULL);
     }
@@ -445,37 +1172,55 @@ db_conn_t *NULLABLE db_connect(const char filepath[NONNULL restrict], message_t
 
 [[gnu::nonnull(1, 2, 3)]]
 /** Closes a prepared statement. Used during disconnect. */
-static void db_finalize(sqlite3 *NONNULL db, sqlite3_stmt *NONNULL stmt, bool *NONNULL ok, message_t *NULLABLE errmsg) {
+static void db_finalize(sqlite3 *NONNULL db, sqlite3_stmt *NONNULL stmt, bool *NONNULL ok, db_error_t *NULLABLE error) {
     int rv = sqlite3_finalize(stmt);
     if unlikely (rv != SQLITE_OK) {
-        // set errmsg on the first error only
+        // set error on the first error only
         if (*ok) {
-            errmsg_dup_db(errmsg, db);
+            error_set_db(error, db);
         }
         *ok = false;
     }
 }
 
 /** Disconnects to the database and free resources. */
-bool db_disconnect(db_conn_t *NONNULL conn, message_t *NULLABLE errmsg) {
+bool db_disconnect(db_conn_t *NONNULL conn, db_error_t *NULLABLE error) {
     bool ok = true;
     sqlite3 *db = conn->db;
-    db_finalize(db, conn->op_begin, &ok, errmsg);
-    db_finalize(db, conn->op_commit, &ok, errmsg);
-    db_finalize(db, conn->op_rollback, &ok, errmsg);
-    db_finalize(db, conn->op_reindex, &ok, errmsg);
-    db_finalize(db, conn->op_insert_movie, &ok, errmsg);
-    db_finalize(db, conn->op_insert_genre, &ok, errmsg);
-    db_finalize(db, conn->op_insert_genre_link, &ok, errmsg);
-    db_finalize(db, conn->op_delete_movie, &ok, errmsg);
-    db_finalize(db, conn->op_delete_unused_genres, &ok, errmsg);
-    db_finalize(db, conn->op_select_all_titles, &ok, errmsg);
-    db_finalize(db, conn->op_select_all_movies, &ok, errmsg);
-    db_finalize(db, conn->op_select_movie, &ok, errmsg);
-    db_finalize(db, conn->op_select_movie_genres, &ok, errmsg);
-    db_finalize(db, conn->op_select_movies_genre, &ok, errmsg);
-    ok = db_close(db, ok ? errmsg : NULL) && ok;
+    db_finalize(db, conn->op_begin, &ok, error);
+    db_finalize(db, conn->op_begin_write, &ok, error);
+    db_finalize(db, conn->op_commit, &ok, error);
+    db_finalize(db, conn->op_rollback, &ok, error);
+    db_finalize(db, conn->op_reindex, &ok, error);
+    db_finalize(db, conn->op_reserve_ids, &ok, error);
+    db_finalize(db, conn->op_insert_movie, &ok, error);
+    db_finalize(db, conn->op_insert_genre, &ok, error);
+    db_finalize(db, conn->op_select_genre_id, &ok, error);
+    for (size_t i = 0; i < GENRE_LINK_VARIANTS; i++) {
+        db_finalize(db, conn->op_insert_genre_links[i], &ok, error);
+    }
+    db_finalize(db, conn->op_append_movie_genre, &ok, error);
+    db_finalize(db, conn->op_merge_movie_genre, &ok, error);
+    db_finalize(db, conn->op_select_movie_by_key, &ok, error);
+    db_finalize(db, conn->op_delete_movie, &ok, error);
+    db_finalize(db, conn->op_delete_unused_genres, &ok, error);
+    db_finalize(db, conn->op_record_change, &ok, error);
+    db_finalize(db, conn->op_select_changes, &ok, error);
+    db_finalize(db, conn->op_select_changed_movies, &ok, error);
+    db_finalize(db, conn->op_select_all_titles, &ok, error);
+    db_finalize(db, conn->op_select_all_movies, &ok, error);
+    db_finalize(db, conn->op_select_all_movies_brief, &ok, error);
+    for (size_t i = 0; i < DB_PAGE_VARIANTS; i++) {
+        db_finalize(db, conn->op_select_movies_page[i], &ok, error);
+    }
+    db_finalize(db, conn->op_select_movie, &ok, error);
+    db_finalize(db, conn->op_select_movie_brief, &ok, error);
+    db_finalize(db, conn->op_select_movie_genres, &ok, error);
+    db_finalize(db, conn->op_select_movies_genre, &ok, error);
+    db_finalize(db, conn->op_select_movies_genre_brief, &ok, error);
+    ok = db_close(db, ok ? error : NULL) && ok;
     movie_builder_destroy(conn->builder);
+    genre_cache_txn_destroy(conn->genres);
 
     memset(conn, 0, sizeof(struct database_connection));
     free(conn);
@@ -628,34 +1373,177 @@ static db_result_t check_results(size_t n, const int rv[NONNULL const n], const
     return DB_SUCCESS;
 }
 
-[[gnu::nonnull(1, 2), gnu::hot]]
-/** Runs a single transaction statement and reset it. */
-static db_result_t db_transaction_op(db_conn_t *NONNULL conn, sqlite3_stmt *NONNULL stmt, message_t *NULLABLE errmsg) {
-    int rv = sqlite3_step(stmt);
-    int rrv = sqlite3_reset(stmt);
-    if unlikely (rv != SQLITE_DONE || rrv != SQLITE_OK) {
-        errmsg_dup_db(errmsg, conn->db);
-        return check_result(rv, rrv);
-    }
-    return DB_SUCCESS;
-}
+/** Tables with ids reserved from `id_block`. */
+enum [[gnu::packed]] db_id_table {
+    ID_MOVIE,
+    ID_GENRE,
+    /** Number of tables. */
+    ID_TABLES,
+};
 
-[[gnu::nonnull(1), gnu::hot]]
-/** Runs `BEGIN TRANSACTION`. */
-static db_result_t db_transaction_begin(db_conn_t *NONNULL conn, message_t *NULLABLE errmsg) {
-    return db_transaction_op(conn, conn->op_begin, errmsg);
-}
+/** Row name in `id_block` for each `db_id_table`. */
+static const char *const ID_TABLE_NAME[ID_TABLES] = {
+    [ID_MOVIE] = "movie",
+    [ID_GENRE] = "genre",
+};
 
-[[gnu::nonnull(1), gnu::hot]]
+/**
+ * Ids reserved in memory for a single table, shared by all connections.
+ *
+ * A new block is only durable after the transaction that reserved it commits. Until then it is owned by that
+ * connection, and dropped if the transaction rolls back, so its ids are never handed out twice after a restart.
+ */
+static struct id_block {
+    /** Protects `next` and `end`. */
+    pthread_mutex_t lock;
+    /** Next id to hand out. */
+    int64_t next;
+    /** One past the last reserved id. */
+    int64_t end;
+    /** Connection whose open transaction reserved this block, or `NULL` if already committed. */
+    _Atomic(const sqlite3 *) owner;
+} id_blocks[ID_TABLES] = {
+    [ID_MOVIE] = {.lock = PTHREAD_MUTEX_INITIALIZER, .next = 0, .end = 0, .owner = NULL},
+    [ID_GENRE] = {.lock = PTHREAD_MUTEX_INITIALIZER, .next = 0, .end = 0, .owner = NULL},
+};
+
+[[gnu::nonnull(1), gnu::hot]]
+/** Releases the id blocks reserved by the transaction of `db`, keeping them only if it committed. */
+static void id_blocks_settle(const sqlite3 *NONNULL db, bool committed) {
+    for (size_t i = 0; i < ID_TABLES; i++) {
+        struct id_block *block = &(id_blocks[i]);
+        // only this connection ever stores its own `db` here, so the unlocked check is enough to skip other blocks
+        if likely (atomic_load_explicit(&(block->owner), memory_order_relaxed) != db) {
+            continue;
+        }
+
+        pthread_mutex_lock(&(block->lock));
+        if unlikely (!committed) {
+            block->next = 0;
+            block->end = 0;
+        }
+        atomic_store_explicit(&(block->owner), NULL, memory_order_relaxed);
+        pthread_mutex_unlock(&(block->lock));
+    }
+}
+
+[[gnu::nonnull(1, 2), gnu::hot]]
+/** Runs a single transaction statement and reset it. */
+static db_result_t db_transaction_op(db_conn_t *NONNULL conn, sqlite3_stmt *NONNULL stmt, db_error_t *NULLABLE error) {
+    int rv = sqlite3_step(stmt);
+    int rrv = sqlite3_reset(stmt);
+    if unlikely (rv != SQLITE_DONE || rrv != SQLITE_OK) {
+        error_set_db(error, conn->db);
+        return check_result(rv, rrv);
+    }
+    return DB_SUCCESS;
+}
+
+[[gnu::nonnull(1), gnu::hot]]
+/** Runs `BEGIN TRANSACTION`. */
+static db_result_t db_transaction_begin(db_conn_t *NONNULL conn, db_error_t *NULLABLE error) {
+    return db_transaction_op(conn, conn->op_begin, error);
+}
+
+[[gnu::nonnull(1), gnu::hot]]
+/** Runs `BEGIN IMMEDIATE TRANSACTION`, and starts tracking genre ids for the cache. */
+static db_result_t db_transaction_begin_write(db_conn_t *NONNULL conn, db_error_t *NULLABLE error) {
+    db_result_t res = db_end_snapshot(conn, error);
+    if unlikely (res != DB_SUCCESS) {
+        return res;
+    }
+
+    res = db_transaction_op(conn, conn->op_begin_write, error);
+    if likely (res == DB_SUCCESS) {
+        genre_cache_txn_begin(conn->genres);
+    }
+    return res;
+}
+
+[[gnu::nonnull(1), gnu::hot]]
 /** Runs `ROLLBACK TRANSACTION`. */
-static db_result_t db_transaction_rollback(db_conn_t *NONNULL conn, message_t *NULLABLE errmsg) {
-    return db_transaction_op(conn, conn->op_rollback, errmsg);
+static db_result_t db_transaction_rollback(db_conn_t *NONNULL conn, db_error_t *NULLABLE error) {
+    // ids created by this transaction may be reused later
+    genre_cache_txn_rollback(conn->genres);
+    id_blocks_settle(conn->db, false);
+    return db_transaction_op(conn, conn->op_rollback, error);
 }
 
 [[gnu::nonnull(1), gnu::hot]]
 /** Runs `COMMIT TRANSACTION`. */
-static db_result_t db_transaction_commit(db_conn_t *NONNULL conn, message_t *NULLABLE errmsg) {
-    return db_transaction_op(conn, conn->op_commit, errmsg);
+static db_result_t db_transaction_commit(db_conn_t *NONNULL conn, db_error_t *NULLABLE error) {
+    const db_result_t res = db_transaction_op(conn, conn->op_commit, error);
+    if likely (res == DB_SUCCESS) {
+        genre_cache_txn_commit(conn->genres);
+    } else {
+        genre_cache_txn_rollback(conn->genres);
+    }
+    id_blocks_settle(conn->db, res == DB_SUCCESS);
+    return res;
+}
+
+[[gnu::hot]]
+/**
+ * Publishes the generation of a committed write. Must run after the commit, so readers never get ahead of it. Writers
+ * may publish out of order, but generations are reserved under the write lock, so all older ones are committed too.
+ */
+static void catalog_changed(uint64_t generation) {
+    uint_fast64_t current = atomic_load_explicit(&catalog_generation, memory_order_relaxed);
+    while (current < generation) {
+        if (atomic_compare_exchange_weak_explicit(
+                &catalog_generation,
+                &current,
+                generation,
+                memory_order_release,
+                memory_order_relaxed
+            )) {
+            return;
+        }
+    }
+}
+
+/** Generation of the catalog seen by the next read on this connection. */
+uint64_t db_generation(const db_conn_t *NONNULL conn) {
+    if (sqlite3_get_autocommit(conn->db) == 0) {
+        return conn->snapshot_generation;
+    }
+    return atomic_load_explicit(&catalog_generation, memory_order_acquire);
+}
+
+/** If a read snapshot is open on this connection. */
+bool db_has_snapshot(const db_conn_t *NONNULL conn) {
+    return sqlite3_get_autocommit(conn->db) == 0;
+}
+
+/** Closes the read snapshot left open by previous reads, if any. */
+db_result_t db_end_snapshot(db_conn_t *NONNULL conn, db_error_t *NULLABLE restrict error) {
+    if likely (sqlite3_get_autocommit(conn->db) != 0) {
+        return DB_SUCCESS;
+    }
+    return db_transaction_commit(conn, error);
+}
+
+[[gnu::nonnull(1), gnu::hot]]
+/**
+ * Prepares a read. Reads of a single statement run in its implicit transaction, while longer ones open a snapshot with
+ * `BEGIN`, or reuse the one left open by a previous read on this connection. Snapshots are only closed by
+ * `db_end_snapshot`, a write, or an error.
+ */
+static db_result_t db_read_begin(db_conn_t *NONNULL conn, bool single_statement, db_error_t *NULLABLE error) {
+    if (single_statement || sqlite3_get_autocommit(conn->db) == 0) {
+        return DB_SUCCESS;
+    }
+    // loaded before the snapshot exists, so the snapshot is at least as new as this generation
+    conn->snapshot_generation = atomic_load_explicit(&catalog_generation, memory_order_acquire);
+    return db_transaction_begin(conn, error);
+}
+
+[[gnu::nonnull(1)]]
+/** Drops the read snapshot after a failed read, if there is one. */
+static void db_read_abort(db_conn_t *NONNULL conn, db_error_t *NULLABLE error) {
+    if (sqlite3_get_autocommit(conn->db) == 0) {
+        db_transaction_rollback(conn, error);
+    }
 }
 
 [[gnu::nonnull(1), gnu::hot]]
@@ -675,126 +1563,481 @@ static db_result_t db_eval_stmt(sqlite3_stmt *NONNULL stmt) {
     return DB_SUCCESS;
 }
 
-[[gnu::nonnull(2)]]
-/** Runs `op_insert_movie` inside an open transaction. */
-static db_result_t register_movie_in_transaction(const db_conn_t conn, struct movie *NONNULL movie) {
-    const size_t genres = movie->genre_count;
-
-    // add all movie genres to db
-    for (size_t i = 0; i < genres; i++) {
-        int rv = sqlite3_bind_text(conn.op_insert_genre, 1, movie->genres[i], -1, SQLITE_STATIC);
-        if unlikely (rv != SQLITE_OK) {
-            sqlite3_clear_bindings(conn.op_insert_genre);
-            return check_result(rv, sqlite3_reset(conn.op_insert_genre));
-        }
+[[gnu::nonnull(1, 2, 3), gnu::hot]]
+/** Step through a statement that returns at most one id. `found` is set if any row was returned. */
+static db_result_t db_eval_id(sqlite3_stmt *NONNULL stmt, int64_t *NONNULL id, bool *NONNULL found) {
+    *found = false;
+    int rv;
+    while ((rv = sqlite3_step(stmt)) == SQLITE_ROW) {
+        *id = sqlite3_column_int64(stmt, 0);
+        *found = true;
+    }
 
-        db_result_t res = db_eval_stmt(conn.op_insert_genre);
-        if unlikely (res != DB_SUCCESS) {
-            return res;
-        }
+    sqlite3_clear_bindings(stmt);
+    int rrv = sqlite3_reset(stmt);
+    if unlikely (rv != SQLITE_DONE || rrv != SQLITE_OK) {
+        return check_result(rv, rrv);
     }
+    return DB_SUCCESS;
+}
 
-    // add movie itself to db
-    const int rvv[3] = {
-        sqlite3_bind_text(conn.op_insert_movie, 1, movie->title, -1, SQLITE_STATIC),
-        sqlite3_bind_text(conn.op_insert_movie, 2, movie->director, -1, SQLITE_STATIC),
-        sqlite3_bind_int(conn.op_insert_movie, 3, movie->release_year),
+[[gnu::nonnull(3), gnu::hot]]
+/** Hands out the next id for `table` inside an open write transaction, reserving a new block when needed. */
+static db_result_t next_id_in_transaction(const db_conn_t conn, enum db_id_table table, int64_t *NONNULL id) {
+    struct id_block *block = &(id_blocks[table]);
+    pthread_mutex_lock(&(block->lock));
+    if likely (block->next < block->end) {
+        *id = block->next++;
+        pthread_mutex_unlock(&(block->lock));
+        return DB_SUCCESS;
+    }
+
+    // the write lock is held, so no other connection can be reserving ids meanwhile
+    const int rvv[2] = {
+        sqlite3_bind_int64(conn.op_reserve_ids, 1, id_block_size),
+        sqlite3_bind_text(conn.op_reserve_ids, 2, ID_TABLE_NAME[table], -1, SQLITE_STATIC),
     };
-    if unlikely (rvv[0] != SQLITE_OK || rvv[1] != SQLITE_OK || rvv[2] != SQLITE_OK) {
-        sqlite3_clear_bindings(conn.op_insert_movie);
-        return check_results(3, rvv, sqlite3_reset(conn.op_insert_movie));
+    if unlikely (rvv[0] != SQLITE_OK || rvv[1] != SQLITE_OK) {
+        pthread_mutex_unlock(&(block->lock));
+        sqlite3_clear_bindings(conn.op_reserve_ids);
+        return check_results(2, rvv, sqlite3_reset(conn.op_reserve_ids));
     }
 
-    int rv;
-    unsigned id_set = 0;
-    while ((rv = sqlite3_step(conn.op_insert_movie)) == SQLITE_ROW) {
-        movie->id = sqlite3_column_int64(conn.op_insert_movie, 0);
-        id_set += 1;
+    int64_t start = 0;
+    bool found = false;
+    db_result_t res = db_eval_id(conn.op_reserve_ids, &start, &found);
+    if unlikely (res == DB_SUCCESS && !found) {
+        res = DB_HARD_ERROR;
+    }
+    if likely (res == DB_SUCCESS) {
+        *id = start;
+        block->next = start + 1;
+        block->end = start + id_block_size;
+        atomic_store_explicit(&(block->owner), conn.db, memory_order_relaxed);
     }
+    pthread_mutex_unlock(&(block->lock));
+    return res;
+}
 
-    sqlite3_clear_bindings(conn.op_insert_movie);
-    int rrv = sqlite3_reset(conn.op_insert_movie);
-    if unlikely (rv != SQLITE_DONE || rrv != SQLITE_OK) {
-        return check_result(rv, rrv);
-    } else if unlikely (id_set != 1) {
+[[gnu::nonnull(4), gnu::hot]]
+/**
+ * Records a change to `movie_id` inside an open write transaction, under a new catalog generation that is written to
+ * `generation`. Publish it with `catalog_changed` once the transaction commits.
+ */
+static db_result_t record_change_in_transaction(
+    const db_conn_t conn,
+    int64_t movie_id,
+    bool deleted,
+    uint64_t *NONNULL generation
+) {
+    // generations are never handed out in blocks, they must stay in commit order
+    const int rvv[2] = {
+        sqlite3_bind_int64(conn.op_reserve_ids, 1, 1),
+        sqlite3_bind_text(conn.op_reserve_ids, 2, "generation", -1, SQLITE_STATIC),
+    };
+    if unlikely (rvv[0] != SQLITE_OK || rvv[1] != SQLITE_OK) {
+        sqlite3_clear_bindings(conn.op_reserve_ids);
+        return check_results(2, rvv, sqlite3_reset(conn.op_reserve_ids));
+    }
+
+    int64_t reserved = 0;
+    bool found = false;
+    db_result_t res = db_eval_id(conn.op_reserve_ids, &reserved, &found);
+    if unlikely (res != DB_SUCCESS) {
+        return res;
+    } else if unlikely (!found || reserved < 1) {
         return DB_HARD_ERROR;
     }
 
-    // link movie to the genres
-    for (size_t i = 0; i < genres; i++) {
+    const int rvc[3] = {
+        sqlite3_bind_int64(conn.op_record_change, 1, movie_id),
+        sqlite3_bind_int64(conn.op_record_change, 2, reserved),
+        sqlite3_bind_int(conn.op_record_change, 3, deleted ? 1 : 0),
+    };
+    if unlikely (rvc[0] != SQLITE_OK || rvc[1] != SQLITE_OK || rvc[2] != SQLITE_OK) {
+        sqlite3_clear_bindings(conn.op_record_change);
+        return check_results(3, rvc, sqlite3_reset(conn.op_record_change));
+    }
+
+    res = db_eval_stmt(conn.op_record_change);
+    if likely (res == DB_SUCCESS) {
+        *generation = (uint64_t) reserved;
+    }
+    return res;
+}
+
+[[gnu::nonnull(2, 3), gnu::hot]]
+/**
+ * Finds the id for `genre` inside an open write transaction, creating the genre if needed.
+ *
+ * Ids are read from the genre cache when possible, otherwise they are recorded for publishing after the commit.
+ */
+static db_result_t genre_id_in_transaction(const db_conn_t conn, const char genre[NONNULL], int64_t *NONNULL id) {
+    if likely (genre_cache_get(genre, id)) {
+        return DB_SUCCESS;
+    }
+
+    bool found = false;
+    int rv = sqlite3_bind_text(conn.op_select_genre_id, 1, genre, -1, SQLITE_STATIC);
+    if unlikely (rv != SQLITE_OK) {
+        sqlite3_clear_bindings(conn.op_select_genre_id);
+        return check_result(rv, sqlite3_reset(conn.op_select_genre_id));
+    }
+    db_result_t res = db_eval_id(conn.op_select_genre_id, id, &found);
+    if unlikely (res != DB_SUCCESS) {
+        return res;
+    }
+
+    if (!found) {
+        res = next_id_in_transaction(conn, ID_GENRE, id);
+        if unlikely (res != DB_SUCCESS) {
+            return res;
+        }
+
+        const int rvv[2] = {
+            sqlite3_bind_int64(conn.op_insert_genre, 1, *id),
+            sqlite3_bind_text(conn.op_insert_genre, 2, genre, -1, SQLITE_STATIC),
+        };
+        if unlikely (rvv[0] != SQLITE_OK || rvv[1] != SQLITE_OK) {
+            sqlite3_clear_bindings(conn.op_insert_genre);
+            return check_results(2, rvv, sqlite3_reset(conn.op_insert_genre));
+        }
+        res = db_eval_stmt(conn.op_insert_genre);
+        if unlikely (res != DB_SUCCESS) {
+            return res;
+        }
+    }
+
+    genre_cache_txn_add(conn.genres, genre, *id);
+    return DB_SUCCESS;
+}
+
+[[gnu::cold, gnu::nonnull(4)]]
+/** Links a movie to genres with `op_merge_movie_genre` inside an open transaction, skipping existing links. */
+static db_result_t merge_links_in_transaction(
+    const db_conn_t conn,
+    int64_t movie_id,
+    size_t count,
+    const int64_t genre_ids[NONNULL count]
+) {
+    for (size_t i = 0; i < count; i++) {
         const int rvv[2] = {
-            sqlite3_bind_int64(conn.op_insert_genre_link, 1, movie->id),
-            sqlite3_bind_text(conn.op_insert_genre_link, 2, movie->genres[i], -1, SQLITE_STATIC),
+            sqlite3_bind_int64(conn.op_merge_movie_genre, 1, movie_id),
+            sqlite3_bind_int64(conn.op_merge_movie_genre, 2, genre_ids[i]),
         };
         if unlikely (rvv[0] != SQLITE_OK || rvv[1] != SQLITE_OK) {
-            sqlite3_clear_bindings(conn.op_insert_genre_link);
-            return check_results(2, rvv, sqlite3_reset(conn.op_insert_genre_link));
+            sqlite3_clear_bindings(conn.op_merge_movie_genre);
+            return check_results(2, rvv, sqlite3_reset(conn.op_merge_movie_genre));
+        }
+
+        int64_t genre_id;
+        bool inserted;
+        const db_result_t res = db_eval_id(conn.op_merge_movie_genre, &genre_id, &inserted);
+        if unlikely (res != DB_SUCCESS) {
+            return res;
+        }
+    }
+    return DB_SUCCESS;
+}
+
+[[gnu::nonnull(4)]]
+/**
+ * Runs `op_insert_genre_links` variants inside an open transaction, one statement per bit of `count`, or one per link
+ * after multi-row variants were disabled. A multi-row variant that inserts fewer rows than given disables them, and
+ * its links are merged one at a time instead.
+ */
+static db_result_t insert_links_in_transaction(
+    const db_conn_t conn,
+    int64_t movie_id,
+    size_t count,
+    const int64_t genre_ids[NONNULL count]
+) {
+    assume(count <= GENRE_LINK_MAX_ROWS);
+
+    const size_t widest = atomic_load_explicit(&multi_row_links_enabled, memory_order_relaxed)
+        ? GENRE_LINK_VARIANTS - 1
+        : 0;
+    size_t done = 0;
+    while (done < count) {
+        size_t variant = widest;
+        while (((size_t) 1 << variant) > count - done) {
+            variant--;
+        }
+        const size_t rows = (size_t) 1 << variant;
+
+        sqlite3_stmt *stmt = conn.op_insert_genre_links[variant];
+        int rv = sqlite3_bind_int64(stmt, 1, movie_id);
+        for (size_t i = 0; rv == SQLITE_OK && i < rows; i++) {
+            rv = sqlite3_bind_int64(stmt, (int) i + 2, genre_ids[done + i]);
+        }
+        if unlikely (rv != SQLITE_OK) {
+            sqlite3_clear_bindings(stmt);
+            return check_result(rv, sqlite3_reset(stmt));
         }
 
-        db_result_t res = db_eval_stmt(conn.op_insert_genre_link);
+        db_result_t res = db_eval_stmt(stmt);
         if unlikely (res != DB_SUCCESS) {
             return res;
         }
+        if unlikely (rows > 1 && (size_t) sqlite3_changes64(conn.db) != rows) {
+            disable_multi_row_links("multi-row VALUES inserted fewer rows than given");
+            res = merge_links_in_transaction(conn, movie_id, rows, &(genre_ids[done]));
+            if unlikely (res != DB_SUCCESS) {
+                return res;
+            }
+        }
+        done += rows;
     }
+    return DB_SUCCESS;
+}
+
+[[gnu::nonnull(4)]]
+/** Links a movie to its genres inside an open write transaction, creating the genres as needed. */
+static db_result_t link_genres_in_transaction(
+    const db_conn_t conn,
+    int64_t movie_id,
+    size_t len,
+    const char *NONNULL restrict const genres[NONNULL len]
+) {
+    int64_t genre_ids[GENRE_LINK_MAX_ROWS];
+
+    for (size_t start = 0; start < len; start += GENRE_LINK_MAX_ROWS) {
+        const size_t count = len - start < GENRE_LINK_MAX_ROWS ? len - start : GENRE_LINK_MAX_ROWS;
+        for (size_t i = 0; i < count; i++) {
+            const db_result_t res = genre_id_in_transaction(conn, genres[start + i], &(genre_ids[i]));
+            if unlikely (res != DB_SUCCESS) {
+                return res;
+            }
+        }
 
+        const db_result_t res = insert_links_in_transaction(conn, movie_id, count, genre_ids);
+        if unlikely (res != DB_SUCCESS) {
+            return res;
+        }
+    }
     return DB_SUCCESS;
 }
 
+[[nodiscard("useless call if discarded"), gnu::pure, gnu::nonnull(2)]]
+/**
+ * Checks that no genre contains `GENRE_SEPARATOR`, which would split it in `movie.genres`. The parsers already reject
+ * them, but other callers may not.
+ */
+static bool genres_are_valid(size_t count, const char *NONNULL const genres[NONNULL count]) {
+    for (size_t i = 0; i < count; i++) {
+        if unlikely (!genre_name_is_valid(strlen(genres[i]), genres[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+[[gnu::malloc, gnu::nonnull(2, 3)]]
+/** Joins `genres` with `GENRE_SEPARATOR`, as stored in `movie.genres`. Returns NULL on allocation failures. */
+static char *NULLABLE
+    pack_genres(size_t count, const char *NONNULL const genres[NONNULL count], size_t *NONNULL length) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        // separator or final NUL
+        if unlikely (ckd_add(&total, total, strlen(genres[i]) + 1)) {
+            return NULL;
+        }
+    }
+
+    char *packed = malloc(total > 0 ? total : 1);
+    if unlikely (packed == NULL) {
+        return NULL;
+    }
+
+    size_t used = 0;
+    for (size_t i = 0; i < count; i++) {
+        const size_t len = strlen(genres[i]);
+        memcpy(&(packed[used]), genres[i], len);
+        used += len;
+        packed[used++] = GENRE_SEPARATOR;
+    }
+    // replace the last separator
+    used = used > 0 ? used - 1 : 0;
+    packed[used] = '\0';
+
+    *length = used;
+    return packed;
+}
+
+[[gnu::nonnull(2)]]
+/** Runs `op_insert_movie` inside an open transaction. */
+static db_result_t register_movie_in_transaction(const db_conn_t conn, struct movie *NONNULL movie) {
+    const size_t genres = movie->genre_count;
+
+    int64_t id;
+    db_result_t res = next_id_in_transaction(conn, ID_MOVIE, &id);
+    if unlikely (res != DB_SUCCESS) {
+        return res;
+    }
+
+    size_t packed_len;
+    char *packed = pack_genres(genres, movie->genres, &packed_len);
+    if unlikely (packed == NULL || packed_len > INT_MAX) {
+        free(packed);
+        return DB_RUNTIME_ERROR;
+    }
+
+    // add movie itself to db
+    const int rvv[5] = {
+        sqlite3_bind_int64(conn.op_insert_movie, 1, id),
+        sqlite3_bind_text(conn.op_insert_movie, 2, movie->title, -1, SQLITE_STATIC),
+        sqlite3_bind_text(conn.op_insert_movie, 3, movie->director, -1, SQLITE_STATIC),
+        sqlite3_bind_int(conn.op_insert_movie, 4, movie->release_year),
+        sqlite3_bind_text(conn.op_insert_movie, 5, packed, (int) packed_len, SQLITE_STATIC),
+    };
+    if unlikely (
+        rvv[0] != SQLITE_OK || rvv[1] != SQLITE_OK || rvv[2] != SQLITE_OK || rvv[3] != SQLITE_OK || rvv[4] != SQLITE_OK
+    ) {
+        sqlite3_clear_bindings(conn.op_insert_movie);
+        free(packed);
+        return check_results(5, rvv, sqlite3_reset(conn.op_insert_movie));
+    }
+
+    res = db_eval_stmt(conn.op_insert_movie);
+    free(packed);
+    if unlikely (res != DB_SUCCESS) {
+        return res;
+    }
+    movie->id = id;
+    // before the commit, a rolled back id just costs one extra query later
+    id_set_add(id);
+
+    // link movie to the genres, creating them as needed
+    return link_genres_in_transaction(conn, movie->id, genres, movie->genres);
+}
+
 /** Registers a new movie and updates its 'id' if successful. */
 db_result_t db_register_movie(
     db_conn_t *NONNULL conn,
     struct movie *NONNULL movie,
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 ) {
     assume(movie->id == 0);
+    db_profile(conn, DB_OP_REGISTER_MOVIE);
+
+    if unlikely (!genres_are_valid(movie->genre_count, movie->genres)) {
+        error_set_code(error, DB_ERROR_INVALID_GENRE);
+        return DB_USER_ERROR;
+    }
 
-    db_result_t res = db_transaction_begin(conn, errmsg);
+    db_result_t res = db_transaction_begin_write(conn, error);
     if unlikely (res != DB_SUCCESS) {
         return res;
     }
 
+    uint64_t generation = 0;
     res = register_movie_in_transaction(*conn, movie);
+    if likely (res == DB_SUCCESS) {
+        res = record_change_in_transaction(*conn, movie->id, false, &generation);
+    }
     if unlikely (res != DB_SUCCESS) {
-        errmsg_dup_db(errmsg, conn->db);
+        error_set_db(error, conn->db);
         db_transaction_rollback(conn, NULL);
         return res;
     }
 
-    return db_transaction_commit(conn, errmsg);
+    res = db_transaction_commit(conn, error);
+    if likely (res == DB_SUCCESS) {
+        catalog_changed(generation);
+        for (size_t i = 0; i < movie->genre_count; i++) {
+            search_cache_invalidate(movie->genres[i]);
+        }
+    }
+    return res;
+}
+
+[[gnu::nonnull(1)]]
+/** Drops the cached searches for each genre in `packed`, joined by `GENRE_SEPARATOR`. Overwrites the separators. */
+static void invalidate_packed_genres(char *NONNULL packed) {
+    char *genre = packed;
+    for (char *pos = packed;; pos++) {
+        if (*pos != GENRE_SEPARATOR && *pos != '\0') {
+            continue;
+        }
+
+        const bool last = *pos == '\0';
+        *pos = '\0';
+        if (*genre != '\0') {
+            search_cache_invalidate(genre);
+        }
+        if (last) {
+            return;
+        }
+        genre = pos + 1;
+    }
+}
+
+/** Drops the cached searches for the `packed` genres of a movie, or all of them if the copy failed. Frees `packed`. */
+static void invalidate_movie_genres(char *NULLABLE packed) {
+    if likely (packed != NULL) {
+        invalidate_packed_genres(packed);
+        free(packed);
+    } else {
+        search_cache_invalidate_all();
+    }
 }
 
-[[gnu::nonnull(3)]]
-/** Runs `op_insert_genre_link` inside an open transaction. */
+[[gnu::nonnull(3, 4)]]
+/**
+ * Runs `op_append_movie_genre` inside an open transaction, for a genre just linked to the movie.
+ *
+ * The updated `movie.genres` replaces the copy in `packed`, which becomes `NULL` if the copy fails.
+ */
+static db_result_t append_genre_in_transaction(
+    const db_conn_t conn,
+    int64_t movie_id,
+    const char genre[NONNULL],
+    char *NULLABLE *NONNULL packed
+) {
+    const int rvu[2] = {
+        sqlite3_bind_text(conn.op_append_movie_genre, 1, genre, -1, SQLITE_STATIC),
+        sqlite3_bind_int64(conn.op_append_movie_genre, 2, movie_id),
+    };
+    if unlikely (rvu[0] != SQLITE_OK || rvu[1] != SQLITE_OK) {
+        sqlite3_clear_bindings(conn.op_append_movie_genre);
+        return check_results(2, rvu, sqlite3_reset(conn.op_append_movie_genre));
+    }
+
+    int rv;
+    while ((rv = sqlite3_step(conn.op_append_movie_genre)) == SQLITE_ROW) {
+        const char *genres = (const char *) sqlite3_column_text(conn.op_append_movie_genre, 0);
+        free(*packed);
+        *packed = likely(genres != NULL) ? strdup(genres) : NULL;
+    }
+
+    sqlite3_clear_bindings(conn.op_append_movie_genre);
+    const int rrv = sqlite3_reset(conn.op_append_movie_genre);
+    if unlikely (rv != SQLITE_DONE || rrv != SQLITE_OK) {
+        return check_result(rv, rrv);
+    }
+    return DB_SUCCESS;
+}
+
+[[gnu::nonnull(3, 5)]]
+/**
+ * Runs `op_insert_genre_links` inside an open transaction. All genres of the movie after the insert are copied to
+ * `packed`, as in `append_genre_in_transaction`.
+ */
 static db_result_t add_genres_in_transaction(
     const db_conn_t conn,
     size_t len,
     const char *NONNULL restrict const genres[NONNULL len],
-    int64_t movie_id
+    int64_t movie_id,
+    char *NULLABLE *NONNULL packed
 ) {
-    for (size_t i = 0; i < len; i++) {
-        int rv = sqlite3_bind_text(conn.op_insert_genre, 1, genres[i], -1, SQLITE_STATIC);
-        if unlikely (rv != SQLITE_OK) {
-            sqlite3_clear_bindings(conn.op_insert_genre);
-            return check_result(rv, sqlite3_reset(conn.op_insert_genre));
-        }
-
-        db_result_t res = db_eval_stmt(conn.op_insert_genre);
-        if unlikely (res != DB_SUCCESS) {
-            return res;
-        }
+    db_result_t res = link_genres_in_transaction(conn, movie_id, len, genres);
+    if unlikely (res != DB_SUCCESS) {
+        return res;
     }
 
+    // keep the denormalized list in sync, after the links are known to be valid and new
     for (size_t i = 0; i < len; i++) {
-        const int rvv[2] = {
-            sqlite3_bind_int64(conn.op_insert_genre_link, 1, movie_id),
-            sqlite3_bind_text(conn.op_insert_genre_link, 2, genres[i], -1, SQLITE_STATIC),
-        };
-        if unlikely (rvv[0] != SQLITE_OK || rvv[1] != SQLITE_OK) {
-            sqlite3_clear_bindings(conn.op_insert_genre_link);
-            return check_results(2, rvv, sqlite3_reset(conn.op_insert_genre_link));
-        }
-
-        db_result_t res = db_eval_stmt(conn.op_insert_genre_link);
+        res = append_genre_in_transaction(conn, movie_id, genres[i], packed);
         if unlikely (res != DB_SUCCESS) {
             return res;
         }
@@ -807,29 +2050,55 @@ db_result_t db_add_genre(
     db_conn_t *NONNULL conn,
     int64_t movie_id,
     const char genre[NONNULL restrict const],
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 ) {
-    db_result_t res = db_transaction_begin(conn, errmsg);
+    db_profile(conn, DB_OP_ADD_GENRE);
+
+    if unlikely (!genre_name_is_valid(strlen(genre), genre)) {
+        error_set_code(error, DB_ERROR_INVALID_GENRE);
+        return DB_USER_ERROR;
+    }
+    if unlikely (!id_set_may_contain(movie_id)) {
+        error_set(error, (db_error_t) {.code = DB_ERROR_NO_MOVIE, .movie_id = movie_id});
+        return DB_USER_ERROR;
+    }
+
+    db_result_t res = db_transaction_begin_write(conn, error);
     if unlikely (res != DB_SUCCESS) {
         return res;
     }
 
-    res = add_genres_in_transaction(*conn, 1, &genre, movie_id);
+    uint64_t generation = 0;
+    char *genres = NULL;
+    res = add_genres_in_transaction(*conn, 1, &genre, movie_id, &genres);
+    if likely (res == DB_SUCCESS) {
+        res = record_change_in_transaction(*conn, movie_id, false, &generation);
+    }
     if likely (res == DB_SUCCESS) {
-        return db_transaction_commit(conn, errmsg);
+        res = db_transaction_commit(conn, error);
+        if likely (res == DB_SUCCESS) {
+            catalog_changed(generation);
+            // cached searches for the other genres also list this movie, with its old genres
+            invalidate_movie_genres(genres);
+        } else {
+            free(genres);
+        }
+        return res;
     }
+    free(genres);
 
     switch (sqlite3_extended_errcode(conn->db)) {
         case SQLITE_CONSTRAINT_FOREIGNKEY:
-            errmsg_printf(errmsg, "no movie with id = %" PRIi64 " found in the database", movie_id);
+            error_set(error, (db_error_t) {.code = DB_ERROR_NO_MOVIE, .movie_id = movie_id});
             res = DB_USER_ERROR;
             break;
+        case SQLITE_CONSTRAINT_PRIMARYKEY:
         case SQLITE_CONSTRAINT_UNIQUE:
-            errmsg_printf(errmsg, "movie with id = %" PRIi64 " already has the provided genre", movie_id);
+            error_set(error, (db_error_t) {.code = DB_ERROR_GENRE_EXISTS, .movie_id = movie_id});
             res = DB_USER_ERROR;
             break;
         default: {
-            errmsg_dup_db(errmsg, conn->db);
+            error_set_db(error, conn->db);
             break;
         }
     }
@@ -837,41 +2106,239 @@ db_result_t db_add_genre(
     return res;
 }
 
-/** Runs `op_delete_movie` inside its automatic transaction. */
-static db_result_t delete_movie_in_transaction(const db_conn_t conn, int64_t movie_id) {
+[[gnu::nonnull(2, 3, 4)]]
+/** Runs `op_select_movie_by_key` inside an open transaction. `found` is set if a movie with the same key exists. */
+static db_result_t find_movie_in_transaction(
+    const db_conn_t conn,
+    const struct movie *NONNULL movie,
+    int64_t *NONNULL id,
+    bool *NONNULL found
+) {
+    const int rvv[3] = {
+        sqlite3_bind_text(conn.op_select_movie_by_key, 1, movie->title, -1, SQLITE_STATIC),
+        sqlite3_bind_text(conn.op_select_movie_by_key, 2, movie->director, -1, SQLITE_STATIC),
+        sqlite3_bind_int(conn.op_select_movie_by_key, 3, movie->release_year),
+    };
+    if unlikely (rvv[0] != SQLITE_OK || rvv[1] != SQLITE_OK || rvv[2] != SQLITE_OK) {
+        sqlite3_clear_bindings(conn.op_select_movie_by_key);
+        return check_results(3, rvv, sqlite3_reset(conn.op_select_movie_by_key));
+    }
+
+    return db_eval_id(conn.op_select_movie_by_key, id, found);
+}
+
+[[gnu::nonnull(2, 3, 4)]]
+/**
+ * Links the existing movie `movie->id` to each of its genres that is not linked yet, inside an open write transaction.
+ * Sets `merged` if any genre was added, and then copies all genres of the movie to `packed`.
+ */
+static db_result_t merge_genres_in_transaction(
+    const db_conn_t conn,
+    const struct movie *NONNULL movie,
+    bool *NONNULL merged,
+    char *NULLABLE *NONNULL packed
+) {
+    *merged = false;
+    for (size_t i = 0; i < movie->genre_count; i++) {
+        int64_t genre_id;
+        db_result_t res = genre_id_in_transaction(conn, movie->genres[i], &genre_id);
+        if unlikely (res != DB_SUCCESS) {
+            return res;
+        }
+
+        const int rvv[2] = {
+            sqlite3_bind_int64(conn.op_merge_movie_genre, 1, movie->id),
+            sqlite3_bind_int64(conn.op_merge_movie_genre, 2, genre_id),
+        };
+        if unlikely (rvv[0] != SQLITE_OK || rvv[1] != SQLITE_OK) {
+            sqlite3_clear_bindings(conn.op_merge_movie_genre);
+            return check_results(2, rvv, sqlite3_reset(conn.op_merge_movie_genre));
+        }
+
+        bool inserted = false;
+        res = db_eval_id(conn.op_merge_movie_genre, &genre_id, &inserted);
+        if unlikely (res != DB_SUCCESS) {
+            return res;
+        } else if (!inserted) {
+            continue;
+        }
+
+        res = append_genre_in_transaction(conn, movie->id, movie->genres[i], packed);
+        if unlikely (res != DB_SUCCESS) {
+            return res;
+        }
+        *merged = true;
+    }
+    return DB_SUCCESS;
+}
+
+/** Registers a movie, or merges its genres into an existing movie with the same title, director and release year. */
+db_result_t db_upsert_movie(
+    db_conn_t *NONNULL conn,
+    struct movie *NONNULL movie,
+    enum db_upsert_outcome *NONNULL outcome,
+    db_error_t *NULLABLE restrict error
+) {
+    assume(movie->id == 0);
+    db_profile(conn, DB_OP_UPSERT_MOVIE);
+
+    if unlikely (!genres_are_valid(movie->genre_count, movie->genres)) {
+        error_set_code(error, DB_ERROR_INVALID_GENRE);
+        return DB_USER_ERROR;
+    }
+
+    db_result_t res = db_transaction_begin_write(conn, error);
+    if unlikely (res != DB_SUCCESS) {
+        return res;
+    }
+
+    int64_t existing = 0;
+    bool found = false;
+    bool changed = true;
+    char *genres = NULL;
+    res = find_movie_in_transaction(*conn, movie, &existing, &found);
+    if likely (res == DB_SUCCESS && found) {
+        movie->id = existing;
+        res = merge_genres_in_transaction(*conn, movie, &changed, &genres);
+    } else if likely (res == DB_SUCCESS) {
+        res = register_movie_in_transaction(*conn, movie);
+    }
+
+    uint64_t generation = 0;
+    if likely (res == DB_SUCCESS && changed) {
+        res = record_change_in_transaction(*conn, movie->id, false, &generation);
+    }
+    if unlikely (res != DB_SUCCESS) {
+        free(genres);
+        error_set_db(error, conn->db);
+        db_transaction_rollback(conn, NULL);
+        return res;
+    }
+
+    res = db_transaction_commit(conn, error);
+    if unlikely (res != DB_SUCCESS) {
+        free(genres);
+        return res;
+    }
+
+    if (changed && found) {
+        catalog_changed(generation);
+        // a merge also changes the cached searches for the genres the movie already had
+        invalidate_movie_genres(genres);
+    } else if (changed) {
+        catalog_changed(generation);
+        for (size_t i = 0; i < movie->genre_count; i++) {
+            search_cache_invalidate(movie->genres[i]);
+        }
+    }
+    *outcome = !found ? DB_UPSERT_INSERTED : changed ? DB_UPSERT_MERGED : DB_UPSERT_UNCHANGED;
+    return DB_SUCCESS;
+}
+
+[[gnu::nonnull(3)]]
+/**
+ * Runs `op_delete_movie` inside an open write transaction.
+ *
+ * The genres of the deleted movie are copied to `genres`, as stored in `movie.genres`. It stays `NULL` if the movie did
+ * not exist or if the copy failed.
+ */
+static db_result_t delete_movie_in_transaction(const db_conn_t conn, int64_t movie_id, char *NULLABLE *NONNULL genres) {
+    *genres = NULL;
     int rv = sqlite3_bind_int64(conn.op_delete_movie, 1, movie_id);
     if unlikely (rv != SQLITE_OK) {
         sqlite3_clear_bindings(conn.op_delete_movie);
         return check_result(rv, sqlite3_reset(conn.op_delete_movie));
     }
 
-    return db_eval_stmt(conn.op_delete_movie);
+    while ((rv = sqlite3_step(conn.op_delete_movie)) == SQLITE_ROW) {
+        const char *packed = (const char *) sqlite3_column_text(conn.op_delete_movie, 0);
+        if likely (packed != NULL && *genres == NULL) {
+            *genres = strdup(packed);
+        }
+    }
+
+    sqlite3_clear_bindings(conn.op_delete_movie);
+    const int rrv = sqlite3_reset(conn.op_delete_movie);
+    if unlikely (rv != SQLITE_DONE || rrv != SQLITE_OK) {
+        free(*genres);
+        *genres = NULL;
+        return check_result(rv, rrv);
+    }
+    return DB_SUCCESS;
 }
 
-/** Runs `op_delete_unused_genres` inside its automatic transaction. */
+/**
+ * Runs `op_delete_unused_genres` inside its automatic transaction.
+ *
+ * Deleted genres are removed from the genre cache while the statement still holds the write lock, so no other
+ * transaction can read their stale ids.
+ */
 static void delete_unused_genres_in_transaction(const db_conn_t conn) {
-    db_result_t result = db_eval_stmt(conn.op_delete_unused_genres);
+    int rv;
+    while ((rv = sqlite3_step(conn.op_delete_unused_genres)) == SQLITE_ROW) {
+        const char *name = (const char *) sqlite3_column_text(conn.op_delete_unused_genres, 0);
+        if likely (name != NULL) {
+            genre_cache_invalidate(name);
+        }
+    }
+
+    const int rrv = sqlite3_reset(conn.op_delete_unused_genres);
+    const db_result_t result = (rv == SQLITE_DONE && rrv == SQLITE_OK) ? DB_SUCCESS : check_result(rv, rrv);
     if unlikely (result != DB_SUCCESS) {
-        const char *NONNULL errmsg = sqlite3_errmsg(conn.db);
-        (void) fprintf(stderr, "failed to delete unused genres: %s\n", errmsg);
+        const char *NONNULL message = sqlite3_errmsg(conn.db);
+        (void) fprintf(stderr, "failed to delete unused genres: %s\n", message);
         // just print errors for this one, and keeps running
     }
 }
 
 /** Removes a movie from the database. */
-db_result_t db_delete_movie(db_conn_t *NONNULL conn, int64_t movie_id, message_t *NULLABLE errmsg) {
-    // no need to create an explicit transaction for a single statement
-    const db_result_t res = delete_movie_in_transaction(*conn, movie_id);
+db_result_t db_delete_movie(db_conn_t *NONNULL conn, int64_t movie_id, db_error_t *NULLABLE error) {
+    db_profile(conn, DB_OP_DELETE_MOVIE);
+
+    if unlikely (!id_set_may_contain(movie_id)) {
+        error_set(error, (db_error_t) {.code = DB_ERROR_NO_MOVIE_TO_DELETE, .movie_id = movie_id});
+        return DB_USER_ERROR;
+    }
+
+    db_result_t res = db_transaction_begin_write(conn, error);
+    if unlikely (res != DB_SUCCESS) {
+        return res;
+    }
+
+    char *genres = NULL;
+    res = delete_movie_in_transaction(*conn, movie_id, &genres);
     if unlikely (res != DB_SUCCESS) {
-        errmsg_dup_db(errmsg, conn->db);
+        error_set_db(error, conn->db);
+        db_transaction_rollback(conn, NULL);
         return res;
     }
 
     if (sqlite3_changes64(conn->db) < 1) {
-        errmsg_printf(errmsg, "no movie with id = %" PRIi64 " to be deleted from the database", movie_id);
+        free(genres);
+        error_set(error, (db_error_t) {.code = DB_ERROR_NO_MOVIE_TO_DELETE, .movie_id = movie_id});
+        db_transaction_rollback(conn, NULL);
         return DB_USER_ERROR;
     }
 
+    // the tombstone must be written in the same transaction as the delete
+    uint64_t generation = 0;
+    res = record_change_in_transaction(*conn, movie_id, true, &generation);
+    if likely (res == DB_SUCCESS) {
+        res = db_transaction_commit(conn, error);
+    } else {
+        error_set_db(error, conn->db);
+        db_transaction_rollback(conn, NULL);
+    }
+    if unlikely (res != DB_SUCCESS) {
+        free(genres);
+        return res;
+    }
+    id_set_remove(movie_id);
+    catalog_changed(generation);
+
+    // already committed, so searches that see the invalidation also see the delete
+    invalidate_movie_genres(genres);
+
     delete_unused_genres_in_transaction(*conn);
     return DB_SUCCESS;
 }
@@ -894,12 +2361,15 @@ static const char *NULLABLE get_str_column(sqlite3_stmt *NONNULL stmt, int colum
     return str;
 }
 
-[[gnu::nonnull(1, 2, 3)]]
-/** Build movie data into `buffer` and correct pointers to `movie`. */
+[[gnu::nonnull(1, 2)]]
+/**
+ * Build movie data into `buffer` and correct pointers to `movie`. Genres are left empty if `inner_stmt` is `NULL`, for
+ * the brief statements that don't select them.
+ */
 static db_result_t get_movie_with_genres(
     movie_builder_t *NONNULL builder,
     sqlite3_stmt *NONNULL outer_stmt,
-    sqlite3_stmt *NONNULL inner_stmt
+    sqlite3_stmt *NULLABLE inner_stmt
 ) {
     size_t title_len;
     size_t director_len;
@@ -920,13 +2390,26 @@ static db_result_t get_movie_with_genres(
         return DB_RUNTIME_ERROR;
     }
 
+    movie_builder_start_genres(builder);
+    if (inner_stmt == NULL) {
+        return DB_SUCCESS;
+    } else if likely (packed_genres_enabled) {
+        size_t packed_len;
+        const char *packed = get_str_column(outer_stmt, 4, &packed_len);
+        if unlikely (packed == NULL) {
+            return DB_RUNTIME_ERROR;
+        }
+
+        bool ok = movie_builder_add_packed_genres(builder, packed_len, packed, GENRE_SEPARATOR);
+        return likely(ok) ? DB_SUCCESS : DB_RUNTIME_ERROR;
+    }
+
     int rv = sqlite3_bind_int64(inner_stmt, 1, id);
     if unlikely (rv != SQLITE_OK) {
         sqlite3_clear_bindings(inner_stmt);
         return check_result(rv, sqlite3_reset(inner_stmt));
     }
 
-    movie_builder_start_genres(builder);
     while ((rv = sqlite3_step(inner_stmt)) == SQLITE_ROW) {
         size_t genre_len;
         const char *genre = get_str_column(inner_stmt, 0, &genre_len);
@@ -949,12 +2432,12 @@ static db_result_t get_movie_with_genres(
     return DB_SUCCESS;
 }
 
-[[gnu::nonnull(1, 2, 3)]]
+[[gnu::nonnull(1, 2)]]
 /** Iterate over movie entries, calling `callback` on each and returning the final result in `movie`.  */
 static db_result_t iter_movies(
     movie_builder_t *NONNULL builder,
     sqlite3_stmt *NONNULL outer_stmt,
-    sqlite3_stmt *NONNULL inner_stmt
+    sqlite3_stmt *NULLABLE inner_stmt
 ) {
     movie_builder_reset(builder);
 
@@ -984,16 +2467,22 @@ static db_result_t iter_movies(
     return DB_SUCCESS;
 }
 
-[[gnu::nonnull(3)]]
+[[gnu::nonnull(4)]]
 /** Read a single movie and write to `movie`. */
-static db_result_t get_movie_in_transaction(const db_conn_t conn, int64_t movie_id, struct movie *NONNULL output) {
-    int rv = sqlite3_bind_int64(conn.op_select_movie, 1, movie_id);
+static db_result_t get_movie_in_transaction(
+    const db_conn_t conn,
+    int64_t movie_id,
+    bool with_genres,
+    struct movie *NONNULL output
+) {
+    sqlite3_stmt *stmt = with_genres ? conn.op_select_movie : conn.op_select_movie_brief;
+    int rv = sqlite3_bind_int64(stmt, 1, movie_id);
     if unlikely (rv != SQLITE_OK) {
-        sqlite3_clear_bindings(conn.op_select_movie);
-        return check_result(rv, sqlite3_reset(conn.op_select_movie));
+        sqlite3_clear_bindings(stmt);
+        return check_result(rv, sqlite3_reset(stmt));
     }
 
-    const db_result_t res = iter_movies(conn.builder, conn.op_select_movie, conn.op_select_movie_genres);
+    const db_result_t res = iter_movies(conn.builder, stmt, with_genres ? conn.op_select_movie_genres : NULL);
     if unlikely (res != DB_SUCCESS) {
         return res;
     }
@@ -1011,79 +2500,120 @@ static db_result_t get_movie_in_transaction(const db_conn_t conn, int64_t movie_
 db_result_t db_get_movie(
     db_conn_t *NONNULL conn,
     int64_t movie_id,
+    bool with_genres,
     struct movie *NONNULL output,
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 ) {
-    db_result_t res = db_transaction_begin(conn, errmsg);
+    db_profile(conn, DB_OP_GET_MOVIE);
+
+    if unlikely (!id_set_may_contain(movie_id)) {
+        error_set(error, (db_error_t) {.code = DB_ERROR_NO_MOVIE, .movie_id = movie_id});
+        return DB_USER_ERROR;
+    }
+
+    db_result_t res = db_read_begin(conn, packed_genres_enabled || !with_genres, error);
     if unlikely (res != DB_SUCCESS) {
         return res;
     }
 
-    res = get_movie_in_transaction(*conn, movie_id, output);
+    res = get_movie_in_transaction(*conn, movie_id, with_genres, output);
     if likely (res == DB_SUCCESS) {
-        res = db_transaction_commit(conn, errmsg);
-        if unlikely (res != DB_SUCCESS) {
-            free_movie(*output);
-        }
-        return res;
+        return DB_SUCCESS;
     }
 
     if (sqlite3_extended_errcode(conn->db) != SQLITE_OK) {
-        errmsg_dup_db(errmsg, conn->db);
+        error_set_db(error, conn->db);
     } else {
         switch (res) {
             case DB_USER_ERROR:
-                errmsg_printf(errmsg, "no movie with id = %" PRIi64 " found in the database", movie_id);
+                error_set(error, (db_error_t) {.code = DB_ERROR_NO_MOVIE, .movie_id = movie_id});
                 break;
             case DB_RUNTIME_ERROR:
-                errmsg_dup_str(errmsg, OUT_OF_MEMORY_ERROR);
+                error_set_code(error, DB_ERROR_OUT_OF_MEMORY);
                 break;
             default:
-                errmsg_dup_str(errmsg, UNKNOWN_ERROR);
+                error_set_code(error, DB_ERROR_UNKNOWN);
                 break;
         }
     }
-    db_transaction_rollback(conn, errmsg);
+    db_read_abort(conn, error);
     return res;
 }
 
-/** Read all movies and run callback on each. */
-static db_result_t list_movies_in_transaction(const db_conn_t conn) {
-    return iter_movies(conn.builder, conn.op_select_all_movies, conn.op_select_movie_genres);
+[[gnu::nonnull(2, 3)]]
+/** Converts the window of `page` into SQLite `LIMIT` and `OFFSET` values, or the whole list without a `page`. */
+static void page_window(const struct db_page *NULLABLE page, int64_t *NONNULL limit, int64_t *NONNULL offset) {
+    // negative limits mean no limit in SQLite
+    *limit = (page == NULL || page->limit == 0 || page->limit > INT64_MAX) ? -1 : (int64_t) page->limit;
+    *offset = (page == NULL) ? 0 : (page->offset > INT64_MAX) ? INT64_MAX : (int64_t) page->offset;
+}
+
+[[gnu::nonnull(1)]]
+/** Binds the window of `page` to the `:limit` and `:offset` parameters at `first` and the next index. */
+static int bind_page_window(sqlite3_stmt *NONNULL stmt, int first, const struct db_page *NULLABLE page) {
+    int64_t limit;
+    int64_t offset;
+    page_window(page, &limit, &offset);
+
+    int rv = sqlite3_bind_int64(stmt, first, limit);
+    if likely (rv == SQLITE_OK) {
+        rv = sqlite3_bind_int64(stmt, first + 1, offset);
+    }
+    return rv;
+}
+
+/** Read all movies, or a sorted window of them, and run callback on each. */
+static db_result_t
+    list_movies_in_transaction(const db_conn_t conn, bool with_genres, const struct db_page *NULLABLE page) {
+    if (page == NULL && !with_genres) {
+        return iter_movies(conn.builder, conn.op_select_all_movies_brief, NULL);
+    } else if (page == NULL) {
+        return iter_movies(conn.builder, conn.op_select_all_movies, conn.op_select_movie_genres);
+    }
+
+    assume(page->order_by < DB_ORDER_COLUMNS);
+    sqlite3_stmt *stmt = conn.op_select_movies_page[2 * (size_t) page->order_by + (page->descending ? 1 : 0)];
+    int rv = bind_page_window(stmt, 1, page);
+    if unlikely (rv != SQLITE_OK) {
+        sqlite3_clear_bindings(stmt);
+        return check_result(rv, sqlite3_reset(stmt));
+    }
+
+    // without genres, the packed column is just never read
+    return iter_movies(conn.builder, stmt, with_genres ? conn.op_select_movie_genres : NULL);
 }
 
 /** List all movies with full information. */
 db_result_t db_list_movies(
     db_conn_t *NONNULL conn,
+    bool with_genres,
+    const struct db_page *NULLABLE page,
     struct movie *NONNULL *NONNULL output,
     size_t *NONNULL output_length,
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 ) {
-    db_result_t res = db_transaction_begin(conn, errmsg);
+    db_profile(conn, DB_OP_LIST_MOVIES);
+
+    db_result_t res = db_read_begin(conn, packed_genres_enabled || !with_genres, error);
     if unlikely (res != DB_SUCCESS) {
         return res;
     }
 
-    res = list_movies_in_transaction(*conn);
+    res = list_movies_in_transaction(*conn, with_genres, page);
     if unlikely (res != DB_SUCCESS) {
         if (sqlite3_extended_errcode(conn->db) != SQLITE_OK) {
-            errmsg_dup_db(errmsg, conn->db);
+            error_set_db(error, conn->db);
         } else {
-            errmsg_dup_str(errmsg, UNKNOWN_ERROR);
+            error_set_code(error, DB_ERROR_UNKNOWN);
         }
-        db_transaction_rollback(conn, errmsg);
-        return res;
-    }
-
-    res = db_transaction_commit(conn, errmsg);
-    if unlikely (res != DB_SUCCESS) {
+        db_read_abort(conn, error);
         return res;
     }
 
     size_t length;
     struct movie *list = movie_builder_take_movie_list(conn->builder, &length);
     if unlikely (list == NULL) {
-        errmsg_dup_str(errmsg, OUT_OF_MEMORY_ERROR);
+        error_set_code(error, DB_ERROR_OUT_OF_MEMORY);
         return DB_RUNTIME_ERROR;
     }
 
@@ -1093,50 +2623,58 @@ db_result_t db_list_movies(
 }
 
 [[gnu::nonnull(2)]]
-/** Search through movies and run callback on each. */
-static db_result_t search_movies_in_transaction(const db_conn_t conn, const char genre[NONNULL restrict const]) {
-    int rv = sqlite3_bind_text(conn.op_select_movies_genre, 1, genre, -1, SQLITE_STATIC);
+/** Search through movies, or a window of them, and run callback on each. */
+static db_result_t search_movies_in_transaction(
+    const db_conn_t conn,
+    const char genre[NONNULL restrict const],
+    bool with_genres,
+    const struct db_page *NULLABLE page
+) {
+    sqlite3_stmt *stmt = with_genres ? conn.op_select_movies_genre : conn.op_select_movies_genre_brief;
+    int rv = sqlite3_bind_text(stmt, 1, genre, -1, SQLITE_STATIC);
+    if likely (rv == SQLITE_OK) {
+        rv = bind_page_window(stmt, 2, page);
+    }
     if unlikely (rv != SQLITE_OK) {
-        sqlite3_clear_bindings(conn.op_select_movies_genre);
-        return check_result(rv, sqlite3_reset(conn.op_select_movies_genre));
+        sqlite3_clear_bindings(stmt);
+        return check_result(rv, sqlite3_reset(stmt));
     }
 
-    return iter_movies(conn.builder, conn.op_select_movies_genre, conn.op_select_movie_genres);
+    return iter_movies(conn.builder, stmt, with_genres ? conn.op_select_movie_genres : NULL);
 }
 
 /* List all movies with a given genre. */
 db_result_t db_search_movies_by_genre(
     db_conn_t *NONNULL conn,
     const char genre[NONNULL restrict const],
+    bool with_genres,
+    const struct db_page *NULLABLE page,
     struct movie *NONNULL *NONNULL output,
     size_t *NONNULL output_length,
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 ) {
-    db_result_t res = db_transaction_begin(conn, errmsg);
+    db_profile(conn, DB_OP_SEARCH_MOVIES_BY_GENRE);
+
+    db_result_t res = db_read_begin(conn, packed_genres_enabled || !with_genres, error);
     if unlikely (res != DB_SUCCESS) {
         return res;
     }
 
-    res = search_movies_in_transaction(*conn, genre);
+    res = search_movies_in_transaction(*conn, genre, with_genres, page);
     if unlikely (res != DB_SUCCESS) {
         if (sqlite3_extended_errcode(conn->db) != SQLITE_OK) {
-            errmsg_dup_db(errmsg, conn->db);
+            error_set_db(error, conn->db);
         } else {
-            errmsg_dup_str(errmsg, UNKNOWN_ERROR);
+            error_set_code(error, DB_ERROR_UNKNOWN);
         }
-        db_transaction_rollback(conn, errmsg);
-        return res;
-    }
-
-    res = db_transaction_commit(conn, errmsg);
-    if unlikely (res != DB_SUCCESS) {
+        db_read_abort(conn, error);
         return res;
     }
 
     size_t length;
     struct movie *list = movie_builder_take_movie_list(conn->builder, &length);
     if unlikely (list == NULL) {
-        errmsg_dup_str(errmsg, OUT_OF_MEMORY_ERROR);
+        error_set_code(error, DB_ERROR_OUT_OF_MEMORY);
         return DB_RUNTIME_ERROR;
     }
 
@@ -1169,11 +2707,16 @@ static db_result_t get_summary_in_list(movie_builder_t *NONNULL builder, sqlite3
     return DB_SUCCESS;
 }
 
-/** Read title and id of all movies and run callback on each. */
-static db_result_t list_summaries_in_transaction(const db_conn_t conn) {
+/** Read title and id of all movies, or a window of them, and run callback on each. */
+static db_result_t list_summaries_in_transaction(const db_conn_t conn, const struct db_page *NULLABLE page) {
     movie_builder_reset(conn.builder);
 
-    int rv;
+    int rv = bind_page_window(conn.op_select_all_titles, 1, page);
+    if unlikely (rv != SQLITE_OK) {
+        sqlite3_clear_bindings(conn.op_select_all_titles);
+        return check_result(rv, sqlite3_reset(conn.op_select_all_titles));
+    }
+
     db_result_t res = DB_SUCCESS;
     while ((rv = sqlite3_step(conn.op_select_all_titles)) == SQLITE_ROW) {
         res = get_summary_in_list(conn.builder, conn.op_select_all_titles);
@@ -1193,35 +2736,33 @@ static db_result_t list_summaries_in_transaction(const db_conn_t conn) {
 /** List all movies with reduced information. */
 db_result_t db_list_summaries(
     db_conn_t *NONNULL conn,
+    const struct db_page *NULLABLE page,
     struct movie_summary *NONNULL *NONNULL output,
     size_t *NONNULL output_length,
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 ) {
-    db_result_t res = db_transaction_begin(conn, errmsg);
+    db_profile(conn, DB_OP_LIST_SUMMARIES);
+
+    db_result_t res = db_read_begin(conn, true, error);
     if unlikely (res != DB_SUCCESS) {
         return res;
     }
 
-    res = list_summaries_in_transaction(*conn);
+    res = list_summaries_in_transaction(*conn, page);
     if unlikely (res != DB_SUCCESS) {
         if (sqlite3_extended_errcode(conn->db) != SQLITE_OK) {
-            errmsg_dup_db(errmsg, conn->db);
+            error_set_db(error, conn->db);
         } else {
-            errmsg_dup_str(errmsg, UNKNOWN_ERROR);
+            error_set_code(error, DB_ERROR_UNKNOWN);
         }
-        db_transaction_rollback(conn, errmsg);
-        return res;
-    }
-
-    res = db_transaction_commit(conn, errmsg);
-    if unlikely (res != DB_SUCCESS) {
+        db_read_abort(conn, error);
         return res;
     }
 
     size_t length;
     struct movie_summary *list = movie_builder_take_summary_list(conn->builder, &length);
     if unlikely (list == NULL) {
-        errmsg_dup_str(errmsg, OUT_OF_MEMORY_ERROR);
+        error_set_code(error, DB_ERROR_OUT_OF_MEMORY);
         return DB_RUNTIME_ERROR;
     }
 
@@ -1229,3 +2770,160 @@ db_result_t db_list_summaries(
     *output_length = length;
     return DB_SUCCESS;
 }
+
+[[gnu::nonnull(1)]]
+/** Binds where `db_changes_since` starts to the `:after_generation` and `:after_id` parameters, from index `first`. */
+static int bind_changes_start(
+    sqlite3_stmt *NONNULL stmt,
+    int first,
+    uint64_t generation,
+    const struct db_change *NULLABLE after
+) {
+    // without a change to resume from, every change at `generation` was already seen
+    const uint64_t after_generation = after != NULL ? after->generation : generation;
+    int rv = sqlite3_bind_int64(stmt, first, (int64_t) after_generation);
+    if likely (rv == SQLITE_OK) {
+        rv = sqlite3_bind_int64(stmt, first + 1, after != NULL ? after->movie_id : INT64_MAX);
+    }
+    return rv;
+}
+
+[[gnu::nonnull(4, 5)]]
+/** Reads the changes after `generation`, or after the `after` change, into a newly allocated list. */
+static db_result_t select_changes_in_transaction(
+    const db_conn_t conn,
+    uint64_t generation,
+    const struct db_change *NULLABLE after,
+    struct db_change *NULLABLE *NONNULL output,
+    size_t *NONNULL output_length
+) {
+    static constexpr const size_t INITIAL_CAPACITY = 16;
+
+    int rv = sqlite3_bind_int64(conn.op_select_changes, 1, (int64_t) generation);
+    if likely (rv == SQLITE_OK) {
+        rv = bind_changes_start(conn.op_select_changes, 2, generation, after);
+    }
+    if unlikely (rv != SQLITE_OK) {
+        sqlite3_clear_bindings(conn.op_select_changes);
+        return check_result(rv, sqlite3_reset(conn.op_select_changes));
+    }
+
+    struct db_change *changes = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    db_result_t res = DB_SUCCESS;
+    while ((rv = sqlite3_step(conn.op_select_changes)) == SQLITE_ROW) {
+        const bool created = sqlite3_column_int(conn.op_select_changes, 1) != 0;
+        const bool deleted = sqlite3_column_int(conn.op_select_changes, 2) != 0;
+        // the client never saw this movie
+        if (created && deleted) {
+            continue;
+        }
+
+        if unlikely (length >= capacity) {
+            const size_t new_capacity = capacity > 0 ? 2 * capacity : INITIAL_CAPACITY;
+            struct db_change *larger = reallocarray(changes, new_capacity, sizeof(struct db_change));
+            if unlikely (larger == NULL) {
+                res = DB_RUNTIME_ERROR;
+                break;
+            }
+            changes = larger;
+            capacity = new_capacity;
+        }
+
+        changes[length++] = (struct db_change) {
+            .movie_id = sqlite3_column_int64(conn.op_select_changes, 0),
+            .generation = (uint64_t) sqlite3_column_int64(conn.op_select_changes, 3),
+            .kind = deleted ? DB_CHANGE_DELETED : created ? DB_CHANGE_ADDED : DB_CHANGE_UPDATED,
+        };
+    }
+
+    sqlite3_clear_bindings(conn.op_select_changes);
+    const int rrv = sqlite3_reset(conn.op_select_changes);
+    if unlikely ((rv != SQLITE_DONE && rv != SQLITE_ROW) || rrv != SQLITE_OK) {
+        free(changes);
+        return check_result(rv, rrv);
+    } else if unlikely (res != DB_SUCCESS) {
+        free(changes);
+        return res;
+    }
+
+    *output = changes;
+    *output_length = length;
+    return DB_SUCCESS;
+}
+
+/** Read the existing movies changed after `generation`, or after the `after` change. */
+static db_result_t select_changed_movies_in_transaction(
+    const db_conn_t conn,
+    uint64_t generation,
+    const struct db_change *NULLABLE after
+) {
+    int rv = bind_changes_start(conn.op_select_changed_movies, 1, generation, after);
+    if unlikely (rv != SQLITE_OK) {
+        sqlite3_clear_bindings(conn.op_select_changed_movies);
+        return check_result(rv, sqlite3_reset(conn.op_select_changed_movies));
+    }
+
+    return iter_movies(conn.builder, conn.op_select_changed_movies, conn.op_select_movie_genres);
+}
+
+/** List movies changed after a catalog generation. */
+db_result_t db_changes_since(
+    db_conn_t *NONNULL conn,
+    uint64_t generation,
+    const struct db_change *NULLABLE after,
+    struct db_change *NULLABLE *NONNULL changes,
+    size_t *NONNULL changes_length,
+    struct movie *NONNULL *NULLABLE movies,
+    size_t *NONNULL movies_length,
+    db_error_t *NULLABLE restrict error
+) {
+    db_profile(conn, DB_OP_CHANGES_SINCE);
+
+    if unlikely (generation > db_generation(conn)) {
+        error_set(error, (db_error_t) {.code = DB_ERROR_FUTURE_GENERATION, .generation = generation});
+        return DB_USER_ERROR;
+    }
+
+    // with movies, both statements must see the same snapshot
+    db_result_t res = db_read_begin(conn, movies == NULL, error);
+    if unlikely (res != DB_SUCCESS) {
+        return res;
+    }
+
+    struct db_change *list = NULL;
+    size_t length = 0;
+    res = select_changes_in_transaction(*conn, generation, after, &list, &length);
+    if likely (res == DB_SUCCESS && movies != NULL) {
+        res = select_changed_movies_in_transaction(*conn, generation, after);
+    }
+    if unlikely (res != DB_SUCCESS) {
+        free(list);
+        if (sqlite3_extended_errcode(conn->db) != SQLITE_OK) {
+            error_set_db(error, conn->db);
+        } else if (res == DB_RUNTIME_ERROR) {
+            error_set_code(error, DB_ERROR_OUT_OF_MEMORY);
+        } else {
+            error_set_code(error, DB_ERROR_UNKNOWN);
+        }
+        db_read_abort(conn, error);
+        return res;
+    }
+
+    if (movies != NULL) {
+        struct movie *records = movie_builder_take_movie_list(conn->builder, movies_length);
+        if unlikely (records == NULL) {
+            free(list);
+            error_set_code(error, DB_ERROR_OUT_OF_MEMORY);
+            return DB_RUNTIME_ERROR;
+        }
+        *movies = records;
+    } else {
+        *movies_length = 0;
+    }
+
+    *changes = list;
+    *changes_length = length;
+    return DB_SUCCESS;
+}
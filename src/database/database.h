@@ -6,6 +6,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "../defines.h"
 #include "../movie/movie.h"
@@ -19,29 +20,71 @@ static constexpr const char DATABASE[] = "movies.db";
 /** Opaque handle to a database connection. */
 typedef struct database_connection db_conn_t [[gnu::aligned(ALIGNMENT_DB_CONN)]];
 
-/** Output error messages, never nullable. */
-typedef const char *NONNULL message_t;
+/** Kinds of errors reported by database functions. Messages are only built by `db_error_format`. */
+enum [[gnu::packed]] db_error_code {
+    /** No error was reported. */
+    DB_ERROR_NONE = 0,
+    DB_ERROR_UNKNOWN,
+    DB_ERROR_OUT_OF_MEMORY,
+    /** The SQLite shutdown could not be registered with `atexit`. */
+    DB_ERROR_ATEXIT,
+    /** SQLite failed with `sqlite_code`. */
+    DB_ERROR_SQLITE,
+    /** The database has an unsupported schema `version`. */
+    DB_ERROR_SCHEMA_VERSION,
+    /** Migrations left rows referencing missing ones. */
+    DB_ERROR_SCHEMA_FOREIGN_KEYS,
+    /** No movie with `movie_id`. */
+    DB_ERROR_NO_MOVIE,
+    /** No movie with `movie_id` to be deleted. */
+    DB_ERROR_NO_MOVIE_TO_DELETE,
+    /** The movie with `movie_id` already has the genre. */
+    DB_ERROR_GENRE_EXISTS,
+    /** The client `generation` is newer than the catalog. */
+    DB_ERROR_FUTURE_GENERATION,
+    /** A genre name contains `GENRE_SEPARATOR`. */
+    DB_ERROR_INVALID_GENRE,
+};
+
+/**
+ * Error reported by database functions, as a code with its context inline, so failures never allocate.
+ */
+typedef struct db_error {  // NOLINT(altera-struct-pack-align)
+    union {
+        /** For `DB_ERROR_SQLITE`, the extended result code. */
+        int sqlite_code;
+        /** For `DB_ERROR_SCHEMA_VERSION`. */
+        int64_t version;
+        /** For `DB_ERROR_NO_MOVIE`, `DB_ERROR_NO_MOVIE_TO_DELETE` and `DB_ERROR_GENRE_EXISTS`. */
+        int64_t movie_id;
+        /** For `DB_ERROR_FUTURE_GENERATION`. */
+        uint64_t generation;
+    };
+    /** What failed. */
+    enum db_error_code code;
+} db_error_t;
+
+/** Buffer size that fits any message from `db_error_format`. */
+#define DB_ERROR_LEN 128
 
 [[nodiscard("cannot use database on false"), gnu::nonnull(1), gnu::cold, gnu::leaf, gnu::nothrow]]
 /**
  * Create or migrate database at `filepath`.
  *
- * Return `true` on success. On failure, the function returns `false` and, if `errmsg` is provided, stores an error
- * message there.
+ * Return `true` on success. On failure, the function returns `false` and, if `error` is provided, stores the error
+ * there.
  *
- * @note The caller is responsible for eventually calling `db_close` to release resources and `db_free_errmsg` to free
- *      any error message.
+ * @note The caller is responsible for eventually calling `db_close` to release resources.
  */
-bool db_setup(const char filepath[NONNULL restrict], message_t *NULLABLE restrict errmsg);
+bool db_setup(const char filepath[NONNULL restrict], db_error_t *NULLABLE restrict error);
 
-[[gnu::nonnull(1), gnu::cold, gnu::leaf, gnu::nothrow]]
+[[gnu::nonnull(3), gnu::leaf, gnu::nothrow]]
 /**
- * Frees a dynamically allocated error message string.
+ * Writes the message for `error` into `buffer`, truncated to `size` bytes with the NUL terminator.
  *
- * This function releases the memory allocated for the error message returned by any database function. If `errmsg` is
- * NULL, no action is taken. After calling this function, `errmsg` becomes invalid.
+ * Returns the length of the message written, not counting the terminator.
  */
-void db_free_errmsg(message_t errmsg);
+size_t db_error_format(db_error_t error, size_t size, char buffer[NONNULL restrict size]);
 
 [[nodiscard("allocated memory must be freed"),
   gnu::malloc,
@@ -54,23 +97,20 @@ void db_free_errmsg(message_t errmsg);
  * Connects to the existing database at `filepath`.
  *
  * On success, returns a newly allocated pointer to a `db_conn` structure. On failure, the function returns `NULL` and,
- * if `errmsg` is provided, stores an error message there.
+ * if `error` is provided, stores the error there.
  *
- * @note The caller is responsible for eventually calling `db_close` to release resources and `db_free_errmsg` to free
- *      any error message.
+ * @note The caller is responsible for eventually calling `db_close` to release resources.
  */
-db_conn_t *NULLABLE db_connect(const char filepath[NONNULL restrict], message_t *NULLABLE restrict errmsg);
+db_conn_t *NULLABLE db_connect(const char filepath[NONNULL restrict], db_error_t *NULLABLE restrict error);
 
 [[gnu::nonnull(1), gnu::cold, gnu::leaf, gnu::nothrow]]
 /**
  * Closes an open database connection.
  *
- * Terminates the connection represented by `conn`. On error, the function logs a message into `errmsg` (if non-null).
+ * Terminates the connection represented by `conn`. On error, the function stores the error into `error` (if non-null).
  * Once closed, the `conn` pointer is invalid for further use.
- *
- * @note The caller must also call `db_free_errmsg` if an error message is set.
  */
-bool db_disconnect(db_conn_t *NONNULL conn, message_t *NULLABLE errmsg);
+bool db_disconnect(db_conn_t *NONNULL conn, db_error_t *NULLABLE error);
 
 /** Possible results for database operations. */
 typedef enum [[gnu::packed]] db_result {
@@ -93,13 +133,39 @@ static_assert(sizeof(db_result_t) == 1);
  * If the `id` field of `movie` is 0, a new record is created, and an ID is generated. The `movie->genres` array
  (if provided) will be inserted into the `genres` table.
  *
- * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `errmsg` is provided,
- stores an error message there.
+ * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `error` is provided,
+ stores the error there.
  */
 db_result_t db_register_movie(
     db_conn_t *NONNULL conn,
     struct movie *NONNULL movie,
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
+);
+
+/** What `db_upsert_movie` did with the movie. */
+enum [[gnu::packed]] db_upsert_outcome {
+    /** No movie had the same key, so a new one was created. */
+    DB_UPSERT_INSERTED,
+    /** Some genres were added to the existing movie. */
+    DB_UPSERT_MERGED,
+    /** The existing movie already had every genre. */
+    DB_UPSERT_UNCHANGED,
+};
+
+[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1, 2, 3), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Registers a movie unless another one has the same title, director and release year, in which case the genres of
+ * `movie` missing from the existing one are added to it. Either way, the `id` field of `movie` is updated and
+ * `outcome` tells which happened. Re-importing the same movies only costs index lookups.
+ *
+ * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `error` is provided,
+ * stores the error there.
+ */
+db_result_t db_upsert_movie(
+    db_conn_t *NONNULL conn,
+    struct movie *NONNULL movie,
+    enum db_upsert_outcome *NONNULL outcome,
+    db_error_t *NULLABLE restrict error
 );
 
 [[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1, 3), gnu::hot, gnu::leaf, gnu::nothrow]]
@@ -108,82 +174,193 @@ db_result_t db_register_movie(
  *
  * Ensures the movie exists and the genre is new to that movie. If required, also creates a entry for the genre itself.
  *
- * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `errmsg` is provided,
- stores an error message there.
+ * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `error` is provided,
+ stores the error there.
  */
 db_result_t db_add_genre(
     db_conn_t *NONNULL conn,
     int64_t movie_id,
     const char genre[NONNULL restrict const],
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 );
 
 [[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
 /**
  * Removes a movie from the database.
  *
- * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `errmsg` is provided,
- stores an error message there.
+ * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `error` is provided,
+ stores the error there.
  */
-db_result_t db_delete_movie(db_conn_t *NONNULL conn, int64_t movie_id, message_t *NULLABLE restrict errmsg);
+db_result_t db_delete_movie(db_conn_t *NONNULL conn, int64_t movie_id, db_error_t *NULLABLE restrict error);
 
-[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1, 3), gnu::hot, gnu::leaf, gnu::nothrow]]
+[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1, 4), gnu::hot, gnu::leaf, gnu::nothrow]]
 /**
  * Get a movie from the database and write it to `movie`. The caller is reponsible for calling `free` on each.
  *
- * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `errmsg` is provided,
- stores an error message there.
+ * Genres are only read if `with_genres`, otherwise the movie has none.
+ *
+ * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `error` is provided,
+ stores the error there.
  */
 db_result_t db_get_movie(
     db_conn_t *NONNULL conn,
     int64_t movie_id,
+    bool with_genres,
     struct movie *NONNULL output,
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 );
 
-[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1, 2, 3), gnu::hot]]
+/** Columns that `db_list_movies` can sort by. */
+enum [[gnu::packed]] db_order {
+    DB_ORDER_ID,
+    DB_ORDER_TITLE,
+    DB_ORDER_RELEASE_YEAR,
+};
+
+/** Sorted window of the movie list, for `db_list_movies`. Searches and summaries only take its `limit` and `offset`. */
+struct db_page {
+    /** Maximum number of movies, or zero for all of them. */
+    uint64_t limit;
+    /** Number of movies skipped before the first one returned. */
+    uint64_t offset;
+    /** Sort column. Ties are broken by id, in the same direction. */
+    enum db_order order_by;
+    /** Sort from the largest to the smallest value. */
+    bool descending;
+};
+
+[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1, 4, 5), gnu::hot]]
 /**
  * List all movies from the database and run `callback` on each one. The caller is reponsible for calling `free` on it.
  *
- * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `errmsg` is provided,
- stores an error message there.
+ * Genres are only read if `with_genres`, otherwise the movies have none. If `page` is given, only that window of the
+ * sorted list is read, walking the index of the sort column, so the cost depends on the window and not on the catalog.
+ *
+ * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `error` is provided,
+ stores the error there.
  */
 db_result_t db_list_movies(
     db_conn_t *NONNULL conn,
+    bool with_genres,
+    const struct db_page *NULLABLE page,
     struct movie *NONNULL *NONNULL output,
     size_t *NONNULL output_length,
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 );
 
-[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1, 2, 3, 4), gnu::hot]]
+[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1, 2, 5, 6), gnu::hot]]
 /**
  * List all movies with a given genre and run `callback` on each one. The caller is reponsible for calling `free` on
  * each.
  *
- * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `errmsg` is provided,
- * stores an error message there.
+ * Genres are only read if `with_genres`, otherwise the movies have none. Movies are sorted by id, and if `page` is
+ * given, only that window is read.
+ *
+ * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `error` is provided,
+ * stores the error there.
  */
 db_result_t db_search_movies_by_genre(
     db_conn_t *NONNULL conn,
     const char genre[NONNULL restrict const],
+    bool with_genres,
+    const struct db_page *NULLABLE page,
     struct movie *NONNULL *NONNULL output,
     size_t *NONNULL output_length,
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 );
 
-[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1, 2, 3), gnu::hot]]
+[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1, 3, 4), gnu::hot]]
 /**
  * List summaries of all movies in the database and run `callback` on each summary. The caller is reponsible for calling
  * `free` on it.
  *
- * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `errmsg` is provided,
- * stores an error message there.
+ * Summaries are sorted by id, and if `page` is given, only that window is read.
+ *
+ * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `error` is provided,
+ * stores the error there.
  */
 db_result_t db_list_summaries(
     db_conn_t *NONNULL conn,
+    const struct db_page *NULLABLE page,
     struct movie_summary *NONNULL *NONNULL output,
     size_t *NONNULL output_length,
-    message_t *NULLABLE restrict errmsg
+    db_error_t *NULLABLE restrict error
 );
 
+/** Kind of change reported by `db_changes_since`. */
+enum [[gnu::packed]] db_change_kind {
+    /** Movie created after the generation. */
+    DB_CHANGE_ADDED,
+    /** Movie that already existed at the generation, and was modified after it. */
+    DB_CHANGE_UPDATED,
+    /** Movie that already existed at the generation, and was removed after it. */
+    DB_CHANGE_DELETED,
+};
+
+/** A movie changed after some catalog generation. */
+struct db_change {
+    /** The changed movie. */
+    int64_t movie_id;
+    /** Generation of its last change. Changes are listed by generation, then by movie id. */
+    uint64_t generation;
+    /** What happened to it. */
+    enum db_change_kind kind;
+};
+
+[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(1, 4, 5, 7), gnu::hot]]
+/**
+ * List the movies changed after catalog `generation`, oldest change first, as returned by `db_generation`. Movies
+ * created and removed after `generation` are skipped. If `movies` is given, the current data for added and updated
+ * movies is also read, in the same snapshot. The caller is reponsible for calling `free` on both lists.
+ *
+ * If `after` is given, a list that was cut short resumes after that change, whose `generation` and `movie_id` are read.
+ *
+ * Return `DB_SUCCESS` on success; otherwise, returns one of the `db_result` error codes and, if `error` is provided,
+ * stores the error there. A `generation` newer than the catalog is a `DB_USER_ERROR`.
+ */
+db_result_t db_changes_since(
+    db_conn_t *NONNULL conn,
+    uint64_t generation,
+    const struct db_change *NULLABLE after,
+    struct db_change *NULLABLE *NONNULL changes,
+    size_t *NONNULL changes_length,
+    struct movie *NONNULL *NULLABLE movies,
+    size_t *NONNULL movies_length,
+    db_error_t *NULLABLE restrict error
+);
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1), gnu::hot]]
+/**
+ * Checks if the connection has a read snapshot open, see `db_end_snapshot`. Results read while a snapshot was already
+ * open may be older than the latest commit.
+ */
+bool db_has_snapshot(const db_conn_t *NONNULL conn);
+
+[[gnu::nonnull(1), gnu::hot]]
+/**
+ * Closes the read snapshot kept open by reads that need more than one statement, so consecutive reads on the same
+ * connection see the same data without repeating `BEGIN` and `COMMIT`. Must be called before the connection goes idle,
+ * since an open snapshot holds a shared lock on the database. Writes close it on their own.
+ *
+ * Return `DB_SUCCESS` on success or when there is no snapshot; otherwise, returns one of the `db_result` error codes
+ * and, if `error` is provided, stores the error there.
+ */
+db_result_t db_end_snapshot(db_conn_t *NONNULL conn, db_error_t *NULLABLE restrict error);
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1), gnu::hot]]
+/**
+ * Catalog generation for the next read on this connection. Every committed write increases it, and data returned by
+ * the read is at least as new as this generation, so equal generations mean the client already has the latest lists.
+ */
+uint64_t db_generation(const db_conn_t *NONNULL conn);
+
+[[gnu::nonnull(1), gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Writes the profiling aggregates as YAML entries under a `database` key, indented for the `stats` response.
+ *
+ * Operation timings and statement counters are only collected when `DB_PROFILE` is set, otherwise only the disabled
+ * state is reported.
+ */
+void db_stats_report(FILE *NONNULL output);
+
 #endif  // SRC_DATABASE_H
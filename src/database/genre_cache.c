@@ -0,0 +1,290 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../alloc.h"
+#include "../defines.h"
+#include "./genre_cache.h"
+
+/** Initial number of slots in the cache table. */
+#define GENRE_CACHE_INITIAL_CAPACITY 64
+/** Initial number of pending entries per transaction. */
+#define GENRE_CACHE_TXN_INITIAL_CAPACITY 8
+
+static_assert(is_power_of_two((unsigned) GENRE_CACHE_INITIAL_CAPACITY));
+
+/** A cached genre. Empty slots have a `NULL` name. */
+struct genre_entry {
+    /** Owned copy of the genre name. */
+    char *NULLABLE name;
+    /** Hash of `name`, kept to avoid recomputing on probes and resizes. */
+    uint64_t hash;
+    /** Genre id in the database. */
+    int64_t id;
+};
+
+/** Open addressing hash table with linear probing, protected by `lock`. */
+static struct genre_table {
+    /** Protects every other field. */
+    pthread_mutex_t lock;
+    /** Slot array, `NULL` before the first insertion. */
+    struct genre_entry *NULLABLE slots;
+    /** Number of slots, always a power of two. */
+    size_t capacity;
+    /** Number of used slots. */
+    size_t count;
+    /**
+     * Incremented on every invalidation. Transactions that see a different value on commit may hold ids to deleted
+     * genres, and must not publish them.
+     */
+    uint64_t epoch;
+} table = {.lock = PTHREAD_MUTEX_INITIALIZER, .slots = NULL, .capacity = 0, .count = 0, .epoch = 0};
+
+/** Lookups resolved by the cache. */
+static atomic_uint_fast64_t hits = 0;
+/** Lookups that had to query the database. */
+static atomic_uint_fast64_t misses = 0;
+
+/** Genres recorded by the current transaction of a connection. */
+struct genre_cache_txn {
+    /** Value of `table.epoch` when the transaction started. */
+    uint64_t epoch;
+    /** Number of pending entries. */
+    size_t count;
+    /** Allocated size of `entries`. */
+    size_t capacity;
+    /** Pending entries, with owned names. */
+    struct genre_entry *NULLABLE entries;
+};
+
+[[gnu::pure, gnu::nonnull(1), gnu::hot]]
+/** FNV-1a hash of a NUL-terminated string. */
+static uint64_t genre_hash(const char name[NONNULL]) {
+    static constexpr const uint64_t FNV_OFFSET = 0xCBF2'9CE4'8422'2325;
+    static constexpr const uint64_t FNV_PRIME = 0x0000'0100'0000'01B3;
+
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; name[i] != '\0'; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+[[gnu::pure, gnu::nonnull(1), gnu::hot]]
+/**
+ * Finds the slot for `name` in the table, or the empty slot where it would be inserted. Must hold `table.lock` and
+ * have `table.slots` allocated.
+ */
+static size_t genre_table_find(const char name[NONNULL], uint64_t hash) {
+    const size_t mask = table.capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const struct genre_entry *slot = &(table.slots[i]);
+        if (slot->name == NULL || (slot->hash == hash && strcmp(slot->name, name) == 0)) {
+            return i;
+        }
+    }
+}
+
+[[gnu::cold]]
+/**
+ * Doubles the table capacity, or allocates the initial table. Must hold `table.lock`.
+ *
+ * Returns `false` on allocation failures, keeping the previous table.
+ */
+static bool genre_table_grow(void) {
+    const size_t capacity = table.capacity == 0 ? GENRE_CACHE_INITIAL_CAPACITY : 2 * table.capacity;
+    struct genre_entry *slots = calloc(capacity, sizeof(struct genre_entry));
+    if unlikely (slots == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < table.capacity; i++) {
+        const struct genre_entry *entry = &(table.slots[i]);
+        if (entry->name == NULL) {
+            continue;
+        }
+        size_t j = entry->hash & (capacity - 1);
+        while (slots[j].name != NULL) {
+            j = (j + 1) & (capacity - 1);
+        }
+        slots[j] = *entry;
+    }
+
+    free(table.slots);
+    table.slots = slots;
+    table.capacity = capacity;
+    return true;
+}
+
+/** Looks up a committed genre id. */
+bool genre_cache_get(const char name[NONNULL], int64_t *NONNULL id) {
+    const uint64_t hash = genre_hash(name);
+
+    pthread_mutex_lock(&table.lock);
+    bool found = false;
+    if likely (table.slots != NULL) {
+        const struct genre_entry *slot = &(table.slots[genre_table_find(name, hash)]);
+        if (slot->name != NULL) {
+            *id = slot->id;
+            found = true;
+        }
+    }
+    pthread_mutex_unlock(&table.lock);
+
+    atomic_fetch_add_explicit(found ? &hits : &misses, 1, memory_order_relaxed);
+    return found;
+}
+
+[[gnu::nonnull(1)]]
+/** Inserts or updates a single entry, taking ownership of `entry->name`. Must hold `table.lock`. */
+static void genre_table_put(struct genre_entry *NONNULL entry) {
+    // keep load factor under 1/2
+    if unlikely (2 * (table.count + 1) > table.capacity && !genre_table_grow()) {
+        free(entry->name);
+        return;
+    }
+
+    struct genre_entry *slot = &(table.slots[genre_table_find(entry->name, entry->hash)]);
+    if (slot->name != NULL) {
+        slot->id = entry->id;
+        free(entry->name);
+        return;
+    }
+    *slot = *entry;
+    table.count += 1;
+}
+
+/** Removes a deleted genre, using backward shift to keep probe sequences intact. */
+void genre_cache_invalidate(const char name[NONNULL]) {
+    const uint64_t hash = genre_hash(name);
+
+    pthread_mutex_lock(&table.lock);
+    table.epoch += 1;
+    if unlikely (table.slots == NULL) {
+        pthread_mutex_unlock(&table.lock);
+        return;
+    }
+
+    const size_t mask = table.capacity - 1;
+    size_t hole = genre_table_find(name, hash);
+    if (table.slots[hole].name == NULL) {
+        pthread_mutex_unlock(&table.lock);
+        return;
+    }
+    free(table.slots[hole].name);
+    table.slots[hole].name = NULL;
+    table.count -= 1;
+
+    for (size_t i = (hole + 1) & mask; table.slots[i].name != NULL; i = (i + 1) & mask) {
+        const size_t home = table.slots[i].hash & mask;
+        // move the entry back if its home slot is not in the cyclic range (hole, i]
+        const bool reachable = (hole < i) ? (hole < home && home <= i) : (hole < home || home <= i);
+        if (!reachable) {
+            table.slots[hole] = table.slots[i];
+            table.slots[i].name = NULL;
+            hole = i;
+        }
+    }
+    pthread_mutex_unlock(&table.lock);
+}
+
+/** Allocates an empty pending list. */
+genre_cache_txn_t *NULLABLE genre_cache_txn_create(void) {
+    genre_cache_txn_t *txn = alloc_like(genre_cache_txn_t);
+    if unlikely (txn == NULL) {
+        return NULL;
+    }
+    txn->epoch = 0;
+    txn->count = 0;
+    txn->capacity = 0;
+    txn->entries = NULL;
+    return txn;
+}
+
+/** Drops all pending entries. */
+void genre_cache_txn_rollback(genre_cache_txn_t *NONNULL txn) {
+    for (size_t i = 0; i < txn->count; i++) {
+        free(txn->entries[i].name);
+    }
+    txn->count = 0;
+}
+
+/** Frees the pending list. */
+void genre_cache_txn_destroy(genre_cache_txn_t *NONNULL txn) {
+    genre_cache_txn_rollback(txn);
+    free(txn->entries);
+    free(txn);
+}
+
+/** Captures the current epoch for the new transaction. */
+void genre_cache_txn_begin(genre_cache_txn_t *NONNULL txn) {
+    genre_cache_txn_rollback(txn);
+
+    pthread_mutex_lock(&table.lock);
+    txn->epoch = table.epoch;
+    pthread_mutex_unlock(&table.lock);
+}
+
+/** Records a genre seen by the current transaction. */
+void genre_cache_txn_add(genre_cache_txn_t *NONNULL txn, const char name[NONNULL], int64_t id) {
+    if unlikely (txn->count >= txn->capacity) {
+        const size_t capacity = txn->capacity == 0 ? GENRE_CACHE_TXN_INITIAL_CAPACITY : 2 * txn->capacity;
+        struct genre_entry *entries = reallocarray(txn->entries, capacity, sizeof(struct genre_entry));
+        if unlikely (entries == NULL) {
+            return;
+        }
+        txn->entries = entries;
+        txn->capacity = capacity;
+    }
+
+    char *copy = strdup(name);
+    if unlikely (copy == NULL) {
+        return;
+    }
+    txn->entries[txn->count++] = (struct genre_entry) {.name = copy, .hash = genre_hash(copy), .id = id};
+}
+
+/** Publishes pending entries, unless some genre was deleted in the meantime. */
+void genre_cache_txn_commit(genre_cache_txn_t *NONNULL txn) {
+    if likely (txn->count == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&table.lock);
+    const bool valid = table.epoch == txn->epoch;
+    if likely (valid) {
+        for (size_t i = 0; i < txn->count; i++) {
+            genre_table_put(&(txn->entries[i]));
+        }
+        txn->count = 0;
+    }
+    pthread_mutex_unlock(&table.lock);
+
+    if unlikely (!valid) {
+        genre_cache_txn_rollback(txn);
+    }
+}
+
+/** Writes cache size and hit counters as YAML. */
+void genre_cache_stats_report(FILE *NONNULL output) {
+    pthread_mutex_lock(&table.lock);
+    const size_t count = table.count;
+    const uint64_t epoch = table.epoch;
+    pthread_mutex_unlock(&table.lock);
+
+    (void) fprintf(
+        output,
+        "  genre_cache:\n    entries: %zu\n    invalidations: %" PRIu64 "\n    hits: %" PRIu64 "\n    misses: %" PRIu64
+        "\n",
+        count,
+        epoch,
+        (uint64_t) atomic_load_explicit(&hits, memory_order_relaxed),
+        (uint64_t) atomic_load_explicit(&misses, memory_order_relaxed)
+    );
+}
@@ -0,0 +1,77 @@
+#ifndef SRC_DATABASE_GENRE_CACHE_H
+/** Process-wide cache of genre names to their database ids, for the write paths. */
+#define SRC_DATABASE_GENRE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../defines.h"
+
+/**
+ * Genres created by a single write transaction, published to the cache only after it commits.
+ *
+ * Each connection owns one, reused across transactions.
+ */
+typedef struct genre_cache_txn genre_cache_txn_t;
+
+[[nodiscard("must be freed"), gnu::malloc, gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Allocates the pending list for a connection. Returns `NULL` on allocation failures.
+ */
+genre_cache_txn_t *NULLABLE genre_cache_txn_create(void);
+
+[[gnu::nonnull(1), gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Frees the pending list.
+ */
+void genre_cache_txn_destroy(genre_cache_txn_t *NONNULL txn);
+
+[[gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Starts tracking a write transaction. Must be called while holding the database write lock (`BEGIN IMMEDIATE`), so
+ * that invalidations from other writers are ordered with this transaction.
+ */
+void genre_cache_txn_begin(genre_cache_txn_t *NONNULL txn);
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1, 2), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Looks up the id of a committed genre. Returns `false` on misses, which must fall back to the database.
+ */
+bool genre_cache_get(const char name[NONNULL], int64_t *NONNULL id);
+
+[[gnu::nonnull(1, 2), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Records a genre id read or created by the current transaction. Allocation failures just skip caching it.
+ */
+void genre_cache_txn_add(genre_cache_txn_t *NONNULL txn, const char name[NONNULL], int64_t id);
+
+[[gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Publishes the genres recorded by a committed transaction.
+ *
+ * Entries are discarded instead if any genre was invalidated since `genre_cache_txn_begin`, because they could have been
+ * deleted after the commit.
+ */
+void genre_cache_txn_commit(genre_cache_txn_t *NONNULL txn);
+
+[[gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Discards the genres recorded by a rolled back transaction, since their ids may be reused.
+ */
+void genre_cache_txn_rollback(genre_cache_txn_t *NONNULL txn);
+
+[[gnu::nonnull(1), gnu::leaf, gnu::nothrow]]
+/**
+ * Removes a deleted genre from the cache.
+ */
+void genre_cache_invalidate(const char name[NONNULL]);
+
+[[gnu::nonnull(1), gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Writes cache size and hit rate as YAML entries under a `genre_cache` key, indented for the `stats` response.
+ */
+void genre_cache_stats_report(FILE *NONNULL output);
+
+#endif  // SRC_DATABASE_GENRE_CACHE_H
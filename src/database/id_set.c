@@ -0,0 +1,150 @@
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../config.h"
+#include "../defines.h"
+#include "./id_set.h"
+
+/** Bits in each word of a leaf. */
+#define ID_SET_WORD_BITS 64
+/** Ids covered by a single leaf, allocated on the first id in its range. */
+#define ID_SET_LEAF_BITS (1 << 16)
+/** Number of leaves, so ids from 1 up to `ID_SET_LEAVES * ID_SET_LEAF_BITS` are tracked. */
+#define ID_SET_LEAVES (1 << 16)
+
+/** Words in a leaf. */
+#define ID_SET_LEAF_WORDS (ID_SET_LEAF_BITS / ID_SET_WORD_BITS)
+
+/**
+ * First level of the bitmap, with a lazily allocated leaf for each range of `ID_SET_LEAF_BITS` ids. Leaves are installed
+ * with a CAS and never freed, so readers need no locks.
+ */
+static _Atomic(atomic_uint_fast64_t *) leaves[ID_SET_LEAVES];
+
+/** Set once every existing id was added, if the bitmap is enabled. */
+static atomic_bool ready = false;
+/** Set if a leaf could not be allocated, which makes every lookup fall back to the database. */
+static atomic_bool incomplete = false;
+/** If the bitmap is used at all. Set by `DB_ID_BITMAP`. */
+static bool enabled = true;
+
+/** Lookups answered as missing without a query. */
+static atomic_uint_fast64_t rejected = 0;
+
+/** Reads configuration. */
+void id_set_setup(void) {
+    enabled = config_u64("DB_ID_BITMAP", 1) != 0;
+}
+
+/** Starts answering lookups from the bitmap. */
+void id_set_ready(void) {
+    atomic_store(&ready, enabled);
+}
+
+[[gnu::nonnull(2, 3, 4)]]
+/** Position of `id` in the bitmap. Returns `false` for untracked ids. */
+static inline bool id_set_position(int64_t id, size_t *NONNULL leaf, size_t *NONNULL word, uint64_t *NONNULL mask) {
+    if unlikely (id <= 0 || (uint64_t) id > (uint64_t) ID_SET_LEAVES * ID_SET_LEAF_BITS) {
+        return false;
+    }
+
+    const uint64_t index = (uint64_t) id - 1;
+    *leaf = (size_t) (index / ID_SET_LEAF_BITS);
+    *word = (size_t) ((index % ID_SET_LEAF_BITS) / ID_SET_WORD_BITS);
+    *mask = UINT64_C(1) << (index % ID_SET_WORD_BITS);
+    return true;
+}
+
+[[gnu::cold]]
+/** Allocates and installs a leaf, or returns the one installed concurrently by another thread. */
+static atomic_uint_fast64_t *NULLABLE id_set_leaf_create(size_t leaf) {
+    atomic_uint_fast64_t *created = calloc(ID_SET_LEAF_WORDS, sizeof(atomic_uint_fast64_t));
+    if unlikely (created == NULL) {
+        return NULL;
+    }
+
+    atomic_uint_fast64_t *expected = NULL;
+    if (atomic_compare_exchange_strong_explicit(
+            &(leaves[leaf]),
+            &expected,
+            created,
+            memory_order_acq_rel,
+            memory_order_acquire
+        )) {
+        return created;
+    }
+    free(created);
+    return expected;
+}
+
+/** Sets the bit for `id`. */
+void id_set_add(int64_t id) {
+    size_t leaf, word;
+    uint64_t mask;
+    if unlikely (!id_set_position(id, &leaf, &word, &mask)) {
+        return;
+    }
+
+    atomic_uint_fast64_t *bits = atomic_load_explicit(&(leaves[leaf]), memory_order_acquire);
+    if unlikely (bits == NULL) {
+        bits = id_set_leaf_create(leaf);
+        if unlikely (bits == NULL) {
+            // an unrecorded id would be reported as missing
+            atomic_store(&incomplete, true);
+            return;
+        }
+    }
+    atomic_fetch_or_explicit(&(bits[word]), mask, memory_order_release);
+}
+
+/** Clears the bit for `id`. */
+void id_set_remove(int64_t id) {
+    size_t leaf, word;
+    uint64_t mask;
+    if unlikely (!id_set_position(id, &leaf, &word, &mask)) {
+        return;
+    }
+
+    atomic_uint_fast64_t *bits = atomic_load_explicit(&(leaves[leaf]), memory_order_acquire);
+    if likely (bits != NULL) {
+        atomic_fetch_and_explicit(&(bits[word]), ~mask, memory_order_release);
+    }
+}
+
+/** Checks the bit for `id`, if the bitmap can answer it. */
+bool id_set_may_contain(int64_t id) {
+    if unlikely (!atomic_load_explicit(&ready, memory_order_acquire)) {
+        return true;
+    }
+    if unlikely (atomic_load_explicit(&incomplete, memory_order_relaxed)) {
+        return true;
+    }
+
+    size_t leaf, word;
+    uint64_t mask;
+    if unlikely (!id_set_position(id, &leaf, &word, &mask)) {
+        return true;
+    }
+
+    const atomic_uint_fast64_t *bits = atomic_load_explicit(&(leaves[leaf]), memory_order_acquire);
+    const bool present = bits != NULL && (atomic_load_explicit(&(bits[word]), memory_order_acquire) & mask) != 0;
+    if (!present) {
+        atomic_fetch_add_explicit(&rejected, 1, memory_order_relaxed);
+    }
+    return present;
+}
+
+/** Writes the bitmap state as YAML. */
+void id_set_stats_report(FILE *NONNULL output) {
+    const bool active = atomic_load(&ready) && !atomic_load(&incomplete);
+    (void) fprintf(
+        output,
+        "  id_set:\n    active: %s\n    rejected: %" PRIu64 "\n",
+        active ? "true" : "false",
+        (uint64_t) atomic_load_explicit(&rejected, memory_order_relaxed)
+    );
+}
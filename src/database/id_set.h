@@ -0,0 +1,52 @@
+#ifndef SRC_DATABASE_ID_SET_H
+/** Process-wide set of existing movie ids, to answer lookups for missing movies without touching the database. */
+#define SRC_DATABASE_ID_SET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../defines.h"
+
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Prepares the set before loading, reading `DB_ID_BITMAP`. Until `id_set_ready` is called, or if disabled, every id is
+ * reported as possibly present.
+ */
+void id_set_setup(void);
+
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Marks the set as complete, after all existing ids were added. From then on, ids not in the set are known to be
+ * missing.
+ */
+void id_set_ready(void);
+
+[[gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Adds a movie id. Must be called before the insert commits, so there is never a window where an existing movie is
+ * reported as missing.
+ */
+void id_set_add(int64_t id);
+
+[[gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Removes a movie id. Must be called only after the delete commits.
+ */
+void id_set_remove(int64_t id);
+
+[[nodiscard("useless call if discarded"), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Returns `false` only if the movie is known not to exist. Ids outside the tracked range, or any id when the set is not
+ * ready, are reported as possibly present.
+ */
+bool id_set_may_contain(int64_t id);
+
+[[gnu::nonnull(1), gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Writes the set state and number of rejected lookups as YAML entries under an `id_set` key, indented for the `stats`
+ * response.
+ */
+void id_set_stats_report(FILE *NONNULL output);
+
+#endif  // SRC_DATABASE_ID_SET_H
@@ -1,8 +1,10 @@
 #ifndef SRC_DATABASE_SCHEMA_H
+/** Numbered schema migrations, applied in order by `db_setup`. */
 #define SRC_DATABASE_SCHEMA_H
 
 // clang-format off
-static constexpr const char SCHEMA[] =
+/** Version 1: the original schema. Uses `IF NOT EXISTS` so databases created before versioning are adopted as-is. */
+static constexpr const char MIGRATION_1[] =
     "CREATE TABLE IF NOT EXISTS movie(\n"
     "    -- Identificador: Número único para cada filme\n"
     "    id INTEGER PRIMARY KEY ASC AUTOINCREMENT NOT NULL,\n"
@@ -36,6 +38,149 @@ static constexpr const char SCHEMA[] =
     "CREATE INDEX IF NOT EXISTS movie_id_link ON movie_genre(movie_id);\n"
     "CREATE INDEX IF NOT EXISTS genre_id_link ON movie_genre(genre_id);\n"
 ;
+
+/**
+ * Version 2: `movie_genre` becomes a WITHOUT ROWID table clustered on (genre_id, movie_id), so searches by genre read a
+ * contiguous range, with a covering reverse index for the genres of a movie. The old `movie_id_link`, `genre_id_link`
+ * and `genre_name` indexes were redundant with the unique constraints and are dropped.
+ */
+static constexpr const char MIGRATION_2[] =
+    "CREATE TABLE movie_genre_v2(\n"
+    "    genre_id INTEGER NOT NULL,\n"
+    "    movie_id INTEGER NOT NULL,\n"
+    "    PRIMARY KEY (genre_id, movie_id),\n"
+    "    FOREIGN KEY (movie_id)\n"
+    "        REFERENCES movie(id)\n"
+    "        ON DELETE CASCADE,\n"
+    "    FOREIGN KEY (genre_id)\n"
+    "        REFERENCES genre(id)\n"
+    "        ON DELETE CASCADE\n"
+    ") STRICT, WITHOUT ROWID;\n"
+    "\n"
+    "INSERT OR IGNORE INTO movie_genre_v2(genre_id, movie_id)\n"
+    "    SELECT genre_id, movie_id\n"
+    "        FROM movie_genre;\n"
+    "\n"
+    "DROP TABLE movie_genre;\n"
+    "ALTER TABLE movie_genre_v2 RENAME TO movie_genre;\n"
+    "\n"
+    "CREATE UNIQUE INDEX movie_genre_by_movie ON movie_genre(movie_id, genre_id);\n"
+    "DROP INDEX IF EXISTS genre_name;\n"
+;
+
+/**
+ * Version 3: denormalized copy of the genre names in `movie.genres`, joined by `GENRE_SEPARATOR`, so full movies can be
+ * read from the `movie` row alone. `movie_genre` remains the source of truth for searches.
+ */
+static constexpr const char MIGRATION_3[] =
+    "ALTER TABLE movie ADD COLUMN genres TEXT NOT NULL DEFAULT '';\n"
+    "\n"
+    "UPDATE movie\n"
+    "    SET genres = coalesce((\n"
+    "        SELECT group_concat(genre.name, char(31))\n"
+    "            FROM movie_genre\n"
+    "                INNER JOIN genre ON genre.id = movie_genre.genre_id\n"
+    "            WHERE movie_genre.movie_id = movie.id\n"
+    "    ), '');\n"
+;
+
+/**
+ * Version 4: `movie` and `genre` drop `AUTOINCREMENT`, which reads and writes `sqlite_sequence` on every insert. Ids are
+ * now reserved in blocks from `id_block`, where `next` is the first id never handed out for that table. Blocks start
+ * after both the old sequence and the current maximum, so ids are still never reused.
+ */
+static constexpr const char MIGRATION_4[] =
+    "CREATE TABLE id_block(\n"
+    "    name TEXT PRIMARY KEY NOT NULL,\n"
+    "    next INTEGER NOT NULL\n"
+    ") STRICT, WITHOUT ROWID;\n"
+    "\n"
+    "INSERT INTO id_block(name, next)\n"
+    "    SELECT 'movie', max(\n"
+    "        coalesce((SELECT seq FROM sqlite_sequence WHERE name = 'movie'), 0),\n"
+    "        coalesce((SELECT max(id) FROM movie), 0)\n"
+    "    ) + 1;\n"
+    "INSERT INTO id_block(name, next)\n"
+    "    SELECT 'genre', max(\n"
+    "        coalesce((SELECT seq FROM sqlite_sequence WHERE name = 'genre'), 0),\n"
+    "        coalesce((SELECT max(id) FROM genre), 0)\n"
+    "    ) + 1;\n"
+    "\n"
+    "CREATE TABLE movie_v4(\n"
+    "    id INTEGER PRIMARY KEY ASC NOT NULL,\n"
+    "    title TEXT NOT NULL,\n"
+    "    director TEXT NOT NULL,\n"
+    "    release_year INTEGER NOT NULL,\n"
+    "    genres TEXT NOT NULL DEFAULT ''\n"
+    ") STRICT;\n"
+    "INSERT INTO movie_v4(id, title, director, release_year, genres)\n"
+    "    SELECT id, title, director, release_year, genres\n"
+    "        FROM movie;\n"
+    "DROP TABLE movie;\n"
+    "ALTER TABLE movie_v4 RENAME TO movie;\n"
+    "\n"
+    "CREATE TABLE genre_v4(\n"
+    "    id INTEGER PRIMARY KEY ASC NOT NULL,\n"
+    "    name TEXT UNIQUE NOT NULL\n"
+    ") STRICT;\n"
+    "INSERT INTO genre_v4(id, name)\n"
+    "    SELECT id, name\n"
+    "        FROM genre;\n"
+    "DROP TABLE genre;\n"
+    "ALTER TABLE genre_v4 RENAME TO genre;\n"
+;
+
+/**
+ * Version 5: `movie_change` keeps the last catalog generation that touched each movie, with tombstones for deleted ones,
+ * so clients can sync only what changed. Generations are handed out from the `generation` row in `id_block`, and
+ * existing movies are recorded as created at generation 1.
+ */
+static constexpr const char MIGRATION_5[] =
+    "CREATE TABLE movie_change(\n"
+    "    movie_id INTEGER PRIMARY KEY ASC NOT NULL,\n"
+    "    created INTEGER NOT NULL,\n"
+    "    modified INTEGER NOT NULL,\n"
+    "    deleted INTEGER NOT NULL DEFAULT 0\n"
+    ") STRICT;\n"
+    "\n"
+    "CREATE INDEX movie_change_by_generation ON movie_change(modified);\n"
+    "\n"
+    "INSERT INTO id_block(name, next) VALUES ('generation', 2);\n"
+    "INSERT INTO movie_change(movie_id, created, modified)\n"
+    "    SELECT id, 1, 1\n"
+    "        FROM movie;\n"
+;
+
+/**
+ * Version 6: indexes on the columns that `list_movies` can be sorted by. Rows are read in index order and the scan
+ * stops after the requested window, so the first K movies cost O(K + log N) instead of sorting the whole table.
+ */
+static constexpr const char MIGRATION_6[] =
+    "CREATE INDEX movie_by_title ON movie(title);\n"
+    "CREATE INDEX movie_by_release_year ON movie(release_year);\n"
+;
+
+/**
+ * Version 7: index on the natural key of a movie, for `upsert_movie`. It is not unique, since existing catalogs may
+ * already have duplicates. `DB_UNIQUE_MOVIES` adds a separate unique index once they are cleaned up.
+ */
+static constexpr const char MIGRATION_7[] =
+    "CREATE INDEX movie_by_natural_key ON movie(title, director, release_year);\n"
+;
 // clang-format on
 
+/** All migrations, where `MIGRATIONS[i]` upgrades from `PRAGMA user_version = i` to `i + 1`. */
+static const char *const MIGRATIONS[] = {
+    MIGRATION_1,
+    MIGRATION_2,
+    MIGRATION_3,
+    MIGRATION_4,
+    MIGRATION_5,
+    MIGRATION_6,
+    MIGRATION_7,
+};
+
+/** Latest schema version. */
+#define SCHEMA_VERSION (sizeof(MIGRATIONS) / sizeof(MIGRATIONS[0]))
+
 #endif  // SRC_DATABASE_SCHEMA_H
@@ -0,0 +1,223 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../config.h"
+#include "../defines.h"
+#include "./search_cache.h"
+
+/** Default number of cached genres. */
+#define SEARCH_CACHE_DEFAULT_SLOTS 64
+/** Default limit for a single cached response. */
+#define SEARCH_CACHE_DEFAULT_MAX_BYTES (1 << 20)
+
+/** Reference counted result, as handed out by `search_cache_lookup`. */
+struct search_blob {
+    /** Owners: the cache slot, if still cached, plus every unreleased lookup. */
+    atomic_size_t refcount;
+    /** Owned copy of the genre name. */
+    char *NONNULL genre;
+    /** Public part, pointing into `bytes`. */
+    struct search_result result;
+    /** Storage for the response. */
+    char bytes[];
+};
+
+/**
+ * A direct-mapped slot, chosen by the genre hash. Colliding genres evict each other.
+ */
+struct search_slot {
+    /** Cached result, or `NULL`. */
+    struct search_blob *NULLABLE blob;
+    /** Incremented on every invalidation of a genre that maps to this slot. */
+    search_ticket_t version;
+};
+
+/** Protects all slots. Held only for pointer updates, never while copying or sending responses. */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+/** The slots, or `NULL` if disabled. */
+static struct search_slot *NULLABLE slots = NULL;
+/** Number of slots, a power of two. */
+static size_t slot_count = 0;
+/** Largest response stored. */
+static size_t max_bytes = SEARCH_CACHE_DEFAULT_MAX_BYTES;
+
+/** Lookups answered from the cache. */
+static atomic_uint_fast64_t hits = 0;
+/** Lookups that went to the database. */
+static atomic_uint_fast64_t misses = 0;
+/** Results dropped by writes. */
+static atomic_uint_fast64_t invalidations = 0;
+
+/** Allocates the slots. */
+void search_cache_setup(void) {
+    const uint64_t requested = config_u64("SEARCH_CACHE_SLOTS", SEARCH_CACHE_DEFAULT_SLOTS);
+    max_bytes = (size_t) config_u64("SEARCH_CACHE_MAX_BYTES", SEARCH_CACHE_DEFAULT_MAX_BYTES);
+    if (requested == 0 || requested > UINT32_MAX) {
+        return;
+    }
+
+    // round up to a power of two, for masking
+    size_t count = 1;
+    while (count < requested) {
+        count *= 2;
+    }
+
+    slots = calloc(count, sizeof(struct search_slot));
+    if unlikely (slots == NULL) {
+        (void) fprintf(stderr, "search_cache: could not allocate %zu slots, cache disabled\n", count);
+        return;
+    }
+    slot_count = count;
+}
+
+[[gnu::pure, gnu::nonnull(1), gnu::hot]]
+/** FNV-1a hash of the genre, masked to a slot index. */
+static size_t search_slot_index(const char genre[NONNULL]) {
+    static constexpr const uint64_t FNV_OFFSET = 0xCBF2'9CE4'8422'2325;
+    static constexpr const uint64_t FNV_PRIME = 0x0000'0100'0000'01B3;
+
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; genre[i] != '\0'; i++) {
+        hash ^= (uint8_t) genre[i];
+        hash *= FNV_PRIME;
+    }
+    return (size_t) hash & (slot_count - 1);
+}
+
+[[gnu::nonnull(1)]]
+/** Drops one reference, freeing the blob on the last one. */
+static void search_blob_release(struct search_blob *NONNULL blob) {
+    if (atomic_fetch_sub_explicit(&(blob->refcount), 1, memory_order_acq_rel) == 1) {
+        free(blob->genre);
+        free(blob);
+    }
+}
+
+/** Finds a cached result, or takes a ticket for storing a new one. */
+const struct search_result *NULLABLE search_cache_lookup(const char genre[NONNULL], search_ticket_t *NONNULL ticket) {
+    *ticket = 0;
+    if unlikely (slots == NULL) {
+        return NULL;
+    }
+    const size_t index = search_slot_index(genre);
+
+    pthread_mutex_lock(&cache_lock);
+    struct search_blob *blob = slots[index].blob;
+    if (blob != NULL && strcmp(blob->genre, genre) == 0) {
+        atomic_fetch_add_explicit(&(blob->refcount), 1, memory_order_relaxed);
+    } else {
+        blob = NULL;
+        *ticket = slots[index].version;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    atomic_fetch_add_explicit(blob != NULL ? &hits : &misses, 1, memory_order_relaxed);
+    return blob != NULL ? &(blob->result) : NULL;
+}
+
+/** Releases a cached result. */
+void search_cache_release(const struct search_result *NONNULL result) {
+    search_blob_release((struct search_blob *) ((const char *) result - offsetof(struct search_blob, result)));
+}
+
+/** Stores a result computed after `ticket` was taken. */
+void search_cache_store(const char genre[NONNULL], search_ticket_t ticket, size_t length, const char data[NONNULL length]) {
+    if unlikely (slots == NULL || length > max_bytes) {
+        return;
+    }
+
+    struct search_blob *blob = malloc(sizeof(struct search_blob) + length);
+    if unlikely (blob == NULL) {
+        return;
+    }
+    blob->genre = strdup(genre);
+    if unlikely (blob->genre == NULL) {
+        free(blob);
+        return;
+    }
+    atomic_init(&(blob->refcount), 1);
+    memcpy(blob->bytes, data, length);
+    blob->result.length = length;
+    blob->result.data = blob->bytes;
+
+    const size_t index = search_slot_index(genre);
+    struct search_blob *evicted = NULL;
+
+    pthread_mutex_lock(&cache_lock);
+    if likely (slots[index].version == ticket) {
+        evicted = slots[index].blob;
+        slots[index].blob = blob;
+        blob = NULL;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    // stale result or replaced entry, freed outside the lock
+    if unlikely (blob != NULL) {
+        search_blob_release(blob);
+    }
+    if (evicted != NULL) {
+        search_blob_release(evicted);
+    }
+}
+
+/** Drops the result for a genre and rejects stores from older tickets. */
+void search_cache_invalidate(const char genre[NONNULL]) {
+    if unlikely (slots == NULL) {
+        return;
+    }
+    const size_t index = search_slot_index(genre);
+
+    pthread_mutex_lock(&cache_lock);
+    struct search_blob *evicted = slots[index].blob;
+    slots[index].blob = NULL;
+    slots[index].version += 1;
+    pthread_mutex_unlock(&cache_lock);
+
+    if (evicted != NULL) {
+        atomic_fetch_add_explicit(&invalidations, 1, memory_order_relaxed);
+        search_blob_release(evicted);
+    }
+}
+
+/** Drops all results and rejects stores from older tickets. */
+void search_cache_invalidate_all(void) {
+    for (size_t i = 0; i < slot_count; i++) {
+        pthread_mutex_lock(&cache_lock);
+        struct search_blob *evicted = slots[i].blob;
+        slots[i].blob = NULL;
+        slots[i].version += 1;
+        pthread_mutex_unlock(&cache_lock);
+
+        if (evicted != NULL) {
+            atomic_fetch_add_explicit(&invalidations, 1, memory_order_relaxed);
+            search_blob_release(evicted);
+        }
+    }
+}
+
+/** Writes the cache counters as YAML. */
+void search_cache_stats_report(FILE *NONNULL output) {
+    size_t entries = 0;
+    pthread_mutex_lock(&cache_lock);
+    for (size_t i = 0; i < slot_count; i++) {
+        entries += slots[i].blob != NULL ? 1 : 0;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    (void) fprintf(
+        output,
+        "  search_cache:\n    slots: %zu\n    entries: %zu\n    hits: %" PRIu64 "\n    misses: %" PRIu64
+        "\n    invalidations: %" PRIu64 "\n",
+        slot_count,
+        entries,
+        (uint64_t) atomic_load_explicit(&hits, memory_order_relaxed),
+        (uint64_t) atomic_load_explicit(&misses, memory_order_relaxed),
+        (uint64_t) atomic_load_explicit(&invalidations, memory_order_relaxed)
+    );
+}
@@ -0,0 +1,67 @@
+#ifndef SRC_DATABASE_SEARCH_CACHE_H
+/** Bounded cache of rendered `search_by_genre` responses, keyed by genre name. */
+#define SRC_DATABASE_SEARCH_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../defines.h"
+
+/** A cached response. Stays valid until released, even if evicted meanwhile. */
+struct search_result {
+    /** Length of `data`, in bytes. */
+    size_t length;
+    /** The rendered response. Not NUL-terminated. */
+    const char *NONNULL data;
+};
+
+/** Opaque version of a cache slot, so results computed before an invalidation are not stored after it. */
+typedef uint64_t search_ticket_t;
+
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Allocates the cache, reading `SEARCH_CACHE_SLOTS` and `SEARCH_CACHE_MAX_BYTES`. With zero slots, or on allocation
+ * failures, the cache stays disabled and every lookup misses.
+ */
+void search_cache_setup(void);
+
+[[nodiscard("must be released"), gnu::nonnull(1, 2), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Looks up the response for `genre`. On a miss, returns `NULL` and sets `ticket` for a later `search_cache_store`,
+ * which must be taken before reading the database.
+ */
+const struct search_result *NULLABLE search_cache_lookup(const char genre[NONNULL], search_ticket_t *NONNULL ticket);
+
+[[gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Releases a result returned by `search_cache_lookup`.
+ */
+void search_cache_release(const struct search_result *NONNULL result);
+
+[[gnu::nonnull(1, 4), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Stores a copy of the response for `genre`, unless it was invalidated since `ticket` was taken or it is larger than
+ * `SEARCH_CACHE_MAX_BYTES`.
+ */
+void search_cache_store(const char genre[NONNULL], search_ticket_t ticket, size_t length, const char data[NONNULL length]);
+
+[[gnu::nonnull(1), gnu::leaf, gnu::nothrow]]
+/**
+ * Drops the response for `genre`. Must be called after the change to the movies with that genre is committed.
+ */
+void search_cache_invalidate(const char genre[NONNULL]);
+
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Drops every cached response, for changes whose genres are not known.
+ */
+void search_cache_invalidate_all(void);
+
+[[gnu::nonnull(1), gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Writes the cache size and hit rate as YAML entries under a `search_cache` key, indented for the `stats` response.
+ */
+void search_cache_stats_report(FILE *NONNULL output);
+
+#endif  // SRC_DATABASE_SEARCH_CACHE_H
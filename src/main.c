@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,8 +13,30 @@
 
 #include "./database/database.h"
 #include "./defines.h"
+#include "./movie/parser.h"
+#include "./stats/capture.h"
+#include "./stats/perf.h"
+#include "./stats/trace.h"
 #include "./worker/worker.h"
 
+/** Output file for traces exported on SIGUSR2. */
+static constexpr const char TRACE_FILE[] = "trace.json";
+
+[[gnu::cold]]
+/** Export recorded spans, if requested by SIGUSR2. */
+static void export_trace_if_requested(void) {
+    if likely (!take_trace_export_request()) {
+        return;
+    }
+
+    bool ok = trace_export(TRACE_FILE);
+    if likely (ok) {
+        (void) fprintf(stderr, "main: trace exported to %s\n", TRACE_FILE);
+    } else {
+        (void) fprintf(stderr, "main: trace export failed: %s\n", strerrordesc_np(errno));
+    }
+}
+
 [[gnu::cold]]
 /** Set up server socket and start listening. */
 static int start_server(void) {
@@ -56,14 +79,21 @@ static int start_server(void) {
 
 extern int main(void) {
     // initialize sqlite
-    const char *errmsg = NULL;
-    bool setup_ok = db_setup(DATABASE, &errmsg);
+    db_error_t error = {.code = DB_ERROR_NONE};
+    bool setup_ok = db_setup(DATABASE, &error);
     if unlikely (!setup_ok) {
-        (void) fprintf(stderr, "db_setup: %s\n", errmsg);
-        db_free_errmsg(errmsg);
+        char message[DB_ERROR_LEN];
+        (void) db_error_format(error, sizeof(message), message);
+        (void) fprintf(stderr, "db_setup: %s\n", message);
         return EXIT_FAILURE;
     }
 
+    // initialize tracing, counters, capture and input limits, before any other thread is started
+    trace_setup();
+    perf_setup();
+    capture_setup();
+    parser_setup();
+
     // initialize worker threads
     setup_ok = workers_start();
     if unlikely (!setup_ok) {
@@ -80,18 +110,27 @@ extern int main(void) {
 
     // start accepting
     while (likely(!was_shutdown_requested())) {
+        export_trace_if_requested();
+
         struct sockaddr_in client_addr;
         socklen_t addrlen = sizeof(client_addr);
+        struct trace_span accept_span = trace_begin_detached("accept");
         int client_fd = accept(server_fd, (struct sockaddr *) &client_addr, &addrlen);
         if unlikely (client_fd < 0) {
-            (void) fprintf(stderr, "main: accept failed: %s\n", strerrordesc_np(errno));
+            if (errno != EINTR) {
+                (void) fprintf(stderr, "main: accept failed: %s\n", strerrordesc_np(errno));
+            }
             continue;
         }
 
+        const trace_id_t request = trace_next_request();
+        trace_set_request(request);
+        trace_end(accept_span);
+
         static constexpr const size_t ADDR_LEN = 32;
         char address_str[ADDR_LEN] = "<unknown>";
         (void) inet_ntop(AF_INET, &(client_addr.sin_addr), address_str, ADDR_LEN);
-        (void) fprintf(stderr, "main: client accepted: %s\n", address_str);
+        (void) fprintf(stderr, "main: client accepted: %s, request %" PRIu64 "\n", address_str, request);
 
         static constexpr const struct timeval SOCKET_TIMEOUT = {.tv_sec = 60, .tv_usec = 0};
         int rv0 = setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &SOCKET_TIMEOUT, sizeof(SOCKET_TIMEOUT));
@@ -103,7 +142,7 @@ extern int main(void) {
         }
 
         static constexpr const unsigned MAX_RETRIES = 512;
-        bool ok = workers_add_work(client_fd, MAX_RETRIES);
+        bool ok = workers_add_work(client_fd, client_addr.sin_addr.s_addr, request, MAX_RETRIES);
         if unlikely (!ok) {
             (void) fprintf(stderr, "main: no worker thread to handle %s, ignoring client\n", address_str);
             close(client_fd);
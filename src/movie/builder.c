@@ -153,6 +153,11 @@ bool movie_builder_has_genres(const movie_builder_t *NONNULL builder) {
     return builder->has_genres;
 }
 
+/** Number of genres in the current movie. */
+size_t movie_builder_genre_count(const movie_builder_t *NONNULL builder) {
+    return builder->has_genres ? builder->current.genres_count : 0;
+}
+
 [[gnu::const]]
 /** Calculates $ceil(a / b)$. */
 static inline size_t ceil_div(size_t a, size_t b) {
@@ -335,6 +340,39 @@ bool movie_builder_add_genre(movie_builder_t *NONNULL builder, size_t len, const
     return true;
 }
 
+/** Add all genres from a packed list to the current movie's genres list. */
+bool movie_builder_add_packed_genres(
+    movie_builder_t *NONNULL builder,
+    size_t len,
+    const char packed[NONNULL restrict len + 1],
+    char separator
+) {
+    assume(builder->has_genres);
+    if unlikely (len == 0) {
+        return true;
+    }
+
+    size_t idx;
+    bool ok = movie_builder_add_string(builder, len, packed, &idx);
+    if unlikely (!ok) {
+        return false;
+    }
+
+    // genres are stored as consecutive strings, so splitting is just terminating each name in place
+    char *str = movie_builder_get_str(builder, idx);
+    size_t count = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == separator) {
+            str[i] = '\0';
+            count += 1;
+        }
+    }
+
+    assert(idx >= builder->current.genres_slice + builder->current.genres_count);
+    builder->current.genres_count += count;
+    return true;
+}
+
 [[gnu::nonnull(1), gnu::hot, gnu::malloc]]
 /**
  * Extract the genre list from a movie reference.
@@ -69,6 +69,12 @@ bool movie_builder_has_release_year(const movie_builder_t *NONNULL builder);
  */
 bool movie_builder_has_genres(const movie_builder_t *NONNULL builder);
 
+[[gnu::nonnull(1), gnu::hot, gnu::pure, gnu::leaf, gnu::nothrow]]
+/**
+ * Number of genres added to the current movie since `movie_builder_start_genres()`.
+ */
+size_t movie_builder_genre_count(const movie_builder_t *NONNULL builder);
+
 [[gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
 /**
  * Set the identifier for the current movie.
@@ -127,6 +133,22 @@ void movie_builder_start_genres(movie_builder_t *NONNULL builder);
  */
 bool movie_builder_add_genre(movie_builder_t *NONNULL builder, size_t len, const char genre[NONNULL restrict len + 1]);
 
+[[gnu::nonnull(1, 3), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Add all genres from `packed`, a list of names joined by `separator`, to the current movie's genres list.
+ *
+ * The list is copied in a single slice, so this is cheaper than calling `movie_builder_add_genre` for each name. An
+ * empty `packed` adds no genres.
+ *
+ * Returns `true` on success and `false` on allocation failures.
+ */
+bool movie_builder_add_packed_genres(
+    movie_builder_t *NONNULL builder,
+    size_t len,
+    const char packed[NONNULL restrict len + 1],
+    char separator
+);
+
 [[nodiscard("output may be uninitialized"), gnu::nonnull(1, 2), gnu::hot, gnu::leaf, gnu::nothrow]]
 /**
  * Dereference the current movie.
@@ -0,0 +1,634 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "../defines.h"
+#include "./json.h"
+
+/** Bytes read from the input at once. */
+#define JSON_READ_SIZE (16 * 1024)
+
+/** Initial size of the buffer for decoded scalars. */
+#define JSON_SCRATCH_INITIAL 256
+
+static_assert(JSON_MAX_DEPTH <= 64, "container kinds are kept in a 64-bit mask");
+
+/**
+ * What the grammar allows next. Colons and commas are consumed internally, so they never become tokens.
+ */
+enum [[gnu::packed]] json_state {
+    /** At the top level, after a colon, or after a comma in an array. */
+    EXPECT_VALUE,
+    /** Right after `[`. */
+    EXPECT_VALUE_OR_END,
+    /** After a comma in an object. */
+    EXPECT_KEY,
+    /** Right after `{`. */
+    EXPECT_KEY_OR_END,
+    /** After an object key. */
+    EXPECT_COLON,
+    /** After a value inside a container. */
+    EXPECT_COMMA_OR_END,
+};
+
+/**
+ * Tokenizer state. Input is consumed in place, and scalars are decoded into `scratch`, so a token may span any number
+ * of reads.
+ */
+struct json_lexer {
+    /** Input source. */
+    json_read_handler_t *NONNULL read;
+    /** Argument for `read`. */
+    void *NULLABLE data;
+    /** Decoded scalar of the current token. */
+    char *NONNULL scratch;
+    /** Bytes used in `scratch`, without the NUL. */
+    size_t scratch_length;
+    /** Allocated size of `scratch`. */
+    size_t scratch_capacity;
+    /** Next unread byte in `input`. */
+    size_t position;
+    /** Bytes available in `input`. */
+    size_t length;
+    /** Stream offset of `input[0]`. */
+    size_t base;
+    /** Current line, for error positions. */
+    size_t line;
+    /** Stream offset of the start of `line`. */
+    size_t line_start;
+    /** Bit `i` is set if the container at depth `i` is an object. */
+    uint64_t objects;
+    /** Number of open containers. */
+    uint8_t depth;
+    /** What the grammar allows next. */
+    enum json_state state;
+    /** Set when the input ended or failed. */
+    bool eof;
+    /** Set after the first error, which is kept in `error`. */
+    bool failed;
+    /** The error returned for every call after a failure. */
+    struct json_token error;
+    /** Raw input. */
+    unsigned char input[JSON_READ_SIZE];
+};
+
+/** Creates a tokenizer pulling from `read`. */
+json_lexer_t *NULLABLE json_lexer_create(json_read_handler_t *NONNULL read, void *NULLABLE data) {
+    json_lexer_t *lexer = malloc(sizeof(json_lexer_t));
+    if unlikely (lexer == NULL) {
+        return NULL;
+    }
+
+    char *scratch = malloc(JSON_SCRATCH_INITIAL);
+    if unlikely (scratch == NULL) {
+        free(lexer);
+        return NULL;
+    }
+
+    *lexer = (struct json_lexer) {
+        .read = read,
+        .data = data,
+        .scratch = scratch,
+        .scratch_length = 0,
+        .scratch_capacity = JSON_SCRATCH_INITIAL,
+        .position = 0,
+        .length = 0,
+        .base = 0,
+        .line = 0,
+        .line_start = 0,
+        .objects = 0,
+        .depth = 0,
+        .state = EXPECT_VALUE,
+        .eof = false,
+        .failed = false,
+        .error = {.ty = JSON_ERROR, .text = NULL, .length = 0, .line = 0, .column = 0},
+    };
+    return lexer;
+}
+
+/** Frees the tokenizer buffers. */
+void json_lexer_destroy(json_lexer_t *NONNULL lexer) {
+    free(lexer->scratch);
+    free(lexer);
+}
+
+[[nodiscard("end of input on false"), gnu::nonnull(1)]]
+/** Reads more input after everything buffered was consumed. */
+static bool json_fill(json_lexer_t *NONNULL lexer) {
+    assume(lexer->position == lexer->length);
+    if unlikely (lexer->eof) {
+        return false;
+    }
+
+    size_t size_read = 0;
+    const int ok = lexer->read(lexer->data, lexer->input, JSON_READ_SIZE, &size_read);
+    lexer->base += lexer->length;
+    lexer->position = 0;
+    lexer->length = size_read;
+    if unlikely (ok == 0 || size_read == 0) {
+        lexer->eof = true;
+        return false;
+    }
+    return true;
+}
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1), gnu::hot]]
+/** The next byte, without consuming it, or -1 at the end of input. */
+static inline int json_peek(json_lexer_t *NONNULL lexer) {
+    if unlikely (lexer->position >= lexer->length && !json_fill(lexer)) {
+        return -1;
+    }
+    return lexer->input[lexer->position];
+}
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1), gnu::hot]]
+/** Consumes the next byte, or returns -1 at the end of input. */
+static inline int json_take(json_lexer_t *NONNULL lexer) {
+    const int byte = json_peek(lexer);
+    if likely (byte >= 0) {
+        lexer->position += 1;
+    }
+    return byte;
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1, 3), gnu::hot]]
+/** Appends decoded bytes to the scratch buffer, always leaving room for the NUL. */
+static bool scratch_append(json_lexer_t *NONNULL lexer, size_t length, const void *NONNULL bytes) {
+    if unlikely (lexer->scratch_length + length >= lexer->scratch_capacity) {
+        size_t capacity = lexer->scratch_capacity;
+        while (lexer->scratch_length + length >= capacity) {
+            if unlikely (capacity > SIZE_MAX / 2) {
+                return false;
+            }
+            capacity *= 2;
+        }
+
+        char *scratch = realloc(lexer->scratch, capacity);
+        if unlikely (scratch == NULL) {
+            return false;
+        }
+        lexer->scratch = scratch;
+        lexer->scratch_capacity = capacity;
+    }
+
+    memcpy(&(lexer->scratch[lexer->scratch_length]), bytes, length);
+    lexer->scratch_length += length;
+    return true;
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1), gnu::hot]]
+/** Appends a single decoded byte. */
+static inline bool scratch_push(json_lexer_t *NONNULL lexer, char byte) {
+    return scratch_append(lexer, 1, &byte);
+}
+
+[[gnu::cold, gnu::nonnull(1, 3)]]
+/** Stops the tokenizer with an error at the start of `token`. */
+static struct json_token json_fail(json_lexer_t *NONNULL lexer, struct json_token token, const char *NONNULL message) {
+    token.ty = JSON_ERROR;
+    token.text = message;
+    token.length = strlen(message);
+    lexer->error = token;
+    lexer->failed = true;
+    return token;
+}
+
+[[gnu::nonnull(1), gnu::hot]]
+/** Skips whitespace, keeping track of lines. Returns the next byte without consuming it, or -1. */
+static int json_skip_whitespace(json_lexer_t *NONNULL lexer) {
+    while (true) {
+        const int byte = json_peek(lexer);
+        if (byte == '\n') {
+            lexer->position += 1;
+            lexer->line += 1;
+            lexer->line_start = lexer->base + lexer->position;
+        } else if (byte == ' ' || byte == '\t' || byte == '\r') {
+            lexer->position += 1;
+        } else {
+            return byte;
+        }
+    }
+}
+
+[[gnu::const]]
+/** Value of a hexadecimal digit, or -1. */
+static inline int hex_digit(int byte) {
+    if (byte >= '0' && byte <= '9') {
+        return byte - '0';
+    } else if (byte >= 'a' && byte <= 'f') {
+        return byte - 'a' + 10;
+    } else if (byte >= 'A' && byte <= 'F') {
+        return byte - 'A' + 10;
+    } else {
+        return -1;
+    }
+}
+
+[[nodiscard("invalid escape on false"), gnu::nonnull(1, 2)]]
+/** Reads the 4 hex digits of a `\u` escape. */
+static bool json_read_hex4(json_lexer_t *NONNULL lexer, uint32_t *NONNULL code) {
+    uint32_t value = 0;
+    for (unsigned i = 0; i < 4; i++) {
+        const int digit = hex_digit(json_take(lexer));
+        if unlikely (digit < 0) {
+            return false;
+        }
+        value = (value << 4) | (uint32_t) digit;
+    }
+    *code = value;
+    return true;
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1)]]
+/** Appends a code point as UTF-8. */
+static bool scratch_push_utf8(json_lexer_t *NONNULL lexer, uint32_t code) {
+    char bytes[4];
+    size_t length;
+    if (code < 0x80) {
+        bytes[0] = (char) code;
+        length = 1;
+    } else if (code < 0x800) {
+        bytes[0] = (char) (0xC0 | (code >> 6));
+        bytes[1] = (char) (0x80 | (code & 0x3F));
+        length = 2;
+    } else if (code < 0x10000) {
+        bytes[0] = (char) (0xE0 | (code >> 12));
+        bytes[1] = (char) (0x80 | ((code >> 6) & 0x3F));
+        bytes[2] = (char) (0x80 | (code & 0x3F));
+        length = 3;
+    } else {
+        bytes[0] = (char) (0xF0 | (code >> 18));
+        bytes[1] = (char) (0x80 | ((code >> 12) & 0x3F));
+        bytes[2] = (char) (0x80 | ((code >> 6) & 0x3F));
+        bytes[3] = (char) (0x80 | (code & 0x3F));
+        length = 4;
+    }
+    return scratch_append(lexer, length, bytes);
+}
+
+[[nodiscard("invalid escape on NULL"), gnu::nonnull(1)]]
+/** Decodes an escape sequence after the backslash. Returns an error message, or `NULL` on success. */
+static const char *NULLABLE json_unescape(json_lexer_t *NONNULL lexer) {
+    const int byte = json_take(lexer);
+    char decoded;
+    switch (byte) {
+        case '"':
+        case '\\':
+        case '/':
+            decoded = (char) byte;
+            break;
+        case 'b':
+            decoded = '\b';
+            break;
+        case 'f':
+            decoded = '\f';
+            break;
+        case 'n':
+            decoded = '\n';
+            break;
+        case 'r':
+            decoded = '\r';
+            break;
+        case 't':
+            decoded = '\t';
+            break;
+        case 'u': {
+            uint32_t code;
+            if unlikely (!json_read_hex4(lexer, &code)) {
+                return "invalid unicode escape";
+            }
+            // characters outside the BMP are escaped as a surrogate pair
+            if (code >= 0xD800 && code <= 0xDBFF) {
+                uint32_t low;
+                if unlikely (json_take(lexer) != '\\' || json_take(lexer) != 'u' || !json_read_hex4(lexer, &low)) {
+                    return "unpaired surrogate in unicode escape";
+                } else if unlikely (low < 0xDC00 || low > 0xDFFF) {
+                    return "unpaired surrogate in unicode escape";
+                }
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            } else if unlikely (code >= 0xDC00 && code <= 0xDFFF) {
+                return "unpaired surrogate in unicode escape";
+            }
+            return scratch_push_utf8(lexer, code) ? NULL : "out of memory for string";
+        }
+        default:
+            return "invalid escape in string";
+    }
+    return scratch_push(lexer, decoded) ? NULL : "out of memory for string";
+}
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1), gnu::hot]]
+/**
+ * Decodes a string after its opening quote. Plain runs are found with `memchr` and copied at once, so only escapes are
+ * handled byte by byte.
+ */
+static struct json_token json_lex_string(json_lexer_t *NONNULL lexer, struct json_token token) {
+    lexer->scratch_length = 0;
+    while (true) {
+        if unlikely (lexer->position >= lexer->length && !json_fill(lexer)) {
+            return json_fail(lexer, token, "unterminated string");
+        }
+
+        const unsigned char *start = &(lexer->input[lexer->position]);
+        const size_t available = lexer->length - lexer->position;
+        const unsigned char *quote = memchr(start, '"', available);
+        size_t run = (quote != NULL) ? (size_t) (quote - start) : available;
+        const unsigned char *escape = memchr(start, '\\', run);
+        if (escape != NULL) {
+            run = (size_t) (escape - start);
+        }
+
+        if unlikely (!scratch_append(lexer, run, start)) {
+            return json_fail(lexer, token, "out of memory for string");
+        }
+        lexer->position += run;
+
+        if (escape != NULL) {
+            lexer->position += 1;
+            const char *message = json_unescape(lexer);
+            if unlikely (message != NULL) {
+                return json_fail(lexer, token, message);
+            }
+        } else if likely (quote != NULL) {
+            lexer->position += 1;
+            break;
+        }
+    }
+
+    lexer->scratch[lexer->scratch_length] = '\0';
+    token.text = lexer->scratch;
+    token.length = lexer->scratch_length;
+    return token;
+}
+
+[[nodiscard("allocation may fail"), gnu::nonnull(1)]]
+/** Copies a run of decimal digits. Returns how many were copied, or -1 on allocation failures. */
+static ssize_t json_lex_digits(json_lexer_t *NONNULL lexer) {
+    ssize_t count = 0;
+    int byte = json_peek(lexer);
+    while (byte >= '0' && byte <= '9') {
+        if unlikely (!scratch_push(lexer, (char) byte)) {
+            return -1;
+        }
+        lexer->position += 1;
+        count += 1;
+        byte = json_peek(lexer);
+    }
+    return count;
+}
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1)]]
+/** Reads a number, checking the JSON grammar: `-? (0 | [1-9][0-9]*) (. [0-9]+)? ([eE] [+-]? [0-9]+)?`. */
+static struct json_token json_lex_number(json_lexer_t *NONNULL lexer, struct json_token token) {
+    lexer->scratch_length = 0;
+    if (json_peek(lexer) == '-') {
+        lexer->position += 1;
+        if unlikely (!scratch_push(lexer, '-')) {
+            return json_fail(lexer, token, "out of memory for number");
+        }
+    }
+
+    if (json_peek(lexer) == '0') {
+        lexer->position += 1;
+        if unlikely (!scratch_push(lexer, '0')) {
+            return json_fail(lexer, token, "out of memory for number");
+        }
+    } else {
+        const ssize_t digits = json_lex_digits(lexer);
+        if unlikely (digits <= 0) {
+            return json_fail(lexer, token, digits < 0 ? "out of memory for number" : "invalid number");
+        }
+    }
+
+    if (json_peek(lexer) == '.') {
+        lexer->position += 1;
+        const ssize_t digits = scratch_push(lexer, '.') ? json_lex_digits(lexer) : -1;
+        if unlikely (digits <= 0) {
+            return json_fail(lexer, token, digits < 0 ? "out of memory for number" : "invalid number");
+        }
+    }
+
+    const int exponent = json_peek(lexer);
+    if (exponent == 'e' || exponent == 'E') {
+        lexer->position += 1;
+        bool ok = scratch_push(lexer, 'e');
+        const int sign = json_peek(lexer);
+        if (ok && (sign == '+' || sign == '-')) {
+            lexer->position += 1;
+            ok = scratch_push(lexer, (char) sign);
+        }
+        const ssize_t digits = ok ? json_lex_digits(lexer) : -1;
+        if unlikely (digits <= 0) {
+            return json_fail(lexer, token, digits < 0 ? "out of memory for number" : "invalid number");
+        }
+    }
+
+    lexer->scratch[lexer->scratch_length] = '\0';
+    token.ty = JSON_NUMBER;
+    token.text = lexer->scratch;
+    token.length = lexer->scratch_length;
+    return token;
+}
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1, 3)]]
+/** Reads one of `true`, `false` or `null`, spelled as `literal`. */
+static struct json_token json_lex_literal(
+    json_lexer_t *NONNULL lexer,
+    struct json_token token,
+    const char *NONNULL literal,
+    enum json_token_ty ty
+) {
+    for (const char *expected = literal; *expected != '\0'; expected++) {
+        if unlikely (json_take(lexer) != *expected) {
+            return json_fail(lexer, token, "invalid literal");
+        }
+    }
+
+    token.ty = ty;
+    token.text = literal;
+    token.length = strlen(literal);
+    return token;
+}
+
+[[gnu::nonnull(1)]]
+/** Updates the state after a complete value. */
+static inline void json_value_done(json_lexer_t *NONNULL lexer) {
+    lexer->state = (lexer->depth == 0) ? EXPECT_VALUE : EXPECT_COMMA_OR_END;
+}
+
+[[gnu::pure, gnu::nonnull(1)]]
+/** Checks if the innermost container is an object. */
+static inline bool json_in_object(const json_lexer_t *NONNULL lexer) {
+    return lexer->depth > 0 && (lexer->objects & (UINT64_C(1) << (lexer->depth - 1))) != 0;
+}
+
+[[gnu::nonnull(1)]]
+/** Opens a container. */
+static struct json_token json_open(json_lexer_t *NONNULL lexer, struct json_token token, bool object) {
+    if unlikely (lexer->depth >= JSON_MAX_DEPTH) {
+        return json_fail(lexer, token, "nesting too deep");
+    }
+
+    lexer->position += 1;
+    const uint64_t bit = UINT64_C(1) << lexer->depth;
+    lexer->objects = object ? (lexer->objects | bit) : (lexer->objects & ~bit);
+    lexer->depth += 1;
+    lexer->state = object ? EXPECT_KEY_OR_END : EXPECT_VALUE_OR_END;
+    token.ty = object ? JSON_OBJECT_START : JSON_ARRAY_START;
+    return token;
+}
+
+[[gnu::nonnull(1)]]
+/** Closes the innermost container, if it is of the right kind. */
+static struct json_token json_close(json_lexer_t *NONNULL lexer, struct json_token token, bool object) {
+    const bool can_end = object ? (lexer->state == EXPECT_KEY_OR_END || lexer->state == EXPECT_COMMA_OR_END)
+                                : (lexer->state == EXPECT_VALUE_OR_END || lexer->state == EXPECT_COMMA_OR_END);
+    if unlikely (lexer->depth == 0 || json_in_object(lexer) != object || !can_end) {
+        return json_fail(lexer, token, object ? "unexpected end of object" : "unexpected end of array");
+    }
+
+    lexer->position += 1;
+    lexer->depth -= 1;
+    json_value_done(lexer);
+    token.ty = object ? JSON_OBJECT_END : JSON_ARRAY_END;
+    return token;
+}
+
+/** Reads the next token. */
+struct json_token json_next(json_lexer_t *NONNULL lexer) {
+    if unlikely (lexer->failed) {
+        return lexer->error;
+    }
+
+    while (true) {
+        const int byte = json_skip_whitespace(lexer);
+        const size_t offset = lexer->base + lexer->position;
+        struct json_token token = {
+            .ty = JSON_ERROR,
+            .text = NULL,
+            .length = 0,
+            .line = lexer->line,
+            .column = offset - lexer->line_start,
+        };
+
+        const bool expect_value = lexer->state == EXPECT_VALUE || lexer->state == EXPECT_VALUE_OR_END;
+        switch (byte) {
+            case -1:
+                if likely (lexer->depth == 0 && lexer->state == EXPECT_VALUE) {
+                    token.ty = JSON_END;
+                    return token;
+                }
+                return json_fail(lexer, token, "document ended unexpectedly");
+
+            case ':':
+                if unlikely (lexer->state != EXPECT_COLON) {
+                    return json_fail(lexer, token, "unexpected colon");
+                }
+                lexer->position += 1;
+                lexer->state = EXPECT_VALUE;
+                continue;
+
+            case ',':
+                if unlikely (lexer->state != EXPECT_COMMA_OR_END) {
+                    return json_fail(lexer, token, "unexpected comma");
+                }
+                lexer->position += 1;
+                lexer->state = json_in_object(lexer) ? EXPECT_KEY : EXPECT_VALUE;
+                continue;
+
+            case '{':
+            case '[':
+                if unlikely (!expect_value) {
+                    return json_fail(lexer, token, "unexpected value");
+                }
+                return json_open(lexer, token, byte == '{');
+
+            case '}':
+            case ']':
+                return json_close(lexer, token, byte == '}');
+
+            case '"': {
+                const bool is_key = lexer->state == EXPECT_KEY || lexer->state == EXPECT_KEY_OR_END;
+                if unlikely (!is_key && !expect_value) {
+                    return json_fail(lexer, token, "unexpected string");
+                }
+                lexer->position += 1;
+                token.ty = is_key ? JSON_KEY : JSON_STRING;
+                token = json_lex_string(lexer, token);
+                if likely (token.ty != JSON_ERROR) {
+                    if (is_key) {
+                        lexer->state = EXPECT_COLON;
+                    } else {
+                        json_value_done(lexer);
+                    }
+                }
+                return token;
+            }
+
+            default:
+                if unlikely (!expect_value) {
+                    return json_fail(lexer, token, "unexpected character");
+                }
+                if (byte == 't') {
+                    token = json_lex_literal(lexer, token, "true", JSON_TRUE);
+                } else if (byte == 'f') {
+                    token = json_lex_literal(lexer, token, "false", JSON_FALSE);
+                } else if (byte == 'n') {
+                    token = json_lex_literal(lexer, token, "null", JSON_NULL);
+                } else if (byte == '-' || (byte >= '0' && byte <= '9')) {
+                    token = json_lex_number(lexer, token);
+                } else {
+                    return json_fail(lexer, token, "unexpected character");
+                }
+                if likely (token.ty != JSON_ERROR) {
+                    json_value_done(lexer);
+                }
+                return token;
+        }
+    }
+}
+
+/** Writes `str` as a quoted JSON string. */
+void json_write_string(FILE *NONNULL output, const char *NONNULL str) {
+    (void) fputc('"', output);
+    while (*str != '\0') {
+        // write runs of plain characters at once
+        size_t run = 0;
+        while (str[run] != '\0' && str[run] != '"' && str[run] != '\\' && (unsigned char) str[run] >= ' ') {
+            run++;
+        }
+        (void) fwrite(str, 1, run, output);
+        str += run;
+        if (*str == '\0') {
+            break;
+        }
+
+        switch (*str) {
+            case '"':
+                (void) fputs("\\\"", output);
+                break;
+            case '\\':
+                (void) fputs("\\\\", output);
+                break;
+            case '\n':
+                (void) fputs("\\n", output);
+                break;
+            case '\r':
+                (void) fputs("\\r", output);
+                break;
+            case '\t':
+                (void) fputs("\\t", output);
+                break;
+            default:
+                (void) fprintf(output, "\\u%04x", (unsigned) (unsigned char) *str);
+                break;
+        }
+        str++;
+    }
+    (void) fputc('"', output);
+}
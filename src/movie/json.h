@@ -0,0 +1,86 @@
+#ifndef SRC_MOVIE_JSON_H
+/** Streaming JSON tokenizer and writer. */
+#define SRC_MOVIE_JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../defines.h"
+
+/** Deepest nesting of objects and arrays accepted. */
+#define JSON_MAX_DEPTH 64
+
+/**
+ * Kinds of tokens, already checked against the JSON grammar.
+ */
+enum [[gnu::packed]] json_token_ty {
+    /** Invalid input, or a read error. `text` has the reason. */
+    JSON_ERROR = -1,
+    /** Input ended between top level values. */
+    JSON_END = 0,
+    JSON_OBJECT_START,
+    JSON_OBJECT_END,
+    JSON_ARRAY_START,
+    JSON_ARRAY_END,
+    /** A string used as an object key. */
+    JSON_KEY,
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL,
+};
+
+/**
+ * A single token.
+ */
+struct json_token {  // NOLINT(altera-struct-pack-align)
+    /** Decoded and NUL-terminated contents of scalars and keys, valid until the next `json_next`. */
+    const char *NULLABLE text;
+    /** Length of `text`. Strings may contain NUL bytes from `\u0000` escapes. */
+    size_t length;
+    /** Line of the token start, from zero. */
+    size_t line;
+    /** Column of the token start, from zero. */
+    size_t column;
+    /** Token kind. */
+    enum json_token_ty ty;
+};
+
+/** Reads up to `size` bytes into `buffer`. Returns 1 on success, with `size_read` zero at the end of input. */
+typedef int json_read_handler_t(
+    void *NULLABLE data,
+    unsigned char *NONNULL buffer,
+    size_t size,
+    size_t *NONNULL size_read
+);
+
+/** Opaque tokenizer state. */
+typedef struct json_lexer json_lexer_t;
+
+[[nodiscard("must be destroyed"), gnu::malloc, gnu::nonnull(1), gnu::leaf, gnu::nothrow]]
+/**
+ * Creates a tokenizer for a stream of JSON values, pulling input from `read` on demand.
+ *
+ * Returns `NULL` on allocation failures.
+ */
+json_lexer_t *NULLABLE json_lexer_create(json_read_handler_t *NONNULL read, void *NULLABLE data);
+
+[[gnu::nonnull(1), gnu::leaf, gnu::nothrow]]
+/** Frees the tokenizer buffers. */
+void json_lexer_destroy(json_lexer_t *NONNULL lexer);
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1), gnu::hot, gnu::nothrow]]
+/**
+ * Reads the next token. Only reads more input when the buffered bytes end inside a token or before one.
+ *
+ * After an error, every call returns the same error, since the stream cannot be resynchronized.
+ */
+struct json_token json_next(json_lexer_t *NONNULL lexer);
+
+[[gnu::nonnull(1, 2), gnu::hot]]
+/** Writes `str` as a quoted JSON string, escaping quotes, backslashes and control characters. */
+void json_write_string(FILE *NONNULL output, const char *NONNULL str);
+
+#endif  // SRC_MOVIE_JSON_H
@@ -5,6 +5,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../defines.h"
 
@@ -38,6 +39,18 @@ struct [[gnu::aligned(2 * sizeof(int64_t))]] movie_summary {
 // even on 32 bit, fields should be aligned to 8 bytes here
 static_assert(sizeof(struct movie_summary) == 2 * sizeof(int64_t));
 
+/**
+ * Separator for packed genre lists, like `movie.genres` in the database. YAML escapes and JSON `\u001f` can still
+ * deliver it, so genre names are checked with `genre_name_is_valid`.
+ */
+#define GENRE_SEPARATOR '\x1F'
+
+[[nodiscard("useless call if discarded"), gnu::pure, gnu::nonnull(2)]]
+/** Checks that a genre name of `length` bytes can be stored in a packed list. */
+static inline bool genre_name_is_valid(size_t length, const char genre[NONNULL length]) {
+    return memchr(genre, GENRE_SEPARATOR, length) == NULL;
+}
+
 /** Free a single movie. Shared strings not deallocated. */
 static inline void free_movie(struct movie movie) {
     free((void *) movie.genres);
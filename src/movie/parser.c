@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdatomic.h>
@@ -14,33 +15,90 @@
 #include <yaml.h>
 
 #include "../alloc.h"
+#include "../config.h"
 #include "../defines.h"
+#include "../stats/capture.h"
+#include "../stats/trace.h"
 #include "./builder.h"
+#include "./json.h"
 #include "./movie.h"
 #include "./parser.h"
 
+/** Input formats, detected from the first bytes sent by the client. */
+enum [[gnu::packed]] input_format {
+    /** Nothing was read yet. */
+    INPUT_UNKNOWN,
+    INPUT_YAML,
+    INPUT_JSON,
+};
+
+/** Default for `REQUEST_MAX_BYTES`. */
+#define DEFAULT_MAX_OPERATION_BYTES (1 << 20)
+/** Default for `REQUEST_MAX_SCALAR`. */
+#define DEFAULT_MAX_SCALAR_LENGTH 4096
+/** Default for `REQUEST_MAX_GENRES`. */
+#define DEFAULT_MAX_GENRES 64
+
+/** Bytes read from the socket while parsing a single operation, or zero if unlimited. */
+static uint64_t max_operation_bytes = DEFAULT_MAX_OPERATION_BYTES;
+/** Longest title, director or genre name accepted, or zero if unlimited. */
+static uint64_t max_scalar_length = DEFAULT_MAX_SCALAR_LENGTH;
+/** Most genres accepted for a single movie, or zero if unlimited. */
+static uint64_t max_genres = DEFAULT_MAX_GENRES;
+
+/** Reads the input limits. */
+void parser_setup(void) {
+    max_operation_bytes = config_u64("REQUEST_MAX_BYTES", DEFAULT_MAX_OPERATION_BYTES);
+    max_scalar_length = config_u64("REQUEST_MAX_SCALAR", DEFAULT_MAX_SCALAR_LENGTH);
+    max_genres = config_u64("REQUEST_MAX_GENRES", DEFAULT_MAX_GENRES);
+}
+
 /**
  * YAML parser, with additional information.
  */
 struct [[gnu::aligned(ALIGNMENT_OPERATION_PARSER)]] operation_parser {
     /** The libyaml parser. */
     yaml_parser_t yaml;
+    /** The JSON tokenizer, only created for JSON clients. */
+    json_lexer_t *NULLABLE json;
+    /** Format of the operations sent by the client. */
+    enum input_format format;
     /** Indicates that the input data is done. */
     bool done;
     /** External parsing position information. */
     bool in_mapping;
+    /** The input went over `max_operation_bytes`, so no more is read. */
+    bool oversized;
+    /** The movie being parsed had more than `max_genres`, so it is rejected even if complete. */
+    bool too_many_genres;
     /** The client socket. */
     int socket;
+    /** Bytes read since the current operation started. */
+    uint64_t input_bytes;
     /** Reusable movie builder. */
     movie_builder_t *builder;
+    /** Why a genre was dropped from the movie being parsed, which is then rejected even if complete. */
+    const char *NULLABLE rejected_genre;
     /** Internal buffer for error messages. */
     char *NULLABLE error_message;
     /** Allocated size for `error_message`. */
     size_t error_message_capacity;
     /** If main thread request to stop work. */
     atomic_bool *NONNULL shutdown_requested;
+    /** Called before blocking on the socket, if set. */
+    parser_idle_handler_t *NULLABLE idle_handler;
+    /** Argument for `idle_handler`. */
+    void *NULLABLE idle_data;
+    /** Options collected for the operation being parsed. */
+    struct operation_options options;
 };
 
+[[gnu::const]]
+/** Options for an operation that didn't set any. */
+static inline struct operation_options default_options(void) {
+    return (struct operation_options) {.fields = FIELD_ALL};
+}
+
 [[gnu::nonnull(1, 2, 4), gnu::hot]]
 /**
  * A read handler for libyaml that reads from a file descriptor.
@@ -53,13 +111,34 @@ static int sock_read_handler(
 ) {
     parser_t *NONNULL parser = aligned_like(struct operation_parser, data);
 
-    ssize_t rv = recv(parser->socket, buffer, size, 0);
+    // never read past the limit, so the parsers can't buffer an unbounded document
+    if unlikely (max_operation_bytes != 0) {
+        const uint64_t remaining = max_operation_bytes - parser->input_bytes;
+        if unlikely (remaining == 0) {
+            // libyaml keeps the partial document and would ask again forever, so the stream ends here
+            parser->oversized = true;
+            parser->done = true;
+            *size_read = 0;
+            return 0;
+        }
+        size = (remaining < size) ? (size_t) remaining : size;
+    }
+
+    ssize_t rv = recv(parser->socket, buffer, size, parser->idle_handler != NULL ? MSG_DONTWAIT : 0);
+    // nothing buffered by the kernel, let the handler run before waiting for the client
+    if (rv < 0 && parser->idle_handler != NULL && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        parser->idle_handler(parser->idle_data);
+        rv = recv(parser->socket, buffer, size, 0);
+    }
     /* Normal data. */
     if likely (rv >= 0) {
         *size_read = (size_t) rv;
+        parser->input_bytes += (uint64_t) rv;
+        capture_read(trace_current_request(), buffer, *size_read);
         return 1;
         /* Error */
     } else {
+        parser->done = true;
         *size_read = 0;
         return 0;
     }
@@ -85,12 +164,21 @@ parser_t *NULLABLE parser_create(atomic_bool *NONNULL shutdown_requested, const
         return NULL;
     }
 
+    parser->json = NULL;
+    parser->format = INPUT_UNKNOWN;
     parser->done = false;
     parser->in_mapping = false;
+    parser->oversized = false;
+    parser->too_many_genres = false;
+    parser->input_bytes = 0;
     parser->builder = builder;
+    parser->rejected_genre = NULL;
     parser->error_message = NULL;
     parser->error_message_capacity = 0;
     parser->shutdown_requested = shutdown_requested;
+    parser->idle_handler = NULL;
+    parser->idle_data = NULL;
+    parser->options = default_options();
 
     parser->socket = sock_fd;
     yaml_parser_set_encoding(&(parser->yaml), YAML_UTF8_ENCODING);
@@ -102,6 +190,9 @@ parser_t *NULLABLE parser_create(atomic_bool *NONNULL shutdown_requested, const
 /** Free YAML parser resources. */
 void parser_destroy(parser_t *NONNULL parser) {
     yaml_parser_delete(&(parser->yaml));
+    if (parser->json != NULL) {
+        json_lexer_destroy(parser->json);
+    }
     movie_builder_destroy(parser->builder);
     if (parser->error_message != NULL) {
         free(parser->error_message);
@@ -109,6 +200,17 @@ void parser_destroy(parser_t *NONNULL parser) {
     free(parser);
 }
 
+/** Sets a callback for when the parser would block on the socket. */
+void parser_set_idle_handler(parser_t *NONNULL parser, parser_idle_handler_t *NONNULL handler, void *NULLABLE data) {
+    parser->idle_handler = handler;
+    parser->idle_data = data;
+}
+
+/** Check if the client sends JSON. */
+bool parser_is_json(const parser_t *NONNULL parser) {
+    return parser->format == INPUT_JSON;
+}
+
 /** Check if input stream already ended. */
 bool parser_finished(const parser_t *NONNULL parser) {
     return unlikely(parser->done) || unlikely(atomic_load(parser->shutdown_requested));
@@ -195,10 +297,15 @@ static const char *NULLABLE error_message_printf(parser_t *NONNULL parser, const
 
 [[gnu::cold, gnu::nonnull(1)]]
 /**
- * Returns an operation with ty=PARSE_ERROR, for libyaml errors.
+ * Returns an operation with ty=PARSE_ERROR, for libyaml errors. libyaml cannot resume after them, so the rest of the
+ * stream is dropped.
  */
 static struct operation parse_fail(parser_t *NONNULL parser) {
-    assume(parser->yaml.problem != NULL);
+    parser->done = true;
+    // already reported, libyaml keeps the error state but not the message
+    if unlikely (parser->yaml.problem == NULL) {
+        return (struct operation) {.ty = PARSE_ERROR, .error_message = "invalid YAML input"};
+    }
 
     const char *error_message;
     if (parser->yaml.context != NULL) {
@@ -250,6 +357,62 @@ static inline struct operation parse_invalid(
     return (struct operation) {.ty = PARSE_ERROR, .error_message = error_message};
 }
 
+[[gnu::cold, gnu::nonnull(1)]]
+/**
+ * Returns an operation with ty=PARSE_ERROR, for inputs over `max_operation_bytes`. The rest of the stream cannot be
+ * read anymore.
+ */
+static struct operation parse_oversized(parser_t *NONNULL parser) {
+    parser->done = true;
+    const char *error_message = error_message_printf(
+        parser,
+        "operation larger than %" PRIu64 " bytes",
+        max_operation_bytes
+    );
+    if unlikely (error_message == NULL) {
+        error_message = "operation too large";
+    }
+    return (struct operation) {.ty = PARSE_ERROR, .error_message = error_message};
+}
+
+[[nodiscard("useless call if discarded"), gnu::pure]]
+/** Checks if a title, director or genre of `length` bytes can be copied into the builder. */
+static inline bool scalar_fits(size_t length) {
+    return max_scalar_length == 0 || length <= max_scalar_length;
+}
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1)]]
+/** Checks if another genre can be added to the movie being built, and marks the movie as rejected otherwise. */
+static inline bool genre_fits(parser_t *NONNULL parser) {
+    if likely (max_genres == 0 || movie_builder_genre_count(parser->builder) < max_genres) {
+        return true;
+    }
+    parser->too_many_genres = true;
+    return false;
+}
+
+[[gnu::cold, gnu::nonnull(1, 3)]]
+/** Returns an operation with ty=PARSE_ERROR for a genre left out of a movie, and rejects the whole movie. */
+static struct operation parse_rejected_genre(
+    parser_t *NONNULL parser,
+    yaml_mark_t position,
+    const char *NONNULL reason
+) {
+    parser->rejected_genre = reason;
+    return parse_invalid(parser, position, reason);
+}
+
+[[gnu::cold, gnu::nonnull(1)]]
+/** Replaces a complete movie that had more than `max_genres` with ty=PARSE_ERROR. */
+static struct operation parse_too_many_genres(parser_t *NONNULL parser, struct movie movie) {
+    free_movie(movie);
+    const char *error_message = error_message_printf(parser, "movie with more than %" PRIu64 " genres", max_genres);
+    if unlikely (error_message == NULL) {
+        error_message = "too many genres";
+    }
+    return (struct operation) {.ty = PARSE_ERROR, .error_message = error_message};
+}
+
 [[gnu::nonnull(1)]]
 /** Consume all events until the is found. */
 static struct operation parse_consume(parser_t *NONNULL parser, bool is_sequence, struct operation result) {
@@ -305,6 +468,12 @@ static struct operation parse_consume(parser_t *NONNULL parser, bool is_sequence
                 return parse_invalid(parser, position, "unexpected end of document");
 
             case YAML_NO_EVENT:
+                // libyaml only sends empty events after an error, which it can't recover from
+                if unlikely (parser->yaml.error != YAML_NO_ERROR) {
+                    return parse_fail(parser);
+                }
+                continue;
+
             case YAML_ALIAS_EVENT:
             case YAML_SCALAR_EVENT:
                 continue;
@@ -343,11 +512,48 @@ static enum operation_ty parse_ty(const yaml_char_t *NONNULL key) {
         return GET_MOVIE;
     } else if (streq(key, "search_by_genre") || streq(key, "7")) {
         return SEARCH_BY_GENRE;
+    } else if (streq(key, "stats") || streq(key, "8")) {
+        return STATS;
+    } else if (streq(key, "changes_since") || streq(key, "9")) {
+        return CHANGES_SINCE;
+    } else if (streq(key, "upsert_movie") || streq(key, "10")) {
+        return UPSERT_MOVIE;
     } else {
         return PARSE_ERROR;
     }
 }
 
+/** Canonical key for the operation type. */
+const char *NONNULL operation_name(enum operation_ty ty) {
+    switch (ty) {
+        case PARSE_DONE:
+            return "done";
+        case ADD_MOVIE:
+            return "add_movie";
+        case ADD_GENRE:
+            return "add_genre";
+        case REMOVE_MOVIE:
+            return "remove_movie";
+        case LIST_SUMMARIES:
+            return "list_summaries";
+        case LIST_MOVIES:
+            return "list_movies";
+        case GET_MOVIE:
+            return "get_movie";
+        case SEARCH_BY_GENRE:
+            return "search_by_genre";
+        case STATS:
+            return "stats";
+        case CHANGES_SINCE:
+            return "changes_since";
+        case UPSERT_MOVIE:
+            return "upsert_movie";
+        case PARSE_ERROR:
+        default:
+            return "parse_error";
+    }
+}
+
 [[nodiscard("uninitialized output if false"), gnu::hot, gnu::nonnull(1, 2)]]
 /**
  * Parses a 64-bit integer from the string `str`.
@@ -384,6 +590,17 @@ enum [[gnu::packed]] current_key {
     GENRE_KEY,
     DIRECTOR_KEY,
     YEAR_KEY,
+    IF_GENERATION_KEY,
+    SINCE_KEY,
+    AFTER_GENERATION_KEY,
+    AFTER_ID_KEY,
+    WITH_MOVIES_KEY,
+    FIELDS_KEY,
+    ORDER_BY_KEY,
+    DESCENDING_KEY,
+    LIMIT_KEY,
+    OFFSET_KEY,
+    REQUEST_ID_KEY,
     OTHER_KEY,
 };
 
@@ -405,6 +622,28 @@ static enum current_key parse_key(const yaml_char_t *NONNULL key) {
         return DIRECTOR_KEY;
     } else if (streq(key, "year") || streq(key, "release_year")) {
         return YEAR_KEY;
+    } else if (streq(key, "if_generation")) {
+        return IF_GENERATION_KEY;
+    } else if (streq(key, "since")) {
+        return SINCE_KEY;
+    } else if (streq(key, "after_generation")) {
+        return AFTER_GENERATION_KEY;
+    } else if (streq(key, "after_id")) {
+        return AFTER_ID_KEY;
+    } else if (streq(key, "with_movies") || streq(key, "with_movie")) {
+        return WITH_MOVIES_KEY;
+    } else if (streq(key, "fields")) {
+        return FIELDS_KEY;
+    } else if (streq(key, "order_by")) {
+        return ORDER_BY_KEY;
+    } else if (streq(key, "descending")) {
+        return DESCENDING_KEY;
+    } else if (streq(key, "limit")) {
+        return LIMIT_KEY;
+    } else if (streq(key, "offset")) {
+        return OFFSET_KEY;
+    } else if (streq(key, "request_id")) {
+        return REQUEST_ID_KEY;
     } else {
         return OTHER_KEY;
     }
@@ -442,8 +681,14 @@ static struct operation parse_genre_list(parser_t *NONNULL parser) {
             case YAML_SCALAR_EVENT:
                 if likely (!ignore) {
                     const char *NONNULL genre = (const char *) event.data.scalar.value;
-                    bool ok = movie_builder_add_genre(parser->builder, strlen(genre), genre);
-                    if unlikely (!ok) {
+                    const size_t length = strlen(genre);
+                    if unlikely (!genre_fits(parser)) {
+                        last_error = parse_invalid(parser, position, "too many genres");
+                    } else if unlikely (!scalar_fits(length)) {
+                        last_error = parse_rejected_genre(parser, position, "genre too long");
+                    } else if unlikely (!genre_name_is_valid(length, genre)) {
+                        last_error = parse_rejected_genre(parser, position, "invalid character in genre");
+                    } else if unlikely (!movie_builder_add_genre(parser->builder, length, genre)) {
                         last_error = parse_invalid(parser, position, "out of memory when adding a genre");
                     }
                 }
@@ -475,6 +720,144 @@ static struct operation parse_genre_list(parser_t *NONNULL parser) {
                 continue;
 
             case YAML_NO_EVENT:
+                yaml_event_delete(&event);
+                if unlikely (parser->yaml.error != YAML_NO_ERROR) {
+                    return parse_fail(parser);
+                }
+                continue;
+
+            case YAML_ALIAS_EVENT:
+                // just consume & ignore
+                yaml_event_delete(&event);
+                continue;
+
+            case YAML_STREAM_END_EVENT:
+                parse_done(parser);
+                [[fallthrough]];
+            case YAML_DOCUMENT_END_EVENT:
+            case YAML_DOCUMENT_START_EVENT:
+            case YAML_MAPPING_END_EVENT:
+            case YAML_STREAM_START_EVENT:
+            default:
+                yaml_event_delete(&event);
+                if likely (last_error.ty == PARSE_ERROR) {
+                    return last_error;
+                } else {
+                    return parse_invalid(parser, position, "document ended unexpectedly");
+                }
+        }
+    }
+
+    if likely (last_error.ty == PARSE_ERROR) {
+        return last_error;
+    } else {
+        return (struct operation) {.ty = PARSE_ERROR, .error_message = "document ended unexpectedly"};
+    }
+}
+
+// not pure, the result is written through `field`
+[[nodiscard("useless call if discarded"), gnu::nonnull(1, 2)]]
+/** Converts a field name into its bit in `enum movie_field`. The id is always sent, so it has no bit. */
+static bool parse_field(const yaml_char_t *NONNULL name, uint8_t *NONNULL field) {
+    switch (parse_key(name)) {
+        case ID_KEY:
+            *field = 0;
+            return true;
+        case TITLE_KEY:
+            *field = FIELD_TITLE;
+            return true;
+        case YEAR_KEY:
+            *field = FIELD_RELEASE_YEAR;
+            return true;
+        case DIRECTOR_KEY:
+            *field = FIELD_DIRECTOR;
+            return true;
+        case GENRE_KEY:
+            *field = FIELD_GENRES;
+            return true;
+        case NONE:
+        case IF_GENERATION_KEY:
+        case SINCE_KEY:
+        case AFTER_GENERATION_KEY:
+        case AFTER_ID_KEY:
+        case WITH_MOVIES_KEY:
+        case FIELDS_KEY:
+        case ORDER_BY_KEY:
+        case DESCENDING_KEY:
+        case LIMIT_KEY:
+        case OFFSET_KEY:
+        case REQUEST_ID_KEY:
+        case OTHER_KEY:
+        default:
+            return false;
+    }
+}
+
+[[gnu::nonnull(1)]]
+/**
+ * Parses the `fields` option, either a single field name or a sequence of them:
+ *   fields: [title, genres]
+ *
+ * Returns `PARSE_DONE` on success, `PARSE_ERROR` on error.
+ */
+static struct operation parse_field_list(parser_t *NONNULL parser) {
+    struct operation last_error = {.ty = PARSE_DONE};
+    uint8_t fields = 0;
+
+    bool in_list = false;
+    while (!parser_finished(parser)) {
+        yaml_event_t event;
+        int rv = yaml_parser_parse(&(parser->yaml), &event);
+        if unlikely (rv == 0) {
+            return parse_fail(parser);
+        }
+
+        const yaml_mark_t position = event.start_mark;
+        switch (event.type) {
+            case YAML_SCALAR_EVENT: {
+                uint8_t field = 0;
+                if likely (parse_field(event.data.scalar.value, &field)) {
+                    fields |= field;
+                } else {
+                    last_error = parse_invalid(parser, position, "unknown movie field");
+                }
+                yaml_event_delete(&event);
+
+                if unlikely (!in_list) {
+                    parser->options.fields = fields;
+                    return last_error;
+                }
+                continue;
+            }
+
+            case YAML_SEQUENCE_START_EVENT:
+                yaml_event_delete(&event);
+                if unlikely (in_list) {
+                    struct operation error = parse_invalid(parser, position, "internal sequence in field list invalid");
+                    last_error = parse_consume(parser, true, error);
+                } else {
+                    in_list = true;
+                }
+                continue;
+
+            case YAML_SEQUENCE_END_EVENT:
+                yaml_event_delete(&event);
+                parser->options.fields = fields;
+                return last_error;
+
+            case YAML_MAPPING_START_EVENT:
+                yaml_event_delete(&event);
+                struct operation error = parse_invalid(parser, position, "mapping unsupported in field list");
+                last_error = parse_consume(parser, false, error);
+                continue;
+
+            case YAML_NO_EVENT:
+                yaml_event_delete(&event);
+                if unlikely (parser->yaml.error != YAML_NO_ERROR) {
+                    return parse_fail(parser);
+                }
+                continue;
+
             case YAML_ALIAS_EVENT:
                 // just consume & ignore
                 yaml_event_delete(&event);
@@ -534,7 +917,11 @@ static struct operation parse_movie_title(
     struct operation last_error
 ) {
     const char *NONNULL title = (const char *) value;
-    bool ok = movie_builder_set_title(parser->builder, strlen(title), title);
+    const size_t length = strlen(title);
+    if unlikely (!scalar_fits(length)) {
+        return parse_invalid(parser, position, "title too long");
+    }
+    bool ok = movie_builder_set_title(parser->builder, length, title);
     if unlikely (!ok) {
         return parse_invalid(parser, position, "out of memory for title input");
     }
@@ -550,7 +937,11 @@ static struct operation parse_movie_director(
     struct operation last_error
 ) {
     const char *NONNULL director = (const char *) value;
-    bool ok = movie_builder_set_director(parser->builder, strlen(director), director);
+    const size_t length = strlen(director);
+    if unlikely (!scalar_fits(length)) {
+        return parse_invalid(parser, position, "director too long");
+    }
+    bool ok = movie_builder_set_director(parser->builder, length, director);
     if unlikely (!ok) {
         return parse_invalid(parser, position, "out of memory for director input");
     }
@@ -577,6 +968,44 @@ static struct operation parse_movie_year(
     return last_error;
 }
 
+[[gnu::nonnull(1, 2, 5)]]
+/** Parse a boolean option from a scalar value. */
+static struct operation parse_flag(
+    parser_t *NONNULL parser,
+    const yaml_char_t *NONNULL value,
+    yaml_mark_t position,
+    struct operation last_error,
+    bool *NONNULL option
+) {
+    if (streq(value, "true")) {
+        *option = true;
+    } else if (streq(value, "false")) {
+        *option = false;
+    } else {
+        return parse_invalid(parser, position, "option must be true or false");
+    }
+    return last_error;
+}
+
+[[gnu::nonnull(1, 2, 5)]]
+/** Parse a non-negative integer option, like `limit`, `offset` or `request_id`, from a scalar value. */
+static struct operation parse_count(
+    parser_t *NONNULL parser,
+    const yaml_char_t *NONNULL value,
+    yaml_mark_t position,
+    struct operation last_error,
+    uint64_t *NONNULL option
+) {
+    int64_t count;
+    bool ok = parse_i64((const char *) value, &count);
+    if unlikely (!ok || count < 0) {
+        return parse_invalid(parser, position, "option is not a valid non-negative integer");
+    }
+
+    *option = (uint64_t) count;
+    return last_error;
+}
+
 [[nodiscard("allocated memory must be freed"), gnu::nonnull(1)]]
 /**
  * Parses a YAML mapping containing a new movie:
@@ -621,6 +1050,13 @@ static struct operation parse_movie(parser_t *NONNULL parser, enum operation_ty
                                 if unlikely (error.ty == PARSE_ERROR) {
                                     last_error = error;
                                 }
+                            } else if (key == FIELDS_KEY) {
+                                key = NONE;
+
+                                struct operation error = parse_field_list(parser);
+                                if unlikely (error.ty == PARSE_ERROR) {
+                                    last_error = error;
+                                }
                             }
                             continue;
                         } else {
@@ -651,7 +1087,36 @@ static struct operation parse_movie(parser_t *NONNULL parser, enum operation_ty
                         last_error = parse_invalid(parser, position, "unexpected genre key");
                         break;
 
+                    case WITH_MOVIES_KEY:
+                        last_error = parse_flag(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.with_movies)
+                        );
+                        break;
+
+                    case REQUEST_ID_KEY:
+                        last_error = parse_count(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.request_id)
+                        );
+                        break;
+
                     case ID_KEY:
+                    case IF_GENERATION_KEY:
+                    case SINCE_KEY:
+                    case AFTER_GENERATION_KEY:
+                    case AFTER_ID_KEY:
+                    case FIELDS_KEY:
+                    case ORDER_BY_KEY:
+                    case DESCENDING_KEY:
+                    case LIMIT_KEY:
+                    case OFFSET_KEY:
                     case OTHER_KEY:
                     default:
                         break;
@@ -693,6 +1158,12 @@ static struct operation parse_movie(parser_t *NONNULL parser, enum operation_ty
                 continue;
 
             case YAML_NO_EVENT:
+                yaml_event_delete(&event);
+                if unlikely (parser->yaml.error != YAML_NO_ERROR) {
+                    return parse_fail(parser);
+                }
+                continue;
+
             case YAML_ALIAS_EVENT:
                 // just consume & ignore
                 yaml_event_delete(&event);
@@ -772,13 +1243,77 @@ static struct operation parse_movie_key_genre(
     struct operation last_error
 ) {
     const char *NONNULL genre = (const char *) value;
-    bool ok = movie_builder_set_title(parser->builder, strlen(genre), genre);
+    const size_t length = strlen(genre);
+    if unlikely (!scalar_fits(length)) {
+        return parse_invalid(parser, position, "genre too long");
+    } else if unlikely (!genre_name_is_valid(length, genre)) {
+        return parse_invalid(parser, position, "invalid character in genre");
+    }
+    bool ok = movie_builder_set_title(parser->builder, length, genre);
     if unlikely (!ok) {
         return parse_invalid(parser, position, "out of memory for genre input");
     }
     return last_error;
 }
 
+[[gnu::nonnull(1, 2, 5)]]
+/** Parse a catalog generation option from a scalar value. */
+static struct operation parse_generation(
+    parser_t *NONNULL parser,
+    const yaml_char_t *NONNULL value,
+    yaml_mark_t position,
+    struct operation last_error,
+    uint64_t *NONNULL option
+) {
+    int64_t generation;
+    bool ok = parse_i64((const char *) value, &generation);
+    if unlikely (!ok || generation < 0) {
+        return parse_invalid(parser, position, "generation is not a valid non-negative integer");
+    }
+
+    *option = (uint64_t) generation;
+    return last_error;
+}
+
+[[gnu::nonnull(1, 2, 5)]]
+/** Parse the `order_by` option from a field name. Only `id`, `title` and `release_year` can be sorted. */
+static struct operation parse_order(
+    parser_t *NONNULL parser,
+    const yaml_char_t *NONNULL value,
+    yaml_mark_t position,
+    struct operation last_error,
+    uint8_t *NONNULL option
+) {
+    switch (parse_key(value)) {
+        case ID_KEY:
+            *option = ORDER_BY_ID;
+            return last_error;
+        case TITLE_KEY:
+            *option = ORDER_BY_TITLE;
+            return last_error;
+        case YEAR_KEY:
+            *option = ORDER_BY_RELEASE_YEAR;
+            return last_error;
+        case NONE:
+        case GENRE_KEY:
+        case DIRECTOR_KEY:
+        case IF_GENERATION_KEY:
+        case SINCE_KEY:
+        case AFTER_GENERATION_KEY:
+        case AFTER_ID_KEY:
+        case WITH_MOVIES_KEY:
+        case FIELDS_KEY:
+        case ORDER_BY_KEY:
+        case DESCENDING_KEY:
+        case LIMIT_KEY:
+        case OFFSET_KEY:
+        case REQUEST_ID_KEY:
+        case OTHER_KEY:
+        default:
+            return parse_invalid(parser, position, "movies can only be ordered by id, title or release_year");
+    }
+}
+
 [[nodiscard("allocated memory must be freed"), gnu::nonnull(1)]]
 /**
  * Parses a smaller mapping that either needs an ID and/or a genre.
@@ -829,6 +1364,17 @@ static struct operation parse_movie_key(
                     case NONE:
                         if (in_mapping) {
                             key = parse_key(event.data.scalar.value);
+                            // a list of fields, parsed like genres
+                            if (key == FIELDS_KEY) {
+                                yaml_event_delete(&event);
+                                key = NONE;
+
+                                struct operation error = parse_field_list(parser);
+                                if unlikely (error.ty == PARSE_ERROR) {
+                                    last_error = error;
+                                }
+                                continue;
+                            }
                         } else if (!movie_builder_has_id(parser->builder) && movie_builder_has_title(parser->builder)) {
                             // e.g., remove_movie wants just an ID
                             last_error = parse_movie_key_id(parser, event.data.scalar.value, position, last_error);
@@ -855,9 +1401,110 @@ static struct operation parse_movie_key(
                         }
                         break;
 
+                    case IF_GENERATION_KEY:
+                        last_error = parse_generation(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.if_generation)
+                        );
+                        break;
+
+                    case SINCE_KEY:
+                        last_error = parse_generation(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.since_generation)
+                        );
+                        break;
+
+                    case AFTER_GENERATION_KEY:
+                        last_error = parse_generation(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.after_generation)
+                        );
+                        break;
+
+                    case AFTER_ID_KEY:
+                        last_error = parse_count(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.after_id)
+                        );
+                        break;
+
+                    case WITH_MOVIES_KEY:
+                        last_error = parse_flag(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.with_movies)
+                        );
+                        break;
+
+                    case ORDER_BY_KEY:
+                        last_error = parse_order(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.order_by)
+                        );
+                        break;
+
+                    case DESCENDING_KEY:
+                        last_error = parse_flag(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.descending)
+                        );
+                        break;
+
+                    case LIMIT_KEY:
+                        last_error = parse_count(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.limit)
+                        );
+                        break;
+
+                    case OFFSET_KEY:
+                        last_error = parse_count(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.offset)
+                        );
+                        break;
+
+                    case REQUEST_ID_KEY:
+                        last_error = parse_count(
+                            parser,
+                            event.data.scalar.value,
+                            position,
+                            last_error,
+                            &(parser->options.request_id)
+                        );
+                        break;
+
                     case TITLE_KEY:
                     case DIRECTOR_KEY:
                     case YEAR_KEY:
+                    case FIELDS_KEY:
                     case OTHER_KEY:
                     default:
                         break;
@@ -899,6 +1546,12 @@ static struct operation parse_movie_key(
                 continue;
 
             case YAML_NO_EVENT:
+                yaml_event_delete(&event);
+                if unlikely (parser->yaml.error != YAML_NO_ERROR) {
+                    return parse_fail(parser);
+                }
+                continue;
+
             case YAML_ALIAS_EVENT:
                 // just consume & ignore
                 yaml_event_delete(&event);
@@ -932,8 +1585,31 @@ static struct operation parse_movie_key(
     }
 }
 
-/** Reads the next operation from the YAML parser */
-struct operation parser_next_op(parser_t *NONNULL parser) {
+[[gnu::nonnull(1)]]
+/** Reads an operation given just by its name, outside a mapping. Only those without arguments are valid. */
+static struct operation parse_bare_op(parser_t *NONNULL parser, enum operation_ty ty, yaml_mark_t position) {
+    switch (ty) {
+        case LIST_SUMMARIES:
+        case LIST_MOVIES:
+        case STATS:
+        case CHANGES_SINCE:
+            return (struct operation) {.ty = ty};
+        case GET_MOVIE:
+        case REMOVE_MOVIE:
+        case SEARCH_BY_GENRE:
+        case ADD_MOVIE:
+        case ADD_GENRE:
+        case UPSERT_MOVIE:
+            return parse_invalid(parser, position, "operation requires a dictionary");
+        case PARSE_ERROR:
+        default:
+            return parse_invalid(parser, position, "unrecognized operation key");
+    }
+}
+
+[[nodiscard("must be freed"), gnu::nonnull(1), gnu::hot]]
+/** Reads the next operation from the YAML parser, without its options. */
+static struct operation parse_next_op(parser_t *NONNULL parser) {
     enum operation_ty ty = PARSE_ERROR;
 
     while (!parser_finished(parser)) {
@@ -953,6 +1629,7 @@ struct operation parser_next_op(parser_t *NONNULL parser) {
                 if (parser->in_mapping) {
                     switch (ty) {
                         case ADD_MOVIE:
+                        case UPSERT_MOVIE:
                             return parse_movie(parser, ty);
                         case ADD_GENRE:
                             return parse_movie_key(parser, ty, true, true);
@@ -963,27 +1640,15 @@ struct operation parser_next_op(parser_t *NONNULL parser) {
                             return parse_movie_key(parser, ty, false, true);
                         case LIST_SUMMARIES:
                         case LIST_MOVIES:
+                        case STATS:
+                        case CHANGES_SINCE:
                             return parse_movie_key(parser, ty, false, false);
                         case PARSE_ERROR:
                         default:
                             return parse_invalid(parser, position, "unrecognized operation key");
                     }
                 } else {
-                    // If we're outside a mapping, only certain ops are valid
-                    switch (ty) {
-                        case LIST_SUMMARIES:
-                        case LIST_MOVIES:
-                            return (struct operation) {.ty = ty};
-                        case GET_MOVIE:
-                        case REMOVE_MOVIE:
-                        case SEARCH_BY_GENRE:
-                        case ADD_MOVIE:
-                        case ADD_GENRE:
-                            return parse_invalid(parser, position, "operation requires a dictionary");
-                        case PARSE_ERROR:
-                        default:
-                            return parse_invalid(parser, position, "unrecognized operation key");
-                    }
+                    return parse_bare_op(parser, ty, position);
                 }
 
             case YAML_MAPPING_START_EVENT:
@@ -1003,6 +1668,12 @@ struct operation parser_next_op(parser_t *NONNULL parser) {
                 continue;
 
             case YAML_NO_EVENT:
+                yaml_event_delete(&event);
+                if unlikely (parser->yaml.error != YAML_NO_ERROR) {
+                    return parse_fail(parser);
+                }
+                continue;
+
             case YAML_ALIAS_EVENT:
             case YAML_STREAM_START_EVENT:
             case YAML_DOCUMENT_START_EVENT:
@@ -1022,3 +1693,468 @@ struct operation parser_next_op(parser_t *NONNULL parser) {
 
     return parse_done(parser);
 }
+
+[[gnu::const]]
+/** Position of a JSON token, for error messages. */
+static inline yaml_mark_t json_mark(struct json_token token) {
+    return (yaml_mark_t) {.index = 0, .line = token.line, .column = token.column};
+}
+
+[[gnu::cold, gnu::nonnull(1)]]
+/** Returns an operation with ty=PARSE_ERROR for tokenizer errors. The stream cannot be resynchronized after them. */
+static struct operation parse_json_fail(parser_t *NONNULL parser, struct json_token token) {
+    assume(token.ty == JSON_ERROR && token.text != NULL);
+    parser->done = true;
+    return parse_invalid(parser, json_mark(token), token.text);
+}
+
+[[gnu::nonnull(1)]]
+/** Consumes the rest of a value that starts with `token`, returning `result` unless the input is invalid. */
+static struct operation parse_json_skip(parser_t *NONNULL parser, struct json_token token, struct operation result) {
+    size_t depth = (token.ty == JSON_OBJECT_START || token.ty == JSON_ARRAY_START) ? 1 : 0;
+    while (depth > 0) {
+        token = json_next(parser->json);
+        switch (token.ty) {
+            case JSON_ERROR:
+                return parse_json_fail(parser, token);
+            case JSON_OBJECT_START:
+            case JSON_ARRAY_START:
+                depth += 1;
+                continue;
+            case JSON_OBJECT_END:
+            case JSON_ARRAY_END:
+                depth -= 1;
+                continue;
+            case JSON_END:
+            case JSON_KEY:
+            case JSON_STRING:
+            case JSON_NUMBER:
+            case JSON_TRUE:
+            case JSON_FALSE:
+            case JSON_NULL:
+            default:
+                continue;
+        }
+    }
+    return result;
+}
+
+/** Parses a single string of a JSON list. */
+typedef struct operation json_item_parser_t(
+    parser_t *NONNULL parser,
+    struct json_token item,
+    struct operation last_error
+);
+
+[[gnu::nonnull(1)]]
+/** Adds a genre to the movie being built. */
+static struct operation parse_json_genre(
+    parser_t *NONNULL parser,
+    struct json_token item,
+    struct operation last_error
+) {
+    if unlikely (!genre_fits(parser)) {
+        return parse_invalid(parser, json_mark(item), "too many genres");
+    } else if unlikely (!scalar_fits(item.length)) {
+        return parse_rejected_genre(parser, json_mark(item), "genre too long");
+    } else if unlikely (!genre_name_is_valid(item.length, item.text)) {
+        return parse_rejected_genre(parser, json_mark(item), "invalid character in genre");
+    }
+    bool ok = movie_builder_add_genre(parser->builder, item.length, item.text);
+    if unlikely (!ok) {
+        return parse_invalid(parser, json_mark(item), "out of memory when adding a genre");
+    }
+    return last_error;
+}
+
+[[gnu::nonnull(1)]]
+/** Adds a field to the `fields` option. */
+static struct operation parse_json_field(
+    parser_t *NONNULL parser,
+    struct json_token item,
+    struct operation last_error
+) {
+    uint8_t field = 0;
+    if unlikely (!parse_field((const yaml_char_t *) item.text, &field)) {
+        return parse_invalid(parser, json_mark(item), "unknown movie field");
+    }
+    parser->options.fields |= field;
+    return last_error;
+}
+
+[[gnu::nonnull(1, 4)]]
+/**
+ * Parses either a single string or an array of strings, like the genres of a movie:
+ *   "genres": ["Sci-Fi", "Comedy"]
+ *
+ * Returns `last_error`, or `PARSE_ERROR` on error.
+ */
+static struct operation parse_json_list(
+    parser_t *NONNULL parser,
+    struct json_token token,
+    struct operation last_error,
+    json_item_parser_t *NONNULL parse_item
+) {
+    if (token.ty == JSON_STRING) {
+        return parse_item(parser, token, last_error);
+    } else if unlikely (token.ty != JSON_ARRAY_START) {
+        struct operation error = parse_invalid(parser, json_mark(token), "expected a string or a list of strings");
+        return parse_json_skip(parser, token, error);
+    }
+
+    while (!parser_finished(parser)) {
+        token = json_next(parser->json);
+        switch (token.ty) {
+            case JSON_ARRAY_END:
+                return last_error;
+            case JSON_STRING:
+                last_error = parse_item(parser, token, last_error);
+                continue;
+            case JSON_ERROR:
+                return parse_json_fail(parser, token);
+            case JSON_END:
+            case JSON_OBJECT_START:
+            case JSON_OBJECT_END:
+            case JSON_ARRAY_START:
+            case JSON_KEY:
+            case JSON_NUMBER:
+            case JSON_TRUE:
+            case JSON_FALSE:
+            case JSON_NULL:
+            default: {
+                struct operation error = parse_invalid(parser, json_mark(token), "list items must be strings");
+                last_error = parse_json_skip(parser, token, error);
+                continue;
+            }
+        }
+    }
+    return (struct operation) {.ty = PARSE_ERROR, .error_message = "document ended unexpectedly"};
+}
+
+[[gnu::nonnull(1)]]
+/** Applies a single argument of an operation, with `value` already read. Unknown keys are ignored, like in YAML. */
+static struct operation parse_json_arg(
+    parser_t *NONNULL parser,
+    bool is_movie,
+    enum current_key key,
+    struct json_token value,
+    struct operation last_error
+) {
+    const yaml_mark_t position = json_mark(value);
+    switch (value.ty) {
+        case JSON_STRING:
+        case JSON_NUMBER:
+        case JSON_TRUE:
+        case JSON_FALSE:
+            break;
+        case JSON_OBJECT_START:
+        case JSON_ARRAY_START:
+            if (key == FIELDS_KEY || (is_movie && key == GENRE_KEY)) {
+                break;
+            }
+            struct operation error = parse_invalid(parser, position, "nested value unsupported in this operation");
+            return parse_json_skip(parser, value, error);
+        case JSON_NULL:
+            return last_error;
+        case JSON_ERROR:
+            return parse_json_fail(parser, value);
+        case JSON_END:
+        case JSON_OBJECT_END:
+        case JSON_ARRAY_END:
+        case JSON_KEY:
+        default:
+            return parse_invalid(parser, position, "unexpected token in operation");
+    }
+
+    const yaml_char_t *text = (const yaml_char_t *) value.text;
+    switch (key) {
+        case TITLE_KEY:
+            if (is_movie && !movie_builder_has_title(parser->builder)) {
+                return parse_movie_title(parser, text, position, last_error);
+            }
+            return last_error;
+        case DIRECTOR_KEY:
+            if (is_movie && !movie_builder_has_director(parser->builder)) {
+                return parse_movie_director(parser, text, position, last_error);
+            }
+            return last_error;
+        case YEAR_KEY:
+            if (is_movie && !movie_builder_has_release_year(parser->builder)) {
+                return parse_movie_year(parser, text, position, last_error);
+            }
+            return last_error;
+        case ID_KEY:
+            if (!movie_builder_has_id(parser->builder)) {
+                return parse_movie_key_id(parser, text, position, last_error);
+            }
+            return last_error;
+        case GENRE_KEY:
+            if (!is_movie && !movie_builder_has_title(parser->builder)) {
+                return parse_movie_key_genre(parser, text, position, last_error);
+            } else if (is_movie && !movie_builder_has_genres(parser->builder)) {
+                movie_builder_start_genres(parser->builder);
+                return parse_json_list(parser, value, last_error, parse_json_genre);
+            } else {
+                return parse_json_skip(parser, value, last_error);
+            }
+        case FIELDS_KEY:
+            parser->options.fields = 0;
+            return parse_json_list(parser, value, last_error, parse_json_field);
+        case IF_GENERATION_KEY:
+            return parse_generation(parser, text, position, last_error, &(parser->options.if_generation));
+        case SINCE_KEY:
+            return parse_generation(parser, text, position, last_error, &(parser->options.since_generation));
+        case AFTER_GENERATION_KEY:
+            return parse_generation(parser, text, position, last_error, &(parser->options.after_generation));
+        case AFTER_ID_KEY:
+            return parse_count(parser, text, position, last_error, &(parser->options.after_id));
+        case WITH_MOVIES_KEY:
+            return parse_flag(parser, text, position, last_error, &(parser->options.with_movies));
+        case ORDER_BY_KEY:
+            return parse_order(parser, text, position, last_error, &(parser->options.order_by));
+        case DESCENDING_KEY:
+            return parse_flag(parser, text, position, last_error, &(parser->options.descending));
+        case LIMIT_KEY:
+            return parse_count(parser, text, position, last_error, &(parser->options.limit));
+        case OFFSET_KEY:
+            return parse_count(parser, text, position, last_error, &(parser->options.offset));
+        case REQUEST_ID_KEY:
+            return parse_count(parser, text, position, last_error, &(parser->options.request_id));
+        case NONE:
+        case OTHER_KEY:
+        default:
+            return last_error;
+    }
+}
+
+[[nodiscard("allocated memory must be freed"), gnu::nonnull(1)]]
+/**
+ * Parses the arguments of an operation, given as a JSON object, a single scalar, or `null`. Accepts the same keys and
+ * shorthands as the YAML mappings, so both formats build the same `struct operation`.
+ */
+static struct operation parse_json_op(parser_t *NONNULL parser, enum operation_ty ty, yaml_mark_t position) {
+    bool is_movie = false;
+    bool needs_id = false;
+    bool needs_genre = false;
+    switch (ty) {
+        case ADD_MOVIE:
+        case UPSERT_MOVIE:
+            is_movie = true;
+            break;
+        case ADD_GENRE:
+            needs_id = true;
+            needs_genre = true;
+            break;
+        case GET_MOVIE:
+        case REMOVE_MOVIE:
+            needs_id = true;
+            break;
+        case SEARCH_BY_GENRE:
+            needs_genre = true;
+            break;
+        case LIST_SUMMARIES:
+        case LIST_MOVIES:
+        case STATS:
+        case CHANGES_SINCE:
+            break;
+        case PARSE_ERROR:
+        default: {
+            struct operation error = parse_invalid(parser, position, "unrecognized operation key");
+            const struct json_token value = json_next(parser->json);
+            if unlikely (value.ty == JSON_ERROR) {
+                return parse_json_fail(parser, value);
+            }
+            return parse_json_skip(parser, value, error);
+        }
+    }
+
+    movie_builder_reset(parser->builder);
+    if (is_movie || !needs_id) {
+        movie_builder_set_id(parser->builder, 0);
+    }
+    if (!is_movie && !needs_genre) {
+        // using summary title as input genre
+        movie_builder_set_title(parser->builder, 0, "");
+    }
+
+    struct operation last_error = {.ty = PARSE_DONE};
+    const struct json_token value = json_next(parser->json);
+    switch (value.ty) {
+        case JSON_OBJECT_START:
+            while (!parser_finished(parser)) {
+                const struct json_token token = json_next(parser->json);
+                if (token.ty == JSON_OBJECT_END) {
+                    break;
+                } else if unlikely (token.ty == JSON_ERROR) {
+                    return parse_json_fail(parser, token);
+                }
+                assume(token.ty == JSON_KEY);
+
+                // the key text is only valid until the value is read
+                const enum current_key key = parse_key((const yaml_char_t *) token.text);
+                last_error = parse_json_arg(parser, is_movie, key, json_next(parser->json), last_error);
+            }
+            break;
+
+        case JSON_STRING:
+        case JSON_NUMBER: {
+            const yaml_char_t *text = (const yaml_char_t *) value.text;
+            const bool has_id = movie_builder_has_id(parser->builder);
+            const bool has_title = movie_builder_has_title(parser->builder);
+            if (!is_movie && !has_id && has_title) {
+                // e.g., remove_movie wants just an ID
+                last_error = parse_movie_key_id(parser, text, json_mark(value), last_error);
+            } else if (!is_movie && has_id && !has_title) {
+                // just a genre for searching
+                last_error = parse_movie_key_genre(parser, text, json_mark(value), last_error);
+            } else {
+                last_error = parse_invalid(parser, json_mark(value), "invalid input for operation");
+            }
+            break;
+        }
+
+        case JSON_NULL:
+            break;
+
+        case JSON_ERROR:
+            return parse_json_fail(parser, value);
+
+        case JSON_END:
+        case JSON_OBJECT_END:
+        case JSON_ARRAY_START:
+        case JSON_ARRAY_END:
+        case JSON_KEY:
+        case JSON_TRUE:
+        case JSON_FALSE:
+        default: {
+            struct operation error = parse_invalid(parser, json_mark(value), "invalid input for operation");
+            last_error = parse_json_skip(parser, value, error);
+            break;
+        }
+    }
+
+    if likely (is_movie && is_movie_done(parser->builder)) {
+        return parse_movie_done(parser->builder, ty);
+    } else if likely (!is_movie && is_movie_key_done(parser->builder)) {
+        return parse_movie_key_done(parser->builder, ty);
+    } else if likely (last_error.ty == PARSE_ERROR) {
+        return last_error;
+    } else {
+        return parse_invalid(parser, position, "operation incomplete");
+    }
+}
+
+[[nodiscard("must be freed"), gnu::nonnull(1), gnu::hot]]
+/**
+ * Reads the next operation from a stream of JSON values, without its options. Each key of an object is an operation,
+ * like in the YAML mappings, and arrays of those objects are flattened. A top level string is an operation without
+ * arguments.
+ */
+static struct operation parse_json_next_op(parser_t *NONNULL parser) {
+    while (!parser_finished(parser)) {
+        const struct json_token token = json_next(parser->json);
+        switch (token.ty) {
+            case JSON_KEY:
+                return parse_json_op(parser, parse_ty((const yaml_char_t *) token.text), json_mark(token));
+
+            case JSON_STRING:
+                return parse_bare_op(parser, parse_ty((const yaml_char_t *) token.text), json_mark(token));
+
+            case JSON_OBJECT_START:
+            case JSON_OBJECT_END:
+            case JSON_ARRAY_START:
+            case JSON_ARRAY_END:
+                // just consume & ignore
+                continue;
+
+            case JSON_NUMBER:
+            case JSON_TRUE:
+            case JSON_FALSE:
+            case JSON_NULL:
+                return parse_invalid(parser, json_mark(token), "unrecognized operation key");
+
+            case JSON_ERROR:
+                return parse_json_fail(parser, token);
+
+            case JSON_END:
+            default:
+                return parse_done(parser);
+        }
+    }
+
+    return parse_done(parser);
+}
+
+/** Bytes inspected at most to detect the input format. */
+#define DETECT_FORMAT_LEN 64
+
+[[gnu::nonnull(1), gnu::cold]]
+/**
+ * Detects the input format from the first bytes, without consuming them. JSON objects always start with a quoted key,
+ * which is rare in YAML, so `{"` and a top level string are taken as JSON and anything else as YAML. Both read the same
+ * operations from a top level string, so that case is not ambiguous.
+ */
+static enum input_format detect_format(const parser_t *NONNULL parser) {
+    unsigned char buffer[DETECT_FORMAT_LEN];
+
+    for (size_t wanted = 1; wanted <= DETECT_FORMAT_LEN; wanted++) {
+        // waits until `wanted` bytes are buffered, so a key split across packets is still seen
+        const ssize_t rv = recv(parser->socket, buffer, wanted, MSG_PEEK | MSG_WAITALL);
+        if unlikely (rv <= 0 || (size_t) rv < wanted) {
+            // closed or failed, reported by the YAML parser
+            return INPUT_YAML;
+        }
+
+        switch (buffer[wanted - 1]) {
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+            case '{':
+            case '[':
+                continue;
+            case '"':
+            case '}':
+            case ']':
+                return INPUT_JSON;
+            default:
+                return INPUT_YAML;
+        }
+    }
+    return INPUT_YAML;
+}
+
+/** Reads the next operation from the YAML or JSON input */
+struct operation parser_next_op(parser_t *NONNULL parser) {
+    if unlikely (parser->format == INPUT_UNKNOWN) {
+        parser->format = detect_format(parser);
+        if (parser->format == INPUT_JSON) {
+            parser->json = json_lexer_create(sock_read_handler, parser);
+            if unlikely (parser->json == NULL) {
+                parser->done = true;
+                return (struct operation) {.ty = PARSE_ERROR, .error_message = "out of memory for JSON input"};
+            }
+        }
+    }
+
+    parser->options = default_options();
+    parser->input_bytes = 0;
+    parser->too_many_genres = false;
+    parser->rejected_genre = NULL;
+    struct operation op = (parser->format == INPUT_JSON) ? parse_json_next_op(parser) : parse_next_op(parser);
+    // the limit shows up as a read error or an early end of input, which can also leave an operation that looks
+    // complete, like a movie with only part of its genre list
+    if unlikely (parser->oversized) {
+        if (op.ty == ADD_MOVIE || op.ty == UPSERT_MOVIE) {
+            free_movie(op.movie);
+        }
+        op = parse_oversized(parser);
+    } else if unlikely (parser->too_many_genres && (op.ty == ADD_MOVIE || op.ty == UPSERT_MOVIE)) {
+        op = parse_too_many_genres(parser, op.movie);
+    } else if unlikely (parser->rejected_genre != NULL && (op.ty == ADD_MOVIE || op.ty == UPSERT_MOVIE)) {
+        free_movie(op.movie);
+        op = (struct operation) {.ty = PARSE_ERROR, .error_message = parser->rejected_genre};
+    }
+    op.options = parser->options;
+    return op;
+}
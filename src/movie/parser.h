@@ -23,6 +23,64 @@ enum [[gnu::packed]] operation_ty {
     LIST_MOVIES = 5,
     GET_MOVIE = 6,
     SEARCH_BY_GENRE = 7,
+    STATS = 8,
+    CHANGES_SINCE = 9,
+    UPSERT_MOVIE = 10,
+};
+
+/**
+ * Movie fields that can be selected with the `fields` option, as bits of `struct operation_options`. The id is always
+ * sent.
+ */
+enum [[gnu::packed]] movie_field {
+    FIELD_TITLE = 1 << 0,
+    FIELD_RELEASE_YEAR = 1 << 1,
+    FIELD_DIRECTOR = 1 << 2,
+    FIELD_GENRES = 1 << 3,
+    /** Every field, the default. */
+    FIELD_ALL = FIELD_TITLE | FIELD_RELEASE_YEAR | FIELD_DIRECTOR | FIELD_GENRES,
+};
+
+/**
+ * Sort orders for `LIST_MOVIES`, selected with the `order_by` option. Ties are broken by id.
+ */
+enum [[gnu::packed]] movie_order {
+    /** Storage order, the default. */
+    ORDER_NONE,
+    ORDER_BY_ID,
+    ORDER_BY_TITLE,
+    ORDER_BY_RELEASE_YEAR,
+};
+
+/**
+ * Optional parameters that modify how an operation is answered, valid for any `ty`.
+ */
+struct operation_options {  // NOLINT(altera-struct-pack-align)
+    /** For list operations, skip the list if the catalog is still at this generation. Zero if not requested. */
+    uint64_t if_generation;
+    /** For `CHANGES_SINCE`, the generation the client already has. Zero lists every movie as added. */
+    uint64_t since_generation;
+    /** For `CHANGES_SINCE`, resume a truncated list after the change to `after_id` at this generation. */
+    uint64_t after_generation;
+    /** For `CHANGES_SINCE`, the last movie already received. Zero if not resuming. */
+    uint64_t after_id;
+    /** For `LIST_MOVIES`, `LIST_SUMMARIES` and `SEARCH_BY_GENRE`, the maximum number to send. Zero if not limited. */
+    uint64_t limit;
+    /** For `LIST_MOVIES`, `LIST_SUMMARIES` and `SEARCH_BY_GENRE`, how many to skip before the first one sent. */
+    uint64_t offset;
+    /**
+     * Client chosen id, echoed back in the response. Operations with an id may run concurrently and be answered out of
+     * order. Zero if not given.
+     */
+    uint64_t request_id;
+    /** For `CHANGES_SINCE`, also send the full added and updated movies. For `ADD_MOVIE`, send the stored movie. */
+    bool with_movies;
+    /** For operations that send full movies, which of `enum movie_field` to include. */
+    uint8_t fields;
+    /** For `LIST_MOVIES`, one of `enum movie_order`. */
+    uint8_t order_by;
+    /** For `LIST_MOVIES`, sort from the largest to the smallest value. */
+    bool descending;
 };
 
 /**
@@ -49,9 +107,24 @@ struct operation {  // NOLINT(altera-struct-pack-align)
          */
         const char *NULLABLE error_message;
     };
+    /** Optional parameters given with the operation. */
+    struct operation_options options;
     enum operation_ty ty;
 };
 
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Reads the input limits from `REQUEST_MAX_BYTES`, `REQUEST_MAX_SCALAR` and `REQUEST_MAX_GENRES`. Must run before any
+ * parser is created.
+ */
+void parser_setup(void);
+
+[[nodiscard("useless call if discarded"), gnu::const, gnu::returns_nonnull, gnu::leaf, gnu::nothrow]]
+/**
+ * Canonical key for the operation type, as accepted by the parser (e.g. ADD_MOVIE => \"add_movie\").
+ */
+const char *NONNULL operation_name(enum operation_ty ty);
+
 /** Optimal alignment for `parser_t`. */
 #define ALIGNMENT_OPERATION_PARSER 128
 
@@ -72,16 +145,37 @@ parser_t *NULLABLE parser_create(atomic_bool *NONNULL shutdown_requested, int so
  */
 bool parser_finished(const parser_t *NONNULL parser);
 
+[[gnu::pure, gnu::nonnull(1), gnu::leaf, gnu::nothrow]]
+/**
+ * Check if the client sends JSON instead of YAML, so it should be answered in JSON. Only known after the first
+ * `parser_next_op`.
+ */
+bool parser_is_json(const parser_t *NONNULL parser);
+
 [[gnu::nonnull(1), gnu::leaf, gnu::nothrow]]
 /**
  * Free memory used by the YAML parser.
  */
 void parser_destroy(parser_t *NONNULL parser);
 
-[[nodiscard("must be freed"), gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/** Callback run before the parser blocks waiting for more input. */
+typedef void parser_idle_handler_t(void *NULLABLE data);
+
+[[gnu::nonnull(1, 2), gnu::leaf, gnu::nothrow]]
+/**
+ * Sets a callback to run whenever all buffered input was consumed and the parser is about to block on the socket.
+ *
+ * Used to release resources that are only worth holding across pipelined operations.
+ */
+void parser_set_idle_handler(parser_t *NONNULL parser, parser_idle_handler_t *NONNULL handler, void *NULLABLE data);
+
+// not a leaf, may call the idle handler
+[[nodiscard("must be freed"), gnu::nonnull(1), gnu::hot, gnu::nothrow]]
 /**
  * Reads the next operation from the YAML parser, which may be outside or inside a mapping.
  *
+ * The first call detects if the client sends JSON instead, which is read into the same operations.
+ *
  * If we are inside a mapping, we expect a key that identifies the operation type, and then we parse its parameters.
  * If we are outside, we only allow certain operation types (e.g., list).
  *
@@ -0,0 +1,70 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../defines.h"
+#include "./json.h"
+#include "./movie.h"
+#include "./parser.h"
+#include "./render.h"
+
+/** Writes `movie` as YAML and frees it. */
+void render_movie(FILE *NONNULL output, struct movie movie, bool in_list, uint8_t fields) {
+    const char *item = in_list ? "- " : "";
+    const char *indent = in_list ? "  " : "";
+
+    if (!in_list) {
+        (void) fputs("movie:\n", output);
+    }
+    (void) fprintf(output, "  %2sid: %" PRIi64 "\n", item, movie.id);
+    if (fields & FIELD_TITLE) {
+        (void) fprintf(output, "  %2stitle: %s\n", indent, movie.title);
+    }
+    if (fields & FIELD_RELEASE_YEAR) {
+        (void) fprintf(output, "  %2srelease_year: %d\n", indent, movie.release_year);
+    }
+    if (fields & FIELD_DIRECTOR) {
+        (void) fprintf(output, "  %2sdirector: %s\n", indent, movie.director);
+    }
+    if (fields & FIELD_GENRES) {
+        if unlikely (movie.genre_count <= 0) {
+            (void) fprintf(output, "  %2sgenres: []\n", indent);
+        } else {
+            (void) fprintf(output, "  %2sgenres:\n", indent);
+        }
+        for (size_t i = 0; i < movie.genre_count; i++) {
+            (void) fprintf(output, "  %2s  - %s\n", indent, movie.genres[i]);
+        }
+    }
+    (void) fputc('\n', output);
+    free_movie(movie);
+}
+
+/** Writes `movie` as a JSON object and frees it. */
+void render_movie_json(FILE *NONNULL output, struct movie movie, uint8_t fields) {
+    (void) fprintf(output, "{\"id\":%" PRIi64, movie.id);
+    if (fields & FIELD_TITLE) {
+        (void) fputs(",\"title\":", output);
+        json_write_string(output, movie.title);
+    }
+    if (fields & FIELD_RELEASE_YEAR) {
+        (void) fprintf(output, ",\"release_year\":%d", movie.release_year);
+    }
+    if (fields & FIELD_DIRECTOR) {
+        (void) fputs(",\"director\":", output);
+        json_write_string(output, movie.director);
+    }
+    if (fields & FIELD_GENRES) {
+        (void) fputs(",\"genres\":[", output);
+        for (size_t i = 0; i < movie.genre_count; i++) {
+            if (i > 0) {
+                (void) fputc(',', output);
+            }
+            json_write_string(output, movie.genres[i]);
+        }
+        (void) fputc(']', output);
+    }
+    (void) fputc('}', output);
+    free_movie(movie);
+}
@@ -0,0 +1,22 @@
+#ifndef SRC_MOVIE_RENDER_H
+/** Movie serialization for responses, as YAML or JSON. */
+#define SRC_MOVIE_RENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../defines.h"
+#include "./movie.h"
+
+[[gnu::hot, gnu::nonnull(1)]]
+/**
+ * Writes the id and the selected `fields` of `movie` as YAML, as an item of a list if `in_list`, and frees it.
+ */
+void render_movie(FILE *NONNULL output, struct movie movie, bool in_list, uint8_t fields);
+
+[[gnu::hot, gnu::nonnull(1)]]
+/** Writes the id and the selected `fields` of `movie` as a JSON object, and frees it. */
+void render_movie_json(FILE *NONNULL output, struct movie movie, uint8_t fields);
+
+#endif  // SRC_MOVIE_RENDER_H
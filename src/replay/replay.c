@@ -0,0 +1,461 @@
+/**
+ * Replays a request capture (see `CAPTURE_FILE`) against a running server.
+ *
+ * Each captured connection is reopened at its original offset from the start of the capture, divided by the speed
+ * factor, and its bytes are resent with the same relative timing. Throughput and the latency distribution are printed as
+ * YAML, so runs against different builds can be compared directly.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../alloc.h"
+#include "../defines.h"
+#include "../stats/capture.h"
+#include "../stats/clock.h"
+
+/** A single captured read, pointing into the loaded capture. */
+struct replay_event {
+    /** Connection id from the capture. */
+    uint64_t connection;
+    /** Monotonic timestamp of the original read. */
+    uint64_t timestamp_ns;
+    /** Payload bytes, or `NULL` for `CAPTURE_END`. */
+    const char *NULLABLE data;
+    /** Payload length. */
+    size_t length;
+};
+
+/** A captured connection and its replay results. */
+struct replay_conn {
+    /** Timestamp of the first read. */
+    uint64_t start_ns;
+    /** All reads for this connection, in order. Points into `state.events`. */
+    const struct replay_event *NONNULL events;
+    /** Number of `events`. */
+    size_t event_count;
+    /** Time from connecting until the server closed the connection. */
+    uint64_t latency_ns;
+    /** Bytes received from the server. */
+    size_t received;
+    /** If the replay failed. */
+    bool failed;
+};
+
+/** Replay options. */
+struct replay_options {
+    /** Server address. */
+    struct sockaddr_in server;
+    /** Speed factor. Zero replays as fast as possible, ignoring timing. */
+    double speed;
+    /** Number of replay threads. */
+    size_t threads;
+};
+
+/** The loaded capture and shared replay state. */
+static struct replay_state {
+    /** Raw capture contents, referenced by the events. */
+    char *NULLABLE buffer;
+    /** All reads, grouped by connection. */
+    struct replay_event *NULLABLE events;
+    /** Number of `events`. */
+    size_t event_count;
+    /** All connections, sorted by `start_ns`. */
+    struct replay_conn *NULLABLE conns;
+    /** Number of `conns`. */
+    size_t conn_count;
+    /** Timestamp of the first read in the capture. */
+    uint64_t capture_start_ns;
+    /** Timestamp when the replay started. */
+    uint64_t replay_start_ns;
+    /** Next connection to be replayed. */
+    atomic_size_t next;
+    /** Replay options. */
+    struct replay_options options;
+} state;
+
+[[gnu::nonnull(1)]]
+/** Reads a whole file into memory. */
+static char *NULLABLE read_file(const char filepath[NONNULL], size_t *NONNULL length) {
+    FILE *file = fopen(filepath, "rb");
+    if unlikely (file == NULL) {
+        return NULL;
+    }
+
+    static constexpr const size_t CHUNK = 1 << 20;
+    char *buffer = NULL;
+    size_t capacity = 0;
+    *length = 0;
+    while (true) {
+        if (*length + CHUNK > capacity) {
+            capacity = *length + 2 * CHUNK;
+            char *larger = realloc(buffer, capacity);
+            if unlikely (larger == NULL) {
+                free(buffer);
+                (void) fclose(file);
+                return NULL;
+            }
+            buffer = larger;
+        }
+
+        const size_t read = fread(buffer + *length, 1, CHUNK, file);
+        *length += read;
+        if (read < CHUNK) {
+            break;
+        }
+    }
+
+    const bool failed = ferror(file) != 0;
+    (void) fclose(file);
+    if unlikely (failed) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+[[gnu::pure, gnu::nonnull(1, 2)]]
+/** Groups events by connection, keeping the capture order inside each connection. */
+static int compare_events(const void *NONNULL a, const void *NONNULL b) {
+    const struct replay_event *lhs = a;
+    const struct replay_event *rhs = b;
+    if (lhs->connection != rhs->connection) {
+        return (lhs->connection > rhs->connection) - (lhs->connection < rhs->connection);
+    }
+    // timestamps are monotonic for reads on the same connection
+    return (lhs->timestamp_ns > rhs->timestamp_ns) - (lhs->timestamp_ns < rhs->timestamp_ns);
+}
+
+[[gnu::pure, gnu::nonnull(1, 2)]]
+/** Orders connections by their first read. */
+static int compare_start(const void *NONNULL a, const void *NONNULL b) {
+    const struct replay_conn *lhs = a;
+    const struct replay_conn *rhs = b;
+    return (lhs->start_ns > rhs->start_ns) - (lhs->start_ns < rhs->start_ns);
+}
+
+/** Reads all records from `state.buffer`, after the magic. */
+static bool load_events(size_t length) {
+    const size_t magic_len = strlen(CAPTURE_MAGIC);
+    size_t capacity = 0;
+
+    for (size_t pos = magic_len; pos < length;) {
+        struct capture_record record;
+        if unlikely (length - pos < sizeof(record)) {
+            (void) fprintf(stderr, "replay: truncated record at offset %zu, ignoring the rest\n", pos);
+            break;
+        }
+        memcpy(&record, state.buffer + pos, sizeof(record));
+        pos += sizeof(record);
+        if unlikely (length - pos < record.length) {
+            (void) fprintf(stderr, "replay: truncated record at offset %zu, ignoring the rest\n", pos);
+            break;
+        }
+
+        if (state.event_count >= capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 1024;
+            struct replay_event *larger = reallocarray(state.events, capacity, sizeof(struct replay_event));
+            if unlikely (larger == NULL) {
+                (void) fprintf(stderr, "replay: out of memory\n");
+                return false;
+            }
+            state.events = larger;
+        }
+        state.events[state.event_count++] = (struct replay_event) {
+            .connection = record.connection,
+            .timestamp_ns = record.timestamp_ns,
+            .data = record.kind == CAPTURE_DATA ? state.buffer + pos : NULL,
+            .length = record.kind == CAPTURE_DATA ? record.length : 0,
+        };
+        pos += record.length;
+    }
+    return true;
+}
+
+[[gnu::nonnull(1)]]
+/** Loads and groups all records from the capture file. */
+static bool load_capture(const char filepath[NONNULL]) {
+    size_t length;
+    state.buffer = read_file(filepath, &length);
+    if unlikely (state.buffer == NULL) {
+        (void) fprintf(stderr, "replay: could not read %s: %s\n", filepath, strerror(errno));
+        return false;
+    }
+
+    const size_t magic_len = strlen(CAPTURE_MAGIC);
+    if unlikely (length < magic_len || memcmp(state.buffer, CAPTURE_MAGIC, magic_len) != 0) {
+        (void) fprintf(stderr, "replay: %s is not a capture file\n", filepath);
+        return false;
+    }
+    if unlikely (!load_events(length)) {
+        return false;
+    }
+    if unlikely (state.event_count == 0) {
+        return true;
+    }
+    qsort(state.events, state.event_count, sizeof(struct replay_event), compare_events);
+
+    state.conns = calloc(state.event_count, sizeof(struct replay_conn));
+    if unlikely (state.conns == NULL) {
+        (void) fprintf(stderr, "replay: out of memory\n");
+        return false;
+    }
+
+    state.capture_start_ns = UINT64_MAX;
+    for (size_t i = 0; i < state.event_count; i++) {
+        const struct replay_event *event = &(state.events[i]);
+        if (i == 0 || event->connection != state.events[i - 1].connection) {
+            state.conns[state.conn_count++] = (struct replay_conn) {.start_ns = event->timestamp_ns, .events = event};
+        }
+        state.conns[state.conn_count - 1].event_count += 1;
+        if (event->timestamp_ns < state.capture_start_ns) {
+            state.capture_start_ns = event->timestamp_ns;
+        }
+    }
+
+    qsort(state.conns, state.conn_count, sizeof(struct replay_conn), compare_start);
+    return true;
+}
+
+/** Sleeps until the replay time equivalent to `capture_ns`. */
+static void wait_until(uint64_t capture_ns) {
+    static constexpr const uint64_t NS_PER_SEC = 1'000'000'000;
+
+    if (state.options.speed <= 0) {
+        return;
+    }
+    const double offset = (double) (capture_ns - state.capture_start_ns) / state.options.speed;
+    const uint64_t target = state.replay_start_ns + (uint64_t) offset;
+
+    const struct timespec deadline = {
+        .tv_sec = (time_t) (target / NS_PER_SEC),
+        .tv_nsec = (long) (target % NS_PER_SEC),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
+}
+
+[[gnu::nonnull(1)]]
+/** Sends all captured bytes for `conn` and waits for the full response. */
+static void replay_connection(struct replay_conn *NONNULL conn) {
+    wait_until(conn->start_ns);
+    const uint64_t start = clock_now_ns();
+
+    const int sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if unlikely (sock_fd < 0) {
+        conn->failed = true;
+        return;
+    }
+    int rv = connect(sock_fd, (const struct sockaddr *) &(state.options.server), sizeof(state.options.server));
+    if unlikely (rv != 0) {
+        conn->failed = true;
+        (void) close(sock_fd);
+        return;
+    }
+
+    for (size_t i = 0; i < conn->event_count && !conn->failed; i++) {
+        const struct replay_event *event = &(conn->events[i]);
+        wait_until(event->timestamp_ns);
+        if (event->data == NULL) {
+            break;
+        }
+        for (size_t sent = 0; sent < event->length;) {
+            const ssize_t n = send(sock_fd, event->data + sent, event->length - sent, MSG_NOSIGNAL);
+            if unlikely (n <= 0) {
+                conn->failed = true;
+                break;
+            }
+            sent += (size_t) n;
+        }
+    }
+    (void) shutdown(sock_fd, SHUT_WR);
+
+    // the server closes the connection after answering every operation
+    char response[4096];
+    ssize_t n;
+    while ((n = recv(sock_fd, response, sizeof(response), 0)) > 0) {
+        conn->received += (size_t) n;
+    }
+    if unlikely (n < 0) {
+        conn->failed = true;
+    }
+
+    conn->latency_ns = clock_now_ns() - start;
+    (void) close(sock_fd);
+}
+
+/** Replay thread, takes connections in start order. */
+static void *NULLABLE replay_thread(void *NULLABLE arg) {
+    (void) arg;
+    while (true) {
+        const size_t i = atomic_fetch_add(&(state.next), 1);
+        if (i >= state.conn_count) {
+            return NULL;
+        }
+        replay_connection(&(state.conns[i]));
+    }
+}
+
+[[gnu::pure, gnu::nonnull(1, 2)]]
+/** Orders latencies. */
+static int compare_u64(const void *NONNULL a, const void *NONNULL b) {
+    const uint64_t lhs = *(const uint64_t *) a;
+    const uint64_t rhs = *(const uint64_t *) b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/** Prints throughput and latency percentiles as YAML. */
+static void report(uint64_t elapsed_ns) {
+    static constexpr const uint64_t NS_PER_US = 1'000;
+    static constexpr const double NS_PER_SEC = 1e9;
+
+    uint64_t *latencies = calloc(state.conn_count > 0 ? state.conn_count : 1, sizeof(uint64_t));
+    size_t completed = 0;
+    size_t sent = 0;
+    size_t received = 0;
+    for (size_t i = 0; i < state.conn_count; i++) {
+        const struct replay_conn *conn = &(state.conns[i]);
+        for (size_t j = 0; j < conn->event_count; j++) {
+            sent += conn->events[j].length;
+        }
+        received += conn->received;
+        if (!conn->failed && latencies != NULL) {
+            latencies[completed++] = conn->latency_ns;
+        }
+    }
+    if (latencies != NULL && completed > 0) {
+        qsort(latencies, completed, sizeof(uint64_t), compare_u64);
+    }
+
+    printf("---\nreplay:\n");
+    printf("  speed: %g\n", state.options.speed);
+    printf("  connections: %zu\n", state.conn_count);
+    printf("  failed: %zu\n", state.conn_count - completed);
+    printf("  bytes_sent: %zu\n", sent);
+    printf("  bytes_received: %zu\n", received);
+    printf("  elapsed_us: %" PRIu64 "\n", elapsed_ns / NS_PER_US);
+    printf("  throughput_per_sec: %.1f\n", elapsed_ns > 0 ? (double) completed * NS_PER_SEC / (double) elapsed_ns : 0);
+    printf("  latency_us:\n");
+    static const struct {
+        const char *name;
+        unsigned permille;
+    } PERCENTILES[] = {
+        {"p50",  500 },
+        {"p90",  900 },
+        {"p99",  990 },
+        {"p999", 999 },
+        {"max",  1000},
+    };
+    for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); i++) {
+        uint64_t value = 0;
+        if (completed > 0) {
+            size_t rank = (completed * PERCENTILES[i].permille) / 1000;
+            value = latencies[rank < completed ? rank : completed - 1];
+        }
+        printf("    %s: %" PRIu64 "\n", PERCENTILES[i].name, value / NS_PER_US);
+    }
+    printf("...\n");
+    free(latencies);
+}
+
+[[gnu::cold]]
+/** Prints usage information. */
+static void usage(const char program[NONNULL]) {
+    (void) fprintf(
+        stderr,
+        "usage: %s [-a ADDRESS] [-p PORT] [-s SPEED] [-j THREADS] CAPTURE_FILE\n"
+        "  -a ADDRESS  server IPv4 address (default 127.0.0.1)\n"
+        "  -p PORT     server port (default 12345)\n"
+        "  -s SPEED    speed factor, 0 to ignore timing (default 1)\n"
+        "  -j THREADS  concurrent connections (default 64)\n",
+        program
+    );
+}
+
+int main(int argc, char *NONNULL argv[]) {
+    static constexpr const uint16_t DEFAULT_PORT = 12'345;
+    static constexpr const size_t DEFAULT_THREADS = 64;
+    static constexpr const int AS_DECIMAL = 10;
+
+    state.options = (struct replay_options) {
+        .server = {.sin_family = AF_INET, .sin_port = htons(DEFAULT_PORT), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)},
+        .speed = 1.0,
+        .threads = DEFAULT_THREADS,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:s:j:h")) != -1) {
+        switch (opt) {
+            case 'a':
+                if (inet_pton(AF_INET, optarg, &(state.options.server.sin_addr)) != 1) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                state.options.server.sin_port = htons((uint16_t) strtoul(optarg, NULL, AS_DECIMAL));
+                break;
+            case 's':
+                state.options.speed = strtod(optarg, NULL);
+                break;
+            case 'j':
+                state.options.threads = strtoul(optarg, NULL, AS_DECIMAL);
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || state.options.threads == 0 || state.options.speed < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if unlikely (!load_capture(argv[optind])) {
+        return EXIT_FAILURE;
+    }
+    (void) fprintf(stderr, "replay: %zu connections loaded\n", state.conn_count);
+
+    const size_t thread_count = state.options.threads < state.conn_count ? state.options.threads : state.conn_count;
+    pthread_t *threads = calloc(thread_count > 0 ? thread_count : 1, sizeof(pthread_t));
+    if unlikely (threads == NULL) {
+        (void) fprintf(stderr, "replay: out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    state.replay_start_ns = clock_now_ns();
+    size_t started = 0;
+    for (; started < thread_count; started++) {
+        if unlikely (pthread_create(&(threads[started]), NULL, replay_thread, NULL) != 0) {
+            (void) fprintf(stderr, "replay: could only start %zu threads\n", started);
+            break;
+        }
+    }
+    if unlikely (started == 0 && state.conn_count > 0) {
+        replay_thread(NULL);
+    }
+    for (size_t i = 0; i < started; i++) {
+        (void) pthread_join(threads[i], NULL);
+    }
+    const uint64_t elapsed_ns = clock_now_ns() - state.replay_start_ns;
+
+    report(elapsed_ns);
+
+    free(threads);
+    free(state.conns);
+    free(state.events);
+    free(state.buffer);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "../defines.h"
+#include "./capture.h"
+#include "./clock.h"
+#include "./trace.h"
+
+/** Capture file descriptor, or -1 when capture is disabled. */
+static atomic_int capture_fd = -1;
+
+/** Opens the capture file. */
+void capture_setup(void) {
+    const char *filepath = getenv("CAPTURE_FILE");
+    if likely (filepath == NULL || filepath[0] == '\0') {
+        return;
+    }
+
+    static constexpr const mode_t MODE = 0644;
+    const int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, MODE);
+    if unlikely (fd < 0) {
+        (void) fprintf(stderr, "capture: could not open %s: %s\n", filepath, strerror(errno));
+        return;
+    }
+
+    const ssize_t rv = write(fd, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC));
+    if unlikely (rv != (ssize_t) strlen(CAPTURE_MAGIC)) {
+        (void) fprintf(stderr, "capture: could not write to %s: %s\n", filepath, strerror(errno));
+        (void) close(fd);
+        return;
+    }
+
+    atomic_store(&capture_fd, fd);
+    (void) fprintf(stderr, "capture: recording requests to %s\n", filepath);
+}
+
+[[gnu::cold]]
+/** Stops capturing after a write error. */
+static void capture_disable(int fd) {
+    int expected = fd;
+    if (atomic_compare_exchange_strong(&capture_fd, &expected, -1)) {
+        (void) fprintf(stderr, "capture: write failed, capture disabled: %s\n", strerror(errno));
+        (void) close(fd);
+    }
+}
+
+/** Appends a single capture record. */
+void capture_read(trace_id_t connection, const void *NULLABLE data, size_t length) {
+    const int fd = atomic_load_explicit(&capture_fd, memory_order_relaxed);
+    if likely (fd < 0) {
+        return;
+    }
+    assume(length <= UINT32_MAX);
+
+    const struct capture_record record = {
+        .connection = connection,
+        .timestamp_ns = clock_now_ns(),
+        .length = (uint32_t) length,
+        .kind = length > 0 ? CAPTURE_DATA : CAPTURE_END,
+    };
+    const struct iovec parts[2] = {
+        {.iov_base = (void *) &record, .iov_len = sizeof(record)},
+        {.iov_base = (void *) data,    .iov_len = length        },
+    };
+
+    const ssize_t rv = writev(fd, parts, length > 0 ? 2 : 1);
+    if unlikely (rv != (ssize_t) (sizeof(record) + length)) {
+        capture_disable(fd);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef SRC_STATS_CAPTURE_H
+/** Raw request capture, for deterministic replays. */
+#define SRC_STATS_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../defines.h"
+#include "./trace.h"
+
+/** Magic bytes at the start of every capture file, including the format version. */
+#define CAPTURE_MAGIC "MC833CAP0001"
+
+/** Kind of event stored in a `capture_record`. */
+enum [[gnu::packed]] capture_kind {
+    /** Bytes received from the client, stored right after the record header. */
+    CAPTURE_DATA = 1,
+    /** Client closed its side of the connection, no payload. */
+    CAPTURE_END = 2,
+};
+
+/**
+ * Header for a single event in the capture file, followed by `length` bytes of payload.
+ *
+ * Fields are written in host byte order, so captures should be replayed on the same architecture.
+ */
+struct [[gnu::packed]] capture_record {
+    /** Connection the bytes were read from, the same request id used in logs and traces. */
+    uint64_t connection;
+    /** Monotonic timestamp of the read, in nanoseconds. */
+    uint64_t timestamp_ns;
+    /** Number of payload bytes after this header. */
+    uint32_t length;
+    /** A `capture_kind`. */
+    uint32_t kind;
+};
+
+static_assert(sizeof(struct capture_record) == 24);
+
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Creates or truncates the file named by `CAPTURE_FILE`, if set. Must be called once, before any other thread is
+ * started.
+ *
+ * Capture is disabled by default. Failures are reported to stderr and leave capture disabled.
+ */
+void capture_setup(void);
+
+[[gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Appends the bytes read from `connection`, or a `CAPTURE_END` record when `length` is zero.
+ *
+ * Each record is written with a single `writev`, so records from different threads are never interleaved.
+ */
+void capture_read(trace_id_t connection, const void *NULLABLE data, size_t length);
+
+#endif  // SRC_STATS_CAPTURE_H
@@ -0,0 +1,27 @@
+#ifndef SRC_STATS_CLOCK_H
+/** Cheap monotonic timestamps for instrumentation. */
+#define SRC_STATS_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "../defines.h"
+
+[[nodiscard("useless call if discarded"), gnu::hot]]
+/**
+ * Current time of the monotonic clock, in nanoseconds.
+ *
+ * Resolved through the vDSO on Linux, so this does not enter the kernel.
+ */
+static inline uint64_t clock_now_ns(void) {
+    static constexpr const uint64_t NS_PER_SEC = 1'000'000'000;
+
+    struct timespec now;
+    int rv = clock_gettime(CLOCK_MONOTONIC, &now);
+    if unlikely (rv != 0) {
+        return 0;
+    }
+    return ((uint64_t) now.tv_sec * NS_PER_SEC) + (uint64_t) now.tv_nsec;
+}
+
+#endif  // SRC_STATS_CLOCK_H
@@ -0,0 +1,203 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../config.h"
+#include "../defines.h"
+#include "../movie/parser.h"
+#include "./perf.h"
+
+/** Number of slots for operation totals, indexed by `ty - PARSE_ERROR`. */
+#define PERF_OPERATIONS 32
+
+static_assert(UPSERT_MOVIE - PARSE_ERROR < PERF_OPERATIONS);
+
+/** Hardware event configuration for each `enum perf_event`. */
+static const uint64_t PERF_CONFIG[PERF_EVENTS] = {
+    [PERF_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+    [PERF_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    [PERF_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+    [PERF_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/** Name for each `enum perf_event`, used in reports. */
+static const char *const PERF_EVENT_NAME[PERF_EVENTS] = {
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_CACHE_MISSES] = "cache_misses",
+    [PERF_BRANCH_MISSES] = "branch_misses",
+};
+
+/** Counter totals for a single operation type, aggregated across all threads. */
+static struct perf_totals {
+    /** Number of samples recorded. */
+    atomic_uint_fast64_t samples;
+    /** Sum of the counter differences, indexed by `enum perf_event`. */
+    atomic_uint_fast64_t values[PERF_EVENTS];
+} totals[PERF_OPERATIONS];
+
+/** If counters should be opened at all. Set by `PERF_COUNTERS`. */
+static bool perf_enabled = false;
+/** Set after the first failure to open counters is reported, to avoid one warning per thread. */
+static atomic_flag open_failure_reported = ATOMIC_FLAG_INIT;
+
+/** File descriptors for the counter group of this thread, the leader first. */
+static thread_local int group_fd[PERF_EVENTS] = {-1, -1, -1, -1};
+/** Set when this thread could not open its counters, so we don't retry on every sample. */
+static thread_local bool group_unavailable = false;
+
+static_assert(PERF_EVENTS == 4, "update `group_fd` initializer");
+
+/** Reads counter configuration. */
+void perf_setup(void) {
+    perf_enabled = config_u64("PERF_COUNTERS", 0) != 0;
+    if (perf_enabled) {
+        (void) fprintf(stderr, "perf: hardware counters enabled\n");
+    }
+}
+
+/** Wrapper for the `perf_event_open` syscall, which has no libc function. */
+static int perf_event_open(struct perf_event_attr *NONNULL attr, int group) {
+    static constexpr const pid_t CURRENT_THREAD = 0;
+    static constexpr const int ANY_CPU = -1;
+
+    return (int) syscall(SYS_perf_event_open, attr, CURRENT_THREAD, ANY_CPU, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+/** Closes the counters of the current thread. */
+void perf_thread_stop(void) {
+    for (size_t i = 0; i < PERF_EVENTS; i++) {
+        if (group_fd[i] >= 0) {
+            (void) close(group_fd[i]);
+            group_fd[i] = -1;
+        }
+    }
+}
+
+[[gnu::cold]]
+/**
+ * Opens the counter group for the current thread.
+ *
+ * Returns `false` if any of the events is not supported, usually on virtual machines or with a restrictive
+ * `perf_event_paranoid`.
+ */
+static bool perf_thread_start(void) {
+    for (size_t i = 0; i < PERF_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_CONFIG[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        group_fd[i] = perf_event_open(&attr, i == 0 ? -1 : group_fd[0]);
+        if unlikely (group_fd[i] < 0) {
+            if (!atomic_flag_test_and_set(&open_failure_reported)) {
+                (void) fprintf(stderr, "perf: could not open %s counter: %s\n", PERF_EVENT_NAME[i], strerror(errno));
+            }
+            perf_thread_stop();
+            group_unavailable = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+[[gnu::hot, gnu::nonnull(1)]]
+/** Reads all counters in the group at once. */
+static bool perf_read(uint64_t values[NONNULL PERF_EVENTS]) {
+    struct {
+        uint64_t nr;
+        uint64_t values[PERF_EVENTS];
+    } group;
+
+    const ssize_t len = read(group_fd[0], &group, sizeof(group));
+    if unlikely (len != (ssize_t) sizeof(group) || group.nr != PERF_EVENTS) {
+        return false;
+    }
+    memcpy(values, group.values, sizeof(group.values));
+    return true;
+}
+
+/** Reads the counters for the current thread. */
+struct perf_sample perf_begin(void) {
+    struct perf_sample sample = {.valid = false};
+    if likely (!perf_enabled || group_unavailable) {
+        return sample;
+    }
+    if unlikely (group_fd[0] < 0 && !perf_thread_start()) {
+        return sample;
+    }
+
+    sample.valid = perf_read(sample.values);
+    return sample;
+}
+
+/** Adds the counter difference since `sample` to the totals of `ty`. */
+void perf_end(struct perf_sample sample, enum operation_ty ty) {
+    if likely (!sample.valid) {
+        return;
+    }
+
+    uint64_t now[PERF_EVENTS];
+    if unlikely (!perf_read(now)) {
+        return;
+    }
+
+    struct perf_totals *op = &(totals[(size_t) (ty - PARSE_ERROR) % PERF_OPERATIONS]);
+    atomic_fetch_add_explicit(&(op->samples), 1, memory_order_relaxed);
+    for (size_t i = 0; i < PERF_EVENTS; i++) {
+        atomic_fetch_add_explicit(&(op->values[i]), now[i] - sample.values[i], memory_order_relaxed);
+    }
+}
+
+/** Writes the counter totals for each operation type as YAML. */
+void perf_stats_report(FILE *NONNULL output) {
+    static constexpr const uint64_t IPC_SCALE = 100;
+
+    (void) fprintf(output, "  perf:\n    enabled: %s\n", perf_enabled ? "true" : "false");
+    if likely (!perf_enabled) {
+        return;
+    }
+
+    (void) fprintf(output, "    operations:\n");
+    for (int ty = PARSE_ERROR; ty - PARSE_ERROR < PERF_OPERATIONS; ty++) {
+        const struct perf_totals *op = &(totals[ty - PARSE_ERROR]);
+        const uint64_t samples = atomic_load_explicit(&(op->samples), memory_order_relaxed);
+        if (samples == 0) {
+            continue;
+        }
+
+        uint64_t values[PERF_EVENTS];
+        for (size_t i = 0; i < PERF_EVENTS; i++) {
+            values[i] = atomic_load_explicit(&(op->values[i]), memory_order_relaxed);
+        }
+        // integer IPC with two decimal places
+        const uint64_t cycles = values[PERF_CYCLES] > 0 ? values[PERF_CYCLES] : 1;
+        const uint64_t ipc = values[PERF_INSTRUCTIONS] * IPC_SCALE / cycles;
+
+        (void) fprintf(
+            output,
+            "      - { name: %s, samples: %" PRIu64 ", ipc: %" PRIu64 ".%02" PRIu64,
+            operation_name((enum operation_ty) ty),
+            samples,
+            ipc / IPC_SCALE,
+            ipc % IPC_SCALE
+        );
+        for (size_t i = 0; i < PERF_EVENTS; i++) {
+            (void) fprintf(output, ", %s: %" PRIu64, PERF_EVENT_NAME[i], values[i]);
+        }
+        (void) fprintf(output, " }\n");
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef SRC_STATS_PERF_H
+/** Hardware performance counters, attributed per operation type. */
+#define SRC_STATS_PERF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../defines.h"
+#include "../movie/parser.h"
+
+/** Hardware events read in each sample. */
+enum [[gnu::packed]] perf_event {
+    /** CPU cycles. */
+    PERF_CYCLES,
+    /** Retired instructions. */
+    PERF_INSTRUCTIONS,
+    /** Last level cache misses. */
+    PERF_CACHE_MISSES,
+    /** Mispredicted branches. */
+    PERF_BRANCH_MISSES,
+    /** Number of events. */
+    PERF_EVENTS,
+};
+
+/**
+ * Counter values at the start of a sampled region, created by `perf_begin` and consumed by `perf_end`.
+ *
+ * When counters are disabled or unavailable for the current thread, `valid` is false and nothing is recorded.
+ */
+struct perf_sample {
+    /** Raw counter values, indexed by `enum perf_event`. */
+    uint64_t values[PERF_EVENTS];
+    /** If the counters were read successfully. */
+    bool valid;
+};
+
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Reads `PERF_COUNTERS` from the environment. Must be called once, before any other thread is started.
+ *
+ * Counters are disabled by default. When enabled, each thread opens its own `perf_event_open` group on first use,
+ * counting only user space so it works with the default `perf_event_paranoid` settings.
+ */
+void perf_setup(void);
+
+[[nodiscard("sample must be ended"), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Reads the counters for the current thread.
+ */
+struct perf_sample perf_begin(void);
+
+[[gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Reads the counters again and adds the difference since `sample` to the totals of `ty`.
+ */
+void perf_end(struct perf_sample sample, enum operation_ty ty);
+
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Closes the counters of the current thread, if any were opened.
+ */
+void perf_thread_stop(void);
+
+[[gnu::nonnull(1), gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Writes the counter totals for each operation type as YAML entries under a `perf` key, indented for the `stats`
+ * response.
+ */
+void perf_stats_report(FILE *NONNULL output);
+
+#endif  // SRC_STATS_PERF_H
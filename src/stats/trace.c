@@ -0,0 +1,235 @@
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "../alloc.h"
+#include "../config.h"
+#include "../defines.h"
+#include "./clock.h"
+#include "./trace.h"
+
+static_assert(is_power_of_two((unsigned) TRACE_RING_CAPACITY));
+
+/**
+ * A single recorded span.
+ *
+ * Fields are relaxed atomics so `trace_export` can read them while the owner thread is still writing, the ring
+ * `head` is used to discard events that were overwritten during the copy.
+ */
+struct trace_event {
+    /** Request that owns this span. */
+    atomic_uint_fast64_t request;
+    /** Static span name. */
+    _Atomic(const char *) name;
+    /** Start timestamp, in nanoseconds. */
+    atomic_uint_fast64_t start_ns;
+    /** Span duration, in nanoseconds. */
+    atomic_uint_fast64_t duration_ns;
+};
+
+/** Optimal alignment for `struct trace_ring`. */
+#define TRACE_RING_ALIGNMENT 64
+
+/**
+ * Per-thread ring buffer of spans. Only the owner thread writes to it.
+ */
+struct [[gnu::aligned(TRACE_RING_ALIGNMENT)]] trace_ring {
+    /** Total number of events ever written. Not capped to `TRACE_RING_CAPACITY`. */
+    atomic_uint_fast64_t head;
+    /** Kernel thread id, for the `tid` field in the exported trace. */
+    int tid;
+    /** The ring storage. */
+    struct trace_event events[TRACE_RING_CAPACITY];
+};
+
+/** One in every `sample_rate` requests is traced. Zero disables tracing. */
+static uint64_t sample_rate = 0;
+
+/** Last request id assigned by `trace_next_request`. */
+static uint64_t last_request = 0;
+
+/** All rings ever registered, so they can be exported from any thread. */
+static _Atomic(struct trace_ring *) rings[TRACE_MAX_THREADS];
+/** Number of slots in `rings` already claimed. */
+static atomic_size_t ring_count = 0;
+
+/** Request currently handled by this thread. */
+static thread_local trace_id_t current_request = 0;
+/** If `current_request` was selected for tracing. */
+static thread_local bool current_sampled = false;
+/** Ring buffer owned by this thread, allocated on the first recorded span. */
+static thread_local struct trace_ring *current_ring = NULL;
+/** Set when this thread could not get a ring, so we don't retry on every span. */
+static thread_local bool ring_unavailable = false;
+
+/** Reads sampling configuration. */
+void trace_setup(void) {
+    sample_rate = config_u64("TRACE_SAMPLE_RATE", 0);
+    if (sample_rate > 0) {
+        (void) fprintf(stderr, "trace: sampling 1 in %" PRIu64 " requests\n", sample_rate);
+    }
+}
+
+/** Assigns the next request id. */
+trace_id_t trace_next_request(void) {
+    last_request += 1;
+    return last_request;
+}
+
+/** Sets the request being handled by the current thread. */
+void trace_set_request(trace_id_t request) {
+    current_request = request;
+    current_sampled = unlikely(sample_rate > 0) && request != 0 && request % sample_rate == 0;
+}
+
+/** The request being handled by the current thread. */
+trace_id_t trace_current_request(void) {
+    return current_request;
+}
+
+/** Opens a span for the current request. */
+struct trace_span trace_begin(const char name[NONNULL]) {
+    if likely (!current_sampled) {
+        return (struct trace_span) {.name = name, .start_ns = 0};
+    }
+    return (struct trace_span) {.name = name, .start_ns = clock_now_ns()};
+}
+
+/** Opens a span before the request is known. */
+struct trace_span trace_begin_detached(const char name[NONNULL]) {
+    if likely (sample_rate == 0) {
+        return (struct trace_span) {.name = name, .start_ns = 0};
+    }
+    return (struct trace_span) {.name = name, .start_ns = clock_now_ns()};
+}
+
+[[gnu::cold]]
+/**
+ * Allocates and registers the ring for the current thread.
+ *
+ * Returns `NULL` if out of memory or if `TRACE_MAX_THREADS` rings are already registered.
+ */
+static struct trace_ring *NULLABLE trace_ring_register(void) {
+    const size_t slot = atomic_fetch_add(&ring_count, 1);
+    if unlikely (slot >= TRACE_MAX_THREADS) {
+        ring_unavailable = true;
+        return NULL;
+    }
+
+    struct trace_ring *ring = alloc_like(struct trace_ring);
+    if unlikely (ring == NULL) {
+        ring_unavailable = true;
+        return NULL;
+    }
+    memset(ring, 0, sizeof(struct trace_ring));
+    ring->tid = gettid();
+
+    atomic_store_explicit(&(rings[slot]), ring, memory_order_release);
+    current_ring = ring;
+    return ring;
+}
+
+/** Closes the span and records it. */
+void trace_end(struct trace_span span) {
+    if likely (span.start_ns == 0 || !current_sampled) {
+        return;
+    }
+
+    const uint64_t end_ns = clock_now_ns();
+    struct trace_ring *ring = current_ring;
+    if unlikely (ring == NULL) {
+        if unlikely (ring_unavailable) {
+            return;
+        }
+        ring = trace_ring_register();
+        if unlikely (ring == NULL) {
+            return;
+        }
+    }
+
+    const uint_fast64_t head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+    struct trace_event *event = &(ring->events[head % TRACE_RING_CAPACITY]);
+    atomic_store_explicit(&(event->request), current_request, memory_order_relaxed);
+    atomic_store_explicit(&(event->name), span.name, memory_order_relaxed);
+    atomic_store_explicit(&(event->start_ns), span.start_ns, memory_order_relaxed);
+    atomic_store_explicit(&(event->duration_ns), end_ns - span.start_ns, memory_order_relaxed);
+    // publish the event for exporters
+    atomic_store_explicit(&(ring->head), head + 1, memory_order_release);
+}
+
+[[gnu::cold, gnu::nonnull(1, 2)]]
+/**
+ * Writes the events in `ring` that survived the copy as JSON objects.
+ *
+ * Returns `false` on I/O errors.
+ */
+static bool trace_export_ring(FILE *NONNULL file, const struct trace_ring *NONNULL ring, bool *NONNULL first) {
+    static constexpr const uint64_t NS_PER_US = 1'000;
+
+    const uint_fast64_t head = atomic_load_explicit(&(ring->head), memory_order_acquire);
+    const uint_fast64_t start = head > TRACE_RING_CAPACITY ? head - TRACE_RING_CAPACITY : 0;
+
+    for (uint_fast64_t i = start; i < head; i++) {
+        const struct trace_event *event = &(ring->events[i % TRACE_RING_CAPACITY]);
+        const uint64_t request = atomic_load_explicit(&(event->request), memory_order_relaxed);
+        const char *name = atomic_load_explicit(&(event->name), memory_order_relaxed);
+        const uint64_t start_ns = atomic_load_explicit(&(event->start_ns), memory_order_relaxed);
+        const uint64_t duration_ns = atomic_load_explicit(&(event->duration_ns), memory_order_relaxed);
+
+        // the owner thread may have lapped us while reading this event
+        atomic_thread_fence(memory_order_acquire);
+        const uint_fast64_t latest = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+        if unlikely (latest - i > TRACE_RING_CAPACITY - 1 || name == NULL) {
+            continue;
+        }
+
+        const int rv = fprintf(
+            file,
+            "%s\n{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%" PRIu64 ".%03" PRIu64
+            ",\"dur\":%" PRIu64 ".%03" PRIu64 ",\"pid\":%d,\"tid\":%d,\"args\":{\"request\":%" PRIu64 "}}",
+            *first ? "" : ",",
+            name,
+            start_ns / NS_PER_US,
+            start_ns % NS_PER_US,
+            duration_ns / NS_PER_US,
+            duration_ns % NS_PER_US,
+            getpid(),
+            ring->tid,
+            request
+        );
+        if unlikely (rv < 0) {
+            return false;
+        }
+        *first = false;
+    }
+    return true;
+}
+
+/** Writes all recorded spans as Chrome trace JSON. */
+bool trace_export(const char filepath[NONNULL]) {
+    FILE *file = fopen(filepath, "w");
+    if unlikely (file == NULL) {
+        return false;
+    }
+
+    bool ok = fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file) >= 0;
+
+    bool first = true;
+    const size_t count = atomic_load(&ring_count);
+    for (size_t i = 0; ok && i < count && i < TRACE_MAX_THREADS; i++) {
+        const struct trace_ring *ring = atomic_load_explicit(&(rings[i]), memory_order_acquire);
+        if likely (ring != NULL) {
+            ok = trace_export_ring(file, ring, &first);
+        }
+    }
+
+    ok = ok && fputs("\n]}\n", file) >= 0;
+    // always close the file, even on previous errors
+    return (fclose(file) == 0) && ok;
+}
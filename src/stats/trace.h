@@ -0,0 +1,91 @@
+#ifndef SRC_STATS_TRACE_H
+/** Sampled per-request tracing. */
+#define SRC_STATS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../defines.h"
+
+/**
+ * Identifier for a single client connection, assigned by the main thread right after `accept`.
+ *
+ * Zero is never assigned, and means "no request" for threads that are not handling a connection.
+ */
+typedef uint64_t trace_id_t;
+
+/** Maximum number of spans kept for each thread. Older spans are overwritten. */
+#define TRACE_RING_CAPACITY 4096
+
+/** Maximum number of threads that can record spans during the process lifetime. */
+#define TRACE_MAX_THREADS 512
+
+/**
+ * An open span, created by `trace_begin` and recorded by `trace_end`.
+ *
+ * When tracing is disabled or the current request was not sampled, `start_ns` is zero and nothing is recorded.
+ */
+struct trace_span {
+    /** Static name for the span, usually the traced function. */
+    const char *NULLABLE name;
+    /** Monotonic timestamp when the span was opened. */
+    uint64_t start_ns;
+};
+
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Reads `TRACE_SAMPLE_RATE` from the environment. Must be called once, before any other thread is started.
+ *
+ * One in every `TRACE_SAMPLE_RATE` requests is traced. A rate of zero (the default) disables tracing.
+ */
+void trace_setup(void);
+
+[[nodiscard("request id should be propagated"), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Assigns the next request id. Should only be called by the main thread.
+ */
+trace_id_t trace_next_request(void);
+
+[[gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Sets the request being handled by the current thread, used by all spans ended afterwards.
+ */
+void trace_set_request(trace_id_t request);
+
+[[nodiscard("useless call if discarded"), gnu::pure, gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * The request being handled by the current thread, or zero.
+ */
+trace_id_t trace_current_request(void);
+
+[[nodiscard("span must be ended"), gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Opens a span for the current request. Only reads the clock when the request is sampled.
+ */
+struct trace_span trace_begin(const char name[NONNULL]);
+
+[[nodiscard("span must be ended"), gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Opens a span before the request is known, like waiting on `accept` or on the work queue.
+ *
+ * The span is recorded only if the request set with `trace_set_request` before `trace_end` is sampled.
+ */
+struct trace_span trace_begin_detached(const char name[NONNULL]);
+
+[[gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Closes the span and records it in the per-thread ring buffer, if sampled.
+ */
+void trace_end(struct trace_span span);
+
+[[gnu::cold, gnu::nonnull(1), gnu::leaf, gnu::nothrow]]
+/**
+ * Writes all recorded spans as Chrome trace JSON (`chrome://tracing` or Perfetto) into `filepath`.
+ *
+ * Threads keep recording while the export runs, so spans being overwritten at that moment may be skipped.
+ *
+ * Returns `true` on success, or `false` with `errno` set on I/O errors.
+ */
+bool trace_export(const char filepath[NONNULL]);
+
+#endif  // SRC_STATS_TRACE_H
@@ -0,0 +1,98 @@
+/**
+ * Regression checks for the `fields` option, which must select the same fields in YAML and JSON. Built with
+ * optimizations, since a wrong function attribute on the field lookup once made optimized builds drop every field.
+ */
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../defines.h"
+#include "../movie/movie.h"
+#include "../movie/parser.h"
+
+/** An input with a single operation and the fields expected from it. */
+struct fields_check {
+    /** Name printed on failures. */
+    const char *NONNULL name;
+    /** Full input stream. */
+    const char *NONNULL input;
+    /** Expected `fields` option of the operation. */
+    uint8_t fields;
+};
+
+[[gnu::nonnull(1)]]
+/** Parses the first operation of `check`, returning whether its fields match the expected ones. */
+static bool run_check(const struct fields_check *NONNULL check) {
+    int sockets[2];
+    if unlikely (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+        perror("socketpair");
+        return false;
+    }
+
+    const size_t length = strlen(check->input);
+    const bool written = write(sockets[1], check->input, length) == (ssize_t) length;
+    close(sockets[1]);
+    if unlikely (!written) {
+        perror("write");
+        close(sockets[0]);
+        return false;
+    }
+
+    atomic_bool shutdown_requested = false;
+    parser_t *parser = parser_create(&shutdown_requested, sockets[0]);
+    if unlikely (parser == NULL) {
+        fprintf(stderr, "%s: could not create parser\n", check->name);
+        close(sockets[0]);
+        return false;
+    }
+
+    struct operation op = parser_next_op(parser);
+    bool ok = op.ty != PARSE_ERROR && op.options.fields == check->fields;
+    if unlikely (!ok) {
+        fprintf(
+            stderr,
+            "%s: got fields %#x, expected %#x%s%s\n",
+            check->name,
+            (unsigned) op.options.fields,
+            (unsigned) check->fields,
+            op.ty == PARSE_ERROR ? ", error: " : "",
+            op.ty == PARSE_ERROR ? op.error_message : ""
+        );
+    }
+    parser_destroy(parser);
+    close(sockets[0]);
+    return ok;
+}
+
+int main(void) {
+    parser_setup();
+
+    const struct fields_check checks[] = {
+        {.name = "YAML default", .input = "get_movie: {id: 2}\n", .fields = FIELD_ALL},
+        {.name = "YAML title", .input = "get_movie: {id: 2, fields: [title]}\n", .fields = FIELD_TITLE},
+        {.name = "YAML single", .input = "list_movies: {fields: genres}\n", .fields = FIELD_GENRES},
+        {
+            .name = "YAML several",
+            .input = "list_movies: {fields: [id, director, release_year]}\n",
+            .fields = FIELD_DIRECTOR | FIELD_RELEASE_YEAR,
+        },
+        {.name = "JSON title", .input = "{\"get_movie\": {\"id\": 2, \"fields\": [\"title\"]}}", .fields = FIELD_TITLE},
+        {
+            .name = "JSON several",
+            .input = "{\"list_movies\": {\"fields\": [\"title\", \"genres\"]}}",
+            .fields = FIELD_TITLE | FIELD_GENRES,
+        },
+    };
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        ok = run_check(&checks[i]) && ok;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,169 @@
+/**
+ * Regression checks for the request limits and genre validation in the parser. Each input is written to a socket pair
+ * and parsed to the end of the stream, which must stop after the first error instead of waiting for events that libyaml
+ * never sends. The meson test timeout catches a parser that spins.
+ */
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../defines.h"
+#include "../movie/movie.h"
+#include "../movie/parser.h"
+
+/** Limit on the bytes of a single operation during the checks. */
+#define MAX_BYTES "1024"
+/** Genres in the oversized list, enough to cross `MAX_BYTES` several times. */
+static constexpr const size_t OVERSIZED_GENRES = 2'000;
+
+/** An input and the errors expected from it. */
+struct parser_check {
+    /** Name printed on failures. */
+    const char *NONNULL name;
+    /** Full input stream. */
+    const char *NONNULL input;
+    /** Number of operations parsed before the stream ends. */
+    size_t operations;
+    /** Prefix of the last error message. */
+    const char *NONNULL error;
+};
+
+[[gnu::nonnull(1)]]
+/** Parses the whole input of `check`, returning whether it matches the expected result. */
+static bool run_check(const struct parser_check *NONNULL check) {
+    int sockets[2];
+    if unlikely (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+        perror("socketpair");
+        return false;
+    }
+
+    const size_t length = strlen(check->input);
+    const bool written = write(sockets[1], check->input, length) == (ssize_t) length;
+    close(sockets[1]);
+    if unlikely (!written) {
+        perror("write");
+        close(sockets[0]);
+        return false;
+    }
+
+    atomic_bool shutdown_requested = false;
+    parser_t *parser = parser_create(&shutdown_requested, sockets[0]);
+    if unlikely (parser == NULL) {
+        fprintf(stderr, "%s: could not create parser\n", check->name);
+        close(sockets[0]);
+        return false;
+    }
+
+    size_t operations = 0;
+    const char *error = "";
+    while (!parser_finished(parser)) {
+        struct operation op = parser_next_op(parser);
+        switch (op.ty) {
+            case PARSE_ERROR:
+                error = op.error_message;
+                break;
+            case ADD_MOVIE:
+            case UPSERT_MOVIE:
+                free_movie(op.movie);
+                break;
+            case PARSE_DONE:
+                continue;
+            case ADD_GENRE:
+            case REMOVE_MOVIE:
+            case GET_MOVIE:
+            case LIST_SUMMARIES:
+            case LIST_MOVIES:
+            case SEARCH_BY_GENRE:
+            case STATS:
+            case CHANGES_SINCE:
+            default:
+                break;
+        }
+        operations += 1;
+    }
+
+    // the error message is owned by the parser
+    const bool ok = operations == check->operations && strncmp(error, check->error, strlen(check->error)) == 0;
+    if unlikely (!ok) {
+        fprintf(
+            stderr,
+            "%s: got %zu operations and error \"%s\", expected %zu and \"%s\"\n",
+            check->name,
+            operations,
+            error,
+            check->operations,
+            check->error
+        );
+    }
+    parser_destroy(parser);
+    close(sockets[0]);
+    return ok;
+}
+
+[[nodiscard("must be freed")]]
+/** A single `add_movie` document whose genre list is larger than `MAX_BYTES`. */
+static char *NULLABLE oversized_genre_list(void) {
+    char *buffer = NULL;
+    size_t size = 0;
+    FILE *output = open_memstream(&buffer, &size);
+    if unlikely (output == NULL) {
+        return NULL;
+    }
+
+    fputs("add_movie: {title: Title, director: Director, release_year: 2000, genres: [", output);
+    for (size_t i = 0; i < OVERSIZED_GENRES; i++) {
+        fprintf(output, "%sgenre%zu", i == 0 ? "" : ", ", i);
+    }
+    fputs("]}\n", output);
+
+    if unlikely (fclose(output) != 0) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+int main(void) {
+    // read once by parser_setup, genres are unlimited so only the byte limit applies
+    setenv("REQUEST_MAX_BYTES", MAX_BYTES, true);
+    setenv("REQUEST_MAX_GENRES", "0", true);
+    parser_setup();
+
+    char *oversized = oversized_genre_list();
+    if unlikely (oversized == NULL) {
+        perror("oversized_genre_list");
+        return EXIT_FAILURE;
+    }
+
+    const struct parser_check checks[] = {
+        {.name = "valid stream", .input = "--- {get_movie: 1}\n--- list_movies\n", .operations = 2, .error = ""},
+        {.name = "oversized genre list", .input = oversized, .operations = 1, .error = "operation larger than"},
+        {.name = "invalid document", .input = "list_movies\nget_movie: 1\n", .operations = 2, .error = "mapping"},
+        {
+            .name = "separator in YAML genre",
+            .input = "add_movie: {title: a, director: b, release_year: 1, genres: [\"a\\x1Fb\"]}\n",
+            .operations = 1,
+            .error = "invalid character in genre",
+        },
+        {
+            .name = "separator in JSON genre",
+            .input = "{\"add_genre\": {\"id\": 1, \"genre\": \"a\\u001Fb\"}}",
+            .operations = 1,
+            .error = "invalid character in genre",
+        },
+    };
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        ok = run_check(&checks[i]) && ok;
+    }
+
+    free(oversized);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,376 @@
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../config.h"
+#include "../defines.h"
+#include "../stats/clock.h"
+#include "../stats/trace.h"
+#include "./peers.h"
+#include "./worker.h"
+
+/** Bits of the address hash used to pick a slot. */
+#define PEER_SLOT_BITS 10
+/** Number of tracked addresses. */
+#define PEER_SLOTS (1 << PEER_SLOT_BITS)
+/** Slots probed for an address before falling back to an idle slot, or the shared overflow entry. */
+#define PEER_PROBES 16
+
+static_assert(PEER_PROBES <= PEER_SLOTS);
+
+/** Default share of the workers a single address can occupy. */
+#define PEER_DEFAULT_MAX_WORKERS (WORKERS_CAPACITY / 2)
+
+/** A connection waiting for a worker. */
+struct pending_socket {  // NOLINT(altera-struct-pack-align)
+    /** Next connection of the same peer, in accept order. */
+    struct pending_socket *NULLABLE next;
+    /** The accepted client socket. */
+    int socket;
+    /** Request id, for tracing. */
+    trace_id_t request;
+};
+
+/**
+ * State of a single client address. Everything but the bucket is guarded by `peers_lock`.
+ */
+struct peer {  // NOLINT(altera-struct-pack-align)
+    /**
+     * Rate limit bucket, as the time its tokens were all spent, in the style of GCRA. A token is available while this
+     * is less than `tolerance_ns` ahead of the clock, so the bucket is a single atomic updated without `peers_lock`.
+     */
+    atomic_uint_fast64_t spent_until;
+    /** Oldest connection waiting for a worker. */
+    struct pending_socket *NULLABLE first;
+    /** Newest connection waiting for a worker. */
+    struct pending_socket *NULLABLE last;
+    /** Next peer in the round-robin list. */
+    struct peer *NULLABLE next_ready;
+    /** Number of connections in `first`. */
+    size_t queued;
+    /** Number of connections handled by some worker. */
+    size_t active;
+    /** The client address, in network order. */
+    in_addr_t address;
+    /** The slot holds some address. */
+    bool used;
+    /** The peer is in the round-robin list. */
+    bool ready;
+};
+
+/** Guards the slots and the round-robin list. Held only for list updates, never while handling a connection. */
+static pthread_mutex_t peers_lock = PTHREAD_MUTEX_INITIALIZER;
+/** Tracked addresses, with linear probing. Slots are reused only when their peer is idle. */
+static struct peer slots[PEER_SLOTS];
+/** Shared by every address that found no slot. */
+static struct peer overflow = {.used = true};
+/** First peer with connections to take, in round-robin order. */
+static struct peer *NULLABLE ready_first = NULL;
+/** Last peer with connections to take. */
+static struct peer *NULLABLE ready_last = NULL;
+
+/** Most workers for a single address, or zero if unlimited. */
+static size_t max_workers = PEER_DEFAULT_MAX_WORKERS;
+/** Operations per second for a single address, or zero if unlimited. */
+static uint64_t rate = 0;
+/** Operations a single address can send at once, above the rate. */
+static uint64_t burst = 0;
+/** Time to refill a token, in nanoseconds. Zero if not rate limited. */
+static uint64_t interval_ns = 0;
+/** How far ahead of the clock a bucket can be spent, in nanoseconds. */
+static uint64_t tolerance_ns = 0;
+
+/** Connections that had to wait because their address already occupied `max_workers` workers. */
+static atomic_uint_fast64_t deferred = 0;
+/** Multiplexed operations run by their connection worker because the address had no worker slot left. */
+static atomic_uint_fast64_t inline_tasks = 0;
+/** Operations rejected for going over the rate. */
+static atomic_uint_fast64_t throttled = 0;
+/** Lookups that fell back to the overflow entry. */
+static atomic_uint_fast64_t overflowed = 0;
+
+/** Reads the limits. */
+void peers_setup(void) {
+    static constexpr const uint64_t NS_PER_SEC = 1'000'000'000;
+    static constexpr const uint64_t MAX_BURST = UINT32_MAX;
+
+    max_workers = (size_t) config_u64("PEER_MAX_WORKERS", PEER_DEFAULT_MAX_WORKERS);
+    rate = config_u64("PEER_RATE", 0);
+    burst = config_u64("PEER_BURST", rate);
+    if (rate == 0) {
+        interval_ns = 0;
+        tolerance_ns = 0;
+        return;
+    }
+
+    burst = (burst == 0) ? 1 : (burst > MAX_BURST ? MAX_BURST : burst);
+    interval_ns = (rate >= NS_PER_SEC) ? 1 : NS_PER_SEC / rate;
+    tolerance_ns = (burst - 1) * interval_ns;
+}
+
+[[gnu::const]]
+/** Fibonacci hash of the address, as a slot index. */
+static inline size_t peer_slot_index(in_addr_t address) {
+    static constexpr const uint64_t GOLDEN_RATIO = 0x9E37'79B9'7F4A'7C15;
+    return (size_t) (((uint64_t) address * GOLDEN_RATIO) >> (64 - PEER_SLOT_BITS));
+}
+
+[[gnu::pure, gnu::nonnull(1)]]
+/** Checks if the peer is not doing anything, so its slot can be given to another address. */
+static inline bool peer_is_idle(const struct peer *NONNULL peer) {
+    return peer->active == 0 && peer->queued == 0;
+}
+
+[[gnu::returns_nonnull]]
+/** Finds the slot for `address`, claiming a new one if needed. Must hold `peers_lock`. */
+static struct peer *NONNULL peer_find(in_addr_t address) {
+    const size_t index = peer_slot_index(address);
+
+    struct peer *idle = NULL;
+    for (size_t i = 0; i < PEER_PROBES; i++) {
+        struct peer *peer = &(slots[(index + i) % PEER_SLOTS]);
+        if (!peer->used) {
+            idle = peer;
+            break;
+        } else if (peer->address == address) {
+            return peer;
+        } else if (idle == NULL && peer_is_idle(peer)) {
+            idle = peer;
+        }
+    }
+
+    if unlikely (idle == NULL) {
+        atomic_fetch_add_explicit(&overflowed, 1, memory_order_relaxed);
+        return &overflow;
+    }
+
+    // an idle address loses its bucket, which is at most a single burst of leniency
+    idle->used = true;
+    idle->address = address;
+    atomic_store_explicit(&(idle->spent_until), 0, memory_order_relaxed);
+    return idle;
+}
+
+[[gnu::pure, gnu::nonnull(1)]]
+/** Checks if a connection of `peer` can be taken now. */
+static inline bool peer_is_eligible(const struct peer *NONNULL peer) {
+    return peer->queued > 0 && (max_workers == 0 || peer->active < max_workers);
+}
+
+[[gnu::nonnull(1)]]
+/** Moves `peer` to the end of the round-robin list, if not there already. Must hold `peers_lock`. */
+static void ready_push(struct peer *NONNULL peer) {
+    if (peer->ready) {
+        return;
+    }
+
+    peer->ready = true;
+    peer->next_ready = NULL;
+    if (ready_last != NULL) {
+        ready_last->next_ready = peer;
+    } else {
+        ready_first = peer;
+    }
+    ready_last = peer;
+}
+
+/** Takes the first peer of the round-robin list. Must hold `peers_lock`. */
+static struct peer *NULLABLE ready_pop(void) {
+    struct peer *peer = ready_first;
+    if likely (peer != NULL) {
+        ready_first = peer->next_ready;
+        if (ready_first == NULL) {
+            ready_last = NULL;
+        }
+        peer->ready = false;
+        peer->next_ready = NULL;
+    }
+    return peer;
+}
+
+/** Queues an accepted socket. */
+bool peers_admit(int socket, in_addr_t address, trace_id_t request) {
+    struct pending_socket *pending = malloc(sizeof(struct pending_socket));
+    if unlikely (pending == NULL) {
+        return false;
+    }
+    *pending = (struct pending_socket) {.next = NULL, .socket = socket, .request = request};
+
+    pthread_mutex_lock(&peers_lock);
+    struct peer *peer = peer_find(address);
+    if (peer->last != NULL) {
+        peer->last->next = pending;
+    } else {
+        peer->first = pending;
+    }
+    peer->last = pending;
+    peer->queued += 1;
+
+    const bool eligible = peer_is_eligible(peer);
+    if likely (eligible) {
+        ready_push(peer);
+    }
+    pthread_mutex_unlock(&peers_lock);
+
+    if unlikely (!eligible) {
+        atomic_fetch_add_explicit(&deferred, 1, memory_order_relaxed);
+    }
+    return true;
+}
+
+/** Takes the next connection in round-robin order. */
+bool peers_take(struct peer_socket *NONNULL next) {
+    pthread_mutex_lock(&peers_lock);
+    // peers reach the limit while in the list, and are added again when a worker is released
+    struct peer *peer = ready_pop();
+    while (peer != NULL && !peer_is_eligible(peer)) {
+        peer = ready_pop();
+    }
+    if unlikely (peer == NULL) {
+        pthread_mutex_unlock(&peers_lock);
+        return false;
+    }
+
+    struct pending_socket *pending = peer->first;
+    assume(pending != NULL);
+    peer->first = pending->next;
+    if (peer->first == NULL) {
+        peer->last = NULL;
+    }
+    peer->queued -= 1;
+    peer->active += 1;
+
+    // the peer goes to the back of the line, behind every other waiting address
+    if (peer_is_eligible(peer)) {
+        ready_push(peer);
+    }
+    const bool more = ready_first != NULL;
+    pthread_mutex_unlock(&peers_lock);
+
+    *next = (struct peer_socket) {.socket = pending->socket, .request = pending->request, .peer = peer, .more = more};
+    free(pending);
+    return true;
+}
+
+/** Takes an extra worker slot of `peer`, for a multiplexed operation. */
+bool peers_acquire(peer_t *NONNULL peer) {
+    pthread_mutex_lock(&peers_lock);
+    assume(peer->active > 0);
+    const bool acquired = max_workers == 0 || peer->active < max_workers;
+    if likely (acquired) {
+        peer->active += 1;
+    }
+    pthread_mutex_unlock(&peers_lock);
+
+    if unlikely (!acquired) {
+        atomic_fetch_add_explicit(&inline_tasks, 1, memory_order_relaxed);
+    }
+    return acquired;
+}
+
+/** Releases a worker slot of `peer`. */
+bool peers_release(peer_t *NONNULL peer) {
+    pthread_mutex_lock(&peers_lock);
+    assume(peer->active > 0);
+    peer->active -= 1;
+    if (peer_is_eligible(peer)) {
+        ready_push(peer);
+    }
+    const bool more = ready_first != NULL;
+    pthread_mutex_unlock(&peers_lock);
+    return more;
+}
+
+/** Takes a token from the bucket of `peer`. */
+bool peers_allow(peer_t *NONNULL peer) {
+    if likely (interval_ns == 0) {
+        return true;
+    }
+
+    const uint64_t now = clock_now_ns();
+    uint_fast64_t spent_until = atomic_load_explicit(&(peer->spent_until), memory_order_relaxed);
+    while (true) {
+        // an unused bucket refills up to the burst, not beyond
+        const uint64_t start = (spent_until > now) ? spent_until : now;
+        if unlikely (start - now > tolerance_ns) {
+            atomic_fetch_add_explicit(&throttled, 1, memory_order_relaxed);
+            return false;
+        }
+
+        bool ok = atomic_compare_exchange_weak_explicit(
+            &(peer->spent_until),
+            &spent_until,
+            start + interval_ns,
+            memory_order_relaxed,
+            memory_order_relaxed
+        );
+        if likely (ok) {
+            return true;
+        }
+    }
+}
+
+[[gnu::nonnull(1)]]
+/** Closes the waiting connections of `peer`. Must hold `peers_lock`. */
+static void peer_clear(struct peer *NONNULL peer) {
+    struct pending_socket *pending = peer->first;
+    while (pending != NULL) {
+        struct pending_socket *next = pending->next;
+        close(pending->socket);
+        free(pending);
+        pending = next;
+    }
+    peer->first = NULL;
+    peer->last = NULL;
+    peer->queued = 0;
+    peer->ready = false;
+    peer->next_ready = NULL;
+}
+
+/** Closes every waiting connection. */
+void peers_clear(void) {
+    pthread_mutex_lock(&peers_lock);
+    for (size_t i = 0; i < PEER_SLOTS; i++) {
+        peer_clear(&(slots[i]));
+    }
+    peer_clear(&overflow);
+    ready_first = NULL;
+    ready_last = NULL;
+    pthread_mutex_unlock(&peers_lock);
+}
+
+/** Writes the limits and counters under a `peers` key. */
+void peers_stats_report(FILE *NONNULL output) {
+    size_t tracked = 0;
+    size_t waiting = 0;
+    pthread_mutex_lock(&peers_lock);
+    for (size_t i = 0; i < PEER_SLOTS; i++) {
+        tracked += slots[i].used ? 1 : 0;
+        waiting += slots[i].queued;
+    }
+    waiting += overflow.queued;
+    pthread_mutex_unlock(&peers_lock);
+
+    (void) fprintf(
+        output,
+        "  peers:\n    max_workers: %zu\n    rate: %" PRIu64 "\n    burst: %" PRIu64 "\n    tracked: %zu\n"
+        "    waiting: %zu\n    deferred: %" PRIu64 "\n    inline_tasks: %" PRIu64 "\n    throttled: %" PRIu64 "\n"
+        "    overflowed: %" PRIu64 "\n",
+        max_workers,
+        rate,
+        burst,
+        tracked,
+        waiting,
+        (uint64_t) atomic_load_explicit(&deferred, memory_order_relaxed),
+        (uint64_t) atomic_load_explicit(&inline_tasks, memory_order_relaxed),
+        (uint64_t) atomic_load_explicit(&throttled, memory_order_relaxed),
+        (uint64_t) atomic_load_explicit(&overflowed, memory_order_relaxed)
+    );
+}
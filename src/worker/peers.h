@@ -0,0 +1,90 @@
+#ifndef SRC_WORKER_PEERS_H
+/** Per client address scheduling: fair dispatch of connections and rate limits on operations. */
+#define SRC_WORKER_PEERS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <netinet/in.h>
+
+#include "../defines.h"
+#include "../stats/trace.h"
+
+/** Opaque state of a single client address. */
+typedef struct peer peer_t;
+
+/** A connection taken from the scheduler, to be handled by a worker. */
+struct peer_socket {  // NOLINT(altera-struct-pack-align)
+    /** The accepted client socket. */
+    int socket;
+    /** Request id assigned when the socket was accepted, for tracing. */
+    trace_id_t request;
+    /** The client address, to be released with `peers_release` once the socket is closed. */
+    peer_t *NONNULL peer;
+    /** More connections are ready, so another worker should be woken up. */
+    bool more;
+};
+
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Reads the limits from `PEER_MAX_WORKERS`, `PEER_RATE` and `PEER_BURST`. Must run before any other `peers_*` call.
+ */
+void peers_setup(void);
+
+[[nodiscard("socket must be closed on false"), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Queues a newly accepted `socket` from `address` until a worker takes it with `peers_take`.
+ *
+ * Returns `false` on allocation failures, and then the socket is not queued.
+ */
+bool peers_admit(int socket, in_addr_t address, trace_id_t request);
+
+[[nodiscard("socket must be handled on true"), gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Takes the oldest connection of the next peer in round-robin order, skipping peers that already occupy
+ * `PEER_MAX_WORKERS` workers. Clients with many connections wait behind their own connections, not behind everyone.
+ *
+ * Returns `false` if no connection can be taken now.
+ */
+bool peers_take(struct peer_socket *NONNULL next);
+
+[[nodiscard("slot must be released on true"), gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Takes another worker slot for `peer`, which already has a connection running, so a multiplexed operation of that
+ * connection can run on a second worker. Tasks count against `PEER_MAX_WORKERS` like connections do.
+ *
+ * Returns `false` if the peer is at its limit, and then the operation should run on the connection worker.
+ */
+bool peers_acquire(peer_t *NONNULL peer);
+
+[[nodiscard("ready connections need a worker"), gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Releases the worker slot taken by `peers_take` or `peers_acquire`, after the connection is closed or the operation
+ * is done.
+ *
+ * Returns `true` if some connection is waiting and can be taken now.
+ */
+bool peers_release(peer_t *NONNULL peer);
+
+[[nodiscard("throttled operations must not run"), gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Takes a token from the bucket of `peer`, for a single operation. Always succeeds when `PEER_RATE` is not set.
+ *
+ * Returns `false` if the peer is over its rate, and the operation should be rejected.
+ */
+bool peers_allow(peer_t *NONNULL peer);
+
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Closes every connection still waiting for a worker, for shutdown.
+ */
+void peers_clear(void);
+
+[[gnu::nonnull(1), gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Writes the limits and the throttling counters as YAML entries under a `peers` key, indented for the `stats`
+ * response.
+ */
+void peers_stats_report(FILE *NONNULL output);
+
+#endif  // SRC_WORKER_PEERS_H
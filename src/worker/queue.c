@@ -37,6 +37,11 @@ struct [[gnu::aligned(2 * CACHE_LINE_SIZE)]] work_queue {
      * Guards the `item_added_cond`.
      */
     [[gnu::aligned(CACHE_LINE_SIZE)]] pthread_mutex_t item_added_mtx;
+    /**
+     * Serializes producers, since pushing is not lock-free across threads. Rarely contended, only workers with
+     * multiplexed operations push besides the main thread.
+     */
+    [[gnu::aligned(CACHE_LINE_SIZE)]] pthread_mutex_t push_mtx;
     // Ring storage --------------------------------------------------------------------------------------------------
     /**
      * The ring buffer, limited to `WORK_QUEUE_CAPACITY` items of `work_item`.
@@ -140,8 +145,16 @@ workq_t *NULLABLE workq_create(void) {
         return NULL;
     }
 
+    ok = workq_mutex_init(&(queue->push_mtx));
+    if unlikely (!ok) {
+        pthread_mutex_destroy(&(queue->item_added_mtx));
+        free(queue);
+        return NULL;
+    }
+
     ok = workq_cond_init(&(queue->item_added_cond));
     if unlikely (!ok) {
+        pthread_mutex_destroy(&(queue->push_mtx));
         pthread_mutex_destroy(&(queue->item_added_mtx));
         free(queue);
         return NULL;
@@ -154,10 +167,11 @@ workq_t *NULLABLE workq_create(void) {
 
 /** Deallocates memory for the work queue and destroy its synchronization variables. */
 void workq_destroy(workq_t *NONNULL queue) {
-    const char *func[] = {"pthread_cond_destroy", "pthread_mutex_destroy"};
+    const char *func[] = {"pthread_cond_destroy", "pthread_mutex_destroy", "pthread_mutex_destroy"};
     const int rvs[] = {
         pthread_cond_destroy(&(queue->item_added_cond)),
         pthread_mutex_destroy(&(queue->item_added_mtx)),
+        pthread_mutex_destroy(&(queue->push_mtx)),
     };
     memset(queue, 0, sizeof(struct work_queue));
     free(queue);
@@ -181,10 +195,10 @@ void workq_destroy(workq_t *NONNULL queue) {
  *
  * Returns false on errors.
  */
-static bool workq_mutex_lock(workq_t *NONNULL queue) {
-    int rv = pthread_mutex_lock(&(queue->item_added_mtx));
+static bool workq_mutex_lock(pthread_mutex_t *NONNULL mutex) {
+    int rv = pthread_mutex_lock(mutex);
     if unlikely (rv == EOWNERDEAD || errno == EOWNERDEAD) {
-        rv = pthread_mutex_consistent(&(queue->item_added_mtx));
+        rv = pthread_mutex_consistent(mutex);
     }
     return likely(rv == 0);
 }
@@ -196,7 +210,7 @@ static bool workq_mutex_lock(workq_t *NONNULL queue) {
  * Returns false on errors.
  */
 static bool workq_awake_workers(workq_t *NONNULL queue, bool broadcast) {
-    bool ok = workq_mutex_lock(queue);
+    bool ok = workq_mutex_lock(&(queue->item_added_mtx));
     if unlikely (!ok) {
         return false;
     }
@@ -239,11 +253,12 @@ static inline int_fast64_t workq_size(uint_fast64_t head, uint_fast64_t tail) {
     return -(int_fast64_t) (~diff + 1);
 }
 
-/** Mostly lock-free push. Returns `false` on full. */
-bool workq_push(workq_t *NONNULL queue, work_item item) {
+[[nodiscard("item is dropped on false"), gnu::nonnull(1)]]
+/** Push while holding `push_mtx`. Returns `false` on full. */
+static bool workq_push_locked(workq_t *NONNULL queue, work_item item) {
     // we just use head to ensure the queue is not full, so we don't need the latest value
     uint_fast64_t head = atomic_load_explicit(&(queue->head), memory_order_relaxed);
-    // assuming push is called by only one thread, we already have the latest tail
+    // producers are serialized by `push_mtx`, so we already have the latest tail
     uint_fast64_t tail = atomic_load_explicit(&(queue->tail), memory_order_relaxed);
 
     if unlikely (workq_size(head, tail) >= WORK_QUEUE_CAPACITY) {
@@ -251,13 +266,11 @@ bool workq_push(workq_t *NONNULL queue, work_item item) {
         head = atomic_load_explicit(&(queue->head), memory_order_acquire);
         if unlikely (workq_size(head, tail) >= WORK_QUEUE_CAPACITY) {
             assert(workq_size(head, tail) == WORK_QUEUE_CAPACITY);
-            // actually full, wake up threads to work on it
-            workq_awake_workers(queue, true);
             return false;
         }
     }
 
-    // WARNING: this is racy, if two threads try to push at the same time, which can't happen in this project.
+    // only safe because no other producer runs at the same time
     queue->buf[idx(tail)] = item;
 
     bool ok = atomic_compare_exchange_strong_explicit(
@@ -271,7 +284,24 @@ bool workq_push(workq_t *NONNULL queue, work_item item) {
     assert(ok);
 
     assert(workq_size(head, tail) <= WORK_QUEUE_CAPACITY);
-    return likely(ok) && workq_awake_workers(queue, false);
+    return likely(ok);
+}
+
+/** Mostly lock-free push. Returns `false` on full. */
+bool workq_push(workq_t *NONNULL queue, work_item item) {
+    bool ok = workq_mutex_lock(&(queue->push_mtx));
+    if unlikely (!ok) {
+        return false;
+    }
+
+    const bool pushed = workq_push_locked(queue, item);
+    int rv = pthread_mutex_unlock(&(queue->push_mtx));
+    if unlikely (!pushed) {
+        // actually full, wake up threads to work on it
+        workq_awake_workers(queue, true);
+        return false;
+    }
+    return likely(rv == 0) && workq_awake_workers(queue, false);
 }
 
 /** Clears the work queue for shutdown. */
@@ -343,7 +373,7 @@ static bool is_empty(const workq_t *NONNULL queue) {
  * Block current thread until there is an item to be taken in the work queue.
  */
 bool workq_wait_not_empty(workq_t *NONNULL queue, atomic_bool *NONNULL stop_condition) {
-    bool ok = workq_mutex_lock(queue);
+    bool ok = workq_mutex_lock(&(queue->item_added_mtx));
     if unlikely (!ok) {
         return false;
     }
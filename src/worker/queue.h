@@ -7,6 +7,7 @@
 #include <stddef.h>
 
 #include "../defines.h"
+#include "../stats/trace.h"
 
 /**
  * Assumed size for the cache line.
@@ -23,12 +24,22 @@
  */
 typedef struct work_queue workq_t [[gnu::aligned(2 * CACHE_LINE_SIZE)]];
 
+/** A client connection with operations waiting for any worker, defined in `request.c`. */
+struct connection;
+
 /**
  * The content of the work queue.
  *
- * Currently, a socket file descriptor (`int`).
+ * Either a connection with multiplexed operations to run, or a hint that an accepted socket is waiting in the peer
+ * scheduler. Sockets themselves are picked by `peers_take`, so the order they are handled in is decided only when a
+ * worker is free.
  */
-typedef int work_item;
+typedef struct work_item {  // NOLINT(altera-struct-pack-align)
+    /** Request id, for tracing. Zero for sockets, which carry their own. */
+    trace_id_t request;
+    /** Connection with a waiting operation, or `NULL` for new sockets. */
+    struct connection *NULLABLE connection;
+} work_item;
 
 [[nodiscard("might need to destroy queue"),
   gnu::malloc,
@@ -53,9 +64,8 @@ void workq_destroy(workq_t *NONNULL queue);
 
 [[gnu::nonnull(1), gnu::leaf, gnu::nothrow]]
 /**
- * Add an item to the queue and signal other threads about it.
- *
- * Warning: not thread safe. Should only be called by the main thread.
+ * Add an item to the queue and signal other threads about it. Producers are serialized by a mutex, so both the main
+ * thread and workers can push.
  *
  * Returns `true` if the item was inserted successfully, or `false` if the queue is full or the mutex lock could not be
  * acquired.
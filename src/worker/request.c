@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <inttypes.h>
+#include <stdarg.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,14 +8,26 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "../config.h"
 #include "../database/database.h"
+#include "../database/genre_cache.h"
+#include "../database/id_set.h"
+#include "../database/search_cache.h"
 #include "../defines.h"
+#include "../movie/json.h"
 #include "../movie/movie.h"
 #include "../movie/parser.h"
+#include "../movie/render.h"
+#include "../stats/perf.h"
+#include "../stats/trace.h"
+#include "./peers.h"
 #include "./request.h"
+#include "./worker.h"
 
 /** Display code in %hhu format. */
 #define hhu(code) ((unsigned char) (code))
@@ -22,106 +35,823 @@
 /** Response length. */
 #define RESP_LEN 2048
 
-[[nodiscard("hard errors cannot be ignored")]]
+/** Most multiplexed operations waiting on a single connection. Beyond that, they run in order. */
+#define MAX_QUEUED_TASKS 64
+
+/** Default for `RESPONSE_MAX_BYTES`. */
+#define DEFAULT_MAX_RESPONSE_BYTES (16 << 20)
+
+/** Size after which movie lists are cut short, or zero if unlimited. */
+static uint64_t max_response_bytes = DEFAULT_MAX_RESPONSE_BYTES;
+
+/** Reads the response limits. */
+void request_setup(void) {
+    max_response_bytes = config_u64("RESPONSE_MAX_BYTES", DEFAULT_MAX_RESPONSE_BYTES);
+}
+
 /**
- * Sends a debug response to the client based on `db_result` and `errmsg`.
+ * A multiplexed operation, copied out of the parser buffers so it outlives the next `parser_next_op`.
+ */
+struct request_task {  // NOLINT(altera-struct-pack-align)
+    /** Next task in arrival order. */
+    struct request_task *NULLABLE next;
+    /** The operation, with strings pointing to `strings`. */
+    struct operation op;
+    /** Storage for the strings of `op`. */
+    char strings[];
+};
+
+/**
+ * State shared by every worker answering operations of the same client connection.
  *
- * If result == DB_SUCCESS, sends an \"ok\" message. Otherwise, sends the error message and frees it. Returns whether
- * we encountered a hard error that might force the server to stop.
+ * The worker that accepted the socket parses every operation. Those with a `request_id` are queued here, and idle
+ * workers are asked to run them with `workers_add_task`, as long as the client address has worker slots left. Whatever
+ * no worker took is run by the connection worker itself before it blocks on the socket again, so operations never wait
+ * for a busy pool.
+ */
+struct connection {  // NOLINT(altera-struct-pack-align)
+    /** The client socket. */
+    int sock_fd;
+    /** The client address. Each queued task holds one of its worker slots, taken with `peers_acquire`. */
+    peer_t *NONNULL peer;
+    /** The client sends JSON, so it is answered in JSON too. Set by the connection worker before any task is queued. */
+    bool json;
+    /** Serializes whole responses, so operations answered concurrently never interleave their bytes. */
+    pthread_mutex_t send_lock;
+    /** Guards the task list, the counters and `refs`. */
+    pthread_mutex_t task_lock;
+    /** Signalled when the last running task finishes. */
+    pthread_cond_t task_done;
+    /** Oldest queued task. */
+    struct request_task *NULLABLE first;
+    /** Newest queued task. */
+    struct request_task *NULLABLE last;
+    /** Number of tasks in the list. */
+    size_t queued;
+    /** Number of tasks taken by some worker and not finished yet. */
+    size_t running;
+    /** The connection worker, plus one for each `workers_add_task` still in the work queue. */
+    size_t refs;
+};
+
+/**
+ * A response being built for a single operation. The `server: received` line is kept until the body is ready, so both
+ * go out in a single write under `send_lock`.
  *
- * @return true if DB_HARD_ERROR was encountered, false otherwise.
+ * JSON responses have no header. Each is a single object in its own line, with the `request_id` as a member.
  */
-static bool handle_result(unsigned long id, int sock_fd, const char *NULLABLE errmsg, db_result_t result) {
-    if likely (errmsg != NULL) {
+struct reply {  // NOLINT(altera-struct-pack-align)
+    /** Connection of the operation. */
+    struct connection *NONNULL conn;
+    /** The `request_id` of the operation, or zero. */
+    uint64_t request_id;
+    /** Render the body as JSON. */
+    bool json;
+    /** Bytes used in `header`. */
+    size_t header_len;
+    /** The `request_id` and `server: received` lines, if any. */
+    char header[RESP_LEN];
+};
+
+[[gnu::nonnull(1, 2)]]
+/** Starts the reply for an operation, echoing `request_id` if given. */
+static void reply_start(struct reply *NONNULL reply, struct connection *NONNULL conn, uint64_t request_id) {
+    reply->conn = conn;
+    reply->request_id = request_id;
+    reply->json = conn->json;
+    reply->header_len = 0;
+    if (request_id != 0 && !reply->json) {
+        const int len = snprintf(reply->header, sizeof(reply->header), "request_id: %" PRIu64 "\n", request_id);
+        reply->header_len = (size_t) len;
+    }
+}
+
+[[gnu::format(printf, 2, 3), gnu::nonnull(1, 2)]]
+/** Appends a line to the reply header. Lines that don't fit are truncated. JSON replies have no header. */
+static void reply_received(struct reply *NONNULL reply, const char *NONNULL restrict format, ...) {
+    if (reply->json) {
+        return;
+    }
+    const size_t available = sizeof(reply->header) - reply->header_len;
+
+    va_list args;
+    va_start(args, format);
+    const int len = vsnprintf(&(reply->header[reply->header_len]), available, format, args);
+    va_end(args);
+
+    if likely (len > 0) {
+        reply->header_len += (size_t) len < available ? (size_t) len : available - 1;
+    }
+}
+
+[[gnu::nonnull(1, 3)]]
+/**
+ * Sends the reply header followed by `data`, with no other response in between.
+ */
+static void reply_send(struct reply *NONNULL reply, size_t length, const char data[NONNULL length]) {
+    struct iovec parts[2] = {
+        {.iov_base = reply->header, .iov_len = reply->header_len},
+        {.iov_base = (void *) data, .iov_len = length           },
+    };
+    struct msghdr message = {.msg_iov = parts, .msg_iovlen = 2};
+
+    pthread_mutex_lock(&(reply->conn->send_lock));
+    size_t remaining = reply->header_len + length;
+    while (remaining > 0) {
+        const ssize_t sent = sendmsg(reply->conn->sock_fd, &message, MSG_NOSIGNAL);
+        if unlikely (sent <= 0) {
+            break;
+        }
+        remaining -= (size_t) sent;
+
+        // partial writes only happen for large bodies, but would break the framing for other responses
+        size_t skip = (size_t) sent;
+        while (message.msg_iovlen > 0 && skip >= message.msg_iov[0].iov_len) {
+            skip -= message.msg_iov[0].iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0) {
+            message.msg_iov[0].iov_base = (char *) message.msg_iov[0].iov_base + skip;
+            message.msg_iov[0].iov_len -= skip;
+        }
+    }
+    pthread_mutex_unlock(&(reply->conn->send_lock));
+
+    reply->header_len = 0;
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Sends a NUL-terminated string as the reply body. */
+static inline void reply_send_str(struct reply *NONNULL reply, const char *NONNULL text) {
+    reply_send(reply, strlen(text), text);
+}
+
+[[gnu::nonnull(1, 2, 3)]]
+/** Starts a JSON response object, with the `request_id` and `status` members. */
+static void render_json_start(FILE *NONNULL output, const struct reply *NONNULL reply, const char *NONNULL status) {
+    (void) fputc('{', output);
+    if (reply->request_id != 0) {
+        (void) fprintf(output, "\"request_id\":%" PRIu64 ",", reply->request_id);
+    }
+    (void) fprintf(output, "\"status\":\"%s\"", status);
+}
+
+[[gnu::nonnull(1, 2)]]
+/** Reports a failure: `server: <message>` in YAML, or an object with `"status":"error"` and the `message` in JSON. */
+static void send_error(struct reply *NONNULL reply, const char *NONNULL message) {
+    if (!reply->json) {
         char response[RESP_LEN];
-        (void) snprintf(response, sizeof(response), "server: %s\n\n", errmsg);
-        send(sock_fd, response, strlen(response), 0);
-        (void) fprintf(stderr, "worker[%zu]: db error: %s\n", id, errmsg);
-        db_free_errmsg(errmsg);
+        (void) snprintf(response, sizeof(response), "server: %s\n\n", message);
+        reply_send_str(reply, response);
+        return;
+    }
+
+    char *doc = NULL;
+    size_t doc_len = 0;
+    FILE *output = open_memstream(&doc, &doc_len);
+    if unlikely (output == NULL) {
+        reply_send_str(reply, "{\"status\":\"error\"}\n");
+        return;
+    }
+
+    render_json_start(output, reply, "error");
+    (void) fputs(",\"error\":", output);
+    json_write_string(output, message);
+    (void) fputs("}\n", output);
+
+    if likely (fclose(output) == 0) {
+        reply_send(reply, doc_len, doc);
+    } else {
+        reply_send_str(reply, "{\"status\":\"error\"}\n");
+    }
+    free(doc);
+}
+
+[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(2)]]
+/**
+ * Sends a debug response to the client based on `db_result` and `error`.
+ *
+ * If an error was reported, its message is rendered on the stack and sent. Returns whether we encountered a hard error
+ * that might force the server to stop.
+ *
+ * @return true if DB_HARD_ERROR was encountered, false otherwise.
+ */
+static bool handle_result(unsigned long id, struct reply *NONNULL reply, db_error_t error, db_result_t result) {
+    if unlikely (error.code != DB_ERROR_NONE) {
+        struct trace_span span = trace_begin("send_error");
+        char message[DB_ERROR_LEN];
+        (void) db_error_format(error, sizeof(message), message);
+        send_error(reply, message);
+        trace_end(span);
+        (void) fprintf(stderr, "worker[%zu]: db error: %s\n", id, message);
     }
 
     return unlikely(result == DB_HARD_ERROR);
 }
 
-[[gnu::hot]]
+[[gnu::hot, gnu::nonnull(1)]]
 /** Sends ok to  */
-static void send_ok(int sock_fd) {
-    char ok[] = "server: ok\n\n";
-    send(sock_fd, ok, strlen(ok), 0);
+static void send_ok(struct reply *NONNULL reply) {
+    struct trace_span span = trace_begin("send_ok");
+    if likely (!reply->json) {
+        reply_send_str(reply, "server: ok\n\n");
+    } else if (reply->request_id == 0) {
+        reply_send_str(reply, "{\"status\":\"ok\"}\n");
+    } else {
+        char response[RESP_LEN];
+        (void) snprintf(
+            response,
+            sizeof(response),
+            "{\"request_id\":%" PRIu64 ",\"status\":\"ok\"}\n",
+            reply->request_id
+        );
+        reply_send_str(reply, response);
+    }
+    trace_end(span);
+}
+
+[[gnu::cold, gnu::nonnull(1)]]
+/** Reports a response that could not be rendered in memory. */
+static void send_render_error(struct reply *NONNULL reply) {
+    send_error(reply, "failed to render response");
 }
 
 [[gnu::hot]]
 /**
  * Sends textual movie data back to the client.
  *
- * Formats the fields of `movie` and writes them to the socket. Continues returning false so iteration can keep going,
- * unless you want to stop after the first record.
+ * The whole response is rendered in memory first, so it goes out in a single `send`.
  */
-static void send_movie(int sock_fd, struct movie movie, bool in_list) {
-    // Ideally, we should be a single in-memory buffer and send a single data to the client, as to
-    // - not clog the SQLite database lock
-    // - allow faster communication by the kernel
-    // - allow proper uring integration
-    char msg[RESP_LEN] = "";
-    if (!in_list) {
-        (void) snprintf(msg, sizeof(msg), "movie:\n");
-        send(sock_fd, msg, strlen(msg), 0);
+static void send_movie(struct reply *NONNULL reply, struct movie movie, uint8_t fields) {
+    struct trace_span span = trace_begin("send_movie");
+    char *doc = NULL;
+    size_t doc_len = 0;
+    FILE *output = open_memstream(&doc, &doc_len);
+    if unlikely (output == NULL) {
+        free_movie(movie);
+        send_render_error(reply);
+        trace_end(span);
+        return;
     }
 
-    (void) snprintf(msg, sizeof(msg), "  %2sid: %" PRIi64 "\n", in_list ? "- " : "", movie.id);
-    send(sock_fd, msg, strlen(msg), 0);
-    (void) snprintf(msg, sizeof(msg), "  %2stitle: %s\n", in_list ? "  " : "", movie.title);
-    send(sock_fd, msg, strlen(msg), 0);
-    (void) snprintf(msg, sizeof(msg), "  %2srelease_year: %d\n", in_list ? "  " : "", movie.release_year);
-    send(sock_fd, msg, strlen(msg), 0);
-    (void) snprintf(msg, sizeof(msg), "  %2sdirector: %s\n", in_list ? "  " : "", movie.director);
-    send(sock_fd, msg, strlen(msg), 0);
-    if unlikely (movie.genre_count <= 0) {
-        (void) snprintf(msg, sizeof(msg), "  %2sgenres: []\n", in_list ? "  " : "");
-        send(sock_fd, msg, strlen(msg), 0);
+    if (reply->json) {
+        render_json_start(output, reply, "ok");
+        (void) fputs(",\"movie\":", output);
+        render_movie_json(output, movie, fields);
+        (void) fputs("}\n", output);
     } else {
-        (void) snprintf(msg, sizeof(msg), "  %2sgenres:\n", in_list ? "  " : "");
-        send(sock_fd, msg, strlen(msg), 0);
+        render_movie(output, movie, false, fields);
     }
-    for (size_t i = 0; i < movie.genre_count; i++) {
-        (void) snprintf(msg, sizeof(msg), "  %2s  - %s\n", in_list ? "  " : "", movie.genres[i]);
-        send(sock_fd, msg, strlen(msg), 0);
+
+    if likely (fclose(output) == 0) {
+        reply_send(reply, doc_len, doc);
+    } else {
+        send_render_error(reply);
+    }
+    free(doc);
+    trace_end(span);
+}
+
+[[gnu::hot]]
+/**
+ * Confirms a new movie with the id assigned to it, so clients don't need to list the catalog to find it. The stored
+ * movie is also sent if `with_movie`, with the selected `fields`. Frees `movie`.
+ *
+ * For upserts, `outcome` tells if the movie was inserted or merged into an existing one.
+ */
+static void send_added(
+    struct reply *NONNULL reply,
+    struct movie movie,
+    const char *NULLABLE outcome,
+    bool with_movie,
+    uint8_t fields
+) {
+    struct trace_span span = trace_begin("send_added");
+    char *doc = NULL;
+    size_t doc_len = 0;
+    FILE *output = open_memstream(&doc, &doc_len);
+    if unlikely (output == NULL) {
+        free_movie(movie);
+        send_render_error(reply);
+        trace_end(span);
+        return;
     }
-    send(sock_fd, "\n", strlen("\n"), 0);
-    free_movie(movie);
+
+    if (reply->json) {
+        render_json_start(output, reply, "ok");
+        (void) fprintf(output, ",\"id\":%" PRIi64, movie.id);
+        if (outcome != NULL) {
+            (void) fprintf(output, ",\"outcome\":\"%s\"", outcome);
+        }
+        if (with_movie) {
+            (void) fputs(",\"movie\":", output);
+            render_movie_json(output, movie, fields);
+        } else {
+            free_movie(movie);
+        }
+        (void) fputs("}\n", output);
+    } else {
+        (void) fprintf(output, "server: ok\nid: %" PRIi64 "\n", movie.id);
+        if (outcome != NULL) {
+            (void) fprintf(output, "outcome: %s\n", outcome);
+        }
+        if (with_movie) {
+            render_movie(output, movie, false, fields);
+        } else {
+            (void) fputc('\n', output);
+            free_movie(movie);
+        }
+    }
+
+    if likely (fclose(output) == 0) {
+        reply_send(reply, doc_len, doc);
+    } else {
+        send_render_error(reply);
+    }
+    free(doc);
+    trace_end(span);
 }
 
-[[gnu::hot, gnu::nonnull(3, 4)]]
-/** Sends multiple movies at once. */
-static void send_movie_list(int sock_fd, size_t count, struct movie movie[NONNULL count], const char *NONNULL key) {
+[[gnu::hot]]
+/**
+ * Answers a conditional list when the client already has the catalog at `generation`.
+ *
+ * Returns `true` if the "not modified" reply was sent and the list can be skipped.
+ */
+static bool send_not_modified(struct reply *NONNULL reply, struct operation_options options, uint64_t generation) {
+    if likely (options.if_generation == 0 || options.if_generation != generation) {
+        return false;
+    }
+
     char msg[RESP_LEN] = "";
-    (void) snprintf(msg, sizeof(msg), "---\n%s:\n\n", key);
-    send(sock_fd, msg, strlen(msg), 0);
+    if (reply->json) {
+        char request_id[RESP_LEN / 2] = "";
+        if (reply->request_id != 0) {
+            (void) snprintf(request_id, sizeof(request_id), "\"request_id\":%" PRIu64 ",", reply->request_id);
+        }
+        (void) snprintf(
+            msg,
+            sizeof(msg),
+            "{%s\"status\":\"not modified\",\"generation\":%" PRIu64 "}\n",
+            request_id,
+            generation
+        );
+    } else {
+        (void) snprintf(msg, sizeof(msg), "server: not modified\ngeneration: %" PRIu64 "\n\n", generation);
+    }
+    reply_send_str(reply, msg);
+    return true;
+}
 
-    for (size_t i = 0; i < count; i++) {
-        send_movie(sock_fd, movie[i], true);
+[[gnu::hot, gnu::nonnull(2)]]
+/** Reads the sorting options of `LIST_MOVIES` into `page`. Returns `false` if the whole list was requested. */
+static bool list_page(struct operation_options options, struct db_page *NONNULL page) {
+    if likely (options.order_by == ORDER_NONE && !options.descending && options.limit == 0 && options.offset == 0) {
+        return false;
+    }
+
+    enum db_order order_by;
+    switch ((enum movie_order) options.order_by) {
+        case ORDER_BY_TITLE:
+            order_by = DB_ORDER_TITLE;
+            break;
+        case ORDER_BY_RELEASE_YEAR:
+            order_by = DB_ORDER_RELEASE_YEAR;
+            break;
+        case ORDER_NONE:
+        case ORDER_BY_ID:
+        default:
+            order_by = DB_ORDER_ID;
+            break;
+    }
+
+    *page = (struct db_page) {
+        .limit = options.limit,
+        .offset = options.offset,
+        .order_by = order_by,
+        .descending = options.descending,
+    };
+    return true;
+}
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(1)]]
+/** Checks if `output` already reached `max_response_bytes`, so no more movies should be added. */
+static inline bool response_full(FILE *NONNULL output) {
+    if likely (max_response_bytes == 0) {
+        return false;
+    }
+    const long position = ftell(output);
+    return position < 0 || (uint64_t) position >= max_response_bytes;
+}
+
+[[gnu::nonnull(1)]]
+/** Marks a list cut short by `RESPONSE_MAX_BYTES`, with the `next_offset` to continue from. */
+static void render_truncated(FILE *NONNULL output, bool json, uint64_t next_offset) {
+    if (json) {
+        (void) fprintf(output, ",\"truncated\":true,\"next_offset\":%" PRIu64, next_offset);
+    } else {
+        (void) fprintf(output, "truncated: true\nnext_offset: %" PRIu64 "\n", next_offset);
+    }
+}
+
+[[gnu::hot, gnu::nonnull(1, 3, 4)]]
+/**
+ * Sends multiple movies at once, rendered in memory as a single document.
+ *
+ * The catalog `generation` is included when non-zero. If `genre` is set, the document is also offered to the search
+ * cache with `ticket`.
+ *
+ * Movies stop being added once the document reaches `RESPONSE_MAX_BYTES`. The response is then marked as `truncated`,
+ * with the `next_offset` to continue from, counted from the `offset` of the first movie.
+ */
+static void send_movie_list(
+    struct reply *NONNULL reply,
+    size_t count,
+    struct movie movie[NONNULL count],
+    const char *NONNULL key,
+    uint64_t offset,
+    uint64_t generation,
+    uint8_t fields,
+    const char *NULLABLE genre,
+    search_ticket_t ticket
+) {
+    struct trace_span span = trace_begin("send_movie_list");
+    char *doc = NULL;
+    size_t doc_len = 0;
+    FILE *output = open_memstream(&doc, &doc_len);
+    if unlikely (output == NULL) {
+        for (size_t i = 0; i < count; i++) {
+            free_movie(movie[i]);
+        }
+        free(movie);
+        send_render_error(reply);
+        trace_end(span);
+        return;
+    }
+
+    size_t sent = 0;
+    if (reply->json) {
+        render_json_start(output, reply, "ok");
+        if (generation != 0) {
+            (void) fprintf(output, ",\"generation\":%" PRIu64, generation);
+        }
+        (void) fprintf(output, ",\"%s\":[", key);
+        for (; sent < count && !response_full(output); sent++) {
+            if (sent > 0) {
+                (void) fputc(',', output);
+            }
+            render_movie_json(output, movie[sent], fields);
+        }
+        (void) fputc(']', output);
+    } else {
+        (void) fputs("---\n", output);
+        if (generation != 0) {
+            (void) fprintf(output, "generation: %" PRIu64 "\n", generation);
+        }
+        (void) fprintf(output, "%s:\n\n", key);
+        for (; sent < count && !response_full(output); sent++) {
+            render_movie(output, movie[sent], true, fields);
+        }
+    }
+
+    const bool truncated = sent < count;
+    for (size_t i = sent; i < count; i++) {
+        free_movie(movie[i]);
     }
     free(movie);
 
-    const char END_DOCUMENT[] = "...\n";
-    send(sock_fd, END_DOCUMENT, strlen(END_DOCUMENT), 0);
+    if unlikely (truncated) {
+        render_truncated(output, reply->json, offset + sent);
+    }
+    (void) fputs(reply->json ? "}\n" : "...\n", output);
+
+    if likely (fclose(output) == 0) {
+        reply_send(reply, doc_len, doc);
+        // only complete results are cached
+        if (genre != NULL && !truncated) {
+            search_cache_store(genre, ticket, doc_len, doc);
+        }
+    } else {
+        send_render_error(reply);
+    }
+    free(doc);
+    trace_end(span);
 }
 
-[[gnu::hot, gnu::nonnull(3)]]
-/** Sends multiple summaries at once. */
-static void send_summary_list(int sock_fd, size_t count, struct movie_summary summary[NONNULL count]) {
-    char msg[RESP_LEN] = "";
-    (void) snprintf(msg, sizeof(msg), "---\n%s:\n", "summaries");
-    send(sock_fd, msg, strlen(msg), 0);
+[[gnu::hot, gnu::nonnull(1, 3)]]
+/**
+ * Sends multiple summaries at once, rendered in memory as a single document, with the catalog `generation`. Bounded
+ * like `send_movie_list`.
+ */
+static void send_summary_list(
+    struct reply *NONNULL reply,
+    size_t count,
+    struct movie_summary summary[NONNULL count],
+    uint64_t offset,
+    uint64_t generation
+) {
+    struct trace_span span = trace_begin("send_summary_list");
+    char *doc = NULL;
+    size_t doc_len = 0;
+    FILE *output = open_memstream(&doc, &doc_len);
+    if unlikely (output == NULL) {
+        free(summary);
+        send_render_error(reply);
+        trace_end(span);
+        return;
+    }
 
-    for (size_t i = 0; i < count; i++) {
-        (void) snprintf(msg, sizeof(msg), "  - { id: %" PRIi64 ", title: '%s' }\n", summary[i].id, summary[i].title);
-        send(sock_fd, msg, strlen(msg), 0);
+    size_t sent = 0;
+    if (reply->json) {
+        render_json_start(output, reply, "ok");
+        (void) fprintf(output, ",\"generation\":%" PRIu64 ",\"summaries\":[", generation);
+        for (; sent < count && !response_full(output); sent++) {
+            (void) fprintf(output, "%s{\"id\":%" PRIi64 ",\"title\":", (sent > 0) ? "," : "", summary[sent].id);
+            json_write_string(output, summary[sent].title);
+            (void) fputc('}', output);
+        }
+        (void) fputc(']', output);
+    } else {
+        (void) fprintf(output, "---\ngeneration: %" PRIu64 "\n%s:\n", generation, "summaries");
+        for (; sent < count && !response_full(output); sent++) {
+            (void) fprintf(output, "  - { id: %" PRIi64 ", title: '%s' }\n", summary[sent].id, summary[sent].title);
+        }
     }
     free(summary);
 
-    const char END_DOCUMENT[] = "...\n";
-    send(sock_fd, END_DOCUMENT, strlen(END_DOCUMENT), 0);
+    if unlikely (sent < count) {
+        render_truncated(output, reply->json, offset + sent);
+    }
+    (void) fputs(reply->json ? "}\n" : "...\n", output);
+
+    if likely (fclose(output) == 0) {
+        reply_send(reply, doc_len, doc);
+    } else {
+        send_render_error(reply);
+    }
+    free(doc);
+    trace_end(span);
+}
+
+[[gnu::nonnull(1, 5)]]
+/** Writes the ids of each change of `kind` as a YAML flow sequence under `key`, or as a JSON array member. */
+static void render_change_ids(
+    FILE *NONNULL output,
+    size_t count,
+    const struct db_change changes[NULLABLE count],
+    enum db_change_kind kind,
+    const char *NONNULL key,
+    bool json
+) {
+    (void) fprintf(output, json ? ",\"%s\":[" : "%s: [", key);
+    bool first = true;
+    for (size_t i = 0; i < count; i++) {
+        if (changes[i].kind == kind) {
+            (void) fprintf(output, "%s%" PRIi64, first ? "" : (json ? "," : ", "), changes[i].movie_id);
+            first = false;
+        }
+    }
+    (void) fputs(json ? "]" : "]\n", output);
+}
+
+[[nodiscard("useless call if discarded"), gnu::nonnull(4)]]
+/**
+ * Counts how many `changes` fit in the response after its first `used` bytes, once their ids and movies are added.
+ * Movies belong, in order, to the changes that are not deletions, and each one ends at its `movie_end` offset. The
+ * first change is always included.
+ */
+static size_t changes_in_response(
+    size_t used,
+    size_t count,
+    const struct db_change changes[NULLABLE count],
+    const size_t movie_end[NONNULL],
+    size_t movie_count
+) {
+    if likely (max_response_bytes == 0) {
+        return count;
+    }
+
+    uint64_t size = used;
+    size_t movies = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0 && size >= max_response_bytes) {
+            return i;
+        }
+        // the id and its separator
+        size += (uint64_t) snprintf(NULL, 0, "%" PRIi64 ", ", changes[i].movie_id);
+        if (changes[i].kind != DB_CHANGE_DELETED && movies < movie_count) {
+            size += movie_end[movies] - (movies > 0 ? movie_end[movies - 1] : 0);
+            movies++;
+        }
+    }
+    return count;
+}
+
+[[gnu::hot]]
+/**
+ * Sends the ids changed since the client generation, and the full movies if read, rendered in memory as a single
+ * document with the catalog `generation`.
+ *
+ * Changes stop being added once the document would reach `RESPONSE_MAX_BYTES`. The response is then marked as
+ * `truncated`, with the `after_generation` and `after_id` of the last change sent to continue from.
+ */
+static void send_changes(
+    struct reply *NONNULL reply,
+    size_t count,
+    struct db_change changes[NULLABLE count],
+    size_t movie_count,
+    struct movie movie[NULLABLE movie_count],
+    uint64_t generation
+) {
+    struct trace_span span = trace_begin("send_changes");
+    const bool json = reply->json;
+    char *doc = NULL;
+    size_t doc_len = 0;
+    FILE *output = open_memstream(&doc, &doc_len);
+    // ids of every kind come before the movies, so the movies are rendered apart to know where to stop
+    char *movie_doc = NULL;
+    size_t movie_doc_len = 0;
+    FILE *movie_output = open_memstream(&movie_doc, &movie_doc_len);
+    size_t *movie_end = calloc(movie_count + 1, sizeof(size_t));
+    if unlikely (output == NULL || movie_output == NULL || movie_end == NULL) {
+        for (size_t i = 0; i < movie_count; i++) {
+            free_movie(movie[i]);
+        }
+        free(movie);
+        free(changes);
+        free(movie_end);
+        if (output != NULL) {
+            (void) fclose(output);
+        }
+        if (movie_output != NULL) {
+            (void) fclose(movie_output);
+        }
+        free(doc);
+        free(movie_doc);
+        send_render_error(reply);
+        trace_end(span);
+        return;
+    }
+
+    for (size_t i = 0; i < movie_count; i++) {
+        if (json) {
+            (void) fputc(',', movie_output);
+            render_movie_json(movie_output, movie[i], FIELD_ALL);
+        } else {
+            render_movie(movie_output, movie[i], true, FIELD_ALL);
+        }
+        const long position = ftell(movie_output);
+        movie_end[i] = position > 0 ? (size_t) position : 0;
+    }
+    const bool with_movies = movie != NULL;
+    free(movie);
+    if unlikely (fclose(movie_output) != 0) {
+        free(changes);
+        free(movie_end);
+        (void) fclose(output);
+        free(doc);
+        free(movie_doc);
+        send_render_error(reply);
+        trace_end(span);
+        return;
+    }
+
+    if (json) {
+        render_json_start(output, reply, "ok");
+        (void) fprintf(output, ",\"generation\":%" PRIu64, generation);
+    } else {
+        (void) fprintf(output, "---\ngeneration: %" PRIu64 "\n", generation);
+    }
+    const long used = ftell(output);
+    const size_t sent = changes_in_response(used > 0 ? (size_t) used : 0, count, changes, movie_end, movie_count);
+    size_t movies_sent = 0;
+    for (size_t i = 0; i < sent; i++) {
+        movies_sent += changes[i].kind != DB_CHANGE_DELETED ? 1 : 0;
+    }
+    movies_sent = movies_sent < movie_count ? movies_sent : movie_count;
+
+    render_change_ids(output, sent, changes, DB_CHANGE_ADDED, "added", json);
+    render_change_ids(output, sent, changes, DB_CHANGE_UPDATED, "updated", json);
+    render_change_ids(output, sent, changes, DB_CHANGE_DELETED, "deleted", json);
+    if (with_movies) {
+        const size_t movie_bytes = movies_sent > 0 ? movie_end[movies_sent - 1] : 0;
+        if (json) {
+            // skip the separator before the first movie
+            (void) fputs(",\"movies\":[", output);
+            (void) fwrite(movie_doc + (movie_bytes > 0 ? 1 : 0), 1, movie_bytes - (movie_bytes > 0 ? 1 : 0), output);
+            (void) fputc(']', output);
+        } else {
+            (void) fputs("movies:\n\n", output);
+            (void) fwrite(movie_doc, 1, movie_bytes, output);
+        }
+    }
+    free(movie_doc);
+    free(movie_end);
+
+    if unlikely (sent < count && json) {
+        (void) fprintf(
+            output,
+            ",\"truncated\":true,\"after_generation\":%" PRIu64 ",\"after_id\":%" PRIi64,
+            changes[sent - 1].generation,
+            changes[sent - 1].movie_id
+        );
+    } else if unlikely (sent < count) {
+        (void) fprintf(
+            output,
+            "truncated: true\nafter_generation: %" PRIu64 "\nafter_id: %" PRIi64 "\n",
+            changes[sent - 1].generation,
+            changes[sent - 1].movie_id
+        );
+    }
+    free(changes);
+    (void) fputs(json ? "}\n" : "...\n", output);
+
+    if likely (fclose(output) == 0) {
+        reply_send(reply, doc_len, doc);
+    } else {
+        send_render_error(reply);
+    }
+    free(doc);
+    trace_end(span);
+}
+
+[[gnu::cold, gnu::nonnull(1, 2)]]
+/** Sends the `stats` document as a string member of a JSON response, since the reports are only written in YAML. */
+static void send_stats_json(struct reply *NONNULL reply, const char *NONNULL stats) {
+    char *doc = NULL;
+    size_t doc_len = 0;
+    FILE *output = open_memstream(&doc, &doc_len);
+    if unlikely (output == NULL) {
+        send_error(reply, "failed to render stats");
+        return;
+    }
+
+    render_json_start(output, reply, "ok");
+    (void) fputs(",\"stats\":", output);
+    json_write_string(output, stats);
+    (void) fputs("}\n", output);
+
+    if likely (fclose(output) == 0) {
+        reply_send(reply, doc_len, doc);
+    } else {
+        send_error(reply, "failed to render stats");
+    }
+    free(doc);
+}
+
+[[gnu::cold]]
+/**
+ * Sends the server statistics as a single YAML document.
+ *
+ * The whole document is rendered in memory first, so it goes out in a single `send`.
+ */
+static void send_stats(struct reply *NONNULL reply) {
+    struct trace_span span = trace_begin("send_stats");
+    char *doc = NULL;
+    size_t doc_len = 0;
+    FILE *output = open_memstream(&doc, &doc_len);
+    if unlikely (output == NULL) {
+        send_error(reply, "failed to render stats");
+        trace_end(span);
+        return;
+    }
+
+    (void) fprintf(output, "---\nstats:\n");
+    db_stats_report(output);
+    genre_cache_stats_report(output);
+    id_set_stats_report(output);
+    search_cache_stats_report(output);
+    peers_stats_report(output);
+    perf_stats_report(output);
+    (void) fprintf(output, "...\n");
+
+    if unlikely (fclose(output) != 0) {
+        send_error(reply, "failed to render stats");
+    } else if (reply->json) {
+        send_stats_json(reply, doc);
+    } else {
+        reply_send(reply, doc_len, doc);
+    }
+    free(doc);
+    trace_end(span);
+}
+
+/** Most operations served from a single read snapshot, so writers on other connections are not starved. */
+#define MAX_OPS_PER_SNAPSHOT 32
+
+/** Closes the read snapshot of the connection in `data`. Runs when the client has no more pipelined operations. */
+static void end_snapshot(void *NULLABLE data) {
+    db_conn_t *db = data;
+    assume(db != NULL);
+
+    db_error_t error = {.code = DB_ERROR_NONE};
+    const db_result_t result = db_end_snapshot(db, &error);
+    if unlikely (result != DB_SUCCESS) {
+        char message[DB_ERROR_LEN];
+        (void) db_error_format(error, sizeof(message), message);
+        (void) fprintf(stderr, "worker: could not end read snapshot: %s\n", message);
+    }
 }
 
 /** Length for an IP text representation. */
@@ -158,175 +888,620 @@ static struct ip_string get_peer_ip(int sock_fd) {
     return str;
 }
 
+[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(2, 3), gnu::hot]]
 /**
- * Main function to handle all YAML-based requests on a single client socket.
- *
- * Uses parser_start() to read YAML operations, dispatches to appropriate db_* calls,
- * and sends textual responses. Closes the socket at the end.
+ * Runs a single operation and sends its response, echoing the `request_id` if given. Frees the operation input.
  *
- * @param sock_fd The socket file descriptor for this client.
- * @param db      A non-null pointer to the database connection.
- * @return true if request was handled successfully, or false if a hard error was encountered (server might stop).
+ * @return true if a hard error was encountered (server might stop).
  */
-bool handle_request(size_t id, int sock_fd, db_conn_t *NONNULL db, atomic_bool *NONNULL shutdown_requested) {
-    (void) fprintf(stderr, "worker[%zu]: handling socket %d, peer ip %s\n", id, sock_fd, get_peer_ip(sock_fd).ip);
-
-    parser_t *parser = parser_create(shutdown_requested, sock_fd);
-    if unlikely (parser == NULL) {
-        const char msg[] = "server: failed to create YAML parser\n\n";
-        send(sock_fd, msg, strlen(msg), 0);
-        close(sock_fd);
-        return false;
-    }
+static bool execute_op(size_t id, struct connection *NONNULL conn, db_conn_t *NONNULL db, struct operation op) {
+    struct reply reply;
+    reply_start(&reply, conn, op.options.request_id);
 
-    bool hard_fail = false;
-    while (!parser_finished(parser) && !hard_fail) {
-        struct operation op = parser_next_op(parser);
+    db_error_t error = {.code = DB_ERROR_NONE};
+    db_result_t result;
+    const struct perf_sample counters = perf_begin();
+    switch (op.ty) {
+        case PARSE_DONE: {
+            result = DB_SUCCESS;
+            break;
+        }
+        case ADD_MOVIE: {
+            reply_received(
+                &reply,
+                "server: received ADD_MOVIE: %s (%d), by %s\n",
+                op.movie.title,
+                op.movie.release_year,
+                op.movie.director
+            );
 
-        const char *errmsg = NULL;
-        db_result_t result;
-        switch (op.ty) {
-            case PARSE_DONE: {
-                result = DB_SUCCESS;
-                break;
+            struct trace_span db_span = trace_begin("db_register_movie");
+            result = db_register_movie(db, &(op.movie), &error);
+            trace_end(db_span);
+            if likely (result == DB_SUCCESS) {
+                send_added(&reply, op.movie, NULL, op.options.with_movies, op.options.fields);
+            } else {
+                free_movie(op.movie);
             }
-            case ADD_MOVIE: {
-                char response[RESP_LEN] = "\n";
-                (void) snprintf(
-                    response,
-                    sizeof(response),
-                    "server: received ADD_MOVIE: %s (%d), by %s\n",
-                    op.movie.title,
-                    op.movie.release_year,
-                    op.movie.director
-                );
-                send(sock_fd, response, strlen(response), 0);
-
-                result = db_register_movie(db, &(op.movie), &errmsg);
+            break;
+        }
+        case UPSERT_MOVIE: {
+            reply_received(
+                &reply,
+                "server: received UPSERT_MOVIE: %s (%d), by %s\n",
+                op.movie.title,
+                op.movie.release_year,
+                op.movie.director
+            );
+
+            enum db_upsert_outcome outcome;
+            struct trace_span db_span = trace_begin("db_upsert_movie");
+            result = db_upsert_movie(db, &(op.movie), &outcome, &error);
+            trace_end(db_span);
+            if likely (result == DB_SUCCESS) {
+                // merged movies may have more genres than sent, so they are never echoed back
+                static const char *const OUTCOME_NAME[] = {
+                    [DB_UPSERT_INSERTED] = "inserted",
+                    [DB_UPSERT_MERGED] = "merged",
+                    [DB_UPSERT_UNCHANGED] = "unchanged",
+                };
+                send_added(&reply, op.movie, OUTCOME_NAME[outcome], false, op.options.fields);
+            } else {
                 free_movie(op.movie);
-                if likely (result == DB_SUCCESS) {
-                    send_ok(sock_fd);
-                }
-                break;
             }
-            case ADD_GENRE: {
-                char response[RESP_LEN] = "\n";
-                (void) snprintf(
-                    response,
-                    sizeof(response),
-                    "server: received ADD_GENRE: %s TO id[%" PRIi64 "]\n",
-                    op.key.genre,
-                    op.key.movie_id
-                );
-                send(sock_fd, response, strlen(response), 0);
-
-                result = db_add_genre(db, op.key.movie_id, op.key.genre, &errmsg);
-                if likely (result == DB_SUCCESS) {
-                    send_ok(sock_fd);
-                }
-                break;
+            break;
+        }
+        case ADD_GENRE: {
+            reply_received(
+                &reply,
+                "server: received ADD_GENRE: %s TO id[%" PRIi64 "]\n",
+                op.key.genre,
+                op.key.movie_id
+            );
+
+            struct trace_span db_span = trace_begin("db_add_genre");
+            result = db_add_genre(db, op.key.movie_id, op.key.genre, &error);
+            trace_end(db_span);
+            if likely (result == DB_SUCCESS) {
+                send_ok(&reply);
             }
-            case REMOVE_MOVIE: {
-                char response[RESP_LEN] = "\n";
-                (void) snprintf(
-                    response,
-                    sizeof(response),
-                    "server: received REMOVE_MOVIE: id[%" PRIi64 "]\n",
-                    op.key.movie_id
-                );
-                send(sock_fd, response, strlen(response), 0);
-
-                result = db_delete_movie(db, op.key.movie_id, &errmsg);
-                if likely (result == DB_SUCCESS) {
-                    send_ok(sock_fd);
-                }
-                break;
+            break;
+        }
+        case REMOVE_MOVIE: {
+            reply_received(&reply, "server: received REMOVE_MOVIE: id[%" PRIi64 "]\n", op.key.movie_id);
+
+            struct trace_span db_span = trace_begin("db_delete_movie");
+            result = db_delete_movie(db, op.key.movie_id, &error);
+            trace_end(db_span);
+            if likely (result == DB_SUCCESS) {
+                send_ok(&reply);
             }
-            case GET_MOVIE: {
-                char response[RESP_LEN] = "\n";
-                (void) snprintf(
-                    response,
-                    sizeof(response),
-                    "server: received GET_MOVIE: id[%" PRIi64 "]\n",
-                    op.key.movie_id
-                );
-                send(sock_fd, response, strlen(response), 0);
-
-                struct movie movie;
-                result = db_get_movie(db, op.key.movie_id, &movie, &errmsg);
-                if likely (result == DB_SUCCESS) {
-                    send_movie(sock_fd, movie, false);
-                }
-                break;
+            break;
+        }
+        case GET_MOVIE: {
+            reply_received(&reply, "server: received GET_MOVIE: id[%" PRIi64 "]\n", op.key.movie_id);
+
+            struct movie movie;
+            struct trace_span db_span = trace_begin("db_get_movie");
+            const uint8_t fields = op.options.fields;
+            result = db_get_movie(db, op.key.movie_id, fields & FIELD_GENRES, &movie, &error);
+            trace_end(db_span);
+            if likely (result == DB_SUCCESS) {
+                send_movie(&reply, movie, fields);
             }
-            case LIST_MOVIES: {
-                char response[RESP_LEN] = "server: received LIST_MOVIES\n";
-                send(sock_fd, response, strlen(response), 0);
-
-                size_t list_size;
-                struct movie *list;
-                result = db_list_movies(db, &list, &list_size, &errmsg);
-                if likely (result == DB_SUCCESS) {
-                    send_movie_list(sock_fd, list_size, list, "movies");
-                }
+            break;
+        }
+        case LIST_MOVIES: {
+            reply_received(&reply, "server: received LIST_MOVIES\n");
+
+            // the data read next is at least this new, so it's safe to report even if more writes commit meanwhile
+            const uint64_t generation = db_generation(db);
+            if (send_not_modified(&reply, op.options, generation)) {
+                result = DB_SUCCESS;
                 break;
             }
-            case SEARCH_BY_GENRE: {
-                char response[RESP_LEN] = "\n";
-                (void) snprintf(response, sizeof(response), "server: received SEARCH_BY_GENRE: %s\n", op.key.genre);
-                send(sock_fd, response, strlen(response), 0);
-
-                size_t list_size;
-                struct movie *list;
-                result = db_search_movies_by_genre(db, op.key.genre, &list, &list_size, &errmsg);
-                if likely (result == DB_SUCCESS) {
-                    send_movie_list(sock_fd, list_size, list, "selected_movies");
-                }
-                break;
+
+            struct db_page page;
+            const bool paged = list_page(op.options, &page);
+
+            size_t list_size;
+            struct movie *list;
+            struct trace_span db_span = trace_begin("db_list_movies");
+            const uint8_t fields = op.options.fields;
+            result = db_list_movies(db, fields & FIELD_GENRES, paged ? &page : NULL, &list, &list_size, &error);
+            trace_end(db_span);
+            if likely (result == DB_SUCCESS) {
+                send_movie_list(&reply, list_size, list, "movies", op.options.offset, generation, fields, NULL, 0);
+            }
+            break;
+        }
+        case SEARCH_BY_GENRE: {
+            reply_received(&reply, "server: received SEARCH_BY_GENRE: %s\n", op.key.genre);
+
+            // only complete results are cached
+            const uint8_t fields = op.options.fields;
+            const bool paged = op.options.limit != 0 || op.options.offset != 0;
+            search_ticket_t ticket = 0;
+            const struct search_result *cached = NULL;
+            // the cache holds YAML documents only
+            if likely (fields == FIELD_ALL && !reply.json && !paged) {
+                cached = search_cache_lookup(op.key.genre, &ticket);
             }
-            case LIST_SUMMARIES: {
-                char response[RESP_LEN] = "\n";
-                (void) snprintf(response, sizeof(response), "server: received LIST_SUMMARIES\n");
-                send(sock_fd, response, strlen(response), 0);
-
-                size_t list_size;
-                struct movie_summary *list;
-                result = db_list_summaries(db, &list, &list_size, &errmsg);
-                if likely (result == DB_SUCCESS) {
-                    send_summary_list(sock_fd, list_size, list);
-                }
+            if (cached != NULL) {
+                reply_send(&reply, cached->length, cached->data);
+                search_cache_release(cached);
+                result = DB_SUCCESS;
                 break;
             }
-            case PARSE_ERROR: {
-                char response[RESP_LEN] = "\n";
-                (void) snprintf(response, sizeof(response), "server: parsing error: %s\n\n", op.error_message);
-                send(sock_fd, response, strlen(response), 0);
+            // a snapshot opened by earlier reads may predate the last write, so its results are not cached
+            const bool cacheable = fields == FIELD_ALL && !reply.json && !paged && !db_has_snapshot(db);
+            const struct db_page page = {.limit = op.options.limit, .offset = op.options.offset};
+
+            size_t list_size;
+            struct movie *list;
+            struct trace_span db_span = trace_begin("db_search_movies_by_genre");
+            result = db_search_movies_by_genre(
+                db,
+                op.key.genre,
+                fields & FIELD_GENRES,
+                paged ? &page : NULL,
+                &list,
+                &list_size,
+                &error
+            );
+            trace_end(db_span);
+            if likely (result == DB_SUCCESS) {
+                const char *genre = cacheable ? op.key.genre : NULL;
+                const uint64_t offset = op.options.offset;
+                send_movie_list(&reply, list_size, list, "selected_movies", offset, 0, fields, genre, ticket);
+            }
+            break;
+        }
+        case LIST_SUMMARIES: {
+            reply_received(&reply, "server: received LIST_SUMMARIES\n");
 
+            const uint64_t generation = db_generation(db);
+            if (send_not_modified(&reply, op.options, generation)) {
                 result = DB_SUCCESS;
                 break;
             }
-            default: {
-                const char response[RESP_LEN] = "server: unexpected error\n\n";
-                send(sock_fd, response, strlen(response), 0);
 
+            const bool paged = op.options.limit != 0 || op.options.offset != 0;
+            const struct db_page page = {.limit = op.options.limit, .offset = op.options.offset};
+
+            size_t list_size;
+            struct movie_summary *list;
+            struct trace_span db_span = trace_begin("db_list_summaries");
+            result = db_list_summaries(db, paged ? &page : NULL, &list, &list_size, &error);
+            trace_end(db_span);
+            if likely (result == DB_SUCCESS) {
+                send_summary_list(&reply, list_size, list, op.options.offset, generation);
+            }
+            break;
+        }
+        case CHANGES_SINCE: {
+            reply_received(
+                &reply,
+                "server: received CHANGES_SINCE: generation %" PRIu64 "\n",
+                op.options.since_generation
+            );
+
+            // changes newer than this may be listed too, and will be sent again on the next sync
+            const uint64_t generation = db_generation(db);
+            // a resumed list still has changes to send at the catalog generation
+            const bool resumed = op.options.after_id != 0;
+            const struct operation_options unchanged = {.if_generation = op.options.since_generation};
+            if (!resumed && send_not_modified(&reply, unchanged, generation)) {
                 result = DB_SUCCESS;
                 break;
             }
+            const struct db_change after = {
+                .movie_id = (int64_t) op.options.after_id,
+                .generation = op.options.after_generation,
+            };
+
+            size_t change_count;
+            struct db_change *changes;
+            size_t movie_count = 0;
+            struct movie *movies = NULL;
+            struct trace_span db_span = trace_begin("db_changes_since");
+            result = db_changes_since(
+                db,
+                op.options.since_generation,
+                resumed ? &after : NULL,
+                &changes,
+                &change_count,
+                op.options.with_movies ? &movies : NULL,
+                &movie_count,
+                &error
+            );
+            trace_end(db_span);
+            if likely (result == DB_SUCCESS) {
+                send_changes(&reply, change_count, changes, movie_count, movies, generation);
+            }
+            break;
         }
+        case STATS: {
+            reply_received(&reply, "server: received STATS\n");
 
-        hard_fail = handle_result(id, sock_fd, errmsg, result);
-        (void) fprintf(
-            stderr,
-            "worker[%zu]: op.ty=%hhu, finished=%hhu, hard_fail=%hhu, result=%hhu\n",
-            id,
-            hhu(op.ty),
-            hhu(parser_finished(parser)),
-            hhu(hard_fail),
-            hhu(result)
-        );
+            send_stats(&reply);
+            result = DB_SUCCESS;
+            break;
+        }
+        case PARSE_ERROR: {
+            char response[RESP_LEN] = "";
+            (void) snprintf(response, sizeof(response), "parsing error: %s", op.error_message);
+            send_error(&reply, response);
+
+            result = DB_SUCCESS;
+            break;
+        }
+        default: {
+            send_error(&reply, "unexpected error");
+
+            result = DB_SUCCESS;
+            break;
+        }
+    }
+
+
+    perf_end(counters, op.ty);
+
+    const bool hard_fail = handle_result(id, &reply, error, result);
+    (void) fprintf(
+        stderr,
+        "worker[%zu]: op.ty=%hhu, request_id=%" PRIu64 ", hard_fail=%hhu, result=%hhu\n",
+        id,
+        hhu(op.ty),
+        op.options.request_id,
+        hhu(hard_fail),
+        hhu(result)
+    );
+    return hard_fail;
+}
+
+[[nodiscard("allocated memory must be freed"), gnu::malloc, gnu::cold]]
+/** Allocates the shared state for `sock_fd`, referenced by the calling worker. */
+static struct connection *NULLABLE connection_create(int sock_fd, peer_t *NONNULL peer) {
+    struct connection *conn = calloc(1, sizeof(struct connection));
+    if unlikely (conn == NULL) {
+        return NULL;
+    }
+
+    if unlikely (pthread_mutex_init(&(conn->send_lock), NULL) != 0) {
+        free(conn);
+        return NULL;
+    }
+    if unlikely (pthread_mutex_init(&(conn->task_lock), NULL) != 0) {
+        pthread_mutex_destroy(&(conn->send_lock));
+        free(conn);
+        return NULL;
+    }
+    if unlikely (pthread_cond_init(&(conn->task_done), NULL) != 0) {
+        pthread_mutex_destroy(&(conn->task_lock));
+        pthread_mutex_destroy(&(conn->send_lock));
+        free(conn);
+        return NULL;
+    }
+
+    conn->sock_fd = sock_fd;
+    conn->peer = peer;
+    conn->refs = 1;
+    return conn;
+}
+
+[[gnu::nonnull(1)]]
+/** Drops a reference to `conn`, freeing it with the last one. */
+static void connection_unref(struct connection *NONNULL conn) {
+    pthread_mutex_lock(&(conn->task_lock));
+    assume(conn->refs > 0);
+    conn->refs -= 1;
+    const bool last = conn->refs == 0;
+    pthread_mutex_unlock(&(conn->task_lock));
+
+    if (last) {
+        assume(conn->first == NULL);
+        pthread_cond_destroy(&(conn->task_done));
+        pthread_mutex_destroy(&(conn->task_lock));
+        pthread_mutex_destroy(&(conn->send_lock));
+        free(conn);
+    }
+}
+
+[[gnu::returns_nonnull, gnu::nonnull(1, 2)]]
+/** Copies `str` into `*storage`, and moves it past the copy. */
+static const char *NONNULL copy_string(char *NONNULL *NONNULL storage, const char *NONNULL str) {
+    const size_t size = strlen(str) + 1;
+    const char *copy = memcpy(*storage, str, size);
+    *storage += size;
+    return copy;
+}
+
+[[nodiscard("allocated memory must be freed"), gnu::malloc]]
+/**
+ * Copies `op` into a new task, moving its genre list. The strings are copied, since they point into parser buffers.
+ *
+ * Returns `NULL` on allocation failures, with `op` still owned by the caller.
+ */
+static struct request_task *NULLABLE task_create(struct operation op) {
+    const bool has_movie = op.ty == ADD_MOVIE || op.ty == UPSERT_MOVIE;
+
+    size_t size = 0;
+    if (has_movie) {
+        size += strlen(op.movie.title) + strlen(op.movie.director) + 2;
+        for (size_t i = 0; i < op.movie.genre_count; i++) {
+            size += strlen(op.movie.genres[i]) + 1;
+        }
+    } else if (op.key.genre != NULL) {
+        size += strlen(op.key.genre) + 1;
+    }
+
+    struct request_task *task = malloc(sizeof(struct request_task) + size);
+    if unlikely (task == NULL) {
+        return NULL;
+    }
+
+    char *strings = task->strings;
+    if (has_movie) {
+        op.movie.title = copy_string(&strings, op.movie.title);
+        op.movie.director = copy_string(&strings, op.movie.director);
+        for (size_t i = 0; i < op.movie.genre_count; i++) {
+            op.movie.genres[i] = copy_string(&strings, op.movie.genres[i]);
+        }
+    } else if (op.key.genre != NULL) {
+        op.key.genre = copy_string(&strings, op.key.genre);
+    }
+
+    task->next = NULL;
+    task->op = op;
+    return task;
+}
+
+[[nodiscard("operation must be skipped on true"), gnu::nonnull(1, 2)]]
+/**
+ * Takes a token from the bucket of `peer` for `op`. If the peer is over its rate, answers with an error and frees the
+ * operation input instead.
+ */
+static bool connection_throttle(struct connection *NONNULL conn, peer_t *NONNULL peer, struct operation op) {
+    if (op.ty == PARSE_ERROR || op.ty == PARSE_DONE || likely(peers_allow(peer))) {
+        return false;
+    }
+
+    struct reply reply;
+    reply_start(&reply, conn, op.options.request_id);
+    send_error(&reply, "rate limited, retry later");
+    if (op.ty == ADD_MOVIE || op.ty == UPSERT_MOVIE) {
+        free_movie(op.movie);
+    }
+    return true;
+}
+
+[[gnu::nonnull(1)]]
+/** Returns the worker slot held by a task of `conn`, waking a worker if that lets a waiting connection in. */
+static void connection_release_slot(struct connection *NONNULL conn) {
+    if (peers_release(conn->peer)) {
+        workers_wake();
+    }
+}
+
+[[nodiscard("operation must run inline on false"), gnu::nonnull(1)]]
+/**
+ * Queues `op` to run on any worker, if it has a `request_id`. Otherwise, or if the connection already has too many
+ * operations waiting, or its address has no worker slot left, it must run in order on the calling worker.
+ */
+static bool connection_defer(struct connection *NONNULL conn, struct operation op) {
+    if likely (op.options.request_id == 0 || op.ty == PARSE_ERROR || op.ty == PARSE_DONE) {
+        return false;
+    }
+
+    pthread_mutex_lock(&(conn->task_lock));
+    const bool full = conn->queued >= MAX_QUEUED_TASKS;
+    pthread_mutex_unlock(&(conn->task_lock));
+    if unlikely (full || !peers_acquire(conn->peer)) {
+        return false;
+    }
+
+    struct request_task *task = task_create(op);
+    if unlikely (task == NULL) {
+        connection_release_slot(conn);
+        return false;
+    }
+
+    pthread_mutex_lock(&(conn->task_lock));
+    if (conn->last != NULL) {
+        conn->last->next = task;
+    } else {
+        conn->first = task;
+    }
+    conn->last = task;
+    conn->queued += 1;
+    conn->refs += 1;
+    pthread_mutex_unlock(&(conn->task_lock));
+
+    // if no worker is asked, the connection runs it before waiting for more input
+    if unlikely (!workers_add_task(conn, trace_current_request())) {
+        pthread_mutex_lock(&(conn->task_lock));
+        conn->refs -= 1;
+        pthread_mutex_unlock(&(conn->task_lock));
+    }
+    return true;
+}
+
+[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(2, 3, 4)]]
+/**
+ * Takes the oldest queued task of `conn`, if any, and runs it on `db`.
+ *
+ * Returns true if a hard error was encountered. Sets `ran` if there was a task.
+ */
+static bool connection_run_task(size_t id, struct connection *NONNULL conn, db_conn_t *NONNULL db, bool *NONNULL ran) {
+    pthread_mutex_lock(&(conn->task_lock));
+    struct request_task *task = conn->first;
+    if likely (task != NULL) {
+        conn->first = task->next;
+        if (conn->first == NULL) {
+            conn->last = NULL;
+        }
+        conn->queued -= 1;
+        conn->running += 1;
+    }
+    pthread_mutex_unlock(&(conn->task_lock));
+
+    *ran = task != NULL;
+    if unlikely (task == NULL) {
+        return false;
+    }
+
+    const bool hard_fail = execute_op(id, conn, db, task->op);
+    free(task);
+    connection_release_slot(conn);
+
+    pthread_mutex_lock(&(conn->task_lock));
+    conn->running -= 1;
+    if (conn->running == 0) {
+        pthread_cond_broadcast(&(conn->task_done));
+    }
+    pthread_mutex_unlock(&(conn->task_lock));
+    return hard_fail;
+}
+
+[[nodiscard("hard errors cannot be ignored"), gnu::nonnull(2, 3)]]
+/** Runs every task of `conn` that no other worker took yet. Returns true if a hard error was encountered. */
+static bool connection_run_queued(size_t id, struct connection *NONNULL conn, db_conn_t *NONNULL db) {
+    bool hard_fail = false;
+    bool ran = true;
+    while (ran && !hard_fail) {
+        hard_fail = connection_run_task(id, conn, db, &ran);
     }
+    return hard_fail;
+}
+
+[[gnu::nonnull(1)]]
+/** Blocks until every task taken by other workers is finished, so the socket can be closed. */
+static void connection_wait_running(struct connection *NONNULL conn) {
+    pthread_mutex_lock(&(conn->task_lock));
+    while (conn->running > 0) {
+        pthread_cond_wait(&(conn->task_done), &(conn->task_lock));
+    }
+    pthread_mutex_unlock(&(conn->task_lock));
+}
+
+/** Runs one multiplexed operation waiting in `connection`. */
+bool handle_task(size_t id, struct connection *NONNULL connection, db_conn_t *NONNULL db) {
+    bool ran;
+    const bool hard_fail = connection_run_task(id, connection, db, &ran);
+    // the snapshot belongs to this worker connection, not to the client
+    end_snapshot(db);
+    connection_unref(connection);
+    return !hard_fail;
+}
+
+/** Per connection state of the worker that parses it. */
+struct session {  // NOLINT(altera-struct-pack-align)
+    /** Worker id, for logging. */
+    size_t id;
+    /** Shared connection state. */
+    struct connection *NONNULL conn;
+    /** Database connection of the worker. */
+    db_conn_t *NONNULL db;
+    /** If a multiplexed operation run by this worker hit a hard error. */
+    bool hard_fail;
+};
+
+/**
+ * Runs when the client has no more pipelined operations: runs the multiplexed ones no idle worker took, since the
+ * client may be waiting for them, then closes the read snapshot.
+ */
+static void session_idle(void *NULLABLE data) {
+    struct session *session = data;
+    assume(session != NULL);
+
+    if (connection_run_queued(session->id, session->conn, session->db)) {
+        session->hard_fail = true;
+    }
+    end_snapshot(session->db);
+}
+
+/**
+ * Main function to handle all YAML-based requests on a single client socket.
+ *
+ * Uses parser_start() to read YAML operations, dispatches to appropriate db_* calls,
+ * and sends textual responses. Operations with a `request_id` may be answered by other workers. Closes the socket at
+ * the end, once all of them are finished.
+ *
+ * @param sock_fd The socket file descriptor for this client.
+ * @param peer    The client address, for rate limits.
+ * @param db      A non-null pointer to the database connection.
+ * @return true if request was handled successfully, or false if a hard error was encountered (server might stop).
+ */
+bool handle_request(
+    size_t id,
+    int sock_fd,
+    peer_t *NONNULL peer,
+    db_conn_t *NONNULL db,
+    atomic_bool *NONNULL shutdown_requested
+) {
+    (void) fprintf(
+        stderr,
+        "worker[%zu]: handling socket %d, peer ip %s, request %" PRIu64 "\n",
+        id,
+        sock_fd,
+        get_peer_ip(sock_fd).ip,
+        trace_current_request()
+    );
 
+    struct connection *conn = connection_create(sock_fd, peer);
+    if unlikely (conn == NULL) {
+        const char msg[] = "server: failed to allocate connection\n\n";
+        send(sock_fd, msg, strlen(msg), 0);
+        close(sock_fd);
+        return false;
+    }
+
+    parser_t *parser = parser_create(shutdown_requested, sock_fd);
+    if unlikely (parser == NULL) {
+        const char msg[] = "server: failed to create YAML parser\n\n";
+        send(sock_fd, msg, strlen(msg), 0);
+        close(sock_fd);
+        connection_unref(conn);
+        return false;
+    }
+    // pipelined reads share a snapshot until the client goes quiet
+    struct session session = {.id = id, .conn = conn, .db = db, .hard_fail = false};
+    parser_set_idle_handler(parser, session_idle, &session);
+
+    size_t ops_in_snapshot = 0;
+    while (!parser_finished(parser) && !session.hard_fail) {
+        struct trace_span parse_span = trace_begin("parser_next_op");
+        struct operation op = parser_next_op(parser);
+        trace_end(parse_span);
+        conn->json = parser_is_json(parser);
+
+        if unlikely (connection_throttle(conn, peer, op)) {
+            continue;
+        }
+        if (connection_defer(conn, op)) {
+            continue;
+        }
+        if (execute_op(id, conn, db, op)) {
+            session.hard_fail = true;
+        }
+
+        ops_in_snapshot += 1;
+        if unlikely (ops_in_snapshot >= MAX_OPS_PER_SNAPSHOT) {
+            end_snapshot(db);
+            ops_in_snapshot = 0;
+        }
+    }
+
+    // tasks still waiting, or running on other workers, answer before the socket is closed
+    if (connection_run_queued(id, conn, db)) {
+        session.hard_fail = true;
+    }
+    connection_wait_running(conn);
+
+    end_snapshot(db);
     parser_destroy(parser);
     close(sock_fd);
-    return !hard_fail;
+    connection_unref(conn);
+    return !session.hard_fail;
 }
@@ -8,19 +8,45 @@
 
 #include "../database/database.h"
 #include "../defines.h"
+#include "./peers.h"
 
-[[gnu::nonnull(3, 4), gnu::hot]]
+[[gnu::cold, gnu::leaf, gnu::nothrow]]
+/**
+ * Reads the response limits from `RESPONSE_MAX_BYTES`. Must run before any request is handled.
+ */
+void request_setup(void);
+
+[[gnu::nonnull(3, 4, 5), gnu::hot]]
 /**
  * Handles a single client connection on sock_fd, parsing YAML requests and calling the database functions.
  *
  * Reads a series of operations from the client socket, interprets them using parser_next_op(), and executes
  * corresponding db_* calls. Sends a simple text response back to the client  for each operation, then closes the
- * socket at the end.
+ * socket at the end. Operations over the rate of `peer` are rejected without running.
  *
  * @param sock_fd The accepted socket file descriptor for this client.
+ * @param peer    The client address, as taken from `peers_take`.
  * @param db      A non-null pointer to the open database connection.
  * @return true on success, and false if a hard failure occurred and the server should possibly shut down.
  */
-bool handle_request(size_t id, int sock_fd, db_conn_t *NONNULL db, atomic_bool *NONNULL shutdown_requested);
+bool handle_request(
+    size_t id,
+    int sock_fd,
+    peer_t *NONNULL peer,
+    db_conn_t *NONNULL db,
+    atomic_bool *NONNULL shutdown_requested
+);
+
+/** A client connection with operations waiting for any worker. */
+struct connection;
+
+[[gnu::nonnull(2, 3), gnu::hot]]
+/**
+ * Runs one of the operations with a `request_id` that `handle_request` left waiting in `connection`, and drops the
+ * reference held for it by `workers_add_task`. Does nothing if the connection worker already ran it.
+ *
+ * @return true on success, and false if a hard failure occurred and the server should possibly shut down.
+ */
+bool handle_task(size_t id, struct connection *NONNULL connection, db_conn_t *NONNULL db);
 
 #endif  // SRC_WORKER_REQUEST_HANDLER_H
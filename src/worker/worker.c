@@ -12,6 +12,9 @@
 #include "../alloc.h"
 #include "../database/database.h"
 #include "../defines.h"
+#include "../stats/perf.h"
+#include "../stats/trace.h"
+#include "./peers.h"
 #include "./queue.h"
 #include "./request.h"
 #include "./worker.h"
@@ -99,6 +102,17 @@ static void handle_termination(int signo) {
     }
 }
 
+/** Set to 1 when a trace export is requested with SIGUSR2. */
+static volatile sig_atomic_t trace_export_requested = 0;
+
+/** Handles SIGUSR2 in main thread. */
+static void handle_trace_export(int signo) {
+    assume(signo == SIGUSR2);
+    (void) signo;
+
+    trace_export_requested = true;
+}
+
 /** Handles SIGUSR1 in worker thread. */
 static void handle_sigusr1(int signo) {
     assume(signo == SIGUSR1);
@@ -106,26 +120,44 @@ static void handle_sigusr1(int signo) {
     // main thread should have already set `finished` flag at this point
 }
 
-[[gnu::nonnull(2, 3)]]
+[[gnu::nonnull(2, 3, 4)]]
 /**
- * Simple pop then wait loop, until a value is taken.
+ * Simple pop then wait loop, until a value is taken. Also sets the current request for tracing.
+ *
+ * Returns `false` if the worker should stop.
  */
-static int workq_pop_or_wait(const pthread_t id, workq_t *NONNULL queue, atomic_bool *NONNULL finished) {
+static bool workq_pop_or_wait(
+    const pthread_t id,
+    workq_t *NONNULL queue,
+    atomic_bool *NONNULL finished,
+    work_item *NONNULL item
+) {
     while (!unlikely(atomic_load(finished))) {
-        int sock_fd;
-        bool ok = workq_pop(queue, &sock_fd);
+        struct trace_span span = trace_begin_detached("workq_pop");
+        bool ok = workq_pop(queue, item);
         if likely (ok) {
-            assume(sock_fd > 0);
-            return sock_fd;
+            trace_set_request(item->request);
+            trace_end(span);
+            return true;
         }
 
         ok = workq_wait_not_empty(queue, finished);
         if unlikely (!ok) {
             (void) fprintf(stderr, "worker[%zu]: workq_wait_not_empty failed: %s\n", id, strerrordesc_np(errno));
-            return -1;
+            return false;
         }
     }
-    return -1;
+    return false;
+}
+
+[[gnu::nonnull(1)]]
+/**
+ * Wakes a worker to take a socket from the peer scheduler. If the queue is full, the socket is taken anyway once a
+ * worker releases its connection.
+ */
+static void workers_wake_for_socket(workq_t *NONNULL queue) {
+    const work_item item = {.request = 0, .connection = NULL};
+    (void) workq_push(queue, item);
 }
 
 /** Data for starting the thread. */
@@ -138,56 +170,85 @@ struct [[gnu::aligned(WORKER_ALIGNMENT)]] worker_input {
     atomic_bool *NONNULL finished;
 };
 
-[[gnu::nonnull(1)]]
+[[gnu::nonnull(2, 3)]]
 /**
- * Thread function that processes completions from the work queue.
+ * Processes completions from the work queue until `finished` is set or an error happens.
  *
- * @param arg pointer to the queue
- * @returns a pointer with the exit code.
+ * @returns the exit code of the worker.
  */
-static void *NULLABLE worker_thread(void *NONNULL arg) {
-    struct worker_input *NONNULL input = aligned_like(struct worker_input, arg);
-    const size_t id = input->worker_id;
-    workq_t *NONNULL const queue = aligned_as(2 * CACHE_LINE_SIZE, input->queue);
-    atomic_bool *NONNULL const finished = input->finished;
-    free(input);
-
+static int worker_run(size_t id, workq_t *NONNULL queue, atomic_bool *NONNULL finished) {
     bool sig_ok = set_single_sigmask(SIGUSR1) && set_signal_handler(SIGUSR1, handle_sigusr1);
     if unlikely (!sig_ok) {
         (void) fprintf(stderr, "worker[%zu]: failed to set signal handler for SIGUSR1\n", id);
-        return PTR_FROM_INT(1);
+        return 1;
     }
 
-    const char *errmsg = NULL;
-    db_conn_t *db = db_connect(DATABASE, &errmsg);
+    db_error_t error = {.code = DB_ERROR_NONE};
+    char message[DB_ERROR_LEN];
+    db_conn_t *db = db_connect(DATABASE, &error);
     if unlikely (db == NULL) {
-        (void) fprintf(stderr, "worker[%zu]: db_connect error: %s\n", id, errmsg);
-        db_free_errmsg(errmsg);
-        return PTR_FROM_INT(2);
+        (void) db_error_format(error, sizeof(message), message);
+        (void) fprintf(stderr, "worker[%zu]: db_connect error: %s\n", id, message);
+        return 2;
     }
 
     while (!unlikely(atomic_load(finished))) {
-        const int sock_fd = workq_pop_or_wait(id, queue, finished);
-        if unlikely (sock_fd < 0) {
+        work_item item;
+        if unlikely (!workq_pop_or_wait(id, queue, finished, &item)) {
             break;
         }
 
         // This blocks the worker while we parse & respond, which might not be truly async.
         // For a fully async approach, you'd queue further read/write requests.
-        bool ok = handle_request(id, sock_fd, db, finished);
+        bool ok = true;
+        struct peer_socket next;
+        if (item.connection != NULL) {
+            ok = handle_task(id, item.connection, db);
+        } else if (peers_take(&next)) {
+            trace_set_request(next.request);
+            if (next.more) {
+                workers_wake_for_socket(queue);
+            }
+            ok = handle_request(id, next.socket, next.peer, db, finished);
+            if (peers_release(next.peer)) {
+                workers_wake_for_socket(queue);
+            }
+        }
+        trace_set_request(0);
         if unlikely (!ok) {
             break;
         }
     }
 
     (void) fprintf(stderr, "worker[%zu]: full stop requested\n", id);
-    bool ok = db_disconnect(db, &errmsg);
+    bool ok = db_disconnect(db, &error);
     if unlikely (!ok) {
-        (void) fprintf(stderr, "worker[%zu]: db_disconnect error: %s\n", id, errmsg);
-        return PTR_FROM_INT(3);
+        (void) db_error_format(error, sizeof(message), message);
+        (void) fprintf(stderr, "worker[%zu]: db_disconnect error: %s\n", id, message);
+        return 3;
     }
 
-    return PTR_FROM_INT(0);
+    return 0;
+}
+
+[[gnu::nonnull(1)]]
+/**
+ * Thread function that processes completions from the work queue.
+ *
+ * @param arg pointer to the queue
+ * @returns a pointer with the exit code.
+ */
+static void *NULLABLE worker_thread(void *NONNULL arg) {
+    struct worker_input *NONNULL input = aligned_like(struct worker_input, arg);
+    const size_t id = input->worker_id;
+    workq_t *NONNULL const queue = aligned_as(2 * CACHE_LINE_SIZE, input->queue);
+    atomic_bool *NONNULL const finished = input->finished;
+    free(input);
+
+    const int rv = worker_run(id, queue, finished);
+    // counters are opened lazily by any operation, so every exit path closes them here
+    perf_thread_stop();
+    return PTR_FROM_INT(rv);
 }
 
 [[gnu::cold, gnu::nonnull(1, 2)]]
@@ -268,12 +329,14 @@ static void workers_stop_partial(size_t initialized) {
 /** Starts threads for handling TCP requests. */
 bool workers_start(void) {
     bool sig_ok = set_signal_handler(SIGINT, handle_termination) && set_signal_handler(SIGTERM, handle_termination)
-        && set_signal_handler(SIGPIPE, SIG_IGN);
+        && set_signal_handler(SIGUSR2, handle_trace_export) && set_signal_handler(SIGPIPE, SIG_IGN);
     if unlikely (!sig_ok) {
         return false;
     }
 
     memset(&workers, 0, sizeof(workers));
+    peers_setup();
+    request_setup();
 
     workq_t *queue = workq_create();
     if unlikely (queue == NULL) {
@@ -298,6 +361,7 @@ bool workers_start(void) {
 void workers_stop(void) {
     workq_clear(workers.queue);
     workers_stop_partial(WORKERS_CAPACITY);
+    peers_clear();
 }
 
 [[gnu::hot]]
@@ -323,18 +387,29 @@ static bool restart_dead_workers(void) {
     return likely(dead_threads < WORKERS_CAPACITY);
 }
 
-/** Adds `socket_fd` to the worker queue and signal worker threads that a new connection is open. */
-bool workers_add_work(int socket_fd, unsigned retries) {
+/** Queues `socket_fd` under its client address and signal worker threads that a new connection is open. */
+bool workers_add_work(int socket_fd, in_addr_t address, trace_id_t request, unsigned retries) {
     workq_t *NONNULL const queue = aligned_as(2 * CACHE_LINE_SIZE, workers.queue);
+    const work_item item = {.request = 0, .connection = NULL};
+    struct trace_span span = trace_begin("workers_add_work");
 
+    bool has_workers = restart_dead_workers();
+    if unlikely (!has_workers || !peers_admit(socket_fd, address, request)) {
+        trace_end(span);
+        return false;
+    }
+
+    // from here on the socket belongs to the scheduler, and a full queue only delays it
     while (likely(!was_shutdown_requested()) && likely(retries > 0)) {
-        bool has_workers = restart_dead_workers();
+        has_workers = restart_dead_workers();
         if unlikely (!has_workers) {
-            return false;
+            trace_end(span);
+            return true;
         }
 
-        bool not_full = workq_push(queue, socket_fd);
+        bool not_full = workq_push(queue, item);
         if likely (not_full) {
+            trace_end(span);
             return true;
         }
 
@@ -343,10 +418,33 @@ bool workers_add_work(int socket_fd, unsigned retries) {
     }
 
     // stopped for shutdown request, so not an issue
+    trace_end(span);
     return true;
 }
 
+/** Asks an idle worker to run a multiplexed operation of `connection`. */
+bool workers_add_task(struct connection *NONNULL connection, trace_id_t request) {
+    workq_t *NONNULL const queue = aligned_as(2 * CACHE_LINE_SIZE, workers.queue);
+    const work_item item = {.request = request, .connection = connection};
+    // no retries, the connection runs the operation itself if no worker takes it
+    return workq_push(queue, item);
+}
+
+/** Wakes a worker for a connection made ready outside the worker loop. */
+void workers_wake(void) {
+    workers_wake_for_socket(aligned_as(2 * CACHE_LINE_SIZE, workers.queue));
+}
+
 /** Returns true if main thread received a signal for shutdown. */
 bool was_shutdown_requested(void) {
     return unlikely(shutdown_requested != 0);
 }
+
+/** Returns true once for each SIGUSR2 received by the main thread. */
+bool take_trace_export_request(void) {
+    if likely (trace_export_requested == 0) {
+        return false;
+    }
+    trace_export_requested = 0;
+    return true;
+}
@@ -4,6 +4,10 @@
 
 #include <stdbool.h>
 
+#include <netinet/in.h>
+
+#include "../stats/trace.h"
+
 /** Expected number of worker threads running. */
 #define WORKERS_CAPACITY 128
 
@@ -25,13 +29,34 @@ void workers_stop(void);
 
 [[gnu::hot, gnu::leaf, gnu::nothrow]]
 /**
- * Adds `socket_fd` to the worker queue and signal worker threads that a new connection is open.
+ * Queues `socket_fd` under its client `address` and signal worker threads that a new connection is open. Connections
+ * are handed to workers in round-robin order across addresses, see `peers_take`.
  *
- * This function also tries to restart worker thread that died for some reason.
+ * The `request` id is handed to the worker that takes the socket, so its spans can be correlated. This function also
+ * tries to restart worker thread that died for some reason.
+ *
+ * Returns true if successful, or false if all workers are dead or the socket could not be queued.
+ */
+bool workers_add_work(int socket_fd, in_addr_t address, trace_id_t request, unsigned retries);
+
+/** A client connection with operations waiting for any worker, defined in `request.c`. */
+struct connection;
+
+[[gnu::nonnull(1), gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Asks an idle worker to run one of the multiplexed operations waiting in `connection`, calling `handle_task`. Safe
+ * to call from worker threads.
  *
- * Returns true if successful, or false if all workers are dead.
+ * Returns false if the queue is full, and then no reference to `connection` is kept.
  */
-bool workers_add_work(int socket_fd, unsigned retries);
+bool workers_add_task(struct connection *NONNULL connection, trace_id_t request);
+
+[[gnu::leaf, gnu::nothrow]]
+/**
+ * Wakes a worker to take a connection from the peer scheduler, after `peers_release` reports one is ready. Safe to
+ * call from worker threads.
+ */
+void workers_wake(void);
 
 [[gnu::hot, gnu::leaf, gnu::nothrow]]
 /**
@@ -39,4 +64,10 @@ bool workers_add_work(int socket_fd, unsigned retries);
  */
 bool was_shutdown_requested(void);
 
+[[gnu::hot, gnu::leaf, gnu::nothrow]]
+/**
+ * Returns true if main thread received SIGUSR2, asking for a trace export. The request is cleared after this call.
+ */
+bool take_trace_export_request(void);
+
 #endif